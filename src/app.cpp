@@ -1,9 +1,17 @@
 #include "app.hpp"
+#include "data_device.hpp"
 #include "debug.hpp"
+#include "decorations.hpp"
+#include "event_loop.hpp"
+#include "latency.hpp"
+#include "layer.hpp"
+#include "stats.hpp"
 #include "xdg-shell-client-protocol.h"
 
 //#define _POSIX_C_SOURCE 200112L
+#include <algorithm>
 #include <cassert>
+#include <csignal>
 #include <sys/mman.h>
 #include <stdexcept>
 #include <memory>
@@ -61,10 +69,19 @@ wl::Registry::Registry(wl::Connection& conn) {
     static const wl_registry_listener listener {
         .global = [](void* self_, wl_registry* registry, uint32_t name, const char* iface, uint32_t version) {
             auto self = (wl::Registry*)self_;
-            self->m_interfaces[iface] = name;
+            Global& global = self->m_globals[name];
+            global.name = name;
+            global.interface = iface;
+            global.version = version;
+            if (self->m_callback) { self->m_callback(global, true); }
         },
         .global_remove = [](void* self_, wl_registry* registry, uint32_t name) {
-            // todo
+            auto self = (wl::Registry*)self_;
+            auto cursor = self->m_globals.find(name);
+            if (cursor == self->m_globals.end()) { return; }
+            Global global = std::move(cursor->second);
+            self->m_globals.erase(cursor);
+            if (self->m_callback) { self->m_callback(global, false); }
         }
     };
     wl_registry_add_listener(m_registry, &listener, this);
@@ -76,11 +93,35 @@ wl::Registry::~Registry() {
     }
 }
 
+std::vector<uint32_t> wl::Registry::find_globals(std::string const& interface_name) const
+{
+    std::vector<uint32_t> names;
+    for (auto const& entry : m_globals) {
+        if (entry.second.interface == interface_name) {
+            names.push_back(entry.first);
+        }
+    }
+    return names;
+}
+
 void* wl::Registry::bind_interface(const wl_interface* interface, uint32_t version)
 {
-    auto cursor = m_interfaces.find(interface->name);
-    if (cursor == m_interfaces.end()) { return nullptr; }
-    auto result = wl_registry_bind(m_registry, cursor->second, interface, version);
+    for (auto const& entry : m_globals) {
+        if (entry.second.interface == interface->name) {
+            return bind_global(entry.first, interface, version);
+        }
+    }
+    return nullptr;
+}
+
+void* wl::Registry::bind_global(uint32_t name, const wl_interface* interface, uint32_t version)
+{
+    auto cursor = m_globals.find(name);
+    if (cursor == m_globals.end() || cursor->second.interface != interface->name) { return nullptr; }
+
+    // binding a version higher than the server has is a protocol error
+    version = std::min(version, cursor->second.version);
+    auto result = wl_registry_bind(m_registry, name, interface, version);
     if (result) {
         info(std::string("bound to interface: ") + interface->name);
     }
@@ -113,6 +154,20 @@ wl::Shm::Shm(Registry& registry) {
     if (!m_shm) {
         throw std::runtime_error("wl::Shm: could not bind to wl_shm");
     }
+
+    m_listener.format = [](void* self_, wl_shm* shm, uint32_t format) {
+        auto self = (wl::Shm*)self_;
+        self->m_formats.push_back(format);
+    };
+
+    wl_shm_add_listener(m_shm, &m_listener, this);
+}
+
+bool wl::Shm::is_format_supported(uint32_t format) const {
+    if (format == WL_SHM_FORMAT_XRGB8888 || format == WL_SHM_FORMAT_ARGB8888) {
+        return true;
+    }
+    return std::find(m_formats.begin(), m_formats.end(), format) != m_formats.end();
 }
 
 wl::Shm::~Shm() {
@@ -123,9 +178,11 @@ wl::Shm::~Shm() {
 
 // wl::Seat -----------------------------------------------------------------
 
-wl::Seat::Seat(Registry& registry) {
+wl::Seat::Seat(Registry& registry, uint32_t global_name, uint16_t id)
+    : m_global_name(global_name), m_id(id)
+{
     m_seat = reinterpret_cast<wl_seat*>(
-        registry.bind_interface(&wl_seat_interface, API_VERSION)
+        registry.bind_global(global_name, &wl_seat_interface, API_VERSION)
     );
     if (!m_seat) {
         throw std::runtime_error("wl::Seat: could not bind to wl_seat");
@@ -159,7 +216,10 @@ wl::Seat::Seat(Registry& registry) {
 }
 
 wl::Seat::~Seat() {
-    if (m_seat) {
+    if (m_seat && wl_seat_get_version(m_seat) >= WL_SEAT_RELEASE_SINCE_VERSION) {
+        wl_seat_release(m_seat);
+    }
+    else if (m_seat) {
         wl_seat_destroy(m_seat);
     }
 }
@@ -227,6 +287,253 @@ void wl::Surface::remove_opaque_region() {
     wl_surface_set_opaque_region(m_surface, NULL);
 }
 
+void wl::Surface::set_input_region(Region& region) {
+    assert(m_surface);
+    wl_surface_set_input_region(m_surface, region.get());
+}
+
+void wl::Surface::remove_input_region() {
+    assert(m_surface);
+    wl_surface_set_input_region(m_surface, NULL);
+}
+
+void wl::Surface::set_buffer_scale(int32_t scale) {
+    assert(m_surface);
+    wl_surface_set_buffer_scale(m_surface, scale);
+}
+
+// wl::Subcompositor --------------------------------------------------------
+
+bool wl::Subcompositor::is_supported(wl::Registry& registry) {
+    return registry.has_interface("wl_subcompositor");
+}
+
+wl::Subcompositor::Subcompositor(wl::Registry& registry) {
+    m_subcompositor = reinterpret_cast<wl_subcompositor*>(
+        registry.bind_interface(&wl_subcompositor_interface, API_VERSION)
+    );
+    if (!m_subcompositor) {
+        throw std::runtime_error("wl::Subcompositor: could not bind to wl_subcompositor");
+    }
+}
+
+wl::Subcompositor::~Subcompositor() {
+    if (m_subcompositor) {
+        wl_subcompositor_destroy(m_subcompositor);
+    }
+}
+
+// wl::DataDeviceManager ---------------------------------------------------
+
+bool wl::DataDeviceManager::is_supported(wl::Registry& registry) {
+    return registry.has_interface("wl_data_device_manager");
+}
+
+wl::DataDeviceManager::DataDeviceManager(wl::Registry& registry) {
+    m_manager = reinterpret_cast<wl_data_device_manager*>(
+        registry.bind_interface(&wl_data_device_manager_interface, API_VERSION)
+    );
+    if (!m_manager) {
+        throw std::runtime_error("wl::DataDeviceManager: could not bind to wl_data_device_manager");
+    }
+}
+
+wl::DataDeviceManager::~DataDeviceManager() {
+    if (m_manager) {
+        wl_data_device_manager_destroy(m_manager);
+    }
+}
+
+// wp::Presentation --------------------------------------------------------
+
+bool wp::Presentation::is_supported(wl::Registry& registry) {
+    return registry.has_interface("wp_presentation");
+}
+
+wp::Presentation::Presentation(wl::Registry& registry) {
+    m_presentation = reinterpret_cast<wp_presentation*>(
+        registry.bind_interface(&wp_presentation_interface, API_VERSION)
+    );
+    if (!m_presentation) {
+        throw std::runtime_error("wp::Presentation: could not bind to wp_presentation");
+    }
+
+    m_listener.clock_id = [](void* self_, wp_presentation* presentation, uint32_t clock_id) {
+        auto self = (wp::Presentation*)self_;
+        self->m_clock_id = clock_id;
+    };
+
+    wp_presentation_add_listener(m_presentation, &m_listener, this);
+}
+
+wp::Presentation::~Presentation() {
+    if (m_presentation) {
+        wp_presentation_destroy(m_presentation);
+    }
+}
+
+// wp::RelativePointerManager -----------------------------------------------
+
+bool wp::RelativePointerManager::is_supported(wl::Registry& registry) {
+    return registry.has_interface("zwp_relative_pointer_manager_v1");
+}
+
+wp::RelativePointerManager::RelativePointerManager(wl::Registry& registry) {
+    m_manager = reinterpret_cast<zwp_relative_pointer_manager_v1*>(
+        registry.bind_interface(&zwp_relative_pointer_manager_v1_interface, API_VERSION)
+    );
+    if (!m_manager) {
+        throw std::runtime_error("wp::RelativePointerManager: could not bind to zwp_relative_pointer_manager_v1");
+    }
+}
+
+wp::RelativePointerManager::~RelativePointerManager() {
+    if (m_manager) {
+        zwp_relative_pointer_manager_v1_destroy(m_manager);
+    }
+}
+
+// wp::PointerConstraints ---------------------------------------------------
+
+bool wp::PointerConstraints::is_supported(wl::Registry& registry) {
+    return registry.has_interface("zwp_pointer_constraints_v1");
+}
+
+wp::PointerConstraints::PointerConstraints(wl::Registry& registry) {
+    m_constraints = reinterpret_cast<zwp_pointer_constraints_v1*>(
+        registry.bind_interface(&zwp_pointer_constraints_v1_interface, API_VERSION)
+    );
+    if (!m_constraints) {
+        throw std::runtime_error("wp::PointerConstraints: could not bind to zwp_pointer_constraints_v1");
+    }
+}
+
+wp::PointerConstraints::~PointerConstraints() {
+    if (m_constraints) {
+        zwp_pointer_constraints_v1_destroy(m_constraints);
+    }
+}
+
+// wp::LockedPointer --------------------------------------------------------
+
+wp::LockedPointer::LockedPointer(wp::PointerConstraints& constraints, wl::Surface& surface,
+    wl_pointer* pointer, bool persistent, wl::Region* region)
+    : m_persistent(persistent)
+{
+    m_locked_pointer = zwp_pointer_constraints_v1_lock_pointer(constraints.get(), surface.get(),
+        pointer, region ? region->get() : nullptr,
+        persistent ? ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT : ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT);
+    if (!m_locked_pointer) {
+        throw std::runtime_error("wp::LockedPointer: zwp_pointer_constraints_v1_lock_pointer() failed");
+    }
+
+    m_listener.locked = [](void* self_, zwp_locked_pointer_v1* locked_pointer) {
+        auto self = (wp::LockedPointer*)self_;
+        self->m_locked = true;
+    };
+    m_listener.unlocked = [](void* self_, zwp_locked_pointer_v1* locked_pointer) {
+        auto self = (wp::LockedPointer*)self_;
+        self->m_locked = false;
+        self->m_defunct = !self->m_persistent;
+    };
+
+    zwp_locked_pointer_v1_add_listener(m_locked_pointer, &m_listener, this);
+}
+
+wp::LockedPointer::~LockedPointer() {
+    if (m_locked_pointer) {
+        zwp_locked_pointer_v1_destroy(m_locked_pointer);
+    }
+}
+
+void wp::LockedPointer::set_cursor_position_hint(float x, float y) {
+    assert(m_locked_pointer);
+    zwp_locked_pointer_v1_set_cursor_position_hint(m_locked_pointer,
+        wl_fixed_from_double(x), wl_fixed_from_double(y));
+}
+
+void wp::LockedPointer::set_region(wl::Region* region) {
+    assert(m_locked_pointer);
+    zwp_locked_pointer_v1_set_region(m_locked_pointer, region ? region->get() : nullptr);
+}
+
+// wp::ConfinedPointer ------------------------------------------------------
+
+wp::ConfinedPointer::ConfinedPointer(wp::PointerConstraints& constraints, wl::Surface& surface,
+    wl_pointer* pointer, bool persistent, wl::Region* region)
+    : m_persistent(persistent)
+{
+    m_confined_pointer = zwp_pointer_constraints_v1_confine_pointer(constraints.get(), surface.get(),
+        pointer, region ? region->get() : nullptr,
+        persistent ? ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT : ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT);
+    if (!m_confined_pointer) {
+        throw std::runtime_error("wp::ConfinedPointer: zwp_pointer_constraints_v1_confine_pointer() failed");
+    }
+
+    m_listener.confined = [](void* self_, zwp_confined_pointer_v1* confined_pointer) {
+        auto self = (wp::ConfinedPointer*)self_;
+        self->m_confined = true;
+    };
+    m_listener.unconfined = [](void* self_, zwp_confined_pointer_v1* confined_pointer) {
+        auto self = (wp::ConfinedPointer*)self_;
+        self->m_confined = false;
+        self->m_defunct = !self->m_persistent;
+    };
+
+    zwp_confined_pointer_v1_add_listener(m_confined_pointer, &m_listener, this);
+}
+
+wp::ConfinedPointer::~ConfinedPointer() {
+    if (m_confined_pointer) {
+        zwp_confined_pointer_v1_destroy(m_confined_pointer);
+    }
+}
+
+void wp::ConfinedPointer::set_region(wl::Region* region) {
+    assert(m_confined_pointer);
+    zwp_confined_pointer_v1_set_region(m_confined_pointer, region ? region->get() : nullptr);
+}
+
+// wl::Subsurface -----------------------------------------------------------
+
+wl::Subsurface::Subsurface(wl::Subcompositor& subcompositor, wl::Surface& surface, wl::Surface& parent) {
+    m_subsurface = wl_subcompositor_get_subsurface(subcompositor.get(), surface.get(), parent.get());
+    if (!m_subsurface) {
+        throw std::runtime_error("wl::Subsurface: wl_subcompositor_get_subsurface() failed");
+    }
+}
+
+wl::Subsurface::~Subsurface() {
+    if (m_subsurface) {
+        wl_subsurface_destroy(m_subsurface);
+    }
+}
+
+void wl::Subsurface::set_position(int32_t x, int32_t y) {
+    assert(m_subsurface);
+    wl_subsurface_set_position(m_subsurface, x, y);
+}
+
+void wl::Subsurface::place_above(wl::Surface& sibling) {
+    assert(m_subsurface);
+    wl_subsurface_place_above(m_subsurface, sibling.get());
+}
+
+void wl::Subsurface::place_below(wl::Surface& sibling) {
+    assert(m_subsurface);
+    wl_subsurface_place_below(m_subsurface, sibling.get());
+}
+
+void wl::Subsurface::set_sync() {
+    assert(m_subsurface);
+    wl_subsurface_set_sync(m_subsurface);
+}
+
+void wl::Subsurface::set_desync() {
+    assert(m_subsurface);
+    wl_subsurface_set_desync(m_subsurface);
+}
+
 // wl::Output ---------------------------------------------------------------
 
 wl::Output::Output(wl::Registry& registry) {
@@ -331,6 +638,19 @@ xdg::Toplevel::Toplevel(xdg::Surface& surface) {
         self->m_last_requested_width = width;
         self->m_last_requested_height = height;
         self->m_configure_requested = true;
+
+        // the states are sent in full each time, so absence means inactive
+        self->m_activated = false;
+        self->m_maximized = false;
+        uint32_t* state;
+        wl_array_for_each(state, states) {
+            if (*state == XDG_TOPLEVEL_STATE_ACTIVATED) {
+                self->m_activated = true;
+            }
+            else if (*state == XDG_TOPLEVEL_STATE_MAXIMIZED) {
+                self->m_maximized = true;
+            }
+        }
         info("received: configure request: " + std::to_string(width) + "x" + std::to_string(height));
         // TODO: we should ack this, but how when we don't know the serial number?
     };
@@ -357,6 +677,27 @@ void xdg::Toplevel::set_title(std::string title) {
     xdg_toplevel_set_title(m_toplevel, title.c_str());
 }
 
+void xdg::Toplevel::move(wl::Seat& seat, uint32_t serial) {
+    xdg_toplevel_move(m_toplevel, seat.get(), serial);
+}
+
+void xdg::Toplevel::resize(wl::Seat& seat, uint32_t serial, uint32_t edges) {
+    xdg_toplevel_resize(m_toplevel, seat.get(), serial, edges);
+}
+
+void xdg::Toplevel::set_maximized(bool maximized) {
+    if (maximized) {
+        xdg_toplevel_set_maximized(m_toplevel);
+    }
+    else {
+        xdg_toplevel_unset_maximized(m_toplevel);
+    }
+}
+
+void xdg::Toplevel::set_minimized() {
+    xdg_toplevel_set_minimized(m_toplevel);
+}
+
 // xdg::DecorationManager ---------------------------------------------------
 
 bool xdg::DecorationManager::is_supported(wl::Registry& registry) {
@@ -383,6 +724,14 @@ xdg::ToplevelDecoration::ToplevelDecoration(xdg::DecorationManager& manager, xdg
     if (!m_decoration) {
         throw std::runtime_error("xdg::ToplevelDecoration: zxdg_decoration_manager_v1_get_toplevel_decoration() failed");
     }
+
+    m_listener.configure = [](void* self_, zxdg_toplevel_decoration_v1* decoration, uint32_t mode) {
+        auto self = (xdg::ToplevelDecoration*) self_;
+        self->m_mode = mode;
+        info("received: decoration mode " + std::to_string(mode));
+    };
+
+    zxdg_toplevel_decoration_v1_add_listener(m_decoration, &m_listener, this);
 }
 
 xdg::ToplevelDecoration::~ToplevelDecoration() {
@@ -408,7 +757,11 @@ wayland::Display::Display() {
 
     m_compositor = std::make_unique<wl::Compositor>(*m_registry);
     m_shm = std::make_unique<wl::Shm>(*m_registry);
-    m_seat = std::make_unique<wl::Seat>(*m_registry);
+
+    // all seats; more may come (and go) later, see handle_global()
+    for (uint32_t name : m_registry->find_globals("wl_seat")) {
+        add_seat(name);
+    }
     m_output = std::make_unique<wl::Output>(*m_registry);
     m_wm_base = std::make_unique<xdg::wm::Base>(*m_registry);
 
@@ -416,6 +769,81 @@ wayland::Display::Display() {
     if (xdg::DecorationManager::is_supported(*m_registry)) {
         m_decoration_manager = std::make_unique<xdg::DecorationManager>(*m_registry);
     }
+
+    // needed only for client-side decorations
+    if (wl::Subcompositor::is_supported(*m_registry)) {
+        m_subcompositor = std::make_unique<wl::Subcompositor>(*m_registry);
+    }
+
+    // only for measuring latency, there is a fallback without it
+    if (wp::Presentation::is_supported(*m_registry)) {
+        m_presentation = std::make_unique<wp::Presentation>(*m_registry);
+    }
+
+    // for the clipboard and drag and drop
+    if (wl::DataDeviceManager::is_supported(*m_registry)) {
+        m_data_device_manager = std::make_unique<wl::DataDeviceManager>(*m_registry);
+    }
+
+    // for mouse look and the like; apps then do without a locked pointer
+    if (wp::RelativePointerManager::is_supported(*m_registry)) {
+        m_relative_pointer_manager = std::make_unique<wp::RelativePointerManager>(*m_registry);
+    }
+    if (wp::PointerConstraints::is_supported(*m_registry)) {
+        m_pointer_constraints = std::make_unique<wp::PointerConstraints>(*m_registry);
+    }
+
+    m_registry->set_global_callback([this](wl::Registry::Global const& global, bool added) {
+        handle_global(global, added);
+    });
+
+    // the bound globals now send their initial state (e.g. the wl_shm formats)
+    m_connection->roundtrip();
+}
+
+wl::Seat& wayland::Display::add_seat(uint32_t global_name)
+{
+    m_seats.push_back(std::make_unique<wl::Seat>(*m_registry, global_name, m_next_seat_id++));
+    return *m_seats.back();
+}
+
+/// Follows seats being added and removed (e.g. input devices plugged into another seat).
+void wayland::Display::handle_global(wl::Registry::Global const& global, bool added)
+{
+    if (global.interface != "wl_seat") { return; }
+    if (added) {
+        try {
+            wl::Seat& seat = add_seat(global.name);
+            if (m_seat_callback) { m_seat_callback(seat, true); }
+        }
+        catch (std::exception& e) {
+            complain(e.what());
+        }
+        return;
+    }
+    for (auto it = m_seats.begin(); it != m_seats.end(); ++it) {
+        if ((*it)->get_global_name() == global.name) {
+            if (m_seat_callback) { m_seat_callback(**it, false); }
+            m_seats.erase(it);
+            return;
+        }
+    }
+}
+
+wl::Seat& wayland::Display::get_seat()
+{
+    if (m_seats.empty()) {
+        throw std::runtime_error("wayland::Display: no seat available");
+    }
+    return *m_seats.front();
+}
+
+wl::Seat* wayland::Display::find_seat(uint16_t id)
+{
+    for (auto& seat : m_seats) {
+        if (seat->get_id() == id) { return seat.get(); }
+    }
+    return nullptr;
 }
 
 xdg::DecorationManager& wayland::Display::get_decoration_manager()
@@ -427,6 +855,46 @@ xdg::DecorationManager& wayland::Display::get_decoration_manager()
     return *m_decoration_manager;
 }
 
+wl::Subcompositor& wayland::Display::get_subcompositor()
+{
+    if (!m_subcompositor) {
+        throw std::runtime_error("wayland::Display: subcompositor not available");
+    }
+    return *m_subcompositor;
+}
+
+wp::Presentation& wayland::Display::get_presentation()
+{
+    if (!m_presentation) {
+        throw std::runtime_error("wayland::Display: presentation feedback not available");
+    }
+    return *m_presentation;
+}
+
+wl::DataDeviceManager& wayland::Display::get_data_device_manager()
+{
+    if (!m_data_device_manager) {
+        throw std::runtime_error("wayland::Display: data device manager not available");
+    }
+    return *m_data_device_manager;
+}
+
+wp::RelativePointerManager& wayland::Display::get_relative_pointer_manager()
+{
+    if (!m_relative_pointer_manager) {
+        throw std::runtime_error("wayland::Display: relative pointer manager not available");
+    }
+    return *m_relative_pointer_manager;
+}
+
+wp::PointerConstraints& wayland::Display::get_pointer_constraints()
+{
+    if (!m_pointer_constraints) {
+        throw std::runtime_error("wayland::Display: pointer constraints not available");
+    }
+    return *m_pointer_constraints;
+}
+
 // wayland::Window ----------------------------------------------------------
 
 wayland::Window::Window(wayland::Display& display) {
@@ -436,6 +904,7 @@ wayland::Window::Window(wayland::Display& display) {
     if (display.has_decoration_manager()) {
         m_decoration = std::make_unique<xdg::ToplevelDecoration>(
             display.get_decoration_manager(), *m_toplevel);
+        m_decoration->set_server_side_mode();
     }
 }
 
@@ -452,63 +921,119 @@ WaylandApp &WaylandApp::the() {
 }
 
 WaylandApp::~WaylandApp() {
-
-    // discard all allocated frames (here we are allowed to delete even those
-    // that may be still in use).
-    while (!m_frames.empty()) {
-        auto frame = m_frames.front();
-        m_frames.pop_front();
-        delete frame;
-    }
-
     the_app = nullptr;
 }
 
 WaylandApp::WaylandApp() {
     assert(!the_app);
     the_app = this;
+
+    // app-level setup: a reader closing its pipe early (see wayland::DataDevice)
+    // must fail our write with EPIPE, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
     m_display = std::make_unique<wayland::Display>();
     m_window = std::make_unique<wayland::Window>(*m_display);
+    m_swapchain = std::make_unique<wayland::Swapchain>(*m_display);
+    m_event_loop = std::make_unique<wayland::EventLoop>(m_display->get_connection());
+    try {
+        m_cursor_theme = std::make_unique<wayland::CursorTheme>(*m_display);
+    }
+    catch (std::exception& e) {
+        // the compositor shows some cursor anyway
+        complain(e.what());
+    }
+    for (auto& seat : m_display->get_seats()) {
+        handle_seat_change(*seat, true);
+    }
+    m_display->set_seat_callback([this](wl::Seat& seat, bool added) {
+        handle_seat_change(seat, added);
+        handle_seat(seat.get_id(), added);
+    });
+    m_latency = std::make_unique<wayland::LatencyTracker>(*m_display, m_window->get_surface());
 }
 
-void WaylandApp::purge_badly_sized_frames(int32_t width, int32_t height) {
-
-    // discard all cached frames that have unsuitable dimensions
-    // (they will exist every time the window is resized)
-    bool restart_search;
-    do {
-        restart_search = false;
-        for (auto frame : m_frames) {
-            if (!frame->is_busy()) {
-                if (frame->get_width() != width || frame->get_height() != height) {
-                    m_frames.remove(frame);
-                    delete frame;
-                    restart_search = true;
-                    info("purged an improperly sized frame");
-                    break;
-                }
+/**
+ * Sets up the input of a seat as it is added, or tears it down
+ * as it is removed (with the pointer lock, if it was for its pointer).
+ */
+void WaylandApp::handle_seat_change(wl::Seat& seat, bool added) {
+    if (!added) {
+        for (auto it = m_seats.begin(); it != m_seats.end(); ++it) {
+            if ((*it)->seat != &seat) { continue; }
+            if (m_constrained_input == (*it)->input.get()) {
+                release_pointer();
             }
+            m_seats.erase(it);
+            return;
         }
-    } while(restart_search);
+        return;
+    }
+
+    auto input = std::make_unique<SeatInput>();
+    input->seat = &seat;
+    input->input = std::make_unique<wayland::Input>(seat, input->ring, *m_event_loop);
+    if (m_cursor_theme) {
+        input->cursors = std::make_unique<wayland::CursorManager>(*m_cursor_theme,
+            *m_display, *m_event_loop);
+        input->cursors->set_shape(m_content_cursor);
+        input->input->set_cursor_manager(input->cursors.get());
+    }
+    if (m_display->has_relative_pointer_manager()) {
+        input->input->set_relative_pointer_manager(&m_display->get_relative_pointer_manager());
+    }
+    if (m_display->has_data_device_manager()) {
+        input->data_device = std::make_unique<wayland::DataDevice>(m_display->get_data_device_manager(),
+            seat, *m_event_loop, input->ring);
+    }
+    m_seats.push_back(std::move(input));
 }
 
-wayland::Frame* WaylandApp::get_new_frame(int32_t width, int32_t height) {
-    purge_badly_sized_frames(width, height);
+WaylandApp::SeatInput* WaylandApp::find_seat_input(uint16_t seat_id) {
+    for (auto& input : m_seats) {
+        if (input->seat->get_id() == seat_id) { return input.get(); }
+    }
+    return nullptr;
+}
 
-    // try to find an already allocated frame of appropriate size and reuse it
-    for (auto frame : m_frames) {
-        if (!frame->is_busy()) {
-            if (frame->get_width() == width && frame->get_height() == height) {
-                return frame;
-            }
-        }
+std::vector<uint16_t> WaylandApp::get_seat_ids() const {
+    std::vector<uint16_t> ids;
+    for (auto const& input : m_seats) {
+        ids.push_back(input->seat->get_id());
     }
+    return ids;
+}
 
-    // no suitable frame was found in the list, so create a new one
-    auto frame = new wayland::Frame(*m_display, width, height);
-    m_frames.push_back(frame);
-    info("created a new frame, now " + std::to_string(m_frames.size()) + " frames in the list");
-    return frame;
+wayland::Input* WaylandApp::get_input(uint16_t seat_id) {
+    SeatInput* input = find_seat_input(seat_id);
+    return input ? input->input.get() : nullptr;
+}
+
+wayland::DataDevice* WaylandApp::get_data_device(uint16_t seat_id) {
+    SeatInput* input = find_seat_input(seat_id);
+    return input ? input->data_device.get() : nullptr;
+}
+
+wayland::CursorManager* WaylandApp::get_cursor_manager(uint16_t seat_id) {
+    SeatInput* input = find_seat_input(seat_id);
+    return input ? input->cursors.get() : nullptr;
+}
+
+/**
+ * Creates or destroys the client-side decorations as the compositor
+ * decides who draws them: we draw them if there is no decoration manager,
+ * or if the compositor asks for client-side mode.
+ */
+void WaylandApp::update_decorations() {
+    bool wanted = !m_window->has_server_side_decorations() && m_display->has_subcompositor();
+    if (wanted && !m_decorations) {
+        m_decorations = std::make_unique<wayland::Decorations>(*m_display, m_window->get_surface());
+        info("drawing client-side decorations");
+    }
+    else if (!wanted && m_decorations) {
+        m_decorations.reset();
+        m_window->get_xdg_surface().set_window_geometry(0, 0, m_window_width, m_window_height);
+    }
 }
 
 /**
@@ -525,15 +1050,17 @@ void WaylandApp::enter_event_loop() {
     int32_t wanted_width = DEFAULT_WINDOW_WIDTH;
     int32_t wanted_height = DEFAULT_WINDOW_HEIGHT;
 
-    // first render (without it, the window won't be shown)
-    auto frame = get_new_frame(wanted_width, wanted_height);
-    render_frame(*frame);
-    frame->attach(*m_window);
+    // the initial commit without a buffer; the compositor answers it
+    // with the first configure event, and only then we may attach frames
+    m_window->get_surface().commit();
+    bool configured = false;
+    bool configure_acked = false;          // since the last present_frame()
 
     bool need_redraw = true;
-    while (m_display->get_connection().dispatch() != -1) {
+    while (m_event_loop->dispatch() != -1) {
         revolutions++;
 
+        process_input();
         if (m_close_requested) {
             break;
         }
@@ -541,39 +1068,577 @@ void WaylandApp::enter_event_loop() {
         if (m_window->get_xdg_surface().is_configure_event_pending()) {
             wanted_width = m_window->get_toplevel().get_last_requested_width();
             wanted_height = m_window->get_toplevel().get_last_requested_height();
+            update_decorations();
             if (wanted_width == 0) {
                 wanted_width = DEFAULT_WINDOW_WIDTH;
             }
+            else if (m_decorations) {
+                // the compositor sizes the whole window, the content is smaller
+                Rect frame = wayland::Decorations::frame_rect(0, 0);
+                wanted_width = std::max(wanted_width - frame.width, 1);
+            }
             if (wanted_height == 0) {
                 wanted_height = DEFAULT_WINDOW_HEIGHT;
             }
+            else if (m_decorations) {
+                Rect frame = wayland::Decorations::frame_rect(0, 0);
+                wanted_height = std::max(wanted_height - frame.height, 1);
+            }
             m_window->get_xdg_surface().ack_configure();
+            configured = true;
+            configure_acked = true;
             need_redraw = true;
         }
 
-        if (need_redraw) {
-            auto frame = get_new_frame(wanted_width, wanted_height);
-            render_frame(*frame);
-            frame->attach(*m_window);
-            m_window->get_surface().commit();
+        if (need_redraw && configured) {
+            present_frame(wanted_width, wanted_height, configure_acked);
+            configure_acked = false;
             redraws++;
         }
         fprintf(stdout, "wayland app running, %d redraws, %d revolutions, %zu frames cached\r",
-            redraws, revolutions, m_frames.size());
+            redraws, revolutions, m_swapchain->size());
 
         // handle closing request that is made by clicking on the closing button
         if (m_window->get_toplevel().is_close_requested()) {
             m_close_requested = true;
         }
     }
+
+    stats::report();
+}
+
+/**
+ * Hands the input queued since the last iteration to handle_input(),
+ * except for what happens on the decorations. The rings of the seats
+ * are drained in turns of at most INPUT_BATCH events, so the events of
+ * the seats come to the app interleaved (about as they happened) and
+ * a seat with a lot of input does not keep the others waiting.
+ */
+void WaylandApp::process_input() {
+    static auto& drain_time = stats::histogram("input.drain_us");
+    stats::ScopedTimer timer(drain_time);
+    bool constrained_pointer_found = false;
+    for (auto& input : m_seats) {
+        input->input->update_devices();
+        if (m_constrained_input && is_constraint_for(*input->input)) {
+            constrained_pointer_found = true;
+        }
+    }
+    if (m_constrained_input && !constrained_pointer_found) {
+        // the lock was for a pointer that is gone
+        release_pointer();
+    }
+
+    // only what is queued now: the rings are not pushed to while draining
+    bool more = true;
+    while (more) {
+        more = false;
+        for (size_t i = 0; i < m_seats.size(); ++i) {
+            SeatInput& input = *m_seats[i];
+            uint32_t count = input.ring.drain([this, &input](InputEvent const& event) {
+                process_event(input, event);
+            }, INPUT_BATCH);
+            if (count == INPUT_BATCH) { more = true; }
+        }
+    }
+}
+
+void WaylandApp::process_event(SeatInput& input, InputEvent const& event) {
+    if (handle_decoration_input(input, event)) {
+        return;
+    }
+    if (event.type == InputEventType::PointerEnter || event.type == InputEventType::PointerMotion) {
+        input.pointer_on_decorations = false;
+        if (input.cursors) { input.cursors->set_shape(m_content_cursor); }
+    }
+    if (m_motion_predictor && input.seat == m_seats.front()->seat) {
+        feed_motion_predictor(event);
+    }
+    handle_input(event);
+    m_latency->input_consumed(event);
+}
+
+/// Gives the predictor the pointer positions; a new entry starts a new motion.
+void WaylandApp::feed_motion_predictor(InputEvent const& event) {
+    switch (event.type) {
+    case InputEventType::PointerEnter:
+        m_motion_predictor->reset();
+        m_motion_predictor->add_sample(input_event_time_ns(event), event.x, event.y);
+        break;
+    case InputEventType::PointerMotion:
+        m_motion_predictor->add_sample(input_event_time_ns(event), event.x, event.y);
+        break;
+    case InputEventType::PointerLeave:
+        m_motion_predictor->reset();
+        break;
+    default:
+        break;
+    }
+}
+
+void WaylandApp::set_cursor(wayland::CursorShape shape) {
+    m_content_cursor = shape;
+    for (auto& input : m_seats) {
+        if (input->cursors && !input->pointer_on_decorations) {
+            input->cursors->set_shape(shape);
+        }
+    }
+}
+
+/// Returns the input of the seat, or null if its pointer cannot be locked or confined.
+wayland::Input* WaylandApp::constrainable_input(uint16_t seat_id) {
+    SeatInput* input = find_seat_input(seat_id);
+    if (!input || !input->input->get_pointer() || !m_display->has_pointer_constraints()) {
+        return nullptr;
+    }
+    return input->input.get();
+}
+
+/**
+ * Returns true if the pointer lock or confinement is for the current
+ * pointer of the input. The pointer is compared by its generation, as
+ * a pointer created anew may get the address of the released one.
+ */
+bool WaylandApp::is_constraint_for(wayland::Input& input) const {
+    return m_constrained_input == &input && input.get_pointer()
+        && m_constrained_generation == input.get_pointer_generation();
+}
+
+bool WaylandApp::lock_pointer(bool persistent, uint16_t seat_id) {
+    release_pointer();
+    wayland::Input* input = constrainable_input(seat_id);
+    if (!input) {
+        return false;
+    }
+    m_locked_pointer = std::make_unique<wp::LockedPointer>(m_display->get_pointer_constraints(),
+        m_window->get_surface(), input->get_pointer(), persistent);
+    m_constrained_input = input;
+    m_constrained_generation = input->get_pointer_generation();
+    return true;
+}
+
+bool WaylandApp::confine_pointer(Rect const* area, bool persistent, uint16_t seat_id) {
+    release_pointer();
+    wayland::Input* input = constrainable_input(seat_id);
+    if (!input) {
+        return false;
+    }
+
+    // the compositor copies the region, so it can go right away
+    std::unique_ptr<wl::Region> region;
+    if (area) {
+        region = std::make_unique<wl::Region>(m_display->get_compositor());
+        region->add(area->x, area->y, area->width, area->height);
+    }
+    m_confined_pointer = std::make_unique<wp::ConfinedPointer>(m_display->get_pointer_constraints(),
+        m_window->get_surface(), input->get_pointer(), persistent, region.get());
+    m_constrained_input = input;
+    m_constrained_generation = input->get_pointer_generation();
+    return true;
+}
+
+void WaylandApp::release_pointer() {
+    m_locked_pointer.reset();
+    m_confined_pointer.reset();
+    m_constrained_input = nullptr;
+}
+
+void WaylandApp::set_motion_prediction(bool enabled) {
+    if (!enabled) {
+        m_motion_predictor.reset();
+    }
+    else if (!m_motion_predictor) {
+        m_motion_predictor = std::make_unique<MotionPredictor>();
+    }
+}
+
+bool WaylandApp::predict_pointer(float& x, float& y) {
+    if (!m_motion_predictor) { return false; }
+    return m_motion_predictor->predict(m_latency->predict_present_ns(stats::now_ns()), x, y);
+}
+
+namespace {
+
+/// Returns the cursor to show over the part of the decorations.
+wayland::CursorShape decoration_cursor(wayland::DecorationPart part) {
+    switch (part) {
+    case wayland::DecorationPart::ResizeTop:          return wayland::CursorShape::ResizeTop;
+    case wayland::DecorationPart::ResizeBottom:       return wayland::CursorShape::ResizeBottom;
+    case wayland::DecorationPart::ResizeLeft:         return wayland::CursorShape::ResizeLeft;
+    case wayland::DecorationPart::ResizeRight:        return wayland::CursorShape::ResizeRight;
+    case wayland::DecorationPart::ResizeTopLeft:      return wayland::CursorShape::ResizeTopLeft;
+    case wayland::DecorationPart::ResizeTopRight:     return wayland::CursorShape::ResizeTopRight;
+    case wayland::DecorationPart::ResizeBottomLeft:   return wayland::CursorShape::ResizeBottomLeft;
+    case wayland::DecorationPart::ResizeBottomRight:  return wayland::CursorShape::ResizeBottomRight;
+    default:                                          return wayland::CursorShape::Default;
+    }
+}
+
+} // namespace
+
+/**
+ * Handles the event if it happened on the decorations: the cursor follows
+ * the part under the pointer, and a press of the left button starts moving
+ * or resizing the window, or presses a button.
+ * Returns false if the event is not for the decorations.
+ */
+bool WaylandApp::handle_decoration_input(SeatInput& input, InputEvent const& event) {
+    if (!m_decorations || !event.surface || event.surface != m_decorations->get_surface().get()) {
+        return false;
+    }
+    bool motion = event.type == InputEventType::PointerEnter || event.type == InputEventType::PointerMotion;
+    bool press = event.type == InputEventType::PointerButton && event.code == BTN_LEFT && event.state;
+    if (!motion && !press) {
+        return true;
+    }
+
+    // the point relative to the content, as hit_test() wants it
+    Rect area = m_decorations->surface_rect(m_window_width, m_window_height);
+    auto part = wayland::Decorations::hit_test((int) event.x + area.x, (int) event.y + area.y,
+        m_window_width, m_window_height);
+    if (motion) {
+        input.pointer_on_decorations = true;
+        if (input.cursors) { input.cursors->set_shape(decoration_cursor(part)); }
+        return true;
+    }
+
+    auto& toplevel = m_window->get_toplevel();
+    auto& seat = *input.seat;
+    switch (part) {
+    case wayland::DecorationPart::TitleBar:
+        toplevel.move(seat, event.serial);
+        break;
+    case wayland::DecorationPart::CloseButton:
+        m_close_requested = true;
+        break;
+    case wayland::DecorationPart::MaximizeButton:
+        toplevel.set_maximized(!toplevel.is_maximized());
+        break;
+    case wayland::DecorationPart::MinimizeButton:
+        toplevel.set_minimized();
+        break;
+    case wayland::DecorationPart::ResizeTop:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_TOP);
+        break;
+    case wayland::DecorationPart::ResizeBottom:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM);
+        break;
+    case wayland::DecorationPart::ResizeLeft:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_LEFT);
+        break;
+    case wayland::DecorationPart::ResizeRight:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_RIGHT);
+        break;
+    case wayland::DecorationPart::ResizeTopLeft:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT);
+        break;
+    case wayland::DecorationPart::ResizeTopRight:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT);
+        break;
+    case wayland::DecorationPart::ResizeBottomLeft:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT);
+        break;
+    case wayland::DecorationPart::ResizeBottomRight:
+        toplevel.resize(seat, event.serial, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+/**
+ * Renders a frame of the given size and, if anything in it changed,
+ * attaches it to the window with the damaged area and commits.
+ * The decorations (if any) are updated too, but as they are cached,
+ * only a resize or a focus change gets them to the compositor again.
+ * Invalidated layers are repainted; the window is committed also when
+ * only they changed, so that synchronized layers get shown. If a configure
+ * was just acked, the window is committed even with nothing changed, as
+ * the acked state applies only with the next commit.
+ */
+void WaylandApp::present_frame(int32_t width, int32_t height, bool configure_acked) {
+    m_window_width = width;
+    m_window_height = height;
+    m_hit_index.set_size(width, height);
+    auto frame = m_swapchain->get_new_frame(width, height);
+    DamageRegion damage = render_frame(*frame);
+
+    bool decorations_changed = false;
+    if (m_decorations) {
+        decorations_changed = m_decorations->update(width, height,
+            m_window->get_toplevel().is_activated());
+        if (decorations_changed) {
+            Rect geometry = wayland::Decorations::frame_rect(width, height);
+            m_window->get_xdg_surface().set_window_geometry(geometry.x, geometry.y,
+                geometry.width, geometry.height);
+        }
+    }
+
+    bool layers_changed = false;
+    for (auto& layer : m_layers) {
+        layer->update();
+        layers_changed |= layer->take_parent_commit_needed();
+    }
+
+    bool input_region_changed = update_input_region();
+
+    if (damage.is_empty() && !decorations_changed && !layers_changed && !input_region_changed) {
+        if (configure_acked) {
+            m_window->get_surface().commit();   // no new buffer, just the acked state
+        }
+        m_latency->frame_skipped();
+        return;
+    }
+    if (!damage.is_empty()) {
+        frame->attach(*m_window);
+        for (auto& rect : damage) {
+            m_window->get_surface().damage(rect.x, rect.y, rect.width, rect.height);
+        }
+    }
+    m_latency->frame_committed();
+    m_window->get_surface().commit();
+}
+
+wayland::Layer& WaylandApp::create_layer(int x, int y, int width, int height, uint32_t format) {
+    m_layers.push_back(std::make_unique<wayland::Layer>(*m_display, m_window->get_surface(),
+        x, y, width, height, format));
+    return *m_layers.back();
+}
+
+void WaylandApp::destroy_layer(wayland::Layer& layer) {
+    auto it = std::find_if(m_layers.begin(), m_layers.end(),
+        [&layer](auto const& item) { return item.get() == &layer; });
+    if (it == m_layers.end()) {
+        throw std::logic_error("WaylandApp: destroy_layer(): not a layer of this app");
+    }
+    m_layers.erase(it);
+}
+
+void WaylandApp::set_input_region_from_hit_index(bool enabled) {
+    m_input_region_from_hits = enabled;
 }
 
-void WaylandApp::render_frame(wayland::Frame& frame) {
+/**
+ * Sets the input region from the hit index if it changed since it was last
+ * sent (or removes it, if the derivation was turned off); it takes effect
+ * with the next commit. Returns true if anything was sent.
+ */
+bool WaylandApp::update_input_region() {
+    if (!m_input_region_from_hits) {
+        if (!m_input_region_sent) { return false; }
+        m_window->get_surface().remove_input_region();
+        m_input_region_sent = false;
+        return true;
+    }
+    if (m_input_region_sent && m_hit_index.version() == m_input_region_version) { return false; }
+
+    static auto& region_rects = stats::histogram("input.region_rects");
+    wl::Region region(m_display->get_compositor());
+    auto rects = m_hit_index.input_region();
+    for (auto& rect : rects) {
+        region.add(rect.x, rect.y, rect.width, rect.height);
+    }
+    m_window->get_surface().set_input_region(region);
+    m_input_region_sent = true;
+    m_input_region_version = m_hit_index.version();
+    region_rects.add(rects.size());
+    return true;
+}
+
+void WaylandApp::set_render_threads(int thread_count, int tile_size) {
+    if (thread_count == 1) {
+        m_tile_renderer.reset();
+        return;
+    }
+    m_tile_renderer = std::make_unique<TileRenderer>(thread_count, tile_size);
+    info("rendering on " + std::to_string(m_tile_renderer->thread_count()) + " threads, "
+        + std::to_string(m_tile_renderer->tile_size()) + " pixel tiles");
+}
+
+void WaylandApp::set_content_hashing(bool enabled, int tile_size) {
+    if (!enabled) {
+        m_tile_hasher.reset();
+        return;
+    }
+    m_tile_hasher = std::make_unique<TileHasher>(tile_size);
+}
+
+void WaylandApp::invalidate() {
+    m_invalidated.add(Rect(0, 0, INT32_MAX/2, INT32_MAX/2));
+}
+
+void WaylandApp::invalidate(Rect const& rect) {
+    m_invalidated.add(rect);
+}
+
+void WaylandApp::scroll(Rect const& rect, int dx, int dy) {
+    if (rect.is_empty() || (dx == 0 && dy == 0)) { return; }
+    if (m_retained_mode || (!m_scroll_rect.is_empty() && m_scroll_rect != rect)) {
+        invalidate(rect);
+        invalidate(m_scroll_rect);
+        m_scroll_rect = Rect();
+        return;
+    }
+
+    // what was invalidated so far moves with the content
+    DamageRegion moved;
+    for (auto& invalid : m_invalidated) {
+        moved.add(invalid.intersected(rect).translated(dx, dy).intersected(rect));
+    }
+    m_invalidated.add(moved);
+
+    m_scroll_rect = rect;
+    m_scroll_dx += dx;
+    m_scroll_dy += dy;
+}
+
+/**
+ * Renders the next frame into the given buffer and returns the damaged
+ * region (empty if nothing changed and the frame need not be presented).
+ * Only the damaged region is repainted: in retained mode it is found by
+ * comparing the display lists of this and the previous frame, otherwise
+ * it is what was invalidated (and exposed by scroll()), or everything
+ * if nothing was. The rest of the buffer, which may hold an image
+ * several frames old, is brought up to date by copying from the last
+ * rendered frame.
+ */
+DamageRegion WaylandApp::render_frame(wayland::Frame& frame) {
     DrawingContext dc = DrawingContext(
         (uint32_t*) frame.get_memory(),
         frame.get_width(),
-        frame.get_height());
-    draw(dc);
+        frame.get_height(),
+        frame.get_stride()/4);
+    Rect surface(0, 0, frame.get_width(), frame.get_height());
+
+    DamageRegion damage = m_invalidated;
+    m_invalidated.clear();
+
+    wayland::Frame* last_frame = m_swapchain->get_last_frame();
+    bool resized = (!last_frame
+        || last_frame->get_width() != frame.get_width()
+        || last_frame->get_height() != frame.get_height());
+    if (resized) {
+        damage = DamageRegion(surface);
+        m_damage_history.clear();
+    }
+
+    // a pending scroll moves the pixels of the last frame; of the scrolled
+    // rectangle, only the strip the move exposes needs to be repainted
+    Rect scroll_area;       // the scrolled rectangle
+    Rect scrolled;          // the part of it that gets moved pixels
+    int scroll_dx = m_scroll_dx;
+    int scroll_dy = m_scroll_dy;
+    if (!m_scroll_rect.is_empty()) {
+        scroll_area = m_scroll_rect.intersected(surface);
+        if (!resized && !m_retained_mode) {
+            scrolled = scroll_area.intersected(scroll_area.translated(scroll_dx, scroll_dy));
+            damage.add(scroll_exposed(scroll_area, scroll_dx, scroll_dy));
+        }
+        else {
+            damage.add(scroll_area);
+        }
+        m_scroll_rect = Rect();
+        m_scroll_dx = 0;
+        m_scroll_dy = 0;
+    }
+
+    DisplayList* list = nullptr;
+    if (m_retained_mode) {
+        list = &m_display_lists[m_current_list];
+        DisplayList& previous = m_display_lists[1 - m_current_list];
+        list->reset(surface.width, surface.height);
+        record(list->recorder());
+        damage.add(list->diff(previous));
+        m_current_list = 1 - m_current_list;
+    }
+    else if (damage.is_empty() && scrolled.is_empty()) {
+        damage.add(surface);
+    }
+    damage.clip(surface);
+    if (damage.is_empty() && scrolled.is_empty()) {
+        return damage;
+    }
+
+    // copy-forward: whatever changed since the buffer was last used,
+    // and is not going to be repainted now, comes from the last frame
+    if (!resized) {
+        DamageRegion stale;
+        if (!m_damage_history.collect_since(frame.get_content_serial(), stale)) {
+            stale = DamageRegion(surface);
+        }
+        for (auto& rect : stale) {
+            if (!damage.contains(rect) && !scrolled.contains(rect)) {
+                frame.copy_from(*last_frame, rect);
+            }
+        }
+
+        if (!scrolled.is_empty()) {
+            static auto& scroll_time = stats::histogram("scroll.move_us");
+            static auto& moved_pixels = stats::counter("scroll.moved_pixels");
+            stats::ScopedTimer timer(scroll_time);
+            if (stale.is_empty()) {
+                // the buffer holds the last frame (age 1), move the pixels in place
+                dc.scroll(scroll_area.x, scroll_area.y, scroll_area.width, scroll_area.height,
+                    scroll_dx, scroll_dy);
+            }
+            else {
+                frame.copy_from(*last_frame, scrolled.translated(-scroll_dx, -scroll_dy),
+                    scroll_dx, scroll_dy);
+            }
+            moved_pixels.add((uint64_t) scrolled.width*scrolled.height);
+        }
+    }
+
+    {
+        static auto& render_time = stats::histogram("render.frame_us");
+        stats::ScopedTimer timer(render_time);
+        if (list && m_tile_renderer) {
+            m_tile_renderer->render(*list, dc, damage);
+            static auto& dirty_tiles = stats::histogram("render.dirty_tiles");
+            dirty_tiles.add(m_tile_renderer->last_dirty_tile_count());
+        }
+        else if (list) {
+            list->replay(dc, damage);
+        }
+        else if (!damage.is_empty()) {
+            dc.push_clip(damage.bounds());
+            draw(dc);
+            dc.pop_clip();
+        }
+    }
+    damage.add(scrolled);
+
+    if (m_tile_hasher) {
+        static auto& hash_time = stats::histogram("hash.frame_us");
+        static auto& damaged_pixels = stats::counter("hash.damaged_pixels");
+        static auto& changed_pixels = stats::counter("hash.changed_pixels");
+        stats::ScopedTimer timer(hash_time);
+        damaged_pixels.add(damage.area());
+        damage = m_tile_hasher->filter((uint32_t const*) frame.get_memory(),
+            frame.get_width(), frame.get_height(), frame.get_stride()/4, damage);
+        changed_pixels.add(damage.area());
+        if (damage.is_empty()) {
+            // the buffer now holds the same image as the last frame
+            frame.set_content_serial(m_frame_serial);
+            return damage;
+        }
+    }
+
+    m_frame_serial++;
+    m_damage_history.push(m_frame_serial, damage);
+    frame.set_content_serial(m_frame_serial);
+    m_swapchain->set_last_frame(&frame);
+    return damage;
+}
+
+void WaylandApp::record(RecordingContext ctx) {
+}
+
+void WaylandApp::handle_input(InputEvent const& event) {
+}
+
+void WaylandApp::handle_seat(uint16_t seat_id, bool added) {
 }
 
 void WaylandApp::draw(DrawingContext ctx) {
@@ -1,19 +1,34 @@
 #pragma once
 
 #include <cstdint>
+#include <ctime>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 #include <wayland-client.h>
+#include "cursor.hpp"
 #include "debug.hpp"
+#include "input.hpp"
+#include "presentation-time-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
+#include "zwp-pointer-constraints-client-protocol.h"
+#include "zwp-relative-pointer-client-protocol.h"
 #include "zxdg-decoration-client-protocol.h"
 #include <linux/input-event-codes.h>
 #include <unistd.h>
 
 #include "frame.hpp"
 #include "draw.hpp"
+#include "damage.hpp"
+#include "display_list.hpp"
+#include "hit_index.hpp"
+#include "motion_predictor.hpp"
+#include "swapchain.hpp"
+#include "tile_hasher.hpp"
+#include "tile_renderer.hpp"
 
 #if USE_EGL
 #include <wayland-egl.h>
@@ -63,11 +78,25 @@ public:
 
 /**
  * Registry of API interfaces that are supported by the Wayland server.
+ * It tracks the global objects the server announces, including several
+ * of the same interface (e.g. seats or outputs), as they come and go.
  */
 class Registry : public WaylandObject {
+public:
+    /// A global object announced by the server.
+    struct Global {
+        uint32_t name = 0;              // numeric, not reused while we are connected
+        std::string interface;
+        uint32_t version = 0;
+    };
+
+    /// Called when a global is announced (added) or removed.
+    using GlobalCallback = std::function<void(Global const& global, bool added)>;
+
 protected:
     wl_registry* m_registry = nullptr;
-    std::map<std::string, uint32_t> m_interfaces;
+    std::map<uint32_t, Global> m_globals;   // by name, that is, in the order of announcing
+    GlobalCallback m_callback;
 public:
     Registry(Connection& conn);
     ~Registry();
@@ -79,16 +108,36 @@ public:
      * after we connect.
      */
     bool has_interface(std::string interface_name) {
-        auto cursor = m_interfaces.find(interface_name);
-        return (cursor != m_interfaces.end());
+        for (auto const& entry : m_globals) {
+            if (entry.second.interface == interface_name) { return true; }
+        }
+        return false;
     }
 
+    /// Returns the names of the globals of the interface, in the order of announcing.
+    std::vector<uint32_t> find_globals(std::string const& interface_name) const;
+
+    /**
+     * Makes the callback called for globals announced and removed from now
+     * on (from the event dispatch); the ones already known can be listed
+     * with find_globals().
+     */
+    void set_global_callback(GlobalCallback callback) { m_callback = std::move(callback); }
+
+    /// Binds the global of the given name, like bind_interface()
+    /// (for interfaces of which there may be several globals).
+    /// The version is lowered to the one the server announced, if that is older;
+    /// the bound proxy's version tells which one it got.
+    void* bind_global(uint32_t name, const wl_interface* interface, uint32_t version);
+
     /// Requests the given Wayland interface with specified version,
     /// and announces the use of it to the Wayland server.
     /// Returns a pointer to a structure representing the interface
     /// (the caller must know what to cast the pointer to).
     /// The resulting structure must be later destroyed via appropriate method
     /// (usually some destroy() version specific to the structure).
+    /// If there are several globals of the interface, the first one is bound
+    /// (by bind_global(), so the version is lowered the same way).
     /// On failure, null is returned.
     void* bind_interface(const wl_interface* interface, uint32_t version);
 };
@@ -106,26 +155,40 @@ public:
 class Shm : public WaylandObject {
 protected:
     wl_shm* m_shm = nullptr;
+    struct wl_shm_listener m_listener = { 0 };
+    std::vector<uint32_t> m_formats;        // as advertised by the compositor
 public:
     const uint32_t API_VERSION = 1;
     Shm(Registry& registry);
     ~Shm();
     wl_shm* get() { return m_shm; }
+
+    /// Returns true if buffers of the given WL_SHM_FORMAT_* can be used
+    /// (XRGB8888 and ARGB8888 always can, others when advertised).
+    bool is_format_supported(uint32_t format) const;
 };
 
 class Seat : public WaylandObject {
 protected:
     wl_seat* m_seat = nullptr;
     struct wl_seat_listener m_listener = { 0 };
+    uint32_t m_global_name = 0;
+    uint16_t m_id = 0;
     std::string m_name = "";
     bool m_pointer_supported = false;
     bool m_keyboard_supported = false;
     bool m_touch_supported = false;
 public:
     const uint32_t API_VERSION = 7;
-    Seat(Registry& registry);
+
+    /// Binds the seat global of the given name, at API_VERSION or the older
+    /// version the compositor has (see wl_seat_get_version()). The id numbers
+    /// the seats for the app (see InputEvent::seat), in the order they appeared.
+    Seat(Registry& registry, uint32_t global_name, uint16_t id);
     ~Seat();
     wl_seat* get() { return m_seat; }
+    uint32_t get_global_name() const { return m_global_name; }
+    uint16_t get_id() const { return m_id; }
     std::string get_name() const { return m_name; }
     bool is_pointer_supported() const { return m_pointer_supported; }
     bool is_keyboard_supported() const { return m_keyboard_supported; }
@@ -145,6 +208,66 @@ public:
     void damage(int32_t x, int32_t y, int32_t width, int32_t height);
     void set_opaque_region(Region& region);
     void remove_opaque_region();
+
+    /// Limits where the surface gets pointer and touch input (applied on commit).
+    void set_input_region(Region& region);
+
+    /// Makes the whole surface get input again (the default).
+    void remove_input_region();
+
+    /// Tells the compositor that attached buffers are scale times
+    /// larger than the surface (for HiDPI outputs).
+    void set_buffer_scale(int32_t scale);
+};
+
+/// The global that turns surfaces into subsurfaces (wl_subcompositor).
+class Subcompositor : public WaylandObject {
+protected:
+    wl_subcompositor* m_subcompositor = nullptr;
+public:
+    const uint32_t API_VERSION = 1;
+    Subcompositor(Registry& registry);
+    ~Subcompositor();
+    wl_subcompositor* get() { return m_subcompositor; }
+    static bool is_supported(Registry& registry);
+};
+
+/// The global that makes data devices and sources, for the clipboard and drag and drop.
+class DataDeviceManager : public WaylandObject {
+protected:
+    wl_data_device_manager* m_manager = nullptr;
+public:
+    const uint32_t API_VERSION = 3;
+    DataDeviceManager(Registry& registry);
+    ~DataDeviceManager();
+    wl_data_device_manager* get() { return m_manager; }
+    static bool is_supported(Registry& registry);
+};
+
+/**
+ * A surface shown as a part of another (parent) surface, positioned
+ * relative to it (wl_subsurface). In the default synchronized mode,
+ * its state (buffer, position) is applied together with the next commit
+ * of the parent, so both change atomically.
+ */
+class Subsurface : public WaylandObject {
+protected:
+    wl_subsurface* m_subsurface = nullptr;
+public:
+    Subsurface(Subcompositor& subcompositor, Surface& surface, Surface& parent);
+    ~Subsurface();
+    wl_subsurface* get() { return m_subsurface; }
+
+    /// Moves the subsurface relative to the parent's top-left corner.
+    void set_position(int32_t x, int32_t y);
+    void place_above(Surface& sibling);
+    void place_below(Surface& sibling);
+
+    /// Makes commits of the subsurface wait for the parent's commit (the default).
+    void set_sync();
+
+    /// Makes commits of the subsurface apply at once, independently of the parent.
+    void set_desync();
 };
 
 class Output : public WaylandObject {
@@ -185,6 +308,121 @@ public:
 
 } // namespace wl
 
+namespace wp {
+
+/**
+ * The global that reports when surface updates were shown (wp_presentation).
+ * Its timestamps are in the presentation clock, which the compositor
+ * announces right after binding (CLOCK_MONOTONIC until then).
+ */
+class Presentation : public wl::WaylandObject {
+protected:
+    wp_presentation* m_presentation = nullptr;
+    wp_presentation_listener m_listener = { 0 };
+    uint32_t m_clock_id = CLOCK_MONOTONIC;
+public:
+    const uint32_t API_VERSION = 1;
+    Presentation(wl::Registry& registry);
+    ~Presentation();
+    wp_presentation* get() { return m_presentation; }
+    clockid_t get_clock_id() const { return (clockid_t) m_clock_id; }
+    static bool is_supported(wl::Registry& registry);
+};
+
+/**
+ * The global that makes relative pointers (zwp_relative_pointer_manager_v1),
+ * which report the motion of the pointer device itself: not clipped by the
+ * screen edges, also while the pointer is locked, and also unaccelerated.
+ */
+class RelativePointerManager : public wl::WaylandObject {
+protected:
+    zwp_relative_pointer_manager_v1* m_manager = nullptr;
+public:
+    const uint32_t API_VERSION = 1;
+    RelativePointerManager(wl::Registry& registry);
+    ~RelativePointerManager();
+    zwp_relative_pointer_manager_v1* get() { return m_manager; }
+    static bool is_supported(wl::Registry& registry);
+};
+
+/// The global that locks the pointer in place or confines it to a region (zwp_pointer_constraints_v1).
+class PointerConstraints : public wl::WaylandObject {
+protected:
+    zwp_pointer_constraints_v1* m_constraints = nullptr;
+public:
+    const uint32_t API_VERSION = 1;
+    PointerConstraints(wl::Registry& registry);
+    ~PointerConstraints();
+    zwp_pointer_constraints_v1* get() { return m_constraints; }
+    static bool is_supported(wl::Registry& registry);
+};
+
+/**
+ * A request to lock the pointer over a surface (zwp_locked_pointer_v1).
+ * The compositor activates the lock when it sees fit (usually when the
+ * pointer is over the surface, which has the focus); while locked, the
+ * pointer does not move and only relative motions come. A oneshot lock
+ * is over once deactivated, a persistent one may activate again.
+ * The region (null for the whole input region) limits where the pointer
+ * must be for the lock to activate.
+ */
+class LockedPointer : public wl::WaylandObject {
+protected:
+    zwp_locked_pointer_v1* m_locked_pointer = nullptr;
+    zwp_locked_pointer_v1_listener m_listener = { 0 };
+    bool m_locked = false;
+    bool m_persistent = false;
+    bool m_defunct = false;         // a oneshot lock was deactivated
+public:
+    LockedPointer(PointerConstraints& constraints, wl::Surface& surface, wl_pointer* pointer,
+        bool persistent, wl::Region* region = nullptr);
+    ~LockedPointer();
+    zwp_locked_pointer_v1* get() { return m_locked_pointer; }
+
+    /// Returns true while the lock is active.
+    bool is_locked() const { return m_locked; }
+
+    /// Returns true if this oneshot lock was deactivated and will not activate again.
+    bool is_defunct() const { return m_defunct; }
+
+    /// Tells where the app shows its own cursor, so the compositor can put the
+    /// pointer there when unlocking (surface coordinates; applied on commit).
+    void set_cursor_position_hint(float x, float y);
+
+    /// Changes the region where the lock may activate (applied on commit).
+    void set_region(wl::Region* region);
+};
+
+/**
+ * A request to confine the pointer to a region of a surface
+ * (zwp_confined_pointer_v1); activated and deactivated by the compositor
+ * like LockedPointer, but the pointer moves within the region.
+ */
+class ConfinedPointer : public wl::WaylandObject {
+protected:
+    zwp_confined_pointer_v1* m_confined_pointer = nullptr;
+    zwp_confined_pointer_v1_listener m_listener = { 0 };
+    bool m_confined = false;
+    bool m_persistent = false;
+    bool m_defunct = false;         // a oneshot confinement was deactivated
+public:
+    ConfinedPointer(PointerConstraints& constraints, wl::Surface& surface, wl_pointer* pointer,
+        bool persistent, wl::Region* region = nullptr);
+    ~ConfinedPointer();
+    zwp_confined_pointer_v1* get() { return m_confined_pointer; }
+
+    /// Returns true while the confinement is active.
+    bool is_confined() const { return m_confined; }
+
+    /// Returns true if this oneshot confinement was deactivated and will not activate again.
+    bool is_defunct() const { return m_defunct; }
+
+    /// Changes the region the pointer is confined to (applied on commit).
+    void set_region(wl::Region* region);
+};
+
+} // namespace wp
+
 namespace xdg {
     namespace wm {
 
@@ -225,6 +463,8 @@ namespace xdg {
         struct xdg_toplevel_listener m_listener = { 0 };
         bool m_close_requested = false;
         bool m_configure_requested = false;
+        bool m_activated = false;
+        bool m_maximized = false;
         int m_last_requested_width = 0;
         int m_last_requested_height = 0;
         int32_t m_recommended_max_width = 0;
@@ -242,6 +482,20 @@ namespace xdg {
         int32_t get_last_requested_height() const { return m_last_requested_height; }
         int32_t get_recommended_max_width() const { return m_recommended_max_width; }
         int32_t get_recommended_max_height() const { return m_recommended_max_height; }
+
+        /// Returns true if the window has the keyboard focus (as of the last configure).
+        bool is_activated() const { return m_activated; }
+
+        /// Returns true if the window is maximized (as of the last configure).
+        bool is_maximized() const { return m_maximized; }
+
+        /// Starts an interactive move or resize, in response to the button
+        /// press with the given serial (e.g. on a client-side title bar).
+        void move(wl::Seat& seat, uint32_t serial);
+        void resize(wl::Seat& seat, uint32_t serial, uint32_t edges);
+
+        void set_maximized(bool maximized);
+        void set_minimized();
     };
 
     class DecorationManager : public wl::WaylandObject {
@@ -258,11 +512,16 @@ namespace xdg {
     class ToplevelDecoration : public wl::WaylandObject {
     protected:
         struct zxdg_toplevel_decoration_v1* m_decoration = nullptr;
+        struct zxdg_toplevel_decoration_v1_listener m_listener = { 0 };
+        uint32_t m_mode = 0;        // as configured by the compositor, 0 until then
     public:
         ToplevelDecoration(xdg::DecorationManager& manager, xdg::Toplevel& toplevel);
         ~ToplevelDecoration();
         zxdg_toplevel_decoration_v1* get() { return m_decoration; }
         void set_server_side_mode();
+
+        /// Returns true if the compositor wants the client to draw the decorations.
+        bool is_client_side() const { return m_mode == ZXDG_TOPLEVEL_DECORATION_V1_MODE_CLIENT_SIDE; }
     };
 
 } // namespace xdg
@@ -270,25 +529,64 @@ namespace xdg {
 namespace wayland {
 
 class Display {
+public:
+    /// Called when a seat is added (once bound) or removed (before it is destroyed).
+    using SeatCallback = std::function<void(wl::Seat& seat, bool added)>;
+
 protected:
     std::unique_ptr<wl::Connection>     m_connection;
     std::unique_ptr<wl::Registry>       m_registry;
     std::unique_ptr<wl::Compositor>     m_compositor;
     std::unique_ptr<wl::Shm>            m_shm;
-    std::unique_ptr<wl::Seat>           m_seat;
+    std::vector<std::unique_ptr<wl::Seat>> m_seats;     // in the order they appeared
+    uint16_t m_next_seat_id = 0;
+    SeatCallback m_seat_callback;
     std::unique_ptr<wl::Output>         m_output;
     std::unique_ptr<xdg::wm::Base>      m_wm_base;
     std::unique_ptr<xdg::DecorationManager> m_decoration_manager;
+    std::unique_ptr<wl::Subcompositor>  m_subcompositor;
+    std::unique_ptr<wp::Presentation>   m_presentation;
+    std::unique_ptr<wl::DataDeviceManager> m_data_device_manager;
+    std::unique_ptr<wp::RelativePointerManager> m_relative_pointer_manager;
+    std::unique_ptr<wp::PointerConstraints> m_pointer_constraints;
+
+    wl::Seat& add_seat(uint32_t global_name);
+    void handle_global(wl::Registry::Global const& global, bool added);
 public:
     Display();
     wl::Connection& get_connection() { return *m_connection; }
     wl::Registry& get_registry() { return *m_registry; }
     wl::Compositor& get_compositor() { return *m_compositor; }
     wl::Shm& get_shm() { return *m_shm; }
-    wl::Seat& get_seat() { return *m_seat; }
+
+    /// Returns the first of the seats; throws if there is none.
+    wl::Seat& get_seat();
+
+    /// Returns all seats, in the order they appeared.
+    std::vector<std::unique_ptr<wl::Seat>> const& get_seats() { return m_seats; }
+
+    /// Returns the seat with the id (see wl::Seat::get_id()), or null if it is gone.
+    wl::Seat* find_seat(uint16_t id);
+
+    /**
+     * Makes the callback called when a seat is added or removed
+     * (from the event dispatch); the seats bound so far are in get_seats().
+     */
+    void set_seat_callback(SeatCallback callback) { m_seat_callback = std::move(callback); }
+
     xdg::wm::Base& get_wm_base() { return *m_wm_base; }
     bool has_decoration_manager() { return !!m_decoration_manager; }
     xdg::DecorationManager& get_decoration_manager();
+    bool has_subcompositor() { return !!m_subcompositor; }
+    wl::Subcompositor& get_subcompositor();
+    bool has_presentation() { return !!m_presentation; }
+    wp::Presentation& get_presentation();
+    bool has_data_device_manager() { return !!m_data_device_manager; }
+    wl::DataDeviceManager& get_data_device_manager();
+    bool has_relative_pointer_manager() { return !!m_relative_pointer_manager; }
+    wp::RelativePointerManager& get_relative_pointer_manager();
+    bool has_pointer_constraints() { return !!m_pointer_constraints; }
+    wp::PointerConstraints& get_pointer_constraints();
 };
 
 class Window {
@@ -306,8 +604,18 @@ public:
     wl::Surface& get_surface() { return *m_surface; }
     xdg::Surface& get_xdg_surface() { return *m_xdg_surface; }
     xdg::Toplevel& get_toplevel() { return *m_toplevel; }
+
+    /// Returns true if the compositor draws the window decorations
+    /// (false without a decoration manager, or if it asked us to draw them).
+    bool has_server_side_decorations() const { return m_decoration && !m_decoration->is_client_side(); }
 };
 
+class DataDevice;
+class Decorations;
+class EventLoop;
+class LatencyTracker;
+class Layer;
+
 } // namespace wayland
 
 class WaylandApp {
@@ -316,6 +624,7 @@ protected:
 
     std::unique_ptr<wayland::Display> m_display;
     std::unique_ptr<wayland::Window> m_window;
+    std::unique_ptr<wayland::EventLoop> m_event_loop;
 
     int m_window_width = DEFAULT_WINDOW_WIDTH;
     int m_window_height = DEFAULT_WINDOW_HEIGHT;
@@ -323,15 +632,99 @@ protected:
 
     bool m_redraw_needed = false;
 
-    std::list<wayland::Frame*> m_frames;
-    wayland::Frame* get_new_frame(int32_t width, int32_t height);
-    void purge_badly_sized_frames(int32_t width, int32_t height);
+    std::unique_ptr<wayland::Swapchain> m_swapchain;
+
+    // client-side decorations, if the compositor does not draw them
+    std::unique_ptr<wayland::Decorations> m_decorations;
+    void update_decorations();
+
+    // the input of a seat, queued for the main loop in a ring of its own
+    struct SeatInput {
+        wl::Seat* seat = nullptr;
+        InputRing ring;
+
+        // the pointer cursor (null without a cursor theme); the decorations
+        // show resize cursors, the content the app's choice
+        std::unique_ptr<wayland::CursorManager> cursors;
+        bool pointer_on_decorations = false;
+
+        std::unique_ptr<wayland::Input> input;
+
+        // the clipboard and drag and drop (null without a data device manager)
+        std::unique_ptr<wayland::DataDevice> data_device;
+    };
+
+    // the cursor theme shared by the seats (null if it could not be loaded)
+    std::unique_ptr<wayland::CursorTheme> m_cursor_theme;
+
+    // the seats, in the order they appeared (added and removed by handle_seat_change())
+    std::vector<std::unique_ptr<SeatInput>> m_seats;
+    wayland::CursorShape m_content_cursor = wayland::CursorShape::Default;
+    void handle_seat_change(wl::Seat& seat, bool added);
+    SeatInput* find_seat_input(uint16_t seat_id);
+
+    // the pointer lock or confinement, see lock_pointer() and confine_pointer()
+    std::unique_ptr<wp::LockedPointer> m_locked_pointer;
+    std::unique_ptr<wp::ConfinedPointer> m_confined_pointer;
+    wayland::Input* m_constrained_input = nullptr;  // the input of the pointer they were made for
+    uint32_t m_constrained_generation = 0;          // and the generation of that pointer
+    wayland::Input* constrainable_input(uint16_t seat_id);
+    bool is_constraint_for(wayland::Input& input) const;
+
+    // the seats' rings are drained in turns of at most this many events
+    static const uint32_t INPUT_BATCH = 64;
+    void process_input();
+    void process_event(SeatInput& seat, InputEvent const& event);
+    bool handle_decoration_input(SeatInput& seat, InputEvent const& event);
+
+    // predicts the pointer position for drawing, if enabled
+    std::unique_ptr<MotionPredictor> m_motion_predictor;
+    void feed_motion_predictor(InputEvent const& event);
+
+    // interactive areas of the window, see get_hit_index()
+    HitIndex m_hit_index;
+    bool m_input_region_from_hits = false;
+    bool m_input_region_sent = false;
+    uint64_t m_input_region_version = 0;    // of the hit index, when last sent
+    bool update_input_region();
+
+    // measures the time from input to the frame showing the response
+    std::unique_ptr<wayland::LatencyTracker> m_latency;
+
+    // overlays on their own subsurfaces, see create_layer()
+    std::vector<std::unique_ptr<wayland::Layer>> m_layers;
+
+    // when true, frames are recorded by record() into display lists,
+    // and only the parts that differ from the previous frame are redrawn
+    bool m_retained_mode = false;
+    DisplayList m_display_lists[2];
+    int m_current_list = 0;
+
+    DamageRegion m_invalidated;             // see invalidate()
+    Rect m_scroll_rect;                     // see scroll()
+    int m_scroll_dx = 0;
+    int m_scroll_dy = 0;
+    DamageHistory m_damage_history;         // of the last few frames, for copy-forward
+    uint64_t m_frame_serial = 0;            // of the last rendered frame
+
+    // if set, display lists are rendered in parallel (retained mode only)
+    std::unique_ptr<TileRenderer> m_tile_renderer;
+
+    // if set, damage is narrowed down by comparing hashes of rendered tiles
+    std::unique_ptr<TileHasher> m_tile_hasher;
+
+    void present_frame(int32_t width, int32_t height, bool configure_acked);
 
 public:
 
     static const int DEFAULT_WINDOW_WIDTH = 1280;
     static const int DEFAULT_WINDOW_HEIGHT = 1024;
 
+    /**
+     * Connects to the compositor and creates the window. Also sets SIGPIPE
+     * to be ignored, for the whole process, so that a clipboard or drag
+     * reader closing its pipe early fails our write instead of killing us.
+     */
     WaylandApp();
     virtual ~WaylandApp();
 
@@ -341,9 +734,161 @@ public:
     int find_unused_buffer();
 
     void enter_event_loop();
-    void render_frame(wayland::Frame& frame);
+    DamageRegion render_frame(wayland::Frame& frame);
     bool is_close_requested() const { return m_close_requested; }
 
+    /// Returns the event loop, e.g. to watch other file descriptors in it.
+    wayland::EventLoop& get_event_loop() { return *m_event_loop; }
+
+    /**
+     * Returns the ids of the seats (see wl::Seat::get_id()), in the order
+     * they appeared; the first seat has id 0. Seats may come and go
+     * while the app runs (see handle_seat()).
+     */
+    std::vector<uint16_t> get_seat_ids() const;
+
+    /// Returns the input devices of the seat (e.g. to turn on motion history), or null.
+    wayland::Input* get_input(uint16_t seat_id = 0);
+
+    /**
+     * Returns the clipboard and drag and drop of the seat, or null if the
+     * compositor has none; their events come to handle_input().
+     */
+    wayland::DataDevice* get_data_device(uint16_t seat_id = 0);
+
+    /**
+     * Sets the cursor shown over the window content for all seats (over
+     * the decorations, the app shows its own); cheap enough to call on
+     * every motion.
+     */
+    void set_cursor(wayland::CursorShape shape);
+
+    /// Returns the cursor manager of the seat, or null if there is no cursor theme.
+    wayland::CursorManager* get_cursor_manager(uint16_t seat_id = 0);
+
+    /**
+     * Asks the compositor to lock the pointer over the window content (e.g.
+     * for mouse look); while locked, the pointer stays in place and only
+     * PointerRelative events tell how the mouse moves. The compositor
+     * activates the lock when it sees fit (see wp::LockedPointer); a
+     * persistent lock activates again whenever the window gets the pointer
+     * back. Replaces the previous lock or confinement (of any seat).
+     * Returns false if the compositor cannot lock the pointer or the seat
+     * has no pointer.
+     */
+    bool lock_pointer(bool persistent = true, uint16_t seat_id = 0);
+
+    /**
+     * Asks the compositor to confine the pointer to the area of the window
+     * content (null for all of it), like lock_pointer().
+     */
+    bool confine_pointer(Rect const* area = nullptr, bool persistent = true, uint16_t seat_id = 0);
+
+    /// Ends the pointer lock or confinement, if any.
+    void release_pointer();
+
+    /// Returns the pointer lock (e.g. to see if it is active), or null.
+    wp::LockedPointer* get_locked_pointer() { return m_locked_pointer.get(); }
+
+    /// Returns the pointer confinement, or null.
+    wp::ConfinedPointer* get_confined_pointer() { return m_confined_pointer.get(); }
+
+    /**
+     * Turns on or off predicting the pointer position (see MotionPredictor),
+     * which is fed with the pointer motion (of the first seat) over the window content.
+     */
+    void set_motion_prediction(bool enabled);
+
+    /// Returns the pointer motion predictor, or null if prediction is off.
+    MotionPredictor* get_motion_predictor() { return m_motion_predictor.get(); }
+
+    /**
+     * Returns where the pointer will probably be when the frame being
+     * drawn is shown, for drawing what is dragged; returns false if
+     * prediction is off or the pointer has not moved over the window yet.
+     */
+    bool predict_pointer(float& x, float& y);
+
+    /**
+     * Returns the index of the interactive areas of the window, for routing
+     * pointer and touch events (see HitIndex); the app keeps it up to date
+     * as widgets appear and move. It covers the window content.
+     */
+    HitIndex& get_hit_index() { return m_hit_index; }
+
+    /**
+     * If enabled, the input region of the window is kept equal to the area
+     * covered by the hit index (see HitIndex::input_region()), so the
+     * compositor does not send pointer and touch events for the areas where
+     * nothing reacts to them (and lets them fall through to other windows).
+     */
+    void set_input_region_from_hit_index(bool enabled);
+
+    /// Returns the client-side decorations, or null if the compositor draws them.
+    wayland::Decorations* get_decorations() { return m_decorations.get(); }
+
+    /**
+     * Creates a layer over the window content, at the given position
+     * relative to the window (see wayland::Layer). Layers are updated
+     * with each frame; the layer stays owned by the app. The format is
+     * WL_SHM_FORMAT_ARGB8888 or WL_SHM_FORMAT_XRGB8888; others throw
+     * std::logic_error.
+     */
+    wayland::Layer& create_layer(int x, int y, int width, int height,
+        uint32_t format = WL_SHM_FORMAT_ARGB8888);
+
+    /// Destroys a layer made by create_layer().
+    void destroy_layer(wayland::Layer& layer);
+
+    /// Marks the whole window as needing a repaint in the next frame.
+    void invalidate();
+
+    /// Marks the rectangle as needing a repaint in the next frame.
+    void invalidate(Rect const& rect);
+
+    /**
+     * Moves the content of the rectangle by (dx, dy) in the next frame:
+     * the pixels of the last frame are moved (in place, or copied from the
+     * last frame if the buffer is older) and only the strip the move exposes
+     * is repainted, together with anything invalidated (given in the moved
+     * coordinates). Scrolls of the same rectangle add up; scrolling another
+     * one in the same frame, or in retained mode (where moved commands
+     * differ from the previous frame anyway), repaints the rectangles.
+     */
+    void scroll(Rect const& rect, int dx, int dy);
+
+    /**
+     * Makes retained-mode frames render on the given number of threads
+     * (0 for one per CPU), split into tiles of the given size;
+     * a thread count of 1 switches back to rendering on the main thread.
+     */
+    void set_render_threads(int thread_count, int tile_size = TileRenderer::DEFAULT_TILE_SIZE);
+
+    /**
+     * Turns on or off deriving the damage from the rendered pixels
+     * (see TileHasher), for apps that redraw everything and never call
+     * invalidate(). The cost is reported in the hash.* statistics:
+     * it pays off when hash.frame_us is small compared to the time
+     * the compositor and copy-forward save on the pixels between
+     * hash.damaged_pixels and hash.changed_pixels.
+     */
+    void set_content_hashing(bool enabled, int tile_size = TileHasher::DEFAULT_TILE_SIZE);
+
     // 2nd level event handlers
+
+    /// Draws the frame directly (used unless m_retained_mode is set).
+    /// Drawing is clipped to the damaged area.
     virtual void draw(DrawingContext ctx);
+
+    /// Records the whole frame into a display list (used if m_retained_mode is set).
+    virtual void record(RecordingContext ctx);
+
+    /// Handles an input event; called for each queued event once per loop
+    /// iteration, before the frame is drawn. Events on the decorations
+    /// are handled by the app itself and do not come here.
+    virtual void handle_input(InputEvent const& event);
+
+    /// Called when a seat is added while the app runs (with its devices set up)
+    /// or removed (after its devices are gone; its queued events are dropped).
+    virtual void handle_seat(uint16_t seat_id, bool added);
 };
@@ -0,0 +1,33 @@
+#include "arena.hpp"
+
+Arena::Arena(size_t chunk_size) : m_chunk_size(chunk_size) {
+}
+
+void* Arena::allocate_slow(size_t size, size_t alignment) {
+    if (size + alignment > m_chunk_size) {
+        // too big for a chunk, gets a block of its own
+        m_oversized.emplace_back(new uint8_t[size + alignment]());
+        uintptr_t start = (uintptr_t) m_oversized.back().get();
+        start = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        m_used += size;
+        return (void*) start;
+    }
+
+    // the current chunk is full; move on to the next one,
+    // reusing a chunk from earlier frames if there is any
+    if (m_current < m_chunks.size()) {
+        m_current++;
+    }
+    if (m_current == m_chunks.size()) {
+        m_chunks.emplace_back(new uint8_t[m_chunk_size]);
+    }
+    m_offset = 0;
+    return allocate(size, alignment);
+}
+
+void Arena::reset() {
+    m_current = 0;
+    m_offset = 0;
+    m_used = 0;
+    m_oversized.clear();
+}
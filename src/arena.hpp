@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/**
+ * A simple bump allocator for short-lived data that is all thrown away
+ * at once (e.g. the commands of one frame). Memory is taken from large
+ * chunks that are kept across reset(), so in a steady state no heap
+ * allocation happens at all. Returned memory is zero-filled.
+ * Destructors of objects placed in the arena are never called.
+ */
+class Arena {
+protected:
+    std::vector<std::unique_ptr<uint8_t[]>> m_chunks;
+    std::vector<std::unique_ptr<uint8_t[]>> m_oversized;   // freed on reset()
+    size_t m_chunk_size = 0;
+    size_t m_current = 0;       // index of the chunk being filled
+    size_t m_offset = 0;        // first free byte in the current chunk
+    size_t m_used = 0;          // bytes handed out since the last reset
+
+    void* allocate_slow(size_t size, size_t alignment);
+
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 64*1024;
+
+    explicit Arena(size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+
+    /// Returns zero-filled memory of the given size and alignment
+    /// (which must be a power of two).
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        if (m_current < m_chunks.size()) {
+            // the address is aligned, not the offset: chunks are only aligned
+            // for max_align_t, and some callers want more (e.g. cache lines)
+            uintptr_t base = (uintptr_t) m_chunks[m_current].get();
+            size_t start = ((base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+            if (start + size <= m_chunk_size) {
+                uint8_t* result = m_chunks[m_current].get() + start;
+                m_offset = start + size;
+                m_used += size;
+                memset(result, 0, size);
+                return result;
+            }
+        }
+        return allocate_slow(size, alignment);
+    }
+
+    /// Forgets all allocations but keeps the memory for reuse.
+    void reset();
+
+    /// Returns the number of bytes allocated since the last reset().
+    size_t used() const { return m_used; }
+
+    /// Returns the number of bytes reserved from the heap.
+    size_t capacity() const { return m_chunks.size()*m_chunk_size; }
+};
@@ -0,0 +1,106 @@
+#include "blend.hpp"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+// (x + 128)/255 correctly rounded, in eight 16-bit lanes (x <= 255*255)
+static inline __m128i div255_epu16(__m128i x) {
+    __m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// copies the alpha lane of each of the two pixels to all four of its lanes
+static inline __m128i broadcast_alpha(__m128i x) {
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+#endif
+
+void blend_mask_argb32(uint32_t* dst, uint8_t const* coverage, int count, uint32_t color) {
+    if (color == 0) { return; }
+    bool opaque = (color >> 24) == 0xFF;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int) color), zero);
+    const __m128i solid = _mm_set1_epi32((int) color);
+
+    for (; i + 4 <= count; i += 4) {
+        uint32_t cov4;
+        memcpy(&cov4, coverage + i, 4);
+        if (cov4 == 0) { continue; }
+        if (cov4 == 0xFFFFFFFF && opaque) {
+            _mm_storeu_si128((__m128i*)(dst + i), solid);
+            continue;
+        }
+
+        // coverage of each pixel spread over its four channels, as 16-bit lanes
+        __m128i c = _mm_cvtsi32_si128((int) cov4);
+        c = _mm_unpacklo_epi8(c, c);
+        c = _mm_unpacklo_epi16(c, c);
+        __m128i c_lo = _mm_unpacklo_epi8(c, zero);
+        __m128i c_hi = _mm_unpackhi_epi8(c, zero);
+
+        // the modulated source, then dst = src + dst*(255 - src alpha)/255
+        __m128i s_lo = div255_epu16(_mm_mullo_epi16(src, c_lo));
+        __m128i s_hi = div255_epu16(_mm_mullo_epi16(src, c_hi));
+        __m128i d = _mm_loadu_si128((__m128i const*)(dst + i));
+        __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+        __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+        d_lo = _mm_mullo_epi16(d_lo, _mm_sub_epi16(c255, broadcast_alpha(s_lo)));
+        d_hi = _mm_mullo_epi16(d_hi, _mm_sub_epi16(c255, broadcast_alpha(s_hi)));
+        d_lo = _mm_add_epi16(s_lo, div255_epu16(d_lo));
+        d_hi = _mm_add_epi16(s_hi, div255_epu16(d_hi));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(d_lo, d_hi));
+    }
+#endif
+
+    // the same arithmetic one pixel at a time (tail, or no SSE2)
+    for (; i < count; ++i) {
+        uint32_t c = coverage[i];
+        if (c == 0) { continue; }
+        uint32_t src = (c == 255) ? color : scale_argb(color, c);
+        dst[i] = (src >> 24 == 0xFF) ? src : blend_over(dst[i], src);
+    }
+}
+
+void blend_argb32(uint32_t* dst, uint32_t const* src, int count) {
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i alpha_mask = _mm_set1_epi32((int) 0xFF000000);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((__m128i const*)(src + i));
+        __m128i alpha = _mm_and_si128(s, alpha_mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF) { continue; }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)(dst + i), s);
+            continue;
+        }
+
+        // dst = src + dst*(255 - src alpha)/255
+        __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+        __m128i d = _mm_loadu_si128((__m128i const*)(dst + i));
+        __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+        __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+        d_lo = _mm_mullo_epi16(d_lo, _mm_sub_epi16(c255, broadcast_alpha(s_lo)));
+        d_hi = _mm_mullo_epi16(d_hi, _mm_sub_epi16(c255, broadcast_alpha(s_hi)));
+        d_lo = _mm_add_epi16(s_lo, div255_epu16(d_lo));
+        d_hi = _mm_add_epi16(s_hi, div255_epu16(d_hi));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(d_lo, d_hi));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        uint32_t s = src[i];
+        if (s == 0) { continue; }
+        dst[i] = (s >> 24 == 0xFF) ? s : blend_over(dst[i], s);
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Compositing kernels shared by the drawing primitives.
+ * Unless stated otherwise, colors here are 0xAARRGGBB with premultiplied
+ * alpha, and blending is the usual "source over destination".
+ */
+
+/// Returns (a*b)/255 correctly rounded, for a and b in 0..255.
+inline uint32_t mul_div255(uint32_t a, uint32_t b) {
+    uint32_t t = a*b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+/// Multiplies all four channels of the color by scale/255.
+inline uint32_t scale_argb(uint32_t argb, uint32_t scale) {
+    uint32_t rb = (argb & 0x00FF00FF)*scale + 0x00800080;
+    uint32_t ag = ((argb >> 8) & 0x00FF00FF)*scale + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    return ag | rb;
+}
+
+/// Converts a straight-alpha color to premultiplied alpha.
+inline uint32_t premultiply(uint32_t argb) {
+    uint32_t a = argb >> 24;
+    if (a == 0xFF) { return argb; }
+    return (a << 24) | (scale_argb(argb, a) & 0x00FFFFFF);
+}
+
+/// Composites the source color over the destination pixel.
+inline uint32_t blend_over(uint32_t dst, uint32_t src) {
+    return src + scale_argb(dst, 255 - (src >> 24));
+}
+
+/**
+ * Composites the color, with its alpha multiplied by coverage[i]/255,
+ * over dst[i] for count pixels of a 32-bit (A/X)RGB buffer.
+ * Works on four pixels at a time with SSE2 where available; runs of zero
+ * coverage are skipped and fully covered runs of an opaque color are
+ * plain stores, so the typical glyph mask costs little more than a copy.
+ */
+void blend_mask_argb32(uint32_t* dst, uint8_t const* coverage, int count, uint32_t color);
+
+/**
+ * Composites count premultiplied pixels of src over dst[i], for a 32-bit
+ * (A/X)RGB buffer (e.g. to draw a cached image). Four pixels at a time
+ * with SSE2 where available; transparent groups are skipped and opaque
+ * groups are plain stores.
+ */
+void blend_argb32(uint32_t* dst, uint32_t const* src, int count);
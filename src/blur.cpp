@@ -0,0 +1,229 @@
+#include "blur.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const int BOX_PASSES = 3;
+
+// width of a stripe of the vertical passes, in bytes
+const int STRIPE_BYTES = 256;
+
+// rows in a band of the horizontal passes
+const int BAND_ROWS = 32;
+
+/**
+ * Finds the radii of three box blurs whose combination is closest
+ * to a Gaussian with the standard deviation sigma ("Fast Almost-Gaussian
+ * Filtering", Kovesi). Returns false if the blur would do nothing.
+ */
+bool box_radii(float radius, int radii[BOX_PASSES]) {
+    float sigma = radius*0.5f;
+    if (!(sigma >= 0.5f)) { return false; }
+    float variance = 12.0f*sigma*sigma;
+    int lower = (int) std::floor(std::sqrt(variance/BOX_PASSES + 1.0f));
+    if (lower % 2 == 0) { lower--; }
+    int m = (int) std::lround((variance - BOX_PASSES*lower*lower - 4*BOX_PASSES*lower - 3*BOX_PASSES)
+        /(-4.0f*lower - 4.0f));
+    for (int i = 0; i < BOX_PASSES; ++i) {
+        int size = (i < m) ? lower : lower + 2;
+        radii[i] = (size - 1)/2;
+    }
+    return radii[BOX_PASSES - 1] > 0;
+}
+
+/**
+ * One vertical box pass over the columns [begin, end) (in bytes) of
+ * a byte image: every byte is a channel of its own.
+ */
+void box_columns(uint8_t const* src, uint8_t* dst, int stride, int height,
+    int begin, int end, int r, BlurEdges edges)
+{
+    bool clamp = (edges == BlurEdges::Clamp);
+    auto row = [&](int y) -> uint8_t const* {
+        if (y < 0) { return clamp ? src : nullptr; }
+        if (y >= height) { return clamp ? src + (intptr_t)(height - 1)*stride : nullptr; }
+        return src + (intptr_t)y*stride;
+    };
+    float scale = 1.0f/(2*r + 1);
+    int x = begin;
+
+#if defined(__SSE2__)
+    __m128i const zero = _mm_setzero_si128();
+    __m128 const factor = _mm_set1_ps(scale);
+    auto load = [&](uint8_t const* p, int x, __m128i out[4]) {
+        __m128i v = p ? _mm_loadu_si128((__m128i const*)(p + x)) : zero;
+        __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        out[0] = _mm_unpacklo_epi16(lo, zero);
+        out[1] = _mm_unpackhi_epi16(lo, zero);
+        out[2] = _mm_unpacklo_epi16(hi, zero);
+        out[3] = _mm_unpackhi_epi16(hi, zero);
+    };
+    auto average = [&](__m128i sum) {
+        return _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), factor));
+    };
+    for (; x + 16 <= end; x += 16) {
+        __m128i sum[4] = { zero, zero, zero, zero }, in[4], out[4];
+        for (int y = -r; y <= r; ++y) {
+            load(row(y), x, in);
+            for (int k = 0; k < 4; ++k) { sum[k] = _mm_add_epi32(sum[k], in[k]); }
+        }
+        uint8_t* target = dst + x;
+        for (int y = 0; y < height; ++y, target += stride) {
+            __m128i lo = _mm_packs_epi32(average(sum[0]), average(sum[1]));
+            __m128i hi = _mm_packs_epi32(average(sum[2]), average(sum[3]));
+            _mm_storeu_si128((__m128i*) target, _mm_packus_epi16(lo, hi));
+            load(row(y + r + 1), x, in);
+            load(row(y - r), x, out);
+            for (int k = 0; k < 4; ++k) {
+                sum[k] = _mm_sub_epi32(_mm_add_epi32(sum[k], in[k]), out[k]);
+            }
+        }
+    }
+#endif
+
+    for (; x < end; ++x) {
+        auto at = [&](int y) -> uint32_t { uint8_t const* p = row(y); return p ? p[x] : 0; };
+        uint32_t sum = 0;
+        for (int y = -r; y <= r; ++y) { sum += at(y); }
+        uint8_t* target = dst + x;
+        for (int y = 0; y < height; ++y, target += stride) {
+            *target = (uint8_t) std::lround(sum*scale);
+            sum += at(y + r + 1) - at(y - r);
+        }
+    }
+}
+
+/// One horizontal box pass over a row of four-channel pixels.
+void box_row_argb32(uint32_t const* src, uint32_t* dst, int width, int r, BlurEdges edges) {
+    bool clamp = (edges == BlurEdges::Clamp);
+    uint32_t left = clamp ? src[0] : 0, right = clamp ? src[width - 1] : 0;
+    auto at = [&](int x) { return (x < 0) ? left : (x >= width) ? right : src[x]; };
+    float scale = 1.0f/(2*r + 1);
+
+#if defined(__SSE2__)
+    __m128i const zero = _mm_setzero_si128();
+    __m128 const factor = _mm_set1_ps(scale);
+    auto unpack = [&](uint32_t pixel) {
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int) pixel), zero), zero);
+    };
+    __m128i sum = zero;
+    for (int x = -r; x <= r; ++x) { sum = _mm_add_epi32(sum, unpack(at(x))); }
+    for (int x = 0; x < width; ++x) {
+        __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), factor));
+        v = _mm_packs_epi32(v, v);
+        dst[x] = (uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+        sum = _mm_sub_epi32(_mm_add_epi32(sum, unpack(at(x + r + 1))), unpack(at(x - r)));
+    }
+#else
+    uint32_t sum[4] = { 0, 0, 0, 0 };
+    auto add = [&](uint32_t pixel, int sign) {
+        for (int k = 0; k < 4; ++k) { sum[k] += sign*((pixel >> 8*k) & 0xFF); }
+    };
+    for (int x = -r; x <= r; ++x) { add(at(x), 1); }
+    for (int x = 0; x < width; ++x) {
+        uint32_t pixel = 0;
+        for (int k = 0; k < 4; ++k) { pixel |= (uint32_t) std::lround(sum[k]*scale) << 8*k; }
+        dst[x] = pixel;
+        add(at(x + r + 1), 1);
+        add(at(x - r), -1);
+    }
+#endif
+}
+
+/// One horizontal box pass over a row of an A8 image.
+void box_row_a8(uint8_t const* src, uint8_t* dst, int width, int r, BlurEdges edges) {
+    bool clamp = (edges == BlurEdges::Clamp);
+    uint32_t left = clamp ? src[0] : 0, right = clamp ? src[width - 1] : 0;
+    auto at = [&](int x) -> uint32_t { return (x < 0) ? left : (x >= width) ? right : src[x]; };
+    float scale = 1.0f/(2*r + 1);
+
+    uint32_t sum = 0;
+    for (int x = -r; x <= r; ++x) { sum += at(x); }
+    for (int x = 0; x < width; ++x) {
+        dst[x] = (uint8_t) std::lround(sum*scale);
+        sum += at(x + r + 1) - at(x - r);
+    }
+}
+
+/// Runs fn(i) for i in [0, count), on the pool if there is one.
+template<class F>
+void for_each_part(ThreadPool* pool, int count, F&& fn) {
+    if (pool && count > 1) {
+        pool->parallel_for(count, fn);
+    }
+    else {
+        for (int i = 0; i < count; ++i) { fn(i); }
+    }
+}
+
+/**
+ * The blur for both pixel types: the vertical passes go from the image
+ * to a scratch copy and back (ending in the scratch copy), then each row
+ * gets its horizontal passes in small per-thread buffers on the way back
+ * into the image.
+ */
+template<class Pixel, class RowPass>
+void blur(Pixel* pixels, int width, int height, int stride, float radius,
+    BlurEdges edges, ThreadPool* pool, RowPass row_pass)
+{
+    int radii[BOX_PASSES];
+    if (width <= 0 || height <= 0 || !box_radii(radius, radii)) { return; }
+
+    static thread_local std::vector<Pixel> scratch;
+    scratch.resize((size_t) stride*height);
+
+    Pixel* source = scratch.data();     // scratch is per thread, the workers need this one
+    auto image = reinterpret_cast<uint8_t*>(pixels);
+    auto copy = reinterpret_cast<uint8_t*>(source);
+    int row_bytes = width*(int) sizeof(Pixel), stride_bytes = stride*(int) sizeof(Pixel);
+    for_each_part(pool, (row_bytes + STRIPE_BYTES - 1)/STRIPE_BYTES, [&](int stripe) {
+        int begin = stripe*STRIPE_BYTES, end = std::min(begin + STRIPE_BYTES, row_bytes);
+        for (int pass = 0; pass < BOX_PASSES; ++pass) {
+            bool forward = (pass % 2 == 0);
+            box_columns(forward ? image : copy, forward ? copy : image, stride_bytes, height,
+                begin, end, radii[pass], edges);
+        }
+    });
+    static_assert(BOX_PASSES % 2 == 1, "the vertical passes must end in the scratch copy");
+
+    for_each_part(pool, (height + BAND_ROWS - 1)/BAND_ROWS, [&](int band) {
+        static thread_local std::vector<Pixel> buffers;
+        buffers.resize(2*(size_t) width);
+        Pixel* a = buffers.data();
+        Pixel* b = a + width;
+        int end = std::min((band + 1)*BAND_ROWS, height);
+        for (int y = band*BAND_ROWS; y < end; ++y) {
+            row_pass(source + (intptr_t)y*stride, a, width, radii[0], edges);
+            row_pass(a, b, width, radii[1], edges);
+            row_pass(b, pixels + (intptr_t)y*stride, width, radii[2], edges);
+        }
+    });
+}
+
+} // namespace
+
+void blur_argb32(uint32_t* pixels, int width, int height, int stride, float radius,
+    BlurEdges edges, ThreadPool* pool)
+{
+    blur(pixels, width, height, stride, radius, edges, pool, box_row_argb32);
+}
+
+void blur_a8(uint8_t* pixels, int width, int height, int stride, float radius,
+    BlurEdges edges, ThreadPool* pool)
+{
+    blur(pixels, width, height, stride, radius, edges, pool, box_row_a8);
+}
+
+int blur_extent(float radius) {
+    int radii[BOX_PASSES];
+    if (!box_radii(radius, radii)) { return 0; }
+    return radii[0] + radii[1] + radii[2];
+}
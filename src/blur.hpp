@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+class ThreadPool;
+
+/// What a blur sees beyond the edges of the image.
+enum class BlurEdges {
+    Transparent,    ///< zeros: the image fades out (for shadows)
+    Clamp,          ///< copies of the edge pixels (for blurring part of a picture)
+};
+
+/**
+ * Blurs an image in place, approximating a Gaussian blur with the given
+ * radius (as in CSS: the standard deviation is half of it) by three box
+ * blurs in each direction. Each box blur is a sliding window, so the cost
+ * per pixel does not depend on the radius.
+ *
+ * The pixels are premultiplied ARGB (any four 8-bit channels will do) and
+ * rows are stride pixels apart. With a thread pool, the vertical passes
+ * are split into stripes of columns and the horizontal ones into bands
+ * of rows.
+ */
+void blur_argb32(uint32_t* pixels, int width, int height, int stride, float radius,
+    BlurEdges edges, ThreadPool* pool = nullptr);
+
+/// The same for an A8 image (the stride is in bytes).
+void blur_a8(uint8_t* pixels, int width, int height, int stride, float radius,
+    BlurEdges edges, ThreadPool* pool = nullptr);
+
+/**
+ * Returns how far a blur with the given radius spreads, in pixels:
+ * a shape blurred with edges Transparent needs this much free space
+ * around it.
+ */
+int blur_extent(float radius);
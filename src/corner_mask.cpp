@@ -0,0 +1,87 @@
+#include "corner_mask.hpp"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+
+// each pixel row is sampled at this many heights; across a row, coverage is exact
+static const int SUBROWS = 16;
+
+// the number of masks in each generation of the cache
+static const size_t CACHE_GENERATION_SIZE = 128;
+
+CornerMask::CornerMask(float rx, float ry) {
+    if (rx <= 0.0f || ry <= 0.0f) { return; }
+    m_width = (int) std::ceil(rx);
+    m_height = (int) std::ceil(ry);
+    m_first.resize(m_height);
+    m_solid.resize(m_height);
+    m_offset.resize(m_height);
+
+    float insets[SUBROWS];
+    std::vector<float> sums;
+    for (int row = 0; row < m_height; ++row) {
+        // how far the edge is from the left side, at each sampled height
+        float min_inset = rx, max_inset = 0.0f;
+        for (int s = 0; s < SUBROWS; ++s) {
+            float y = row + (s + 0.5f)/SUBROWS;
+            float inset = 0.0f;
+            if (y < ry) {
+                float dy = (ry - y)/ry;
+                inset = rx*(1.0f - std::sqrt(1.0f - dy*dy));
+            }
+            insets[s] = inset;
+            min_inset = std::min(min_inset, inset);
+            max_inset = std::max(max_inset, inset);
+        }
+
+        int first = (int) std::floor(min_inset);
+        int solid = std::min(m_width, (int) std::ceil(max_inset));
+        if (solid < first) { solid = first; }
+        m_first[row] = first;
+        m_solid[row] = solid;
+        m_offset[row] = (int) m_coverage.size();
+
+        sums.assign(solid - first, 0.0f);
+        for (int s = 0; s < SUBROWS; ++s) {
+            for (int c = first; c < solid; ++c) {
+                sums[c - first] += std::clamp(c + 1 - insets[s], 0.0f, 1.0f);
+            }
+        }
+        for (float sum : sums) {
+            m_coverage.push_back((uint8_t) std::lround(sum*255.0f/SUBROWS));
+        }
+    }
+}
+
+/**
+ * The cache is kept in two generations: when the current one is full,
+ * it becomes the old one and the previous old one is freed, so a mask
+ * returned recently is never destroyed while it may still be in use.
+ */
+CornerMask const& CornerMask::get(float rx, float ry) {
+    using Cache = std::unordered_map<uint64_t, std::unique_ptr<CornerMask>>;
+    static thread_local Cache current, old;
+
+    uint32_t qx = (uint32_t) std::lround(std::clamp(rx, 0.0f, 65535.0f)*16.0f);
+    uint32_t qy = (uint32_t) std::lround(std::clamp(ry, 0.0f, 65535.0f)*16.0f);
+    uint64_t key = (uint64_t) qx << 32 | qy;
+
+    auto found = current.find(key);
+    if (found != current.end()) { return *found->second; }
+
+    std::unique_ptr<CornerMask> mask;
+    auto found_old = old.find(key);
+    if (found_old != old.end()) {
+        mask = std::move(found_old->second);
+        old.erase(found_old);
+    }
+    else {
+        mask.reset(new CornerMask(qx/16.0f, qy/16.0f));
+    }
+    if (current.size() >= CACHE_GENERATION_SIZE) {
+        old = std::move(current);
+        current.clear();
+    }
+    return *(current[key] = std::move(mask));
+}
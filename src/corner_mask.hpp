@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * The anti-aliased shape of a rounded corner: the top-left quarter of an
+ * ellipse with radii rx and ry, as the coverage of a ceil(rx) x ceil(ry)
+ * area of pixels, with the shape continuing to the right and down.
+ * Only the edge pixels of each row are stored; everything left of them is
+ * empty and everything right of them is fully covered. The other corners
+ * are mirror images, so one mask serves all four.
+ */
+class CornerMask {
+protected:
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<int> m_first;           // per row: the first pixel with any coverage
+    std::vector<int> m_solid;           // per row: the first fully covered pixel
+    std::vector<int> m_offset;          // per row: where its edge pixels are in m_coverage
+    std::vector<uint8_t> m_coverage;
+
+public:
+    CornerMask(float rx, float ry);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int first(int row) const { return m_first[row]; }
+    int solid(int row) const { return m_solid[row]; }
+
+    /// Returns the coverage of a pixel of the corner area (0 to 255);
+    /// columns past the width are fully covered.
+    uint8_t at(int row, int column) const {
+        if (column < m_first[row]) { return 0; }
+        if (column >= m_solid[row]) { return 255; }
+        return m_coverage[m_offset[row] + column - m_first[row]];
+    }
+
+    /**
+     * Returns the mask for the radii (rounded to 1/16 of a pixel) from a
+     * cache owned by the calling thread. The reference stays valid
+     * for at least the next hundred calls.
+     */
+    static CornerMask const& get(float rx, float ry);
+};
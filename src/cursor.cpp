@@ -0,0 +1,199 @@
+#include "cursor.hpp"
+#include "app.hpp"
+#include "debug.hpp"
+#include "event_loop.hpp"
+#include "stats.hpp"
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <wayland-cursor.h>
+
+namespace {
+
+/**
+ * Names to look the shapes up by, in the order of preference: the CSS names
+ * of newer themes, then the traditional X cursor font names. Null-terminated.
+ */
+const char* const CURSOR_NAMES[wayland::CURSOR_SHAPE_COUNT][4] = {
+    { "default", "left_ptr", nullptr },
+    { "text", "xterm", nullptr },
+    { "pointer", "hand2", "hand1", nullptr },
+    { "grab", "openhand", "hand1", nullptr },
+    { "grabbing", "closedhand", "fleur", nullptr },
+    { "move", "fleur", nullptr },
+    { "crosshair", "cross", nullptr },
+    { "wait", "watch", nullptr },
+    { "progress", "left_ptr_watch", nullptr },
+    { "not-allowed", "crossed_circle", nullptr },
+    { "n-resize", "top_side", nullptr },
+    { "s-resize", "bottom_side", nullptr },
+    { "w-resize", "left_side", nullptr },
+    { "e-resize", "right_side", nullptr },
+    { "nw-resize", "top_left_corner", nullptr },
+    { "ne-resize", "top_right_corner", nullptr },
+    { "sw-resize", "bottom_left_corner", nullptr },
+    { "se-resize", "bottom_right_corner", nullptr },
+    { nullptr },
+};
+
+} // namespace
+
+// wayland::CursorTheme ----------------------------------------------------
+
+wayland::CursorTheme::CursorTheme(wayland::Display& display, int size) {
+    if (size <= 0) {
+        const char* env_size = getenv("XCURSOR_SIZE");
+        size = env_size ? atoi(env_size) : 0;
+        if (size <= 0) { size = DEFAULT_SIZE; }
+    }
+
+    static auto& load_time = stats::histogram("cursor.theme_load_us");
+    {
+        stats::ScopedTimer timer(load_time);
+        m_theme = wl_cursor_theme_load(getenv("XCURSOR_THEME"), size, display.get_shm().get());
+    }
+    if (!m_theme) {
+        throw std::runtime_error("wayland::CursorTheme: wl_cursor_theme_load() failed");
+    }
+
+    // the default shape is needed right at the first entry
+    get_cursor(CursorShape::Default);
+}
+
+wayland::CursorTheme::~CursorTheme() {
+    wl_cursor_theme_destroy(m_theme);
+}
+
+/**
+ * Looks the shape up in the theme and creates the buffers of all its
+ * images, the first time the shape is used. A shape missing in the theme
+ * falls back to the default one.
+ */
+wl_cursor* wayland::CursorTheme::get_cursor(CursorShape shape) {
+    Shape& result = m_shapes[int(shape)];
+    if (result.resolved) {
+        return result.cursor;
+    }
+    result.resolved = true;
+    if (shape == CursorShape::Hidden) {
+        return nullptr;
+    }
+    for (auto name = CURSOR_NAMES[int(shape)]; *name && !result.cursor; ++name) {
+        result.cursor = wl_cursor_theme_get_cursor(m_theme, *name);
+    }
+    if (!result.cursor) {
+        if (shape == CursorShape::Default) {
+            complain("cursor theme has no default cursor");
+            return nullptr;
+        }
+        result.cursor = get_cursor(CursorShape::Default);
+        return result.cursor;
+    }
+
+    // wl_cursor_image_get_buffer() creates the buffer the first time and caches it
+    for (unsigned i = 0; i < result.cursor->image_count; ++i) {
+        if (!wl_cursor_image_get_buffer(result.cursor->images[i])) {
+            complain("wayland::CursorTheme: wl_cursor_image_get_buffer() failed");
+            result.cursor = nullptr;
+            break;
+        }
+    }
+    return result.cursor;
+}
+
+// wayland::CursorManager ---------------------------------------------------
+
+wayland::CursorManager::CursorManager(CursorTheme& theme, wayland::Display& display,
+    wayland::EventLoop& event_loop)
+    : m_theme(theme), m_event_loop(event_loop)
+{
+    m_animation_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (m_animation_fd < 0) {
+        throw std::runtime_error("wayland::CursorManager: timerfd_create() failed: " + errno_to_string());
+    }
+    m_event_loop.watch(m_animation_fd, POLLIN, [this](short revents) { handle_animation_timer(); });
+
+    m_surface = std::make_unique<wl::Surface>(display.get_compositor());
+}
+
+wayland::CursorManager::~CursorManager() {
+    m_event_loop.unwatch(m_animation_fd);
+    close(m_animation_fd);
+}
+
+void wayland::CursorManager::set_shape(CursorShape shape) {
+    if (shape == m_shape) { return; }
+    static auto& changes = stats::counter("cursor.shape_changes");
+    changes.add();
+    m_shape = shape;
+    if (m_pointer) {
+        apply();
+    }
+}
+
+void wayland::CursorManager::pointer_entered(wl_pointer* pointer, uint32_t serial) {
+    m_pointer = pointer;
+    m_serial = serial;
+    apply();
+}
+
+void wayland::CursorManager::pointer_left() {
+    m_pointer = nullptr;
+    schedule_animation(0);
+}
+
+/// Shows the current shape (from its first image) with the serial of the last entry.
+void wayland::CursorManager::apply() {
+    wl_cursor* cursor = m_theme.get_cursor(m_shape);
+    schedule_animation(0);
+    m_image = -1;
+    if (m_shape == CursorShape::Hidden) {
+        wl_pointer_set_cursor(m_pointer, m_serial, nullptr, 0, 0);
+        return;
+    }
+    if (!cursor) {
+        return;                 // nothing to show, leave whatever the compositor shows
+    }
+    m_animation_start_ns = stats::now_ns();
+    show_image(0);
+    auto image = cursor->images[0];
+    wl_pointer_set_cursor(m_pointer, m_serial, m_surface->get(), image->hotspot_x, image->hotspot_y);
+    if (cursor->image_count > 1) {
+        schedule_animation(image->delay);
+    }
+}
+
+/// Attaches the (already created) buffer of the image of the current shape.
+void wayland::CursorManager::show_image(int index) {
+    if (index == m_image) { return; }
+    auto image = m_theme.get_cursor(m_shape)->images[index];
+    wl_surface_attach(m_surface->get(), wl_cursor_image_get_buffer(image), 0, 0);
+    m_surface->damage(0, 0, image->width, image->height);
+    m_surface->commit();
+    m_image = index;
+}
+
+/// Arms the animation timer to fire after the delay (0 disarms it).
+void wayland::CursorManager::schedule_animation(uint32_t delay_ms) {
+    itimerspec spec = {};
+    spec.it_value.tv_sec = delay_ms/1000;
+    spec.it_value.tv_nsec = (delay_ms % 1000)*1000000L;
+    timerfd_settime(m_animation_fd, 0, &spec, nullptr);
+}
+
+/// Moves an animated cursor to the image for the time since it was shown.
+void wayland::CursorManager::handle_animation_timer() {
+    uint64_t expirations = 0;
+    if (read(m_animation_fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !m_pointer) {
+        return;
+    }
+    wl_cursor* cursor = m_theme.get_cursor(m_shape);
+    if (!cursor || cursor->image_count < 2) {
+        return;
+    }
+    uint32_t elapsed_ms = uint32_t((stats::now_ns() - m_animation_start_ns)/1000000);
+    uint32_t remaining_ms = 0;
+    show_image(wl_cursor_frame_and_duration(cursor, elapsed_ms, &remaining_ms));
+    schedule_animation(remaining_ms);
+}
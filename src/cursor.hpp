@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <wayland-client.h>
+
+struct wl_cursor;
+struct wl_cursor_theme;
+
+namespace wl {
+class Surface;
+}
+
+namespace wayland {
+
+class Display;
+class EventLoop;
+
+/// Pointer cursor shapes (see CursorManager::set_shape()).
+enum class CursorShape {
+    Default,
+    Text,
+    Pointer,            ///< over links and buttons
+    Grab,
+    Grabbing,
+    Move,
+    Crosshair,
+    Wait,
+    Progress,           ///< busy, but still responding
+    NotAllowed,
+    ResizeTop,
+    ResizeBottom,
+    ResizeLeft,
+    ResizeRight,
+    ResizeTopLeft,
+    ResizeTopRight,
+    ResizeBottomLeft,
+    ResizeBottomRight,
+    Hidden,
+};
+
+const int CURSOR_SHAPE_COUNT = int(CursorShape::Hidden) + 1;
+
+/**
+ * A cursor theme, loaded once (by libwayland-cursor, which puts all images
+ * of the theme into one shm pool) and shared by the cursor managers of all
+ * seats. The first time a shape is used, a buffer is created in the pool
+ * for each of its images, and the buffers are kept, so showing a shape
+ * again takes no allocation and no new memfd.
+ *
+ * The theme and size come from XCURSOR_THEME and XCURSOR_SIZE, as with
+ * other clients. It must outlive the cursor managers using it.
+ */
+class CursorTheme {
+public:
+    static const int DEFAULT_SIZE = 24;
+
+protected:
+    struct Shape {
+        wl_cursor* cursor = nullptr;    // null if the theme has none (or Hidden)
+        bool resolved = false;          // looked up and buffers created
+    };
+
+    wl_cursor_theme* m_theme = nullptr;
+    Shape m_shapes[CURSOR_SHAPE_COUNT];
+
+public:
+    /// Loads the cursor theme at the given size (0 for XCURSOR_SIZE, or DEFAULT_SIZE).
+    explicit CursorTheme(wayland::Display& display, int size = 0);
+    ~CursorTheme();
+    CursorTheme(CursorTheme const&) = delete;
+    CursorTheme& operator=(CursorTheme const&) = delete;
+
+    /**
+     * Returns the cursor of the shape, with the buffers of its images
+     * created; a shape missing in the theme falls back to the default one.
+     * Returns null for Hidden, or if the theme has no usable cursor.
+     */
+    wl_cursor* get_cursor(CursorShape shape);
+};
+
+/**
+ * Shows the pointer cursor of a seat over our surfaces, from a shared
+ * CursorTheme. The manager has only its own cursor surface; changing the
+ * shape attaches a buffer the theme already has. Animated cursors are
+ * advanced by a timerfd watched by the event loop.
+ *
+ * Input tells the manager when the pointer enters and leaves, since the
+ * cursor can only be set with the serial of the entry.
+ */
+class CursorManager {
+protected:
+    CursorTheme& m_theme;
+    wayland::EventLoop& m_event_loop;
+    std::unique_ptr<wl::Surface> m_surface;
+
+    CursorShape m_shape = CursorShape::Default;
+    wl_pointer* m_pointer = nullptr;    // null while the pointer is not over us
+    uint32_t m_serial = 0;              // of the last entry
+    int m_image = -1;                   // attached image of an animated cursor
+    uint64_t m_animation_start_ns = 0;
+    int m_animation_fd = -1;            // timerfd
+
+    void apply();
+    void show_image(int index);
+    void handle_animation_timer();
+    void schedule_animation(uint32_t delay_ms);
+
+public:
+    /// Makes a cursor surface to show the shapes of the theme with.
+    CursorManager(CursorTheme& theme, wayland::Display& display, wayland::EventLoop& event_loop);
+    ~CursorManager();
+    CursorManager(CursorManager const&) = delete;
+    CursorManager& operator=(CursorManager const&) = delete;
+
+    /**
+     * Changes the cursor shape; shown at once if the pointer is over
+     * one of our surfaces, otherwise when it enters. Setting the current
+     * shape again does nothing, so it can be called for every motion.
+     */
+    void set_shape(CursorShape shape);
+
+    CursorShape get_shape() const { return m_shape; }
+
+    /// Called by Input when the pointer enters one of our surfaces.
+    void pointer_entered(wl_pointer* pointer, uint32_t serial);
+
+    /// Called by Input when the pointer leaves (or the pointer goes away).
+    void pointer_left();
+};
+
+} // namespace wayland
@@ -0,0 +1,172 @@
+#include "damage.hpp"
+#include <cassert>
+
+// the number of temporary pieces a rectangle may be split into while adding
+static const int MAX_PIECES = 64;
+
+/**
+ * Stores the parts of rectangle p that lie outside rectangle e into out[],
+ * returning their number (0 to 4).
+ */
+static int subtract(Rect const& p, Rect const& e, Rect* out) {
+    Rect i = p.intersected(e);
+    if (i.is_empty()) {
+        out[0] = p;
+        return 1;
+    }
+    int n = 0;
+    if (i.y > p.y) { out[n++] = Rect(p.x, p.y, p.width, i.y - p.y); }
+    if (i.bottom() < p.bottom()) { out[n++] = Rect(p.x, i.bottom(), p.width, p.bottom() - i.bottom()); }
+    if (i.x > p.x) { out[n++] = Rect(p.x, i.y, i.x - p.x, i.height); }
+    if (i.right() < p.right()) { out[n++] = Rect(i.right(), i.y, p.right() - i.right(), i.height); }
+    return n;
+}
+
+/**
+ * Removes from pieces[] everything covered by the given rectangles.
+ * Returns the new number of pieces, or -1 if there were too many.
+ */
+static int subtract_all(Rect* pieces, int count, Rect const* rects, int rect_count) {
+    Rect temp[MAX_PIECES];
+    for (int r = 0; r < rect_count && count > 0; ++r) {
+        int n = 0;
+        for (int p = 0; p < count; ++p) {
+            if (n + 4 > MAX_PIECES) { return -1; }
+            n += subtract(pieces[p], rects[r], temp + n);
+        }
+        for (int p = 0; p < n; ++p) { pieces[p] = temp[p]; }
+        count = n;
+    }
+    return count;
+}
+
+// DamageRegion --------------------------------------------------------------
+
+void DamageRegion::add(Rect const& rect) {
+    if (rect.is_empty()) { return; }
+
+    // drop the rectangles that the new one swallows completely
+    int kept = 0;
+    for (int i = 0; i < m_count; ++i) {
+        if (!rect.contains(m_rects[i])) {
+            m_rects[kept++] = m_rects[i];
+        }
+    }
+    m_count = kept;
+
+    // keep only the parts of the new rectangle that are not damaged yet
+    Rect pieces[MAX_PIECES];
+    pieces[0] = rect;
+    int count = subtract_all(pieces, 1, m_rects, m_count);
+
+    if (count < 0 || m_count + count > MAX_RECTS) {
+        // too fragmented; fall back to a single bounding box
+        m_rects[0] = bounds().united(rect);
+        m_count = 1;
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        m_rects[m_count++] = pieces[i];
+    }
+}
+
+void DamageRegion::add(DamageRegion const& other) {
+    for (auto& rect : other) {
+        add(rect);
+    }
+}
+
+Rect DamageRegion::bounds() const {
+    Rect result;
+    for (int i = 0; i < m_count; ++i) {
+        result = result.united(m_rects[i]);
+    }
+    return result;
+}
+
+int64_t DamageRegion::area() const {
+    int64_t result = 0;
+    for (int i = 0; i < m_count; ++i) {
+        result += (int64_t)m_rects[i].width*m_rects[i].height;
+    }
+    return result;
+}
+
+bool DamageRegion::intersects(Rect const& rect) const {
+    for (int i = 0; i < m_count; ++i) {
+        if (m_rects[i].intersects(rect)) { return true; }
+    }
+    return false;
+}
+
+bool DamageRegion::contains(Rect const& rect) const {
+    if (rect.is_empty()) { return true; }
+    Rect pieces[MAX_PIECES];
+    pieces[0] = rect;
+    // on overflow, answer conservatively that the rectangle is not covered
+    return subtract_all(pieces, 1, m_rects, m_count) == 0;
+}
+
+void DamageRegion::clip(Rect const& rect) {
+    int kept = 0;
+    for (int i = 0; i < m_count; ++i) {
+        Rect r = m_rects[i].intersected(rect);
+        if (!r.is_empty()) {
+            m_rects[kept++] = r;
+        }
+    }
+    m_count = kept;
+}
+
+DamageRegion scroll_exposed(Rect const& rect, int dx, int dy) {
+    DamageRegion exposed;
+    Rect moved = rect.intersected(rect.translated(dx, dy));
+    if (moved.is_empty()) {
+        exposed.add(rect);
+        return exposed;
+    }
+
+    // the rows above or below the moved content, then the columns beside it
+    if (moved.y > rect.y) {
+        exposed.add(Rect(rect.x, rect.y, rect.width, moved.y - rect.y));
+    }
+    if (moved.bottom() < rect.bottom()) {
+        exposed.add(Rect(rect.x, moved.bottom(), rect.width, rect.bottom() - moved.bottom()));
+    }
+    if (moved.x > rect.x) {
+        exposed.add(Rect(rect.x, moved.y, moved.x - rect.x, moved.height));
+    }
+    if (moved.right() < rect.right()) {
+        exposed.add(Rect(moved.right(), moved.y, rect.right() - moved.right(), moved.height));
+    }
+    return exposed;
+}
+
+// DamageHistory -------------------------------------------------------------
+
+void DamageHistory::push(uint64_t serial, DamageRegion const& damage) {
+    assert(serial > m_latest);
+    int index = serial % DEPTH;
+    m_regions[index] = damage;
+    m_serials[index] = serial;
+    m_latest = serial;
+}
+
+void DamageHistory::clear() {
+    for (int i = 0; i < DEPTH; ++i) {
+        m_serials[i] = 0;
+        m_regions[i].clear();
+    }
+}
+
+bool DamageHistory::collect_since(uint64_t serial, DamageRegion& out) const {
+    if (serial == 0 || serial > m_latest || m_latest - serial > DEPTH) {
+        return false;
+    }
+    for (uint64_t s = serial + 1; s <= m_latest; ++s) {
+        int index = s % DEPTH;
+        if (m_serials[index] != s) { return false; }
+        out.add(m_regions[index]);
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include "rect.hpp"
+
+/**
+ * A set of damaged (changed) areas of a surface, stored as a small number
+ * of non-overlapping rectangles, so that each damaged pixel is repainted
+ * exactly once. When more than MAX_RECTS rectangles would be needed,
+ * the region degrades to its bounding box (never losing any damage).
+ * Has no heap-allocated data and can be freely copied.
+ */
+class DamageRegion {
+public:
+    static const int MAX_RECTS = 16;
+
+protected:
+    Rect m_rects[MAX_RECTS];
+    int m_count = 0;
+
+public:
+    DamageRegion() {}
+    explicit DamageRegion(Rect const& rect) { add(rect); }
+
+    bool is_empty() const { return m_count == 0; }
+    int count() const { return m_count; }
+    Rect const& operator[](int index) const { return m_rects[index]; }
+    Rect const* begin() const { return m_rects; }
+    Rect const* end() const { return m_rects + m_count; }
+
+    void clear() { m_count = 0; }
+
+    /// Adds the rectangle to the region.
+    void add(Rect const& rect);
+
+    /// Adds all rectangles of the other region to this one.
+    void add(DamageRegion const& other);
+
+    /// Returns the smallest rectangle containing the whole region.
+    Rect bounds() const;
+
+    /// Returns the number of pixels in the region.
+    int64_t area() const;
+
+    /// Returns true if any part of the rectangle is damaged.
+    bool intersects(Rect const& rect) const;
+
+    /// Returns true if the whole rectangle is damaged.
+    bool contains(Rect const& rect) const;
+
+    /// Discards everything outside the given rectangle.
+    void clip(Rect const& rect);
+};
+
+/**
+ * Returns the part of the rectangle that moving its content by (dx, dy)
+ * leaves without content: a strip along one or two edges (all of it
+ * if the move is not smaller than the rectangle).
+ */
+DamageRegion scroll_exposed(Rect const& rect, int dx, int dy);
+
+/**
+ * Remembers the damage of the last few rendered frames, numbered by serial.
+ * Used to find out what must be brought up to date in a reused buffer
+ * whose content is several frames old.
+ */
+class DamageHistory {
+public:
+    static const int DEPTH = 4;
+
+protected:
+    DamageRegion m_regions[DEPTH];
+    uint64_t m_serials[DEPTH] = { 0 };
+    uint64_t m_latest = 0;
+
+public:
+    /// Records the damage of the frame with the given serial number.
+    void push(uint64_t serial, DamageRegion const& damage);
+
+    /// Forgets everything (e.g. when the surface size changes).
+    void clear();
+
+    /// Returns the serial of the newest recorded frame (0 if none).
+    uint64_t latest() const { return m_latest; }
+
+    /**
+     * Collects the damage of all frames newer than the given serial into
+     * the output region. Returns false if that is not possible because
+     * the serial is unknown or too old; the caller must then assume
+     * everything is damaged.
+     */
+    bool collect_since(uint64_t serial, DamageRegion& out) const;
+};
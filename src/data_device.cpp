@@ -0,0 +1,489 @@
+// request GNU-specific definitions (splice(), memfd_create())
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "data_device.hpp"
+#include "app.hpp"
+#include "debug.hpp"
+#include "event_loop.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t COPY_BUFFER_SIZE = 64*1024;
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/// Writes all of the data at the offset of a file (which does not block).
+bool pwrite_all(int fd, char const* data, size_t size, loff_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+} // namespace
+
+// wayland::DataOffer -------------------------------------------------------
+
+wayland::DataOffer::DataOffer(wl_data_offer* offer)
+    : m_offer(offer)
+{
+    m_listener.offer = [](void* self_, wl_data_offer* offer, char const* mime_type) {
+        auto self = (wayland::DataOffer*) self_;
+        self->m_mime_types.push_back(mime_type);
+    };
+    m_listener.source_actions = [](void* self_, wl_data_offer* offer, uint32_t actions) {
+        auto self = (wayland::DataOffer*) self_;
+        self->m_source_actions = actions;
+    };
+    m_listener.action = [](void* self_, wl_data_offer* offer, uint32_t action) {
+        auto self = (wayland::DataOffer*) self_;
+        self->m_action = action;
+    };
+    wl_data_offer_add_listener(m_offer, &m_listener, this);
+}
+
+wayland::DataOffer::~DataOffer() {
+    wl_data_offer_destroy(m_offer);
+}
+
+bool wayland::DataOffer::has_mime_type(std::string const& mime_type) const {
+    return std::find(m_mime_types.begin(), m_mime_types.end(), mime_type) != m_mime_types.end();
+}
+
+// wayland::DataSource ------------------------------------------------------
+
+wayland::DataSource::DataSource(wayland::DataDevice& device, wl::DataDeviceManager& manager)
+    : m_device(device)
+{
+    m_source = wl_data_device_manager_create_data_source(manager.get());
+    if (!m_source) {
+        throw std::runtime_error("wayland::DataSource: wl_data_device_manager_create_data_source() failed");
+    }
+
+    m_listener.target = [](void* self_, wl_data_source* source, char const* mime_type) {
+    };
+    m_listener.send = [](void* self_, wl_data_source* source, char const* mime_type, int32_t fd) {
+        auto self = (wayland::DataSource*) self_;
+        self->m_device.send(*self, mime_type, fd);
+    };
+    m_listener.cancelled = [](void* self_, wl_data_source* source) {
+        auto self = (wayland::DataSource*) self_;
+        self->m_device.release_source(self);
+    };
+    m_listener.dnd_drop_performed = [](void* self_, wl_data_source* source) {
+    };
+    m_listener.dnd_finished = [](void* self_, wl_data_source* source) {
+        auto self = (wayland::DataSource*) self_;
+        self->m_device.release_source(self);
+    };
+    m_listener.action = [](void* self_, wl_data_source* source, uint32_t action) {
+        auto self = (wayland::DataSource*) self_;
+        self->m_action = action;
+    };
+    wl_data_source_add_listener(m_source, &m_listener, this);
+}
+
+wayland::DataSource::~DataSource() {
+    wl_data_source_destroy(m_source);
+    for (auto& content : m_contents) {
+        close(content.fd);
+    }
+}
+
+void wayland::DataSource::add(std::string const& mime_type, int fd, size_t size) {
+    int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own_fd < 0) {
+        throw std::runtime_error("wayland::DataSource: fcntl(F_DUPFD_CLOEXEC) failed: " + errno_to_string());
+    }
+    m_contents.push_back(Content { mime_type, own_fd, size });
+    wl_data_source_offer(m_source, mime_type.c_str());
+}
+
+void wayland::DataSource::add(std::string const& mime_type, void const* data, size_t size) {
+    int fd = memfd_create("data-source", MFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("wayland::DataSource: memfd_create() failed: " + errno_to_string());
+    }
+    if (!pwrite_all(fd, static_cast<char const*>(data), size, 0)) {
+        auto message = errno_to_string();
+        close(fd);
+        throw std::runtime_error("wayland::DataSource: write() failed: " + message);
+    }
+    m_contents.push_back(Content { mime_type, fd, size });
+    wl_data_source_offer(m_source, mime_type.c_str());
+}
+
+int wayland::DataSource::find(std::string const& mime_type, size_t& size) const {
+    for (auto& content : m_contents) {
+        if (content.mime_type == mime_type) {
+            size = content.size;
+            return content.fd;
+        }
+    }
+    return -1;
+}
+
+// wayland::DataDevice ------------------------------------------------------
+
+wayland::DataDevice::DataDevice(wl::DataDeviceManager& manager, wl::Seat& seat,
+    wayland::EventLoop& event_loop, InputRing& ring)
+    : m_manager(manager), m_event_loop(event_loop), m_ring(ring), m_seat_id(seat.get_id())
+{
+    m_device = wl_data_device_manager_get_data_device(manager.get(), seat.get());
+    if (!m_device) {
+        throw std::runtime_error("wayland::DataDevice: wl_data_device_manager_get_data_device() failed");
+    }
+
+    m_listener.data_offer = [](void* self_, wl_data_device* device, wl_data_offer* offer) {
+        auto self = (wayland::DataDevice*) self_;
+        self->m_new_offers.push_back(std::make_unique<DataOffer>(offer));
+    };
+    m_listener.enter = [](void* self_, wl_data_device* device, uint32_t serial,
+        wl_surface* surface, wl_fixed_t x, wl_fixed_t y, wl_data_offer* offer)
+    {
+        auto self = (wayland::DataDevice*) self_;
+        self->m_drag = self->take_new_offer(offer);
+        self->m_dropped = false;
+        self->m_drag_serial = serial;
+        self->m_drag_surface = surface;
+        self->m_drag_x = (float) wl_fixed_to_double(x);
+        self->m_drag_y = (float) wl_fixed_to_double(y);
+        self->push(InputEventType::DragEnter);
+    };
+    m_listener.leave = [](void* self_, wl_data_device* device) {
+        auto self = (wayland::DataDevice*) self_;
+        // after a drop, the offer stays until the data is received
+        if (!self->m_dropped) {
+            self->m_drag.reset();
+        }
+        self->push(InputEventType::DragLeave);
+        self->m_drag_surface = nullptr;
+    };
+    m_listener.motion = [](void* self_, wl_data_device* device, uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+        auto self = (wayland::DataDevice*) self_;
+        self->m_drag_x = (float) wl_fixed_to_double(x);
+        self->m_drag_y = (float) wl_fixed_to_double(y);
+        self->push(InputEventType::DragMotion, time);
+    };
+    m_listener.drop = [](void* self_, wl_data_device* device) {
+        auto self = (wayland::DataDevice*) self_;
+        self->m_dropped = true;
+        self->push(InputEventType::Drop);
+    };
+    m_listener.selection = [](void* self_, wl_data_device* device, wl_data_offer* offer) {
+        auto self = (wayland::DataDevice*) self_;
+        self->m_selection = self->take_new_offer(offer);
+        self->push(InputEventType::Selection);
+    };
+    wl_data_device_add_listener(m_device, &m_listener, this);
+
+    m_copy_buffer.reset(new char[COPY_BUFFER_SIZE]);
+}
+
+wayland::DataDevice::~DataDevice() {
+    while (!m_transfers.empty()) {
+        finish(m_transfers.back().get(), false);
+    }
+    m_selection_source.reset();
+    m_drag_source.reset();
+    m_selection.reset();
+    m_drag.reset();
+    m_new_offers.clear();
+    if (wl_data_device_get_version(m_device) >= WL_DATA_DEVICE_RELEASE_SINCE_VERSION) {
+        wl_data_device_release(m_device);
+    }
+    else {
+        wl_data_device_destroy(m_device);
+    }
+}
+
+/// Takes the announced offer out of the new ones (null stays null).
+std::unique_ptr<wayland::DataOffer> wayland::DataDevice::take_new_offer(wl_data_offer* offer) {
+    std::unique_ptr<DataOffer> result;
+    for (auto it = m_new_offers.begin(); it != m_new_offers.end(); ++it) {
+        if ((*it)->get() == offer) {
+            result = std::move(*it);
+            m_new_offers.erase(it);
+            break;
+        }
+    }
+    return result;
+}
+
+void wayland::DataDevice::push(InputEventType type, uint32_t time) {
+    static stats::Counter& dropped = stats::counter("input.dropped");
+    InputEvent event;
+    event.type = type;
+    event.seat = m_seat_id;
+    event.time = time;
+    event.received_ns = stats::now_ns();
+    event.surface = m_drag_surface;
+    event.serial = m_drag_serial;
+    event.x = m_drag_x;
+    event.y = m_drag_y;
+    if (type == InputEventType::Selection) {
+        event.surface = nullptr;
+        event.serial = 0;
+    }
+    if (!m_ring.push(event)) {
+        dropped.add();
+    }
+}
+
+void wayland::DataDevice::receive_selection(std::string const& mime_type, TransferDone done) {
+    if (!m_selection) {
+        if (done) { done(false, -1, 0); }
+        return;
+    }
+    receive(*m_selection, mime_type, std::move(done));
+}
+
+void wayland::DataDevice::accept_drag(std::string const& mime_type, uint32_t actions, uint32_t preferred_action) {
+    if (!m_drag || m_dropped) { return; }
+    wl_data_offer_accept(m_drag->get(), m_drag_serial, mime_type.empty() ? nullptr : mime_type.c_str());
+    if (wl_data_offer_get_version(m_drag->get()) >= WL_DATA_OFFER_SET_ACTIONS_SINCE_VERSION) {
+        wl_data_offer_set_actions(m_drag->get(), actions, preferred_action);
+    }
+}
+
+void wayland::DataDevice::receive_drop(std::string const& mime_type, TransferDone done) {
+    if (!m_drag || !m_dropped) {
+        if (done) { done(false, -1, 0); }
+        return;
+    }
+
+    // the drag ends when the data is in; the offer goes with it
+    std::shared_ptr<DataOffer> offer(std::move(m_drag));
+    m_dropped = false;
+    receive(*offer, mime_type, [offer, done](bool ok, int fd, size_t size) {
+        if (wl_data_offer_get_version(offer->get()) >= WL_DATA_OFFER_FINISH_SINCE_VERSION
+            && offer->get_action() != WL_DATA_DEVICE_MANAGER_DND_ACTION_ASK)
+        {
+            wl_data_offer_finish(offer->get());
+        }
+        if (done) { done(ok, fd, size); }
+    });
+}
+
+/// Asks the offering client to write the data into a pipe, which we splice into a memfd.
+void wayland::DataDevice::receive(DataOffer& offer, std::string const& mime_type, TransferDone done) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC|O_NONBLOCK) != 0) {
+        complain("wayland::DataDevice: pipe2() failed: " + errno_to_string());
+        if (done) { done(false, -1, 0); }
+        return;
+    }
+    int memfd = memfd_create("data-offer", MFD_CLOEXEC);
+    if (memfd < 0) {
+        complain("wayland::DataDevice: memfd_create() failed: " + errno_to_string());
+        close(fds[0]);
+        close(fds[1]);
+        if (done) { done(false, -1, 0); }
+        return;
+    }
+
+    // the request carries a copy of the write end, we no longer need ours
+    wl_data_offer_receive(offer.get(), mime_type.c_str(), fds[1]);
+    close(fds[1]);
+
+    auto transfer = std::make_unique<Transfer>();
+    transfer->from = fds[0];
+    transfer->to = memfd;
+    transfer->done = std::move(done);
+    start(std::move(transfer));
+}
+
+std::unique_ptr<wayland::DataSource> wayland::DataDevice::create_source() {
+    return std::make_unique<DataSource>(*this, m_manager);
+}
+
+void wayland::DataDevice::set_selection(std::unique_ptr<DataSource> source, uint32_t serial) {
+    wl_data_device_set_selection(m_device, source ? source->get() : nullptr, serial);
+    m_selection_source = std::move(source);
+}
+
+void wayland::DataDevice::start_drag(std::unique_ptr<DataSource> source, wl::Surface& origin,
+    uint32_t serial, uint32_t actions)
+{
+    assert(source);
+    if (wl_data_source_get_version(source->get()) >= WL_DATA_SOURCE_SET_ACTIONS_SINCE_VERSION) {
+        wl_data_source_set_actions(source->get(), actions);
+    }
+    wl_data_device_start_drag(m_device, source->get(), origin.get(), nullptr, serial);
+    m_drag_source = std::move(source);
+}
+
+void wayland::DataDevice::send(DataSource& source, char const* mime_type, int fd) {
+    size_t size = 0;
+    int content_fd = source.find(mime_type, size);
+    int own_fd = content_fd >= 0 ? fcntl(content_fd, F_DUPFD_CLOEXEC, 0) : -1;
+    if (own_fd < 0) {
+        // not offered (or out of descriptors); closing the pipe gives the reader nothing
+        close(fd);
+        return;
+    }
+    set_nonblocking(fd);
+
+    auto transfer = std::make_unique<Transfer>();
+    transfer->sending = true;
+    transfer->from = own_fd;
+    transfer->to = fd;
+    transfer->size = size;
+    start(std::move(transfer));
+}
+
+void wayland::DataDevice::release_source(DataSource* source) {
+    // transfers in progress have their own descriptors and go on
+    if (m_selection_source.get() == source) {
+        m_selection_source.reset();
+    }
+    else if (m_drag_source.get() == source) {
+        m_drag_source.reset();
+    }
+}
+
+/// Makes the transfer continue whenever its pipe is ready.
+void wayland::DataDevice::start(std::unique_ptr<Transfer> transfer) {
+    Transfer* raw = transfer.get();
+    raw->start_ns = stats::now_ns();
+    m_transfers.push_back(std::move(transfer));
+    int pipe_fd = raw->sending ? raw->to : raw->from;
+    m_event_loop.watch(pipe_fd, raw->sending ? POLLOUT : POLLIN, [this, raw](short revents) { pump(raw); });
+}
+
+/**
+ * Moves up to count bytes from the file to the pipe, or from the pipe to the
+ * file, at the offset of the transfer. Returns the number of bytes moved,
+ * 0 at the end of the pipe, or -1 with errno (EAGAIN when the pipe is not ready).
+ */
+ssize_t wayland::DataDevice::move(Transfer& transfer, size_t count) {
+    static auto& fallbacks = stats::counter("data.copy_fallbacks");
+    if (transfer.splicing) {
+        ssize_t moved = transfer.sending
+            ? splice(transfer.from, &transfer.offset, transfer.to, nullptr, count, SPLICE_F_MOVE|SPLICE_F_NONBLOCK)
+            : splice(transfer.from, nullptr, transfer.to, &transfer.offset, count, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (moved >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return moved;
+        }
+        transfer.splicing = false;
+        fallbacks.add();
+    }
+
+    count = std::min(count, COPY_BUFFER_SIZE);
+    char* buffer = m_copy_buffer.get();
+    if (transfer.sending) {
+        // sendfile() reads the file in the kernel too; then a plain copy
+        ssize_t moved = sendfile(transfer.to, transfer.from, &transfer.offset, count);
+        if (moved >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return moved;
+        }
+        ssize_t got = pread(transfer.from, buffer, count, transfer.offset);
+        if (got <= 0) {
+            return got;
+        }
+        moved = write(transfer.to, buffer, got);
+        if (moved > 0) {
+            transfer.offset += moved;
+        }
+        return moved;
+    }
+    ssize_t got = read(transfer.from, buffer, count);
+    if (got <= 0) {
+        return got;
+    }
+    if (!pwrite_all(transfer.to, buffer, got, transfer.offset)) {
+        return -1;
+    }
+    transfer.offset += got;
+    return got;
+}
+
+/// Moves what the pipe takes (or has) now; called by the event loop.
+void wayland::DataDevice::pump(Transfer* transfer) {
+    size_t moved_now = 0;
+    while (moved_now < MAX_BYTES_PER_WAKEUP) {
+        size_t count = MAX_BYTES_PER_WAKEUP - moved_now;
+        if (transfer->sending) {
+            size_t left = transfer->size - size_t(transfer->offset);
+            if (left == 0) {
+                finish(transfer, true);
+                return;
+            }
+            count = std::min(count, left);
+        }
+        ssize_t moved = move(*transfer, count);
+        if (moved > 0) {
+            moved_now += moved;
+            continue;
+        }
+        if (moved == 0) {
+            // the end of the pipe, or the file ended before its size
+            finish(transfer, !transfer->sending);
+            return;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            finish(transfer, false);
+        }
+        return;
+    }
+}
+
+void wayland::DataDevice::finish(Transfer* transfer, bool ok) {
+    static auto& transfer_time = stats::histogram("data.transfer_us");
+    static auto& sent = stats::counter("data.sent_bytes");
+    static auto& received = stats::counter("data.received_bytes");
+    static auto& failed = stats::counter("data.failed_transfers");
+
+    auto it = std::find_if(m_transfers.begin(), m_transfers.end(),
+        [transfer](auto const& candidate) { return candidate.get() == transfer; });
+    assert(it != m_transfers.end());
+    std::unique_ptr<Transfer> owned = std::move(*it);
+    m_transfers.erase(it);
+
+    int pipe_fd = transfer->sending ? transfer->to : transfer->from;
+    m_event_loop.unwatch(pipe_fd);
+    close(pipe_fd);
+
+    size_t size = size_t(transfer->offset);
+    transfer_time.add((stats::now_ns() - transfer->start_ns)/1000);
+    (transfer->sending ? sent : received).add(size);
+    if (!ok) { failed.add(); }
+
+    int result_fd = -1;
+    if (transfer->sending) {
+        close(transfer->from);
+    }
+    else if (ok) {
+        result_fd = transfer->to;
+    }
+    else {
+        close(transfer->to);
+    }
+    if (transfer->done) {
+        transfer->done(ok, result_fd, size);
+    }
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <wayland-client.h>
+#include "input.hpp"
+
+namespace wl {
+class DataDeviceManager;
+class Seat;
+class Surface;
+}
+
+namespace wayland {
+
+class DataDevice;
+class EventLoop;
+
+/**
+ * Called when a transfer ends. For received data, fd is a memfd holding
+ * the data (owned by the callee from now on), or -1 if the transfer failed;
+ * for sent data, fd is always -1. The size is what was transferred.
+ */
+using TransferDone = std::function<void(bool ok, int fd, size_t size)>;
+
+/**
+ * Data offered by another client (or by us), as the clipboard content
+ * or by a drag: a list of MIME types it can be received as.
+ */
+class DataOffer {
+protected:
+    wl_data_offer* m_offer = nullptr;
+    wl_data_offer_listener m_listener = { 0 };
+    std::vector<std::string> m_mime_types;
+    uint32_t m_source_actions = 0;      // WL_DATA_DEVICE_MANAGER_DND_ACTION_*
+    uint32_t m_action = 0;              // chosen by the compositor
+
+public:
+    explicit DataOffer(wl_data_offer* offer);
+    ~DataOffer();
+    DataOffer(DataOffer const&) = delete;
+    DataOffer& operator=(DataOffer const&) = delete;
+
+    wl_data_offer* get() { return m_offer; }
+    std::vector<std::string> const& get_mime_types() const { return m_mime_types; }
+    bool has_mime_type(std::string const& mime_type) const;
+    uint32_t get_source_actions() const { return m_source_actions; }
+    uint32_t get_action() const { return m_action; }
+};
+
+/**
+ * Data we offer, as the clipboard content or by a drag. Each MIME type
+ * is backed by a file descriptor (a file, or a memfd the data is copied
+ * into once), which is spliced to whoever asks for it, so serving even
+ * a large payload does not go through our memory. Made by
+ * DataDevice::create_source().
+ */
+class DataSource {
+protected:
+    struct Content {
+        std::string mime_type;
+        int fd = -1;
+        size_t size = 0;
+    };
+
+    DataDevice& m_device;
+    wl_data_source* m_source = nullptr;
+    wl_data_source_listener m_listener = { 0 };
+    std::vector<Content> m_contents;
+    uint32_t m_action = 0;              // of a drag, chosen by the compositor
+
+public:
+    DataSource(DataDevice& device, wl::DataDeviceManager& manager);
+    ~DataSource();
+    DataSource(DataSource const&) = delete;
+    DataSource& operator=(DataSource const&) = delete;
+
+    wl_data_source* get() { return m_source; }
+
+    /**
+     * Offers the content of the file (from its start) as the MIME type.
+     * The descriptor is duplicated, the caller keeps the original;
+     * the file must not shrink while the source exists.
+     */
+    void add(std::string const& mime_type, int fd, size_t size);
+
+    /// Offers a copy of the data as the MIME type (copied into a memfd now).
+    void add(std::string const& mime_type, void const* data, size_t size);
+
+    /// Returns the action of a drag, once the compositor chose it.
+    uint32_t get_action() const { return m_action; }
+
+    /// Returns the descriptor and size of the content of the MIME type, or -1.
+    int find(std::string const& mime_type, size_t& size) const;
+};
+
+/**
+ * The clipboard and drag and drop of a seat (wl_data_device). Changes of
+ * the clipboard and drags over our surfaces come as InputEvents through
+ * the ring (Selection, DragEnter, DragMotion, DragLeave, Drop); the offered
+ * data is then received with receive_selection() or receive_drop().
+ *
+ * Data goes through the pipes the protocol hands over, moved by splice()
+ * between the pipe and a file or memfd, so it is not copied through user
+ * space (a read/write copy is the fallback where splice() is refused).
+ * Transfers never block: the pipes are non-blocking and each transfer
+ * continues from the event loop whenever its pipe is ready, moving at
+ * most MAX_BYTES_PER_WAKEUP at a time, so a paste of many megabytes
+ * does not hold up the frames.
+ *
+ * A reader closing its end of a pipe early raises SIGPIPE on our write;
+ * the process must ignore SIGPIPE (WaylandApp does) so that the write
+ * fails with EPIPE instead of killing the app.
+ */
+class DataDevice {
+public:
+    /// A transfer moves at most this many bytes before letting the event loop go on.
+    static const size_t MAX_BYTES_PER_WAKEUP = 1 << 20;
+
+protected:
+    struct Transfer {
+        bool sending = false;
+        bool splicing = true;           // false once splice() was refused
+        int from = -1;                  // sending: the file; receiving: the pipe
+        int to = -1;                    // sending: the pipe; receiving: the memfd
+        loff_t offset = 0;              // in the file
+        size_t size = 0;                // sending: of the content
+        uint64_t start_ns = 0;
+        TransferDone done;
+    };
+
+    wl::DataDeviceManager& m_manager;
+    wayland::EventLoop& m_event_loop;
+    InputRing& m_ring;
+    uint16_t m_seat_id = 0;
+    wl_data_device* m_device = nullptr;
+    wl_data_device_listener m_listener = { 0 };
+
+    std::vector<std::unique_ptr<DataOffer>> m_new_offers;   // announced, not yet used
+    std::unique_ptr<DataOffer> m_selection;
+    std::unique_ptr<DataOffer> m_drag;
+    uint32_t m_drag_serial = 0;
+    wl_surface* m_drag_surface = nullptr;
+    float m_drag_x = 0.0f;
+    float m_drag_y = 0.0f;
+    bool m_dropped = false;
+
+    std::unique_ptr<DataSource> m_selection_source;
+    std::unique_ptr<DataSource> m_drag_source;
+
+    std::vector<std::unique_ptr<Transfer>> m_transfers;
+    std::unique_ptr<char[]> m_copy_buffer;      // for the fallback copy
+
+    std::unique_ptr<DataOffer> take_new_offer(wl_data_offer* offer);
+    void push(InputEventType type, uint32_t time = 0);
+    void receive(DataOffer& offer, std::string const& mime_type, TransferDone done);
+    void start(std::unique_ptr<Transfer> transfer);
+    void pump(Transfer* transfer);
+    ssize_t move(Transfer& transfer, size_t count);
+    void finish(Transfer* transfer, bool ok);
+
+public:
+    DataDevice(wl::DataDeviceManager& manager, wl::Seat& seat,
+        wayland::EventLoop& event_loop, InputRing& ring);
+    ~DataDevice();
+    DataDevice(DataDevice const&) = delete;
+    DataDevice& operator=(DataDevice const&) = delete;
+
+    /**
+     * Returns the current clipboard content, or null if it is empty. When
+     * we set the clipboard, the compositor offers our own source here too
+     * (receiving it goes through a pipe back to us); see owns_selection().
+     */
+    DataOffer* get_selection() { return m_selection.get(); }
+
+    /// Returns true if the clipboard holds our source (until another client takes it).
+    bool owns_selection() const { return !!m_selection_source; }
+
+    /**
+     * Receives the clipboard content as the MIME type (one of those offered)
+     * into a memfd; the callback gets it when all has arrived.
+     */
+    void receive_selection(std::string const& mime_type, TransferDone done);
+
+    /// Returns the offer of the drag over (or dropped on) our surface, or null.
+    DataOffer* get_drag() { return m_drag.get(); }
+
+    /**
+     * Tells the compositor which MIME type (empty for none) and actions
+     * we would take if the drag were dropped now; call on DragEnter
+     * and, as the target under the pointer changes, on DragMotion.
+     */
+    void accept_drag(std::string const& mime_type,
+        uint32_t actions = WL_DATA_DEVICE_MANAGER_DND_ACTION_COPY,
+        uint32_t preferred_action = WL_DATA_DEVICE_MANAGER_DND_ACTION_COPY);
+
+    /// Receives the dropped data as the MIME type, then ends the drag.
+    void receive_drop(std::string const& mime_type, TransferDone done);
+
+    /// Makes a source to fill with content for set_selection() or start_drag().
+    std::unique_ptr<DataSource> create_source();
+
+    /**
+     * Puts the source into the clipboard (null clears it). The serial is of
+     * the input event that caused it (e.g. a key press); the compositor
+     * ignores requests without a recent one.
+     */
+    void set_selection(std::unique_ptr<DataSource> source, uint32_t serial);
+
+    /**
+     * Starts dragging the source from the surface, as a response to a button
+     * press or touch down with the serial; actions are the ones allowed.
+     */
+    void start_drag(std::unique_ptr<DataSource> source, wl::Surface& origin,
+        uint32_t serial, uint32_t actions = WL_DATA_DEVICE_MANAGER_DND_ACTION_COPY);
+
+    /// Serves a request for the source's content (called by the source).
+    void send(DataSource& source, char const* mime_type, int fd);
+
+    /// Forgets a source the compositor no longer uses (called by the source).
+    void release_source(DataSource* source);
+};
+
+} // namespace wayland
@@ -0,0 +1,249 @@
+#include "decorations.hpp"
+#include "draw.hpp"
+#include "path.hpp"
+#include "stats.hpp"
+#include "truetype.hpp"
+#include <algorithm>
+
+namespace {
+
+// colors of the unfocused and the focused window (indexed by the focus)
+const uint32_t TITLE_COLOR[2] = { 0xFFEBEBEB, 0xFFD6D6D6 };
+const uint32_t BORDER_COLOR[2] = { 0xFFC0C0C0, 0xFFB0B0B0 };
+const uint32_t TEXT_COLOR[2] = { 0xFF909090, 0xFF2E2E2E };
+const uint32_t SHADOW_COLOR[2] = { 0x28000000, 0x50000000 };
+const uint32_t CLOSE_COLOR[2] = { 0xFFC8C8C8, 0xFFE0524C };
+const uint32_t BUTTON_COLOR[2] = { 0xFFC8C8C8, 0xFFC8C8C8 };
+const uint32_t SYMBOL_COLOR = 0xFF404040;
+
+/// The button rectangles within a title bar of the given width (close is the rightmost).
+Rect button_rect(int index, int title_width) {
+    int size = wayland::Decorations::BUTTON_SIZE, spacing = wayland::Decorations::BUTTON_SPACING;
+    int x = title_width - (index + 1)*(size + spacing);
+    return Rect(x, (wayland::Decorations::TITLE_BAR_HEIGHT - size)/2, size, size);
+}
+
+} // namespace
+
+wayland::Decorations::Decorations(wayland::Display& display, wl::Surface& parent)
+    : m_display(display)
+{
+    m_surface = std::make_unique<wl::Surface>(display.get_compositor());
+    m_subsurface = std::make_unique<wl::Subsurface>(display.get_subcompositor(), *m_surface, parent);
+    m_subsurface->place_below(parent);
+}
+
+Rect wayland::Decorations::frame_rect(int width, int height) {
+    return Rect(-BORDER_WIDTH, -(TITLE_BAR_HEIGHT + BORDER_WIDTH),
+        width + 2*BORDER_WIDTH, height + TITLE_BAR_HEIGHT + 2*BORDER_WIDTH);
+}
+
+Rect wayland::Decorations::surface_rect(int width, int height) const {
+    Rect frame = frame_rect(width, height);
+    int m = margin();
+    return Rect(frame.x - m, frame.y - m, frame.width + 2*m, frame.height + 2*m);
+}
+
+/// Returns how far the decoration surface extends beyond the frame (for the shadow).
+int wayland::Decorations::margin() const {
+    return std::max(blur_extent(SHADOW_RADIUS) + SHADOW_OFFSET, RESIZE_MARGIN);
+}
+
+bool wayland::Decorations::update(int width, int height, bool focused, int scale) {
+    static stats::Counter& reuses = stats::counter("csd.reuses");
+    scale = std::max(scale, 1);
+
+    auto matches = [&](Entry const& entry) {
+        return entry.width == width && entry.height == height && entry.focused == focused
+            && entry.scale == scale && entry.title_serial == m_title_serial;
+    };
+    if (m_attached && matches(*m_attached)) {
+        return false;
+    }
+
+    // a cached image may still be held by the compositor if it was shown
+    // only recently; then it cannot be attached again and is rendered anew
+    auto entry = std::find_if(m_entries.begin(), m_entries.end(), [&](Entry const& entry) {
+        return matches(entry) && !entry.frame->is_busy();
+    });
+    if (entry != m_entries.end()) {
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+        reuses.add();
+    }
+    else {
+        m_entries.emplace_front();
+        entry = m_entries.begin();
+        entry->width = width;
+        entry->height = height;
+        entry->focused = focused;
+        entry->scale = scale;
+        entry->title_serial = m_title_serial;
+        render(*entry);
+    }
+
+    Rect frame = frame_rect(width, height);
+    int m = margin();
+    m_surface->set_buffer_scale(scale);
+    entry->frame->attach(*m_surface);
+    m_surface->damage(0, 0, entry->frame->get_width(), entry->frame->get_height());
+    m_subsurface->set_position(frame.x - m, frame.y - m);
+    update_input_region(width, height);
+    m_surface->commit();
+    m_attached = &*entry;
+
+    // the shadows are only drawn into the images, so older ones can go now
+    m_shadows.next_frame();
+
+    // drop the least recently used images, except those still held by the compositor
+    size_t kept = 0;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+        if (++kept > CACHE_SIZE && &*it != m_attached && !it->frame->is_busy()) {
+            it = m_entries.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    return true;
+}
+
+/**
+ * Limits the input of the decoration surface to the frame and the resize
+ * margin around it, so clicks on the rest of the shadow fall through to
+ * what is below the window. Applied with the next commit.
+ */
+void wayland::Decorations::update_input_region(int width, int height) {
+    if (width == m_input_width && height == m_input_height) { return; }
+    Rect frame = frame_rect(width, height);
+    int m = margin();
+    wl::Region region(m_display.get_compositor());
+    region.add(m - RESIZE_MARGIN, m - RESIZE_MARGIN,
+        frame.width + 2*RESIZE_MARGIN, frame.height + 2*RESIZE_MARGIN);
+    m_surface->set_input_region(region);
+    m_input_width = width;
+    m_input_height = height;
+}
+
+/**
+ * Draws the decorations for the entry's size and state into a new frame.
+ * Everything is drawn in buffer pixels, i.e. all sizes are multiplied
+ * by the scale.
+ */
+void wayland::Decorations::render(Entry& entry) {
+    static stats::Counter& renders = stats::counter("csd.renders");
+    static stats::Histogram& render_time = stats::histogram("csd.render_us");
+    stats::ScopedTimer timer(render_time);
+    renders.add();
+
+    int s = entry.scale, f = entry.focused ? 1 : 0;
+    int m = margin();
+    Rect frame = frame_rect(entry.width, entry.height);
+    entry.frame = std::make_unique<Frame>(m_display,
+        (frame.width + 2*m)*s, (frame.height + 2*m)*s, WL_SHM_FORMAT_ARGB8888);
+
+    BasicDrawingContext<ARGB8888Traits> ctx((uint32_t*) entry.frame->get_memory(),
+        entry.frame->get_width(), entry.frame->get_height(), entry.frame->get_stride()/4);
+    ctx.fill_rect(0, 0, ctx.width(), ctx.height(), 0x00000000);
+
+    // the frame in buffer pixels
+    int x = m*s, y = m*s, w = frame.width*s, h = frame.height*s;
+    int r = CORNER_RADIUS*s, b = BORDER_WIDTH*s, t = TITLE_BAR_HEIGHT*s;
+
+    draw_shadow(ctx, m_shadows, x, y + SHADOW_OFFSET*s, w, h, r, SHADOW_RADIUS*s, SHADOW_COLOR[f]);
+
+    // the border, then the title bar inside it; both have only the top corners rounded
+    ctx.fill_rounded_rect(x, y, w, 2*r, r, BORDER_COLOR[f]);
+    ctx.fill_rect(x, y + r, w, h - r, BORDER_COLOR[f]);
+    ctx.fill_rounded_rect(x + b, y + b, w - 2*b, 2*(r - b), r - b, TITLE_COLOR[f]);
+    ctx.fill_rect(x + b, y + r, w - 2*b, t + b - r, TITLE_COLOR[f]);
+
+    // the buttons: close, maximize, minimize from the right
+    auto title = ctx.subview(x + b, y + b, w - 2*b, t);
+    for (int i = 0; i < 3; ++i) {
+        Rect button = button_rect(i, entry.width);
+        int bx = button.x*s, by = button.y*s, bs = button.width*s;
+        title.fill_circle(bx + bs/2, by + bs/2, bs/2, i == 0 ? CLOSE_COLOR[f] : BUTTON_COLOR[f]);
+
+        int inset = bs/4, thickness = std::max(s, 1);
+        if (i == 0) {
+            // a cross of two thin quads
+            float x0 = bx + inset, y0 = by + inset, x1 = bx + bs - inset, y1 = by + bs - inset;
+            float d = thickness*0.7071f;
+            Path cross;
+            cross.move_to(x0 - d, y0 + d);
+            cross.line_to(x0 + d, y0 - d);
+            cross.line_to(x1 + d, y1 - d);
+            cross.line_to(x1 - d, y1 + d);
+            cross.move_to(x1 - d, y0 - d);
+            cross.line_to(x1 + d, y0 + d);
+            cross.line_to(x0 + d, y1 + d);
+            cross.line_to(x0 - d, y1 - d);
+            title.fill_path(cross, SYMBOL_COLOR);
+        }
+        else if (i == 1) {
+            title.stroke_rounded_rect(bx + inset, by + inset, bs - 2*inset, bs - 2*inset,
+                s, thickness, SYMBOL_COLOR);
+        }
+        else {
+            title.fill_rect(bx + inset, by + bs/2 - thickness/2, bs - 2*inset, thickness, SYMBOL_COLOR);
+        }
+    }
+
+    if (m_font && !m_title.empty()) {
+        float size = m_font_size*s;
+        int text_width = m_font->layout(size, m_title).width;
+        int text_height = (int) m_font->line_height(size);
+        draw_text(title, *m_font, size, (title.width() - text_width)/2, (t - text_height)/2,
+            m_title, TEXT_COLOR[f]);
+    }
+}
+
+void wayland::Decorations::set_title(std::string const& title) {
+    if (title == m_title) { return; }
+    m_title = title;
+    m_title_serial++;
+}
+
+void wayland::Decorations::set_font(TrueTypeFont* font, float size) {
+    m_font = font;
+    m_font_size = size;
+    m_title_serial++;
+}
+
+wayland::DecorationPart wayland::Decorations::hit_test(int x, int y, int width, int height) {
+    Rect frame = frame_rect(width, height);
+    Rect outer(frame.x - RESIZE_MARGIN, frame.y - RESIZE_MARGIN,
+        frame.width + 2*RESIZE_MARGIN, frame.height + 2*RESIZE_MARGIN);
+    if (!outer.contains(x, y)) {
+        return DecorationPart::None;
+    }
+    if (Rect(0, 0, width, height).contains(x, y)) {
+        return DecorationPart::Content;
+    }
+
+    // near the edges of the frame (the corners take a whole corner radius)
+    int corner = std::max(CORNER_RADIUS, RESIZE_MARGIN);
+    bool left = x < frame.x + BORDER_WIDTH, right = x >= frame.right() - BORDER_WIDTH;
+    bool top = y < frame.y + BORDER_WIDTH, bottom = y >= frame.bottom() - BORDER_WIDTH;
+    bool near_left = x < frame.x + corner, near_right = x >= frame.right() - corner;
+    bool near_top = y < frame.y + corner, near_bottom = y >= frame.bottom() - corner;
+    if ((top && near_left) || (left && near_top)) { return DecorationPart::ResizeTopLeft; }
+    if ((top && near_right) || (right && near_top)) { return DecorationPart::ResizeTopRight; }
+    if ((bottom && near_left) || (left && near_bottom)) { return DecorationPart::ResizeBottomLeft; }
+    if ((bottom && near_right) || (right && near_bottom)) { return DecorationPart::ResizeBottomRight; }
+    if (top) { return DecorationPart::ResizeTop; }
+    if (bottom) { return DecorationPart::ResizeBottom; }
+    if (left) { return DecorationPart::ResizeLeft; }
+    if (right) { return DecorationPart::ResizeRight; }
+
+    // the title bar
+    static const DecorationPart buttons[3] = {
+        DecorationPart::CloseButton, DecorationPart::MaximizeButton, DecorationPart::MinimizeButton
+    };
+    for (int i = 0; i < 3; ++i) {
+        if (button_rect(i, width).contains(x, y + TITLE_BAR_HEIGHT)) {
+            return buttons[i];
+        }
+    }
+    return DecorationPart::TitleBar;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include "app.hpp"
+#include "rect.hpp"
+#include "shadow.hpp"
+
+class TrueTypeFont;
+
+namespace wayland {
+
+/// Parts of a window with client-side decorations (see Decorations::hit_test()).
+enum class DecorationPart {
+    None,               ///< outside the window (in the shadow)
+    Content,
+    TitleBar,
+    CloseButton,
+    MaximizeButton,
+    MinimizeButton,
+    ResizeTop,
+    ResizeBottom,
+    ResizeLeft,
+    ResizeRight,
+    ResizeTopLeft,
+    ResizeTopRight,
+    ResizeBottomLeft,
+    ResizeBottomRight,
+};
+
+/**
+ * Window decorations drawn by the client (title bar with buttons, a border
+ * and a drop shadow), for compositors that do not draw any (e.g. GNOME).
+ *
+ * They live on their own surface, a synchronized subsurface placed below
+ * the window, so they are never redrawn with the content, and their changes
+ * are applied with the window's next commit. Each image is rendered once
+ * per (size, focus, scale) and kept, so only a resize (or a new title)
+ * renders a new one; switching the focus back and forth just attaches
+ * a buffer that is already there.
+ *
+ * All coordinates are relative to the top-left corner of the content.
+ */
+class Decorations {
+public:
+    static const int TITLE_BAR_HEIGHT = 32;
+    static const int BORDER_WIDTH = 1;
+    static const int CORNER_RADIUS = 8;     ///< of the top corners
+    static const int SHADOW_RADIUS = 24;    ///< blur radius of the drop shadow
+    static const int SHADOW_OFFSET = 4;     ///< the shadow is moved down by this much
+    static const int RESIZE_MARGIN = 8;     ///< how far from the border resizing works
+    static const int BUTTON_SIZE = 16;
+    static const int BUTTON_SPACING = 8;
+
+    /// Number of rendered images kept (focused and unfocused, plus a spare size).
+    static const size_t CACHE_SIZE = 4;
+
+protected:
+    struct Entry {
+        int width = 0;                      // of the content
+        int height = 0;
+        bool focused = false;
+        int scale = 1;
+        uint64_t title_serial = 0;
+        std::unique_ptr<Frame> frame;
+    };
+
+    wayland::Display& m_display;
+    std::unique_ptr<wl::Surface> m_surface;
+    std::unique_ptr<wl::Subsurface> m_subsurface;
+    ShadowCache m_shadows;
+    std::list<Entry> m_entries;             // most recently used first
+    Entry const* m_attached = nullptr;      // the image on the surface
+    int m_input_width = -1;                 // the content size the input region is for
+    int m_input_height = -1;
+
+    std::string m_title;
+    uint64_t m_title_serial = 1;            // changes with the title, making old images stale
+    TrueTypeFont* m_font = nullptr;
+    float m_font_size = 14.0f;
+
+    int margin() const;
+    void render(Entry& entry);
+    void update_input_region(int width, int height);
+
+public:
+    /// Creates the decoration surface below the parent (the window's surface).
+    Decorations(wayland::Display& display, wl::Surface& parent);
+    Decorations(Decorations const&) = delete;
+    Decorations& operator=(Decorations const&) = delete;
+
+    /**
+     * Returns the visible window (content plus title bar and border)
+     * for content of the given size; this is the window geometry
+     * to report to the compositor.
+     */
+    static Rect frame_rect(int width, int height);
+
+    /**
+     * Shows the decorations for content of the given size and state,
+     * rendering them only if this combination is not cached.
+     * Returns true if the decoration surface changed; the parent surface
+     * must then be committed for the change to appear.
+     */
+    bool update(int width, int height, bool focused, int scale = 1);
+
+    /// Sets the title shown in the title bar (only drawn if a font is set).
+    void set_title(std::string const& title);
+
+    /// Sets the font of the title; the font must outlive the decorations.
+    void set_font(TrueTypeFont* font, float size);
+
+    /// Returns what is at the point, for content of the given size.
+    static DecorationPart hit_test(int x, int y, int width, int height);
+
+    /// Returns the decoration surface (input on it is for the decorations).
+    wl::Surface& get_surface() { return *m_surface; }
+
+    /// Returns where the decoration surface is, for content of the given size
+    /// (the frame with room for the shadow around it).
+    Rect surface_rect(int width, int height) const;
+};
+
+} // namespace wayland
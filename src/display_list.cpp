@@ -0,0 +1,393 @@
+#include "display_list.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+// how many of the biggest later fills are remembered when looking for occlusion
+static const int MAX_OCCLUDERS = 8;
+
+// DisplayList ---------------------------------------------------------------
+
+void DisplayList::reset(int width, int height) {
+    m_arena.reset();
+    m_commands.clear();
+    m_width = width;
+    m_height = height;
+}
+
+RecordingContext DisplayList::recorder() {
+    return RecordingContext(*this);
+}
+
+void DisplayList::finish(DisplayCommand* command) {
+
+    // FNV-1a over everything after the hash itself; the padding is zero
+    // because the arena hands out zeroed memory
+    const size_t start = offsetof(DisplayCommand, type);
+    const uint8_t* bytes = (const uint8_t*) command + start;
+    const uint8_t* end = (const uint8_t*) command + command->size;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; bytes < end; ++bytes) {
+        hash = (hash ^ *bytes) * 0x100000001b3ULL;
+    }
+    command->hash = hash;
+}
+
+/**
+ * Marks the commands whose whole area is overwritten by later fills.
+ * Only the few biggest fills are considered as occluders, which catches
+ * the common cases (backgrounds, panels) at a linear cost.
+ */
+void DisplayList::find_occluded_commands() {
+    m_occluded.assign(m_commands.size(), 0);
+
+    Rect occluders[MAX_OCCLUDERS];
+    int occluder_count = 0;
+
+    for (size_t i = m_commands.size(); i-- > 0; ) {
+        DisplayCommand* command = m_commands[i];
+        bool occluded = false;
+        for (int k = 0; k < occluder_count; ++k) {
+            if (occluders[k].contains(command->bounds)) {
+                occluded = true;
+                break;
+            }
+        }
+        if (occluded) {
+            m_occluded[i] = 1;
+            continue;
+        }
+
+        // a fill replaces the pixels completely, so it hides what is below
+        if (command->type == DisplayCommandType::FillRect) {
+            Rect const& r = command->bounds;
+            if (occluder_count < MAX_OCCLUDERS) {
+                occluders[occluder_count++] = r;
+            }
+            else {
+                int smallest = 0;
+                for (int k = 1; k < MAX_OCCLUDERS; ++k) {
+                    if ((int64_t)occluders[k].width*occluders[k].height
+                        < (int64_t)occluders[smallest].width*occluders[smallest].height) {
+                        smallest = k;
+                    }
+                }
+                if ((int64_t)r.width*r.height
+                    > (int64_t)occluders[smallest].width*occluders[smallest].height) {
+                    occluders[smallest] = r;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Checks whether two fills of the same color can be done as one,
+ * storing the combined rectangle into the result.
+ */
+static bool can_merge(Rect const& a, Rect const& b, Rect& result) {
+    if (a.contains(b)) { result = a; return true; }
+    if (b.contains(a)) { result = b; return true; }
+    bool same_rows = (a.y == b.y && a.height == b.height);
+    bool same_columns = (a.x == b.x && a.width == b.width);
+    if ((same_rows && (a.right() == b.x || b.right() == a.x))
+        || (same_columns && (a.bottom() == b.y || b.bottom() == a.y))) {
+        result = a.united(b);
+        return true;
+    }
+    return false;
+}
+
+template<class Format>
+void DisplayList::replay_area(BasicDrawingContext<Format>& ctx, Rect const& area,
+    int const* indices, size_t count, ReplayStats& stats) const
+{
+    ctx.push_clip(area);
+
+    // a fill that is waiting to be merged with the following ones
+    bool pending = false;
+    Rect pending_rect;
+    uint32_t pending_color = 0;
+    auto flush = [&]() {
+        if (pending) {
+            ctx.fill_rect(pending_rect.x, pending_rect.y, pending_rect.width, pending_rect.height, pending_color);
+            stats.executed++;
+            pending = false;
+        }
+    };
+
+    if (!indices) {
+        count = m_commands.size();
+    }
+    for (size_t k = 0; k < count; ++k) {
+        size_t i = indices ? indices[k] : k;
+        DisplayCommand* command = m_commands[i];
+        if (m_occluded[i] || !command->bounds.intersects(area)) {
+            continue;
+        }
+
+        switch (command->type) {
+        case DisplayCommandType::FillRect: {
+            auto fill = static_cast<FillRectCommand*>(command);
+            Rect merged;
+            if (pending && pending_color == fill->color && can_merge(pending_rect, fill->bounds, merged)) {
+                pending_rect = merged;
+                stats.merged++;
+                break;
+            }
+            flush();
+            pending = true;
+            pending_rect = fill->bounds;
+            pending_color = fill->color;
+            break;
+        }
+        case DisplayCommandType::BlitMask: {
+            auto blit = static_cast<BlitMaskCommand*>(command);
+            flush();
+            ctx.push_clip(blit->clip);
+            ctx.blit_mask(blit->x, blit->y, blit->mask, blit->mask_stride,
+                blit->width, blit->height, blit->color);
+            ctx.pop_clip();
+            stats.executed++;
+            break;
+        }
+        case DisplayCommandType::BlitImage: {
+            auto blit = static_cast<BlitImageCommand*>(command);
+            flush();
+            ctx.push_clip(blit->clip);
+            ctx.blit_image(blit->x, blit->y, blit->image, blit->image_stride,
+                blit->width, blit->height);
+            ctx.pop_clip();
+            stats.executed++;
+            break;
+        }
+        case DisplayCommandType::FillPath: {
+            auto fill = static_cast<FillPathCommand*>(command);
+            flush();
+            ctx.push_clip(fill->clip);
+            ctx.fill_path(fill->path(), fill->color, fill->rule);
+            ctx.pop_clip();
+            stats.executed++;
+            break;
+        }
+        case DisplayCommandType::RoundedBox: {
+            auto box = static_cast<RoundedBoxCommand*>(command);
+            flush();
+            ctx.push_clip(box->clip);
+            ctx.draw_rounded_box(box->x, box->y, box->width, box->height,
+                box->rx, box->ry, box->line_width, box->color);
+            ctx.pop_clip();
+            stats.executed++;
+            break;
+        }
+        }
+    }
+    flush();
+
+    ctx.pop_clip();
+}
+
+void DisplayList::prepare_replay(DamageRegion const& damage) {
+    m_replay_stats = ReplayStats();
+    find_occluded_commands();
+
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        if (m_occluded[i]) {
+            m_replay_stats.occluded++;
+        }
+        else if (!damage.intersects(m_commands[i]->bounds)) {
+            m_replay_stats.culled++;
+        }
+    }
+}
+
+void DisplayList::add_replay_stats(ReplayStats const& stats) {
+    m_replay_stats.executed += stats.executed;
+    m_replay_stats.merged += stats.merged;
+}
+
+template<class Format>
+void DisplayList::replay(BasicDrawingContext<Format>& ctx, DamageRegion const& damage) {
+    prepare_replay(damage);
+
+    // the damaged rectangles do not overlap, so each pixel is drawn once
+    Rect surface(0, 0, m_width, m_height);
+    for (auto& rect : damage) {
+        Rect area = rect.intersected(surface);
+        if (!area.is_empty()) {
+            replay_area(ctx, area, nullptr, 0, m_replay_stats);
+        }
+    }
+}
+
+#define INSTANTIATE_REPLAY(Format) \
+    template void DisplayList::replay(BasicDrawingContext<Format>&, DamageRegion const&); \
+    template void DisplayList::replay_area(BasicDrawingContext<Format>&, Rect const&, \
+        int const*, size_t, ReplayStats&) const;
+
+INSTANTIATE_REPLAY(XRGB8888Traits)
+INSTANTIATE_REPLAY(ARGB8888Traits)
+INSTANTIATE_REPLAY(RGB565Traits)
+INSTANTIATE_REPLAY(A8Traits)
+
+/**
+ * Commands of both lists are matched in order by their hashes (a greedy
+ * common subsequence); whatever is left unmatched on either side changed.
+ * A pixel outside all unmatched bounds is touched only by matched commands
+ * in the same order in both frames, so it cannot differ.
+ */
+DamageRegion DisplayList::diff(DisplayList const& previous) {
+    DamageRegion result;
+    if (previous.m_width != m_width || previous.m_height != m_height) {
+        result.add(Rect(0, 0, m_width, m_height));
+        return result;
+    }
+
+    m_sorted.clear();
+    for (size_t i = 0; i < previous.m_commands.size(); ++i) {
+        m_sorted.emplace_back(previous.m_commands[i]->hash, (int) i);
+    }
+    std::sort(m_sorted.begin(), m_sorted.end());
+    m_matched.assign(previous.m_commands.size(), 0);
+
+    int last_matched = -1;
+    for (auto command : m_commands) {
+        bool found = false;
+        auto cursor = std::lower_bound(m_sorted.begin(), m_sorted.end(),
+            std::make_pair(command->hash, last_matched + 1));
+        for (; cursor != m_sorted.end() && cursor->first == command->hash; ++cursor) {
+            auto candidate = previous.m_commands[cursor->second];
+            if (candidate->size == command->size
+                && memcmp(candidate, command, command->size) == 0) {
+                last_matched = cursor->second;
+                m_matched[last_matched] = 1;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            result.add(command->bounds);
+        }
+    }
+    for (size_t i = 0; i < previous.m_commands.size(); ++i) {
+        if (!m_matched[i]) {
+            result.add(previous.m_commands[i]->bounds);
+        }
+    }
+    return result;
+}
+
+// RecordingContext ----------------------------------------------------------
+
+RecordingContext::RecordingContext(DisplayList& list)
+    : DrawingView(list.width(), list.height()), m_list(&list)
+{
+}
+
+RecordingContext RecordingContext::subview(int x, int y, int width, int height) const {
+    RecordingContext result = *this;
+    result.narrow_to(x, y, width, height);
+    return result;
+}
+
+void RecordingContext::xline(int x, int y, int width, uint32_t color) {
+    fill_rect(x, y, width, 1, color);
+}
+
+void RecordingContext::yline(int x, int y, int height, uint32_t color) {
+    fill_rect(x, y, 1, height, color);
+}
+
+void RecordingContext::draw_rect(int x, int y, int width, int height, uint32_t color) {
+    xline(x, y, width, color);
+    xline(x, y+height, width, color);
+    yline(x, y, height, color);
+    yline(x+width, y, height, color);
+}
+
+void RecordingContext::fill_rect(int x, int y, int width, int height, uint32_t color) {
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty()) { return; }
+
+    // the clip is already applied to the bounds; it is not needed
+    // for replaying and would only make equal fills hash differently
+    auto command = m_list->append<FillRectCommand>(DisplayCommandType::FillRect, r, r);
+    command->color = color;
+    DisplayList::finish(command);
+}
+
+void RecordingContext::blit_mask(int x, int y, uint8_t const* mask, int mask_stride,
+    int width, int height, uint32_t color)
+{
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty() || (color >> 24) == 0) { return; }
+
+    // the mask is positioned as a whole and clipped to the bounds on replay
+    auto command = m_list->append<BlitMaskCommand>(DisplayCommandType::BlitMask, r, r);
+    command->mask = mask;
+    command->mask_stride = mask_stride;
+    command->x = x + m_origin_x;
+    command->y = y + m_origin_y;
+    command->width = width;
+    command->height = height;
+    command->color = color;
+    DisplayList::finish(command);
+}
+
+void RecordingContext::blit_image(int x, int y, uint32_t const* image, int image_stride,
+    int width, int height, uint64_t version)
+{
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty()) { return; }
+
+    auto command = m_list->append<BlitImageCommand>(DisplayCommandType::BlitImage, r, r);
+    command->image = image;
+    command->version = version;
+    command->image_stride = image_stride;
+    command->x = x + m_origin_x;
+    command->y = y + m_origin_y;
+    command->width = width;
+    command->height = height;
+    DisplayList::finish(command);
+}
+
+void RecordingContext::fill_path(PathView const& path, uint32_t color, FillRule rule) {
+    Rect r = path.bounds().translated(m_origin_x, m_origin_y).intersected(m_clip);
+    if (r.is_empty() || (color >> 24) == 0) { return; }
+
+    size_t points_size = path.point_count*sizeof(PathPoint);
+    auto command = m_list->append<FillPathCommand>(DisplayCommandType::FillPath, r, r,
+        points_size + path.verb_count*sizeof(PathVerb));
+    command->color = color;
+    command->rule = rule;
+    command->verb_count = path.verb_count;
+    command->point_count = path.point_count;
+
+    // the path is stored in absolute coordinates, as all recorded geometry
+    auto points = const_cast<PathPoint*>(command->path().points);
+    for (size_t i = 0; i < path.point_count; ++i) {
+        points[i].x = path.points[i].x + m_origin_x;
+        points[i].y = path.points[i].y + m_origin_y;
+    }
+    memcpy(const_cast<PathVerb*>(command->path().verbs), path.verbs, path.verb_count*sizeof(PathVerb));
+    DisplayList::finish(command);
+}
+
+void RecordingContext::draw_rounded_box(int x, int y, int width, int height,
+    float rx, float ry, int line_width, uint32_t color)
+{
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty() || (color >> 24) == 0) { return; }
+
+    auto command = m_list->append<RoundedBoxCommand>(DisplayCommandType::RoundedBox, r, r);
+    command->x = x + m_origin_x;
+    command->y = y + m_origin_y;
+    command->width = width;
+    command->height = height;
+    command->rx = rx;
+    command->ry = ry;
+    command->line_width = line_width;
+    command->color = color;
+    DisplayList::finish(command);
+}
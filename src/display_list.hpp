@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "arena.hpp"
+#include "damage.hpp"
+#include "draw.hpp"
+
+/// Kinds of recorded drawing commands.
+enum class DisplayCommandType : uint16_t {
+    FillRect,
+    BlitMask,
+    FillPath,
+    RoundedBox,
+    BlitImage,
+};
+
+/**
+ * The header shared by all recorded commands. Coordinates are absolute
+ * (relative to the surface, not to any sub-view). The bounds are the area
+ * the command may touch, already clipped by the clip that was in effect
+ * when the command was recorded.
+ */
+struct DisplayCommand {
+    uint64_t hash = 0;          // of everything that follows, see DisplayList::diff()
+    DisplayCommandType type = DisplayCommandType::FillRect;
+    uint16_t reserved = 0;
+    uint32_t size = 0;          // of the whole command including the header, in bytes
+    Rect bounds;
+    Rect clip;
+};
+
+/// Fills the bounds with a color (a plain copy, no blending).
+struct FillRectCommand : public DisplayCommand {
+    uint32_t color = 0;
+};
+
+/**
+ * Blends a color through an A8 mask (see BasicDrawingContext::blit_mask()).
+ * Only the pointer to the mask is recorded, so the mask memory must stay
+ * valid and unchanged while the list exists (glyph atlases guarantee that);
+ * the command clip is the clip that was in effect when recording.
+ */
+struct BlitMaskCommand : public DisplayCommand {
+    uint8_t const* mask = nullptr;
+    int32_t mask_stride = 0;
+    int32_t x = 0;              // position of the whole mask, before clipping
+    int32_t y = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    uint32_t color = 0;
+};
+
+/**
+ * Fills a path (see BasicDrawingContext::fill_path()). The path data
+ * follows the command: point_count PathPoints in absolute coordinates,
+ * then verb_count PathVerbs.
+ */
+struct FillPathCommand : public DisplayCommand {
+    uint32_t color = 0;
+    FillRule rule = FillRule::NonZero;
+    uint32_t verb_count = 0;
+    uint32_t point_count = 0;
+
+    PathView path() const {
+        auto points = reinterpret_cast<PathPoint const*>(this + 1);
+        auto verbs = reinterpret_cast<PathVerb const*>(points + point_count);
+        return PathView { verbs, verb_count, points, point_count };
+    }
+};
+
+/// Draws a rounded box (see BasicDrawingContext::draw_rounded_box()).
+struct RoundedBoxCommand : public DisplayCommand {
+    int32_t x = 0;              // the whole box, before clipping
+    int32_t y = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    float rx = 0.0f;
+    float ry = 0.0f;
+    int32_t line_width = 0;
+    uint32_t color = 0;
+};
+
+/**
+ * Composites an ARGB image (see BasicDrawingContext::blit_image()).
+ * As with masks, only the pointer is recorded; the version stands for
+ * the pixels in the hash, so a changed image damages its area.
+ */
+struct BlitImageCommand : public DisplayCommand {
+    uint32_t const* image = nullptr;
+    uint64_t version = 0;
+    int32_t image_stride = 0;
+    int32_t x = 0;              // position of the whole image, before clipping
+    int32_t y = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+};
+
+class RecordingContext;
+
+/**
+ * A recorded frame: a sequence of drawing commands kept in an arena,
+ * so recording a frame does no heap allocation once the arena has grown.
+ * Draw into it through a RecordingContext (see recorder()), which has
+ * the same drawing API as DrawingContext; then replay() it into real pixels,
+ * possibly restricted to a damaged region, and diff() it against the list
+ * of the previous frame to find out what changed.
+ */
+class DisplayList {
+public:
+    /// What the last replay() did, for statistics.
+    struct ReplayStats {
+        int executed = 0;       // commands actually drawn (merged fills count once)
+        int culled = 0;         // outside the damaged region
+        int occluded = 0;       // completely overdrawn by later commands
+        int merged = 0;         // fills merged into a neighbouring fill
+    };
+
+protected:
+    Arena m_arena;
+    std::vector<DisplayCommand*> m_commands;
+    int m_width = 0;
+    int m_height = 0;
+    ReplayStats m_replay_stats;
+
+    // scratch space kept between frames to avoid reallocation
+    std::vector<uint8_t> m_occluded;
+    std::vector<std::pair<uint64_t, int>> m_sorted;
+    std::vector<uint8_t> m_matched;
+
+    void find_occluded_commands();
+
+public:
+    DisplayList() {}
+    DisplayList(DisplayList const&) = delete;
+    DisplayList& operator=(DisplayList const&) = delete;
+
+    /// Discards all commands and starts a new frame of the given size.
+    void reset(int width, int height);
+
+    /// Returns a context that records into this list, covering the whole surface.
+    RecordingContext recorder();
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    size_t command_count() const { return m_commands.size(); }
+    DisplayCommand const* command(size_t index) const { return m_commands[index]; }
+
+    /// Returns the number of bytes taken by the recorded commands.
+    size_t memory_used() const { return m_arena.used(); }
+
+    /**
+     * Allocates a new command of the given type at the end of the list;
+     * the caller fills in the type-specific fields and then calls finish().
+     * Used by RecordingContext; extra_size bytes of trailing payload
+     * are allocated after the command structure.
+     */
+    template<class T>
+    T* append(DisplayCommandType type, Rect const& bounds, Rect const& clip, size_t extra_size = 0) {
+        void* memory = m_arena.allocate(sizeof(T) + extra_size, alignof(T));
+        T* command = new (memory) T();
+        command->type = type;
+        command->size = sizeof(T) + extra_size;
+        command->bounds = bounds;
+        command->clip = clip;
+        m_commands.push_back(command);
+        return command;
+    }
+
+    /// Computes the hash of a fully filled-in command.
+    static void finish(DisplayCommand* command);
+
+    /**
+     * Draws the commands into the context, which must cover the whole
+     * surface, touching only pixels inside the damaged region.
+     * Commands outside the region are skipped, commands hidden under
+     * later fills are skipped, and adjacent fills of the same color
+     * are merged into one.
+     */
+    template<class Format>
+    void replay(BasicDrawingContext<Format>& ctx, DamageRegion const& damage);
+
+    /**
+     * The first step of replay(): finds the occluded commands and resets
+     * the statistics. Needed before calling replay_area() directly.
+     */
+    void prepare_replay(DamageRegion const& damage);
+
+    /// Returns true if the command is hidden (valid after prepare_replay()).
+    bool is_occluded(size_t index) const { return m_occluded[index]; }
+
+    /**
+     * Replays the given commands (by index, in increasing order; all of them
+     * if indices is null) touching only pixels inside the area.
+     * Does not modify the list, so several areas can be replayed in parallel
+     * (each with its own copy of the context and its own statistics).
+     */
+    template<class Format>
+    void replay_area(BasicDrawingContext<Format>& ctx, Rect const& area,
+        int const* indices, size_t count, ReplayStats& stats) const;
+
+    /// Returns statistics of the last replay().
+    ReplayStats const& replay_stats() const { return m_replay_stats; }
+
+    /// Adds the statistics of separately replayed areas to replay_stats().
+    void add_replay_stats(ReplayStats const& stats);
+
+    /**
+     * Compares this list with the list of the previous frame and returns
+     * the region where the two frames may differ: the bounds of every
+     * command that was added, removed, changed or reordered.
+     * If the sizes differ, the whole surface is damaged.
+     */
+    DamageRegion diff(DisplayList const& previous);
+};
+
+/**
+ * Records drawing commands into a DisplayList instead of drawing them.
+ * Mirrors the API of DrawingContext (views, clipping and the primitives),
+ * so drawing code can be written as a template over the context type.
+ * Like DrawingContext, this is a small value type.
+ */
+class RecordingContext : public DrawingView, public RoundedShapes<RecordingContext> {
+protected:
+    DisplayList* m_list = nullptr;
+
+public:
+    RecordingContext(DisplayList& list);
+
+    /// See BasicDrawingContext::subview().
+    RecordingContext subview(int x, int y, int width, int height) const;
+
+    void xline(int x, int y, int width, uint32_t color);
+    void yline(int x, int y, int height, uint32_t color);
+    void draw_rect(int x, int y, int width, int height, uint32_t color);
+    void fill_rect(int x, int y, int width, int height, uint32_t color);
+    void blit_mask(int x, int y, uint8_t const* mask, int mask_stride,
+        int width, int height, uint32_t color);
+
+    /**
+     * Records compositing of an image. The image memory must stay valid
+     * until the list is replayed, and the version must change whenever
+     * the pixels do (e.g. OffscreenCache provides both).
+     */
+    void blit_image(int x, int y, uint32_t const* image, int image_stride,
+        int width, int height, uint64_t version);
+
+    void fill_path(PathView const& path, uint32_t color, FillRule rule = FillRule::NonZero);
+    void draw_rounded_box(int x, int y, int width, int height,
+        float rx, float ry, int line_width, uint32_t color);
+};
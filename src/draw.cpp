@@ -1,55 +1,507 @@
 #include "draw.hpp"
+#include "corner_mask.hpp"
+#include "raster.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
 
-DrawingContext::DrawingContext(uint32_t* pixels, int width, int height)
-    : m_pixels(pixels), m_width(width), m_height(height)
+// Pixel format traits -------------------------------------------------------
+
+void RGB565Traits::blend_mask(pixel_type* dst, uint8_t const* coverage, int count, uint32_t color) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t c = coverage[i];
+        if (c == 0) { continue; }
+        uint32_t src = (c == 255) ? color : scale_argb(color, c);
+        dst[i] = from_argb((src >> 24) == 0xFF ? src : blend_over(to_argb(dst[i]), src));
+    }
+}
+
+void A8Traits::blend_mask(pixel_type* dst, uint8_t const* coverage, int count, uint32_t color) {
+    uint32_t alpha = color >> 24;
+    for (int i = 0; i < count; ++i) {
+        uint32_t c = coverage[i];
+        if (c == 0) { continue; }
+        uint32_t a = (c == 255) ? alpha : mul_div255(alpha, c);
+        dst[i] = (pixel_type)(a + mul_div255(dst[i], 255 - a));
+    }
+}
+
+void RGB565Traits::blend_image(pixel_type* dst, uint32_t const* src, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t s = src[i];
+        if (s == 0) { continue; }
+        dst[i] = from_argb((s >> 24) == 0xFF ? s : blend_over(to_argb(dst[i]), s));
+    }
+}
+
+void A8Traits::blend_image(pixel_type* dst, uint32_t const* src, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t a = src[i] >> 24;
+        if (a == 0) { continue; }
+        dst[i] = (pixel_type)(a + mul_div255(dst[i], 255 - a));
+    }
+}
+
+// Rounded shapes ------------------------------------------------------------
+
+namespace {
+
+/// A row of full coverage, for blending solid spans with blend_mask().
+struct FullCoverage {
+    static const int SIZE = 256;
+    uint8_t values[SIZE];
+    FullCoverage() { std::fill_n(values, SIZE, 255); }
+};
+
+FullCoverage const full_coverage;
+
+/// The columns of a row of a rounded box where it has any coverage
+/// ([lo, hi)) and where it is fully covered ([solid_lo, solid_hi)).
+struct RowExtent {
+    int lo, solid_lo, solid_hi, hi;
+};
+
+/**
+ * A box whose corners are the shape of a CornerMask (mirrored for the other
+ * three corners). Where the corners of opposite sides overlap (in an ellipse
+ * or a box narrower than two corners), their coverage is combined,
+ * which is exact except at the very tips.
+ */
+struct RoundedBox {
+    int width;
+    int height;
+    CornerMask const& mask;
+
+    RowExtent row(int j) const {
+        int top = (j < mask.height()) ? j : -1;
+        int bottom = (height - 1 - j < mask.height()) ? height - 1 - j : -1;
+        int lo = 0, solid_lo = 0;
+        if (top >= 0) {
+            lo = mask.first(top);
+            solid_lo = mask.solid(top);
+        }
+        if (bottom >= 0) {
+            lo = std::max(lo, mask.first(bottom));
+            solid_lo = std::max(solid_lo, mask.solid(bottom));
+        }
+        int hi = width - lo, solid_hi = width - solid_lo;
+        if (lo >= hi) { lo = hi = width/2; }
+        if (solid_lo >= solid_hi) { solid_lo = solid_hi = width/2; }
+        return RowExtent { lo, solid_lo, solid_hi, hi };
+    }
+
+    /// Returns the coverage of the pixel at row j, column c of the box.
+    int coverage(int j, int c) const {
+        if (c < 0 || c >= width) { return 0; }
+        int result = 255;
+        if (j < mask.height()) { result = across(j, c); }
+        if (height - 1 - j < mask.height()) {
+            result = std::max(0, result + across(height - 1 - j, c) - 255);
+        }
+        return result;
+    }
+
+    /// Returns the coverage of a pixel in the given row of the corner mask
+    /// combined with its mirror image on the right side.
+    int across(int row, int c) const {
+        return std::max(0, mask.at(row, c) + mask.at(row, width - 1 - c) - 255);
+    }
+};
+
+/// Blends columns [from, to) of a row (limited to [clip_lo, clip_hi)),
+/// with the coverage of each column given by the function.
+template<class Format, class Coverage>
+void blend_edge(typename Format::pixel_type* row, int from, int to, int clip_lo, int clip_hi,
+    uint32_t premultiplied, Coverage const& coverage)
+{
+    from = std::max(from, clip_lo);
+    to = std::min(to, clip_hi);
+    uint8_t values[FullCoverage::SIZE];
+    while (from < to) {
+        int count = std::min(to - from, FullCoverage::SIZE);
+        for (int i = 0; i < count; ++i) {
+            values[i] = (uint8_t) coverage(from + i);
+        }
+        Format::blend_mask(row + from, values, count, premultiplied);
+        from += count;
+    }
+}
+
+/// Fills columns [from, to) of a row (limited to [clip_lo, clip_hi)) with the color.
+template<class Format>
+void fill_span(typename Format::pixel_type* row, int from, int to, int clip_lo, int clip_hi,
+    uint32_t color, uint32_t premultiplied)
+{
+    from = std::max(from, clip_lo);
+    to = std::min(to, clip_hi);
+    if (from >= to) { return; }
+    if ((color >> 24) == 0xFF) {
+        std::fill_n(row + from, to - from, Format::from_argb(color));
+        return;
+    }
+    while (from < to) {
+        int count = std::min(to - from, FullCoverage::SIZE);
+        Format::blend_mask(row + from, full_coverage.values, count, premultiplied);
+        from += count;
+    }
+}
+
+} // namespace
+
+// DrawingView ---------------------------------------------------------------
+
+void DrawingView::narrow_to(int x, int y, int width, int height) {
+    m_clip = clip_to_buffer(x, y, width, height);
+    m_origin_x += x;
+    m_origin_y += y;
+    m_width = width > 0 ? width : 0;
+    m_height = height > 0 ? height : 0;
+    m_clip_depth = 0;
+}
+
+void DrawingView::push_clip(int x, int y, int width, int height) {
+    if (m_clip_depth >= MAX_CLIP_DEPTH) {
+        throw std::logic_error("DrawingView: clip stack overflow");
+    }
+    m_clip_stack[m_clip_depth++] = m_clip;
+    m_clip = clip_to_buffer(x, y, width, height);
+}
+
+void DrawingView::pop_clip() {
+    if (m_clip_depth <= 0) {
+        throw std::logic_error("DrawingView: pop_clip() without push_clip()");
+    }
+    m_clip = m_clip_stack[--m_clip_depth];
+}
+
+// BasicDrawingContext -------------------------------------------------------
+
+template<class Format>
+BasicDrawingContext<Format>::BasicDrawingContext(pixel_type* pixels, int width, int height)
+    : BasicDrawingContext(pixels, width, height, width)
 {
-    assert(m_pixels && m_width >= 0 && m_height >= 0);
+}
+
+template<class Format>
+BasicDrawingContext<Format>::BasicDrawingContext(pixel_type* pixels, int width, int height, int stride)
+    : DrawingView(width, height), m_pixels(pixels), m_stride(stride)
+{
+    assert(m_pixels && m_width >= 0 && m_height >= 0 && m_stride >= m_width);
+}
+
+template<class Format>
+BasicDrawingContext<Format> BasicDrawingContext<Format>::subview(int x, int y, int width, int height) const {
+    BasicDrawingContext result = *this;
+    result.narrow_to(x, y, width, height);
+    return result;
 }
 
 /**
  * Draws a horizontal line from (x, y) to (x+width-1, y),
- * using the given pixel value.
+ * using the given color.
  * Line is automatically clipped against the underlying pixel buffer boundaries.
  * Negative starting coordinates are safe and work as expected.
  */
-void DrawingContext::xline(int x, int y, int width, uint32_t pixel) {
-    if (y < 0 || y >= m_height || x >= m_width || width <= 0) { return; }
-    if (x < 0) { x = 0; }
-    if (x + width > m_width) { width = m_width - x; }
+template<class Format>
+void BasicDrawingContext<Format>::xline(int x, int y, int width, uint32_t color) {
+    fill_rect(x, y, width, 1, color);
+}
+
+/**
+ * Draws a vertical line from (x, y) to (x, y+height-1),
+ * clipped the same way as xline().
+ */
+template<class Format>
+void BasicDrawingContext<Format>::yline(int x, int y, int height, uint32_t color) {
+    Rect r = clip_to_buffer(x, y, 1, height);
+    if (r.is_empty()) { return; }
 
     assert(m_pixels);
-    uint32_t* addr = m_pixels + y*m_width + x;
-    uint32_t* end = addr + width;
+    pixel_type pixel = Format::from_argb(color);
+    pixel_type* addr = buffer_address(r.x, r.y);
+    pixel_type* end = addr + (intptr_t)r.height*m_stride;
 
-    for(; addr < end; addr++) {
+    for(; addr < end; addr += m_stride) {
         *addr = pixel;
     }
 }
 
-void DrawingContext::yline(int x, int y, int height, uint32_t pixel) {
-    if (x < 0 || x >= m_width || y >= height || height <= 0) { return; }
-    if (y < 0) y = 0;
-    if (y + height > m_height) { height = m_height - y; }
+template<class Format>
+void BasicDrawingContext<Format>::draw_rect(int x, int y, int width, int height, uint32_t color) {
+    xline(x, y, width, color);
+    xline(x, y+height, width, color);
+    yline(x, y, height, color);
+    yline(x+width, y, height, color);
+}
+
+template<class Format>
+void BasicDrawingContext<Format>::fill_rect(int x, int y, int width, int height, uint32_t color) {
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty()) { return; }
 
     assert(m_pixels);
-    uint32_t* addr = m_pixels + y*m_width + x;
-    uint32_t* end = m_pixels + (y+height)*m_width + x;
+    pixel_type pixel = Format::from_argb(color);
+    pixel_type* row = buffer_address(r.x, r.y);
+    for (int i = 0; i < r.height; ++i, row += m_stride) {
+        std::fill_n(row, r.width, pixel);
+    }
+}
 
-    for(; addr < end; addr += m_width) {
-        *addr = pixel;
+template<class Format>
+void BasicDrawingContext<Format>::blit_mask(int x, int y, uint8_t const* mask, int mask_stride,
+    int width, int height, uint32_t color)
+{
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty() || (color >> 24) == 0) { return; }
+
+    assert(m_pixels && mask);
+    uint32_t premultiplied = premultiply(color);
+    uint8_t const* mask_row = mask + (intptr_t)(r.y - y - m_origin_y)*mask_stride + (r.x - x - m_origin_x);
+    pixel_type* row = buffer_address(r.x, r.y);
+    for (int i = 0; i < r.height; ++i, row += m_stride, mask_row += mask_stride) {
+        Format::blend_mask(row, mask_row, r.width, premultiplied);
+    }
+}
+
+template<class Format>
+void BasicDrawingContext<Format>::blit_image(int x, int y, uint32_t const* image, int image_stride,
+    int width, int height, uint64_t)
+{
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty()) { return; }
+
+    assert(m_pixels && image);
+    uint32_t const* image_row = image + (intptr_t)(r.y - y - m_origin_y)*image_stride + (r.x - x - m_origin_x);
+    pixel_type* row = buffer_address(r.x, r.y);
+    for (int i = 0; i < r.height; ++i, row += m_stride, image_row += image_stride) {
+        Format::blend_image(row, image_row, r.width);
+    }
+}
+
+template<class Format>
+void BasicDrawingContext<Format>::fill_path(PathView const& path, uint32_t color, FillRule rule) {
+    Rect r = path.bounds().translated(m_origin_x, m_origin_y).intersected(m_clip);
+    if (r.is_empty() || (color >> 24) == 0) { return; }
+
+    assert(m_pixels);
+    ScanlineRasterizer& rasterizer = ScanlineRasterizer::scratch();
+    rasterizer.reset(r);
+    rasterizer.add_path(path, (float) m_origin_x, (float) m_origin_y);
+
+    uint32_t premultiplied = premultiply(color);
+    rasterizer.render(rule, [&](int x, int y, uint8_t const* coverage, int count) {
+        Format::blend_mask(buffer_address(x, y), coverage, count, premultiplied);
+    });
+}
+
+template<class Format>
+void BasicDrawingContext<Format>::blur(int x, int y, int width, int height, float radius, ThreadPool* pool) {
+    Rect r = clip_to_buffer(x, y, width, height);
+    if (r.is_empty()) { return; }
+
+    assert(m_pixels);
+    if constexpr (sizeof(pixel_type) == 4) {
+        blur_argb32(buffer_address(r.x, r.y), r.width, r.height, m_stride, radius, BlurEdges::Clamp, pool);
+    }
+    else if constexpr (sizeof(pixel_type) == 1) {
+        blur_a8(buffer_address(r.x, r.y), r.width, r.height, m_stride, radius, BlurEdges::Clamp, pool);
+    }
+    else {
+        throw std::logic_error("BasicDrawingContext: blur() is not supported for this format");
     }
 }
 
-void DrawingContext::draw_rect(int x, int y, int width, int height, uint32_t pixel) {
-    xline(x, y, width, pixel);
-    xline(x, y+height, width, pixel);
-    yline(x, y, height, pixel);
-    yline(x+width, y, height, pixel);
+template<class Format>
+void BasicDrawingContext<Format>::scroll(int x, int y, int width, int height, int dx, int dy) {
+    Rect r = clip_to_buffer(x, y, width, height);
+    Rect target = r.intersected(r.translated(dx, dy));
+    if (target.is_empty() || (dx == 0 && dy == 0)) { return; }
+
+    assert(m_pixels);
+    size_t row_bytes = (size_t) target.width*sizeof(pixel_type);
+    if (dy > 0) {
+        // moving down: start from the bottom so no source row is overwritten before use
+        for (int row = target.bottom() - 1; row >= target.y; --row) {
+            memmove(buffer_address(target.x, row), buffer_address(target.x - dx, row - dy), row_bytes);
+        }
+    }
+    else {
+        for (int row = target.y; row < target.bottom(); ++row) {
+            memmove(buffer_address(target.x, row), buffer_address(target.x - dx, row - dy), row_bytes);
+        }
+    }
 }
 
-void DrawingContext::fill_rect(int x, int y, int width, int height, uint32_t pixel) {
-    for (int i=0; i < height; ++i) {
-        xline(x, y+i, width, pixel);
+template<class Format>
+void BasicDrawingContext<Format>::draw_rounded_box(int x, int y, int width, int height,
+    float rx, float ry, int line_width, uint32_t color)
+{
+    Rect box(x + m_origin_x, y + m_origin_y, width, height);
+    Rect r = box.intersected(m_clip);
+    if (r.is_empty() || (color >> 24) == 0) { return; }
+
+    assert(m_pixels);
+    rx = std::clamp(rx, 0.0f, width*0.5f);
+    ry = std::clamp(ry, 0.0f, height*0.5f);
+    if (line_width < 0 || 2*line_width >= std::min(width, height)) {
+        line_width = 0;             // no hole left, same as a fill
     }
+
+    // a stroke is the outer box minus the inner one (with correspondingly smaller corners)
+    RoundedBox outer { width, height, CornerMask::get(rx, ry) };
+    RoundedBox inner { width - 2*line_width, height - 2*line_width,
+        line_width ? CornerMask::get(rx - line_width, ry - line_width) : outer.mask };
+
+    uint32_t premultiplied = premultiply(color);
+    int clip_lo = r.x - box.x, clip_hi = r.right() - box.x;
+    for (int j = r.y - box.y; j < r.bottom() - box.y; ++j) {
+        pixel_type* row = buffer_address(box.x, box.y + j);
+        RowExtent o = outer.row(j);
+        int inner_j = j - line_width;
+        if (line_width == 0 || inner_j < 0 || inner_j >= inner.height) {
+            auto coverage = [&](int c) { return outer.coverage(j, c); };
+            blend_edge<Format>(row, o.lo, o.solid_lo, clip_lo, clip_hi, premultiplied, coverage);
+            fill_span<Format>(row, o.solid_lo, o.solid_hi, clip_lo, clip_hi, color, premultiplied);
+            blend_edge<Format>(row, o.solid_hi, o.hi, clip_lo, clip_hi, premultiplied, coverage);
+            continue;
+        }
+
+        RowExtent i = inner.row(inner_j);
+        i.lo += line_width;
+        i.solid_lo += line_width;
+        i.solid_hi += line_width;
+        i.hi += line_width;
+        auto coverage = [&](int c) {
+            return std::max(0, outer.coverage(j, c) - inner.coverage(inner_j, c - line_width));
+        };
+
+        // left of the hole: solid between the outer and the inner edge, if they do not touch
+        if (o.solid_lo < i.lo) {
+            blend_edge<Format>(row, o.lo, o.solid_lo, clip_lo, clip_hi, premultiplied, coverage);
+            fill_span<Format>(row, o.solid_lo, i.lo, clip_lo, clip_hi, color, premultiplied);
+            blend_edge<Format>(row, i.lo, i.solid_lo, clip_lo, clip_hi, premultiplied, coverage);
+        }
+        else {
+            blend_edge<Format>(row, o.lo, i.solid_lo, clip_lo, clip_hi, premultiplied, coverage);
+        }
+
+        // and the mirror image right of the hole
+        if (i.hi < o.solid_hi) {
+            blend_edge<Format>(row, i.solid_hi, i.hi, clip_lo, clip_hi, premultiplied, coverage);
+            fill_span<Format>(row, i.hi, o.solid_hi, clip_lo, clip_hi, color, premultiplied);
+            blend_edge<Format>(row, o.solid_hi, o.hi, clip_lo, clip_hi, premultiplied, coverage);
+        }
+        else {
+            blend_edge<Format>(row, i.solid_hi, o.hi, clip_lo, clip_hi, premultiplied, coverage);
+        }
+    }
+}
+
+template struct BasicDrawingContext<XRGB8888Traits>;
+template struct BasicDrawingContext<ARGB8888Traits>;
+template struct BasicDrawingContext<RGB565Traits>;
+template struct BasicDrawingContext<A8Traits>;
+
+// AnyDrawingContext ---------------------------------------------------------
+
+static AnyDrawingContext make_context(PixelFormat format, void* pixels, int width, int height, int stride) {
+    switch (format) {
+    case PixelFormat::XRGB8888:
+        return BasicDrawingContext<XRGB8888Traits>((uint32_t*) pixels, width, height, stride);
+    case PixelFormat::ARGB8888:
+        return BasicDrawingContext<ARGB8888Traits>((uint32_t*) pixels, width, height, stride);
+    case PixelFormat::RGB565:
+        return BasicDrawingContext<RGB565Traits>((uint16_t*) pixels, width, height, stride);
+    case PixelFormat::A8:
+        return BasicDrawingContext<A8Traits>((uint8_t*) pixels, width, height, stride);
+    }
+    throw std::invalid_argument("AnyDrawingContext: unknown pixel format");
+}
+
+AnyDrawingContext::AnyDrawingContext(PixelFormat format, void* pixels, int width, int height, int stride)
+    : AnyDrawingContext(make_context(format, pixels, width, height, stride))
+{
+}
+
+PixelFormat AnyDrawingContext::format() const {
+    return std::visit([](auto& ctx) { return ctx.format(); }, m_context);
+}
+
+int AnyDrawingContext::width() const {
+    return std::visit([](auto& ctx) { return ctx.width(); }, m_context);
+}
+
+int AnyDrawingContext::height() const {
+    return std::visit([](auto& ctx) { return ctx.height(); }, m_context);
+}
+
+int AnyDrawingContext::stride() const {
+    return std::visit([](auto& ctx) { return ctx.stride(); }, m_context);
+}
+
+Rect AnyDrawingContext::clip_rect() const {
+    return std::visit([](auto& ctx) { return ctx.clip_rect(); }, m_context);
+}
+
+AnyDrawingContext AnyDrawingContext::subview(int x, int y, int width, int height) const {
+    return std::visit([&](auto& ctx) {
+        return AnyDrawingContext(ctx.subview(x, y, width, height));
+    }, m_context);
+}
+
+void AnyDrawingContext::push_clip(int x, int y, int width, int height) {
+    std::visit([&](auto& ctx) { ctx.push_clip(x, y, width, height); }, m_context);
+}
+
+void AnyDrawingContext::pop_clip() {
+    std::visit([](auto& ctx) { ctx.pop_clip(); }, m_context);
+}
+
+void AnyDrawingContext::xline(int x, int y, int width, uint32_t color) {
+    std::visit([&](auto& ctx) { ctx.xline(x, y, width, color); }, m_context);
+}
+
+void AnyDrawingContext::yline(int x, int y, int height, uint32_t color) {
+    std::visit([&](auto& ctx) { ctx.yline(x, y, height, color); }, m_context);
+}
+
+void AnyDrawingContext::draw_rect(int x, int y, int width, int height, uint32_t color) {
+    std::visit([&](auto& ctx) { ctx.draw_rect(x, y, width, height, color); }, m_context);
+}
+
+void AnyDrawingContext::fill_rect(int x, int y, int width, int height, uint32_t color) {
+    std::visit([&](auto& ctx) { ctx.fill_rect(x, y, width, height, color); }, m_context);
+}
+
+void AnyDrawingContext::blit_mask(int x, int y, uint8_t const* mask, int mask_stride,
+    int width, int height, uint32_t color)
+{
+    std::visit([&](auto& ctx) { ctx.blit_mask(x, y, mask, mask_stride, width, height, color); }, m_context);
+}
+
+void AnyDrawingContext::blit_image(int x, int y, uint32_t const* image, int image_stride,
+    int width, int height, uint64_t version)
+{
+    std::visit([&](auto& ctx) { ctx.blit_image(x, y, image, image_stride, width, height, version); },
+        m_context);
+}
+
+void AnyDrawingContext::fill_path(PathView const& path, uint32_t color, FillRule rule) {
+    std::visit([&](auto& ctx) { ctx.fill_path(path, color, rule); }, m_context);
+}
+
+void AnyDrawingContext::blur(int x, int y, int width, int height, float radius, ThreadPool* pool) {
+    std::visit([&](auto& ctx) { ctx.blur(x, y, width, height, radius, pool); }, m_context);
+}
+
+void AnyDrawingContext::scroll(int x, int y, int width, int height, int dx, int dy) {
+    std::visit([&](auto& ctx) { ctx.scroll(x, y, width, height, dx, dy); }, m_context);
+}
+
+void AnyDrawingContext::draw_rounded_box(int x, int y, int width, int height,
+    float rx, float ry, int line_width, uint32_t color)
+{
+    std::visit([&](auto& ctx) { ctx.draw_rounded_box(x, y, width, height, rx, ry, line_width, color); },
+        m_context);
 }
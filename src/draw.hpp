@@ -1,29 +1,341 @@
 #pragma once
 
 #include <cstdint>
+#include <variant>
+#include "blend.hpp"
+#include "blur.hpp"
+#include "path.hpp"
+#include "rect.hpp"
+
+/// Pixel formats that a drawing context can be instantiated for.
+enum class PixelFormat {
+    XRGB8888,   ///< 32 bits, alpha byte ignored (the usual window format)
+    ARGB8888,   ///< 32 bits with premultiplied alpha
+    RGB565,     ///< 16 bits, no alpha
+    A8,         ///< 8-bit coverage/alpha mask
+};
+
+/*
+ * Pixel format traits. Each describes the in-memory pixel type and how to
+ * convert colors to it. Colors passed to the drawing functions are always
+ * 0xAARRGGBB with straight (non-premultiplied) alpha; they are converted
+ * to the native pixel value once per drawing call.
+ *
+ * blend_mask() composites a premultiplied color over count pixels,
+ * modulated by an A8 coverage mask (see blend_mask_argb32());
+ * blend_image() composites count premultiplied ARGB pixels over them
+ * (see blend_argb32()).
+ */
+
+struct XRGB8888Traits {
+    using pixel_type = uint32_t;
+    static const PixelFormat format = PixelFormat::XRGB8888;
+    static pixel_type from_argb(uint32_t argb) { return argb; }
+    static uint32_t to_argb(pixel_type pixel) { return pixel | 0xFF000000; }
+    static void blend_mask(pixel_type* dst, uint8_t const* coverage, int count, uint32_t color) {
+        blend_mask_argb32(dst, coverage, count, color);
+    }
+    static void blend_image(pixel_type* dst, uint32_t const* src, int count) {
+        blend_argb32(dst, src, count);
+    }
+};
+
+struct ARGB8888Traits {
+    using pixel_type = uint32_t;
+    static const PixelFormat format = PixelFormat::ARGB8888;
+    static pixel_type from_argb(uint32_t argb) { return premultiply(argb); }
+    static uint32_t to_argb(pixel_type pixel) { return pixel; }
+    static void blend_mask(pixel_type* dst, uint8_t const* coverage, int count, uint32_t color) {
+        blend_mask_argb32(dst, coverage, count, color);
+    }
+    static void blend_image(pixel_type* dst, uint32_t const* src, int count) {
+        blend_argb32(dst, src, count);
+    }
+};
+
+struct RGB565Traits {
+    using pixel_type = uint16_t;
+    static const PixelFormat format = PixelFormat::RGB565;
+    static pixel_type from_argb(uint32_t argb) {
+        return (pixel_type)(((argb >> 8) & 0xF800) | ((argb >> 5) & 0x07E0) | ((argb >> 3) & 0x001F));
+    }
+    static uint32_t to_argb(pixel_type pixel) {
+        uint32_t r = (pixel >> 11) & 0x1F, g = (pixel >> 5) & 0x3F, b = pixel & 0x1F;
+        return 0xFF000000 | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+    }
+    static void blend_mask(pixel_type* dst, uint8_t const* coverage, int count, uint32_t color);
+    static void blend_image(pixel_type* dst, uint32_t const* src, int count);
+};
+
+struct A8Traits {
+    using pixel_type = uint8_t;
+    static const PixelFormat format = PixelFormat::A8;
+    static pixel_type from_argb(uint32_t argb) { return (pixel_type)(argb >> 24); }
+    static uint32_t to_argb(pixel_type pixel) { return (uint32_t)pixel << 24; }
+    static void blend_mask(pixel_type* dst, uint8_t const* coverage, int count, uint32_t color);
+    static void blend_image(pixel_type* dst, uint32_t const* src, int count);
+};
 
 /**
- * A context and a set of functions for simple drawing into a memory buffer
- * of RGBA8888 or BGRA8888 format.
- * Does not hold any heap-allocated data by itself (destructor is trivial).
+ * The geometry shared by everything that can be drawn into: the size and
+ * origin of a view into a pixel buffer, and a stack of clip rectangles.
+ * All coordinates given to the drawing functions are relative to the view
+ * origin; the effective clip is kept in buffer coordinates, so it is
+ * resolved once per primitive, never per pixel.
+ * Has no heap-allocated data (copying and destruction are trivial).
  */
-struct DrawingContext {
+struct DrawingView {
+public:
+    /// Maximum number of nested push_clip() calls.
+    static const int MAX_CLIP_DEPTH = 16;
+
 protected:
-    uint32_t* m_pixels = nullptr;
-    int m_width = 0;
-    int m_height = 0;
+    int m_width = 0;                // width of the view
+    int m_height = 0;               // height of the view
+    int m_origin_x = 0;             // position of the view in the buffer
+    int m_origin_y = 0;
+    Rect m_clip;                    // effective clip, in buffer coordinates
+    Rect m_clip_stack[MAX_CLIP_DEPTH];
+    int m_clip_depth = 0;
 
-public:
-    DrawingContext(uint32_t* pixels, int width, int height);
+    DrawingView() {}
+    DrawingView(int width, int height)
+        : m_width(width), m_height(height), m_clip(0, 0, width, height) {}
 
-    /** Returns the width of the underlying pixel buffer, in pixels. */
+    /// Converts a rectangle from view coordinates to buffer coordinates
+    /// and clips it by the current clip rectangle.
+    Rect clip_to_buffer(int x, int y, int width, int height) const {
+        return Rect(x + m_origin_x, y + m_origin_y, width, height).intersected(m_clip);
+    }
+
+    /// Turns this view into a sub-view (see subview() of derived classes).
+    void narrow_to(int x, int y, int width, int height);
+
+public:
+    /** Returns the width of the view, in pixels. */
     int width() const { return m_width; }
 
-    /** Returns the height of the underlying pixel buffer, in pixels. */
+    /** Returns the height of the view, in pixels. */
     int height() const { return m_height; }
 
-    void xline(int x, int y, int width, uint32_t pixel);
-    void yline(int x, int y, int height, uint32_t pixel);
-    void draw_rect(int x, int y, int width, int height, uint32_t pixel);
-    void fill_rect(int x, int y, int width, int height, uint32_t pixel);
+    /** Returns the current clip rectangle, in view coordinates. */
+    Rect clip_rect() const { return m_clip.translated(-m_origin_x, -m_origin_y); }
+
+    /**
+     * Narrows the clip to the intersection of the current clip and the given
+     * rectangle (in view coordinates) until the matching pop_clip().
+     * Throws std::logic_error if nested deeper than MAX_CLIP_DEPTH.
+     */
+    void push_clip(int x, int y, int width, int height);
+    void push_clip(Rect const& rect) { push_clip(rect.x, rect.y, rect.width, rect.height); }
+
+    /// Restores the clip that was in effect before the last push_clip().
+    void pop_clip();
+};
+
+/**
+ * The shapes drawn by draw_rounded_box(), for every context that has it
+ * (BasicDrawingContext, AnyDrawingContext and RecordingContext), which
+ * derive from this with themselves as Context. Strokes lie inside the
+ * outline; a circle is centered on the corner between pixels at (cx, cy);
+ * an ellipse is inscribed in the given rectangle.
+ */
+template<class Context>
+struct RoundedShapes {
+    void fill_rounded_rect(int x, int y, int width, int height, int radius, uint32_t color) {
+        self().draw_rounded_box(x, y, width, height, radius, radius, 0, color);
+    }
+    void stroke_rounded_rect(int x, int y, int width, int height, int radius,
+        int line_width, uint32_t color)
+    {
+        if (line_width > 0) { self().draw_rounded_box(x, y, width, height, radius, radius, line_width, color); }
+    }
+    void fill_circle(int cx, int cy, int radius, uint32_t color) {
+        self().draw_rounded_box(cx - radius, cy - radius, 2*radius, 2*radius, radius, radius, 0, color);
+    }
+    void stroke_circle(int cx, int cy, int radius, int line_width, uint32_t color) {
+        if (line_width > 0) {
+            self().draw_rounded_box(cx - radius, cy - radius, 2*radius, 2*radius, radius, radius,
+                line_width, color);
+        }
+    }
+    void fill_ellipse(int x, int y, int width, int height, uint32_t color) {
+        self().draw_rounded_box(x, y, width, height, width*0.5f, height*0.5f, 0, color);
+    }
+    void stroke_ellipse(int x, int y, int width, int height, int line_width, uint32_t color) {
+        if (line_width > 0) {
+            self().draw_rounded_box(x, y, width, height, width*0.5f, height*0.5f, line_width, color);
+        }
+    }
+
+private:
+    Context& self() { return static_cast<Context&>(*this); }
+};
+
+/**
+ * A context and a set of functions for simple drawing into a memory buffer,
+ * with the pixel format fixed at compile time by the Format traits
+ * (one of the *Traits structs above); every primitive is instantiated
+ * separately for each format, so there is no per-pixel format switch.
+ * Does not hold any heap-allocated data by itself (destructor is trivial).
+ *
+ * The context is a view into the buffer (see DrawingView and subview());
+ * rows of the buffer are stride() pixels apart, which may be more than
+ * the width (e.g. for atlases or padded buffers).
+ */
+template<class Format>
+struct BasicDrawingContext : public DrawingView, public RoundedShapes<BasicDrawingContext<Format>> {
+public:
+    using format_traits = Format;
+    using pixel_type = typename Format::pixel_type;
+
+protected:
+    pixel_type* m_pixels = nullptr; // first pixel of the whole buffer
+    int m_stride = 0;               // distance between rows, in pixels
+
+    /// Returns the address of a pixel given in buffer coordinates.
+    pixel_type* buffer_address(int x, int y) const {
+        return m_pixels + (intptr_t)y*m_stride + x;
+    }
+
+public:
+    BasicDrawingContext(pixel_type* pixels, int width, int height);
+    BasicDrawingContext(pixel_type* pixels, int width, int height, int stride);
+
+    /** Returns the pixel format of the underlying buffer. */
+    static PixelFormat format() { return Format::format; }
+
+    /** Returns the distance between two rows of the buffer, in pixels. */
+    int stride() const { return m_stride; }
+
+    /**
+     * Returns a context for the given sub-rectangle of this view,
+     * with the origin moved to (x, y) and clipped by the current clip.
+     * The pixels are shared, nothing is copied. The clip stack
+     * of the new context starts empty.
+     */
+    BasicDrawingContext subview(int x, int y, int width, int height) const;
+
+    void xline(int x, int y, int width, uint32_t color);
+    void yline(int x, int y, int height, uint32_t color);
+    void draw_rect(int x, int y, int width, int height, uint32_t color);
+    void fill_rect(int x, int y, int width, int height, uint32_t color);
+
+    /**
+     * Blends the color into the view through an A8 coverage mask
+     * of the given size placed at (x, y): each pixel receives the color
+     * with its alpha multiplied by the mask value. The mask rows are
+     * mask_stride bytes apart. Used for glyphs and anti-aliased shapes.
+     */
+    void blit_mask(int x, int y, uint8_t const* mask, int mask_stride,
+        int width, int height, uint32_t color);
+
+    /**
+     * Composites an image of premultiplied ARGB pixels of the given size,
+     * placed at (x, y), over the view. The image rows are image_stride
+     * pixels apart. The version identifies the image content for
+     * a RecordingContext (see blit_image() there) and is ignored here.
+     */
+    void blit_image(int x, int y, uint32_t const* image, int image_stride,
+        int width, int height, uint64_t version = 0);
+
+    /**
+     * Fills the path with the color, anti-aliased, blending it over what is
+     * already there. Only the pixels the path covers are touched.
+     */
+    void fill_path(PathView const& path, uint32_t color, FillRule rule = FillRule::NonZero);
+
+    /**
+     * Blurs the pixels in the rectangle (see blur_argb32()), with the pixels
+     * beyond its edges taken as copies of the edge, e.g. for a frosted panel.
+     * As this reads back what was drawn, there is no recorded equivalent.
+     * Throws std::logic_error for RGB565, which is not supported.
+     */
+    void blur(int x, int y, int width, int height, float radius, ThreadPool* pool = nullptr);
+
+    /**
+     * Moves the content of the rectangle by (dx, dy), in place: pixels
+     * are taken only from inside the rectangle (and the clip), and the
+     * strip the move exposes keeps its old content for the caller
+     * to repaint (see scroll_exposed()). Rows are moved with memmove(),
+     * which is vectorized and safe for the overlapping rows.
+     * As this reads back what was drawn, there is no recorded equivalent.
+     */
+    void scroll(int x, int y, int width, int height, int dx, int dy);
+
+    /**
+     * Draws a box with its corners rounded to quarter ellipses with radii
+     * rx and ry (limited to half the size), anti-aliased and blended over
+     * what is already there. If line_width is positive, only a band of that
+     * width inside the outline is drawn (a stroke), otherwise the box is filled.
+     *
+     * Rows are drawn as spans: the covered middle of a row is filled
+     * in one go and only the pixels the edge crosses are anti-aliased,
+     * with the coverage taken from a cached CornerMask, so drawing the same
+     * rounded panel again costs about as much as a fill_rect().
+     */
+    void draw_rounded_box(int x, int y, int width, int height,
+        float rx, float ry, int line_width, uint32_t color);
+};
+
+// the primitives are compiled in draw.cpp for exactly these formats
+extern template struct BasicDrawingContext<XRGB8888Traits>;
+extern template struct BasicDrawingContext<ARGB8888Traits>;
+extern template struct BasicDrawingContext<RGB565Traits>;
+extern template struct BasicDrawingContext<A8Traits>;
+
+/// The drawing context for window frames.
+using DrawingContext = BasicDrawingContext<XRGB8888Traits>;
+
+/**
+ * A drawing context whose pixel format is chosen at run time.
+ * Each call is dispatched once to the context instantiated for the right
+ * format, which then runs without any further format checks.
+ * Like the contexts themselves, this is a small value type.
+ */
+class AnyDrawingContext : public RoundedShapes<AnyDrawingContext> {
+protected:
+    std::variant<
+        BasicDrawingContext<XRGB8888Traits>,
+        BasicDrawingContext<ARGB8888Traits>,
+        BasicDrawingContext<RGB565Traits>,
+        BasicDrawingContext<A8Traits>> m_context;
+
+public:
+    template<class Format>
+    AnyDrawingContext(BasicDrawingContext<Format> const& context) : m_context(context) {}
+
+    /// Wraps raw pixel memory; the stride is in pixels of the given format.
+    AnyDrawingContext(PixelFormat format, void* pixels, int width, int height, int stride);
+
+    PixelFormat format() const;
+    int width() const;
+    int height() const;
+    int stride() const;
+    Rect clip_rect() const;
+
+    /// Returns the statically typed context, or nullptr if the format differs.
+    template<class Format>
+    BasicDrawingContext<Format>* get_if() {
+        return std::get_if<BasicDrawingContext<Format>>(&m_context);
+    }
+
+    AnyDrawingContext subview(int x, int y, int width, int height) const;
+    void push_clip(int x, int y, int width, int height);
+    void push_clip(Rect const& rect) { push_clip(rect.x, rect.y, rect.width, rect.height); }
+    void pop_clip();
+
+    void xline(int x, int y, int width, uint32_t color);
+    void yline(int x, int y, int height, uint32_t color);
+    void draw_rect(int x, int y, int width, int height, uint32_t color);
+    void fill_rect(int x, int y, int width, int height, uint32_t color);
+    void blit_mask(int x, int y, uint8_t const* mask, int mask_stride,
+        int width, int height, uint32_t color);
+    void blit_image(int x, int y, uint32_t const* image, int image_stride,
+        int width, int height, uint64_t version = 0);
+    void fill_path(PathView const& path, uint32_t color, FillRule rule = FillRule::NonZero);
+    void blur(int x, int y, int width, int height, float radius, ThreadPool* pool = nullptr);
+    void scroll(int x, int y, int width, int height, int dx, int dy);
+    void draw_rounded_box(int x, int y, int width, int height,
+        float rx, float ry, int line_width, uint32_t color);
 };
@@ -0,0 +1,94 @@
+#include "event_loop.hpp"
+#include "app.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+
+wayland::EventLoop::EventLoop(wl::Connection& connection)
+    : m_connection(connection)
+{
+}
+
+wayland::EventLoop::Watch* wayland::EventLoop::find(int fd) {
+    for (auto& watch : m_watches) {
+        if (watch->fd == fd) { return watch.get(); }
+    }
+    return nullptr;
+}
+
+void wayland::EventLoop::watch(int fd, short events, Handler handler) {
+    assert(fd >= 0);
+    Watch* watch = find(fd);
+    if (watch && m_dispatching) {
+        // its handler may be the one being called, keep it until the end
+        watch->fd = -1;
+        watch = nullptr;
+    }
+    if (!watch) {
+        m_watches.push_back(std::make_unique<Watch>());
+        watch = m_watches.back().get();
+        watch->fd = fd;
+    }
+    watch->events = events;
+    watch->handler = std::move(handler);
+}
+
+void wayland::EventLoop::unwatch(int fd) {
+    Watch* watch = find(fd);
+    if (!watch) { return; }
+    watch->fd = -1;
+    if (!m_dispatching) {
+        remove_unwatched();
+    }
+}
+
+void wayland::EventLoop::remove_unwatched() {
+    m_watches.erase(std::remove_if(m_watches.begin(), m_watches.end(),
+        [](auto const& watch) { return watch->fd < 0; }), m_watches.end());
+}
+
+int wayland::EventLoop::dispatch(int timeout_ms) {
+    wl_display* display = m_connection.get();
+
+    // events already read (e.g. by a roundtrip) must be dispatched before waiting
+    while (wl_display_prepare_read(display) != 0) {
+        if (wl_display_dispatch_pending(display) < 0) {
+            return -1;
+        }
+    }
+    wl_display_flush(display);
+
+    m_pollfds.clear();
+    m_pollfds.push_back(pollfd { wl_display_get_fd(display), POLLIN, 0 });
+    for (auto& watch : m_watches) {
+        m_pollfds.push_back(pollfd { watch->fd, watch->events, 0 });
+    }
+
+    int ready = poll(m_pollfds.data(), m_pollfds.size(), timeout_ms);
+    if (ready < 0) {
+        wl_display_cancel_read(display);
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (m_pollfds[0].revents & (POLLIN|POLLERR|POLLHUP)) {
+        if (wl_display_read_events(display) < 0) {
+            return -1;
+        }
+    }
+    else {
+        wl_display_cancel_read(display);
+    }
+
+    // handlers may watch and unwatch; the list is only appended to meanwhile
+    m_dispatching = true;
+    for (size_t i = 1; i < m_pollfds.size(); i++) {
+        if (!m_pollfds[i].revents) { continue; }
+        Watch* watch = find(m_pollfds[i].fd);
+        if (watch) {
+            watch->handler(m_pollfds[i].revents);
+        }
+    }
+    m_dispatching = false;
+    remove_unwatched();
+
+    return wl_display_dispatch_pending(display);
+}
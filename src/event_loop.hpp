@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <poll.h>
+
+namespace wl {
+class Connection;
+}
+
+namespace wayland {
+
+/**
+ * Waits for events of the Wayland connection together with other file
+ * descriptors (timers, pipes, sockets) with a single poll(), so the app
+ * sleeps until something happens, whatever it is. Wayland events are
+ * read and dispatched as by wl_display_dispatch(); for each watched
+ * descriptor that became ready, its handler is called.
+ */
+class EventLoop {
+public:
+    /// Called with the poll() revents of the descriptor (POLLIN, POLLOUT, POLLHUP...).
+    using Handler = std::function<void(short revents)>;
+
+protected:
+    struct Watch {
+        int fd = -1;            // -1 once unwatched
+        short events = 0;
+        Handler handler;
+    };
+
+    wl::Connection& m_connection;
+    std::vector<std::unique_ptr<Watch>> m_watches;
+    std::vector<pollfd> m_pollfds;          // kept between calls to avoid reallocation
+    bool m_dispatching = false;
+
+    Watch* find(int fd);
+    void remove_unwatched();
+
+public:
+    explicit EventLoop(wl::Connection& connection);
+    EventLoop(EventLoop const&) = delete;
+    EventLoop& operator=(EventLoop const&) = delete;
+
+    /**
+     * Calls the handler whenever the descriptor is ready for any of
+     * the events (POLLIN, POLLOUT); watching a watched descriptor again
+     * replaces its events and handler. Can be called from handlers.
+     */
+    void watch(int fd, short events, Handler handler);
+
+    /// Stops watching the descriptor (before closing it). Can be called from handlers.
+    void unwatch(int fd);
+
+    /**
+     * Flushes the requests, waits until there are Wayland events or a watched
+     * descriptor is ready (at most timeout_ms, or forever if negative),
+     * then dispatches the Wayland events and calls the handlers.
+     * Returns the number of dispatched Wayland events, or -1 if
+     * the connection failed.
+     */
+    int dispatch(int timeout_ms = -1);
+};
+
+} // namespace wayland
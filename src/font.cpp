@@ -0,0 +1,421 @@
+#include "font.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+static uint32_t read_le16(uint8_t const* p) {
+    return p[0] | (uint32_t) p[1] << 8;
+}
+
+static uint32_t read_le32(uint8_t const* p) {
+    return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+uint32_t decode_utf8(std::string_view text, size_t& pos) {
+    auto bytes = (uint8_t const*) text.data();
+    uint32_t c = bytes[pos++];
+    if (c < 0x80) { return c; }
+
+    int extra;
+    uint32_t min;
+    if ((c & 0xE0) == 0xC0) { extra = 1; min = 0x80; c &= 0x1F; }
+    else if ((c & 0xF0) == 0xE0) { extra = 2; min = 0x800; c &= 0x0F; }
+    else if ((c & 0xF8) == 0xF0) { extra = 3; min = 0x10000; c &= 0x07; }
+    else { return REPLACEMENT_CHARACTER; }
+
+    if (pos + extra > text.size()) { return REPLACEMENT_CHARACTER; }
+    for (int i = 0; i < extra; ++i) {
+        if ((bytes[pos + i] & 0xC0) != 0x80) { return REPLACEMENT_CHARACTER; }
+        c = (c << 6) | (bytes[pos + i] & 0x3F);
+    }
+    if (c < min || c > 0x10FFFF) { return REPLACEMENT_CHARACTER; }
+    pos += extra;
+    return c;
+}
+
+// GlyphAtlas ----------------------------------------------------------------
+
+uint8_t* GlyphAtlas::allocate(int width, int height) {
+    if (width < 0 || height < 0 || width > PAGE_SIZE || height > PAGE_SIZE) {
+        throw std::logic_error("GlyphAtlas: glyph does not fit in a page");
+    }
+
+    // start a new shelf when the current one is full, a new page when out of shelves
+    if (!m_pages.empty() && m_shelf_x + width > PAGE_SIZE) {
+        m_shelf_y += m_shelf_height;
+        m_shelf_x = 0;
+        m_shelf_height = 0;
+    }
+    if (m_pages.empty() || m_shelf_y + height > PAGE_SIZE) {
+        m_pages.emplace_back(new uint8_t[PAGE_SIZE*PAGE_SIZE]());
+        m_shelf_x = 0;
+        m_shelf_y = 0;
+        m_shelf_height = 0;
+    }
+
+    uint8_t* result = m_pages.back().get() + m_shelf_y*PAGE_SIZE + m_shelf_x;
+    m_shelf_x += width;
+    m_shelf_height = std::max(m_shelf_height, height);
+    return result;
+}
+
+// BitmapFont ----------------------------------------------------------------
+
+BitmapFont::BitmapFont(std::string const& path)
+    : m_file(path)
+{
+    uint8_t const* data = m_file.data();
+    size_t size = m_file.size();
+
+    m_fallback = -1;
+    if (size >= 4 && data[0] == 0x36 && data[1] == 0x04) {
+        load_psf1(path);
+    }
+    else if (size >= 32 && read_le32(data) == 0x864AB572) {
+        load_psf2(path);
+    }
+    else if (size >= 9 && memcmp(data, "STARTFONT", 9) == 0) {
+        load_bdf(path);
+    }
+    else {
+        throw std::runtime_error("BitmapFont: " + path + " is not a PSF or BDF font");
+    }
+    if (m_sources.empty()) {
+        throw std::runtime_error("BitmapFont: " + path + " contains no glyphs");
+    }
+
+    if (m_fallback < 0) {
+        auto it = m_index.find('?');
+        m_fallback = (it != m_index.end()) ? it->second : 0;
+    }
+
+    // ASCII is looked up in a plain array, everything else in the hash map
+    for (uint32_t c = 0; c < 128; ++c) {
+        auto it = m_index.find(c);
+        if (it != m_index.end()) {
+            m_ascii[c] = it->second;
+            m_index.erase(it);
+        }
+        else {
+            m_ascii[c] = m_fallback;
+        }
+    }
+
+    m_glyphs.resize(m_sources.size());
+    m_rendered.assign(m_sources.size(), 0);
+}
+
+void BitmapFont::map_code_point(uint32_t code_point, int glyph_index) {
+    // when a character is listed twice, the first glyph wins
+    m_index.emplace(code_point, glyph_index);
+}
+
+/**
+ * PSF1: a 4-byte header, 256 or 512 glyphs 8 pixels wide, optionally
+ * followed by a table of 16-bit code points for each glyph
+ * (terminated by 0xFFFF; 0xFFFE starts combining sequences, which are skipped).
+ */
+void BitmapFont::load_psf1(std::string const& path) {
+    uint8_t const* data = m_file.data();
+    size_t size = m_file.size();
+    int mode = data[2];
+    int char_size = data[3];
+    int count = (mode & 0x01) ? 512 : 256;
+
+    size_t table = 4 + (size_t) count*char_size;
+    if (char_size == 0 || table > size) {
+        throw std::runtime_error("BitmapFont: " + path + " is truncated or corrupt");
+    }
+
+    m_ascent = char_size;
+    m_descent = 0;
+    m_sources.resize(count);
+    for (int i = 0; i < count; ++i) {
+        GlyphSource& source = m_sources[i];
+        source.offset = 4 + (size_t) i*char_size;
+        source.metrics.width = 8;
+        source.metrics.height = char_size;
+        source.metrics.y_offset = -char_size;
+        source.metrics.advance = 8;
+    }
+
+    if (!(mode & 0x06)) {
+        for (int i = 0; i < count; ++i) { map_code_point(i, i); }
+        return;
+    }
+    size_t pos = table;
+    for (int i = 0; i < count && pos + 2 <= size; ++i) {
+        bool in_sequence = false;
+        for (; pos + 2 <= size; pos += 2) {
+            uint32_t value = read_le16(data + pos);
+            if (value == 0xFFFF) { pos += 2; break; }
+            if (value == 0xFFFE) { in_sequence = true; }
+            else if (!in_sequence) { map_code_point(value, i); }
+        }
+    }
+}
+
+/**
+ * PSF2: a header of 32-bit fields, glyphs of any size, and optionally
+ * a table of UTF-8 strings for each glyph (terminated by 0xFF;
+ * 0xFE starts combining sequences, which are skipped).
+ */
+void BitmapFont::load_psf2(std::string const& path) {
+    uint8_t const* data = m_file.data();
+    size_t size = m_file.size();
+    uint32_t header_size = read_le32(data + 8);
+    uint32_t flags = read_le32(data + 12);
+    uint32_t count = read_le32(data + 16);
+    uint32_t char_size = read_le32(data + 20);
+    uint32_t height = read_le32(data + 24);
+    uint32_t width = read_le32(data + 28);
+
+    if (width == 0 || height == 0 || width > GlyphAtlas::PAGE_SIZE || height > GlyphAtlas::PAGE_SIZE
+        || char_size < height*((width + 7)/8) || count == 0 || count > 0x110000
+        || header_size < 32 || header_size > size
+        || (size - header_size)/char_size < count) {
+        throw std::runtime_error("BitmapFont: " + path + " is truncated or corrupt");
+    }
+
+    m_ascent = height;
+    m_descent = 0;
+    m_sources.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        GlyphSource& source = m_sources[i];
+        source.offset = header_size + (size_t) i*char_size;
+        source.metrics.width = width;
+        source.metrics.height = height;
+        source.metrics.y_offset = -(int) height;
+        source.metrics.advance = width;
+    }
+
+    if (!(flags & 0x01)) {
+        for (uint32_t i = 0; i < count; ++i) { map_code_point(i, i); }
+        return;
+    }
+    size_t pos = header_size + (size_t) count*char_size;
+    for (uint32_t i = 0; i < count && pos < size; ++i) {
+        bool in_sequence = false;
+        while (pos < size) {
+            uint8_t byte = data[pos];
+            if (byte == 0xFF) { pos++; break; }
+            if (byte == 0xFE) { in_sequence = true; pos++; continue; }
+            uint32_t code_point = decode_utf8(std::string_view((char const*) data, size), pos);
+            if (!in_sequence) { map_code_point(code_point, i); }
+        }
+    }
+}
+
+/**
+ * BDF: a text format with one STARTCHAR ... ENDCHAR block per glyph,
+ * giving its encoding, metrics and the bitmap as rows of hex digits.
+ * Only the offset of the bitmap is remembered here; it is decoded
+ * in render_glyph().
+ */
+void BitmapFont::load_bdf(std::string const& path) {
+    char const* data = (char const*) m_file.data();
+    size_t size = m_file.size();
+    m_is_bdf = true;
+
+    int box_width = 0, box_height = 0, box_x = 0, box_y = 0;
+    int ascent = -1, descent = -1;
+    long default_char = -1;
+
+    // the glyph being parsed
+    bool in_char = false;
+    long encoding = -1;
+    GlyphSource source;
+
+    size_t pos = 0;
+    while (pos < size) {
+        size_t line_end = pos;
+        while (line_end < size && data[line_end] != '\n') { ++line_end; }
+        size_t next = line_end < size ? line_end + 1 : size;
+
+        // sscanf needs a terminated string; no line that matters is long
+        char line[128];
+        size_t length = std::min(line_end - pos, sizeof(line) - 1);
+        memcpy(line, data + pos, length);
+        line[length] = 0;
+
+        int a, b, c, d;
+        long value;
+        if (!in_char) {
+            if (sscanf(line, "FONTBOUNDINGBOX %d %d %d %d", &a, &b, &c, &d) == 4) {
+                box_width = a; box_height = b; box_x = c; box_y = d;
+            }
+            else if (sscanf(line, "FONT_ASCENT %d", &a) == 1) { ascent = a; }
+            else if (sscanf(line, "FONT_DESCENT %d", &a) == 1) { descent = a; }
+            else if (sscanf(line, "DEFAULT_CHAR %ld", &value) == 1) { default_char = value; }
+            else if (strncmp(line, "STARTCHAR", 9) == 0) {
+                in_char = true;
+                encoding = -1;
+                source = GlyphSource();
+                source.metrics.width = box_width;
+                source.metrics.height = box_height;
+                source.metrics.x_offset = box_x;
+                source.metrics.y_offset = -(box_y + box_height);
+                source.metrics.advance = box_width;
+            }
+        }
+        else if (sscanf(line, "ENCODING %ld", &value) == 1) { encoding = value; }
+        else if (sscanf(line, "DWIDTH %d", &a) == 1) { source.metrics.advance = a; }
+        else if (sscanf(line, "BBX %d %d %d %d", &a, &b, &c, &d) == 4) {
+            if (a < 0 || b < 0 || a > GlyphAtlas::PAGE_SIZE || b > GlyphAtlas::PAGE_SIZE) {
+                throw std::runtime_error("BitmapFont: " + path + " has a glyph of invalid size");
+            }
+            source.metrics.width = a;
+            source.metrics.height = b;
+            source.metrics.x_offset = c;
+            source.metrics.y_offset = -(d + b);
+        }
+        else if (strncmp(line, "BITMAP", 6) == 0) {
+            source.offset = next;
+        }
+        else if (strncmp(line, "ENDCHAR", 7) == 0) {
+            in_char = false;
+            if (encoding >= 0 && source.offset != 0) {
+                int index = (int) m_sources.size();
+                m_sources.push_back(source);
+                map_code_point((uint32_t) encoding, index);
+                if (encoding == default_char) { m_fallback = index; }
+            }
+        }
+        pos = next;
+    }
+
+    m_ascent = ascent >= 0 ? ascent : box_height + box_y;
+    m_descent = descent >= 0 ? descent : -box_y;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    return -1;
+}
+
+void BitmapFont::render_glyph(int glyph_index) {
+    GlyphSource const& source = m_sources[glyph_index];
+    Glyph glyph = source.metrics;
+    int width = glyph.width;
+    int height = glyph.height;
+    int row_bytes = (width + 7)/8;
+
+    uint8_t const* data = m_file.data();
+    size_t size = m_file.size();
+    size_t pos = source.offset;
+
+    uint8_t* mask = (width > 0 && height > 0) ? m_atlas.allocate(width, height) : nullptr;
+    bool blank = true;
+    uint8_t bits[GlyphAtlas::PAGE_SIZE/8];
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t const* row = bits;
+        if (m_is_bdf) {
+            // one line of hex digits per row; missing digits are zero
+            memset(bits, 0, row_bytes);
+            for (int i = 0; i < row_bytes*2 && pos < size; ++i, ++pos) {
+                int value = hex_value((char) data[pos]);
+                if (value < 0) { break; }
+                bits[i/2] |= (i & 1) ? value : value << 4;
+            }
+            while (pos < size && data[pos] != '\n') { ++pos; }
+            if (pos < size) { ++pos; }
+        }
+        else {
+            // the loader checked that all bitmaps are inside the file
+            row = data + pos + (size_t) y*row_bytes;
+        }
+
+        uint8_t* out = mask + y*m_atlas.stride();
+        for (int x = 0; x < width; ++x) {
+            if (row[x >> 3] & (0x80 >> (x & 7))) {
+                out[x] = 255;
+                blank = false;
+            }
+        }
+    }
+
+    if (!blank) {
+        glyph.mask = mask;
+        glyph.stride = m_atlas.stride();
+    }
+    m_glyphs[glyph_index] = glyph;
+    m_rendered[glyph_index] = 1;
+}
+
+// TextRunCache --------------------------------------------------------------
+
+void TextRunCache::layout(BitmapFont& font, std::string_view text, TextRun& run) {
+    run.glyphs.clear();
+    int pen = 0;
+    int ascent = font.ascent();
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        Glyph const& glyph = font.glyph(decode_utf8(text, pos));
+        if (glyph.mask) {
+            PlacedGlyph placed;
+            placed.mask = glyph.mask;
+            placed.stride = glyph.stride;
+            placed.x = pen + glyph.x_offset;
+            placed.y = ascent + glyph.y_offset;
+            placed.width = glyph.width;
+            placed.height = glyph.height;
+            run.glyphs.push_back(placed);
+        }
+        pen += glyph.advance;
+    }
+    run.width = pen;
+    run.height = font.line_height();
+}
+
+TextRun const& TextRunCache::get(BitmapFont& font, std::string_view text) {
+    static stats::Counter& hits = stats::counter("text.run_cache_hits");
+    static stats::Counter& misses = stats::counter("text.run_cache_misses");
+
+    // FNV-1a over the text, seeded with the font
+    uint64_t key = 0xcbf29ce484222325ULL ^ (uint64_t)(uintptr_t) &font;
+    for (char c : text) {
+        key = (key ^ (uint8_t) c) * 0x100000001b3ULL;
+    }
+
+    std::list<Entry>::iterator entry;
+    auto found = m_lookup.find(key);
+    if (found != m_lookup.end()) {
+        entry = found->second;
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+        if (entry->font == &font && entry->text == text) {
+            hits.add();
+            return entry->run;
+        }
+        // a hash collision; the old entry is replaced
+    }
+    else if (m_entries.size() >= m_capacity) {
+        // reuse the least recently used entry, including its memory
+        entry = std::prev(m_entries.end());
+        m_lookup.erase(entry->key);
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+    }
+    else {
+        entry = m_entries.emplace(m_entries.begin());
+    }
+    misses.add();
+
+    entry->key = key;
+    entry->font = &font;
+    entry->text.assign(text.data(), text.size());
+    layout(font, text, entry->run);
+    m_lookup[key] = entry;
+    return entry->run;
+}
+
+void TextRunCache::clear() {
+    m_entries.clear();
+    m_lookup.clear();
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "mapped_file.hpp"
+
+/**
+ * Decodes the UTF-8 character at pos and moves pos past it (pos must be
+ * less than the length). Malformed input gives U+FFFD and skips one byte.
+ */
+uint32_t decode_utf8(std::string_view text, size_t& pos);
+
+/**
+ * Storage for glyph images: A8 coverage masks packed into fixed-size pages
+ * in rows ("shelves"). Pages are never moved or freed while the atlas
+ * exists, so a mask pointer stays valid and can be recorded in a display list.
+ */
+class GlyphAtlas {
+public:
+    /// Width and height of a page; also the largest glyph that fits.
+    static const int PAGE_SIZE = 512;
+
+protected:
+    std::vector<std::unique_ptr<uint8_t[]>> m_pages;
+    int m_shelf_x = 0;          // free space on the current shelf of the last page
+    int m_shelf_y = 0;
+    int m_shelf_height = 0;
+
+public:
+    GlyphAtlas() {}
+    GlyphAtlas(GlyphAtlas const&) = delete;
+    GlyphAtlas& operator=(GlyphAtlas const&) = delete;
+
+    /**
+     * Reserves a zeroed area of the given size and returns its first byte;
+     * rows are stride() bytes apart. Throws std::logic_error if the size
+     * exceeds PAGE_SIZE.
+     */
+    uint8_t* allocate(int width, int height);
+
+    /** Returns the distance between rows of a page, in bytes. */
+    int stride() const { return PAGE_SIZE; }
+
+    /** Returns the number of bytes taken by the pages. */
+    size_t memory_used() const { return m_pages.size()*PAGE_SIZE*PAGE_SIZE; }
+};
+
+/// A rendered glyph and how to place it relative to the pen position.
+struct Glyph {
+    uint8_t const* mask = nullptr;  // first byte of the image in the atlas (null if blank)
+    int stride = 0;                 // distance between rows of the image
+    int16_t width = 0;              // of the image
+    int16_t height = 0;
+    int16_t x_offset = 0;           // of the image's top-left corner from the pen position
+    int16_t y_offset = 0;           // (the pen is on the baseline, y grows downwards)
+    int16_t advance = 0;            // how far the pen moves after the glyph
+};
+
+/**
+ * A bitmap font loaded from a PSF (version 1 or 2, the Linux console format)
+ * or BDF file. The file is mapped into memory rather than read; each glyph
+ * is converted to an A8 mask in the atlas the first time it is used.
+ * Throws std::runtime_error if the file cannot be loaded.
+ */
+class BitmapFont {
+protected:
+    /// Where the 1-bit image of a glyph is in the file, and its metrics.
+    struct GlyphSource {
+        size_t offset = 0;          // PSF: first byte of the bitmap; BDF: first hex line
+        Glyph metrics;              // everything except the mask
+    };
+
+    MappedFile m_file;
+    bool m_is_bdf = false;
+    int m_ascent = 0;
+    int m_descent = 0;
+
+    std::vector<GlyphSource> m_sources;         // by glyph index
+    std::vector<Glyph> m_glyphs;                // by glyph index, when rendered
+    std::vector<uint8_t> m_rendered;
+    int m_ascii[128];                           // glyph index for ASCII characters
+    std::unordered_map<uint32_t, int> m_index;  // glyph index for other code points
+    int m_fallback = 0;                         // glyph for missing characters
+    GlyphAtlas m_atlas;
+
+    void load_psf1(std::string const& path);
+    void load_psf2(std::string const& path);
+    void load_bdf(std::string const& path);
+    void map_code_point(uint32_t code_point, int glyph_index);
+    void render_glyph(int glyph_index);
+
+public:
+    explicit BitmapFont(std::string const& path);
+    BitmapFont(BitmapFont const&) = delete;
+    BitmapFont& operator=(BitmapFont const&) = delete;
+
+    /** Returns the distance from the top of a line to the baseline. */
+    int ascent() const { return m_ascent; }
+
+    /** Returns the distance from the baseline to the bottom of a line. */
+    int descent() const { return m_descent; }
+
+    /** Returns the height of a line of text. */
+    int line_height() const { return m_ascent + m_descent; }
+
+    /** Returns the number of glyphs in the font. */
+    size_t glyph_count() const { return m_sources.size(); }
+
+    /** Returns the atlas holding the rendered glyphs. */
+    GlyphAtlas const& atlas() const { return m_atlas; }
+
+    /**
+     * Returns the glyph for the Unicode code point (the fallback glyph
+     * if the font has none), rendering it into the atlas on first use.
+     */
+    Glyph const& glyph(uint32_t code_point) {
+        int index = m_fallback;
+        if (code_point < 128) {
+            index = m_ascii[code_point];
+        }
+        else {
+            auto it = m_index.find(code_point);
+            if (it != m_index.end()) { index = it->second; }
+        }
+        if (!m_rendered[index]) { render_glyph(index); }
+        return m_glyphs[index];
+    }
+};
+
+/// A glyph of a laid-out run, relative to the top-left corner of the run.
+struct PlacedGlyph {
+    uint8_t const* mask = nullptr;
+    int32_t stride = 0;
+    int16_t x = 0;
+    int16_t y = 0;
+    int16_t width = 0;
+    int16_t height = 0;
+};
+
+/// A line of text laid out in a font: glyph images with their positions.
+struct TextRun {
+    std::vector<PlacedGlyph> glyphs;    // only those with a non-empty image
+    int width = 0;                      // total advance
+    int height = 0;                     // line height of the font
+};
+
+/**
+ * Remembers the layout of recently drawn text, keyed by (text, font),
+ * so a label that is drawn again costs only the blits. The least recently
+ * used run is dropped (and its memory reused) when the cache is full.
+ * Not thread-safe.
+ */
+class TextRunCache {
+protected:
+    struct Entry {
+        uint64_t key = 0;
+        BitmapFont const* font = nullptr;
+        std::string text;
+        TextRun run;
+    };
+
+    size_t m_capacity;
+    std::list<Entry> m_entries;                     // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_lookup;
+
+    static void layout(BitmapFont& font, std::string_view text, TextRun& run);
+
+public:
+    explicit TextRunCache(size_t capacity = 1024) : m_capacity(capacity > 0 ? capacity : 1) {}
+    TextRunCache(TextRunCache const&) = delete;
+    TextRunCache& operator=(TextRunCache const&) = delete;
+
+    /**
+     * Returns the layout of the (UTF-8) text in the font, laying it out
+     * if it is not cached. The reference is valid until the next call.
+     */
+    TextRun const& get(BitmapFont& font, std::string_view text);
+
+    size_t size() const { return m_entries.size(); }
+    void clear();
+};
+
+/**
+ * Draws a line of UTF-8 text with the top-left corner of the line at (x, y)
+ * and returns its width. Works with any context that has blit_mask()
+ * (the drawing contexts as well as RecordingContext).
+ */
+template<class Context>
+int draw_text(Context& ctx, TextRunCache& cache, BitmapFont& font,
+    int x, int y, std::string_view text, uint32_t color)
+{
+    TextRun const& run = cache.get(font, text);
+    for (auto& glyph : run.glyphs) {
+        ctx.blit_mask(x + glyph.x, y + glyph.y, glyph.mask, glyph.stride,
+            glyph.width, glyph.height, color);
+    }
+    return run.width;
+}
@@ -8,13 +8,27 @@
 
 #include <sys/mman.h>
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 
-wayland::Frame::Frame(wayland::Display& display, int32_t width, int32_t height) {
+wayland::Frame::Frame(wayland::Display& display, int32_t width, int32_t height, uint32_t format) {
     assert(width >= 0 && height >= 0);
+    assert(format == WL_SHM_FORMAT_XRGB8888 || format == WL_SHM_FORMAT_ARGB8888
+        || format == WL_SHM_FORMAT_NV12);
+    if (!display.get_shm().is_format_supported(format)) {
+        throw std::runtime_error("wayland::Frame: pixel format not supported by the compositor");
+    }
 
-    int32_t size = width*height*4;  // 4 bytes per pixel (XRGB or ARGB)
-    int32_t stride = width*4;       // each row is width*4 bytes wide
+    // 4 bytes per pixel (XRGB or ARGB); rows are padded to whole cache lines
+    // so that threads rendering neighbouring tiles never share a cache line
+    int32_t stride = (width*4 + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    int32_t size = stride*height;
+    if (format == WL_SHM_FORMAT_NV12) {
+        // a byte of luma per pixel, then the interleaved chroma plane with half
+        // the rows, right after it and with the same stride (as wl_shm expects)
+        stride = (width + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+        size = stride*height + stride*((height + 1)/2);
+    }
 
     // an anonymous in-memory file to share with the Wayland server
     int fd = memfd_create("frame", MFD_CLOEXEC|MFD_ALLOW_SEALING);
@@ -49,7 +63,7 @@ wayland::Frame::Frame(wayland::Display& display, int32_t width, int32_t height)
 
     // allocate the given size of the buffer from the pool
     std::unique_ptr<wl_buffer, wl_buffer_deleter> buffer {
-        wl_shm_pool_create_buffer(pool.get(), 0, width, height, stride, WL_SHM_FORMAT_XRGB8888)
+        wl_shm_pool_create_buffer(pool.get(), 0, width, height, stride, format)
     };
     if (!buffer) {
         auto orig_errno = errno;
@@ -72,6 +86,8 @@ wayland::Frame::Frame(wayland::Display& display, int32_t width, int32_t height)
     m_size = size;
     m_width = width;
     m_height = height;
+    m_stride = stride;
+    m_format = format;
     m_buffer = std::move(buffer);
 }
 
@@ -81,7 +97,32 @@ wayland::Frame::~Frame() {
 }
 
 void wayland::Frame::attach(wayland::Window& window) {
+    attach(window.get_surface());
+}
+
+void wayland::Frame::attach(wl::Surface& surface) {
     assert(!m_buffer_busy);
     m_buffer_busy = true;
-    wl_surface_attach(window.get_surface().get(), m_buffer.get(), 0, 0);
+    wl_surface_attach(surface.get(), m_buffer.get(), 0, 0);
+}
+
+void wayland::Frame::copy_from(wayland::Frame const& other, Rect const& rect) {
+    copy_from(other, rect, 0, 0);
+}
+
+void wayland::Frame::copy_from(wayland::Frame const& other, Rect const& rect, int dx, int dy) {
+    assert(other.m_width == m_width && other.m_height == m_height);
+    assert(m_format != WL_SHM_FORMAT_NV12 && other.m_format != WL_SHM_FORMAT_NV12);
+    assert(&other != this);
+    Rect bounds(0, 0, m_width, m_height);
+    Rect r = rect.intersected(bounds).translated(dx, dy).intersected(bounds);
+    if (r.is_empty()) { return; }
+
+    auto src = (const uint8_t*) other.m_memory + (r.y - dy)*other.m_stride + (r.x - dx)*4;
+    auto dst = (uint8_t*) m_memory + r.y*m_stride + r.x*4;
+    for (int i = 0; i < r.height; ++i) {
+        memcpy(dst, src, r.width*4);
+        src += other.m_stride;
+        dst += m_stride;
+    }
 }
@@ -2,11 +2,16 @@
 
 #include <wayland-client.h>
 #include <memory>
+#include "rect.hpp"
 
 struct wl_buffer_deleter {
     void operator()(wl_buffer* buf) { wl_buffer_destroy(buf); }
 };
 
+namespace wl {
+class Surface;
+}
+
 namespace wayland {
 
 class Display;
@@ -30,17 +35,50 @@ protected:
     int32_t m_size = 0;
     int32_t m_width = 0;
     int32_t m_height = 0;
+    int32_t m_stride = 0;
+    uint32_t m_format = WL_SHM_FORMAT_XRGB8888;
     std::unique_ptr<wl_buffer, wl_buffer_deleter> m_buffer;
     wl_buffer_listener m_listener = { 0 };
     bool    m_buffer_busy = false;
+    uint64_t m_content_serial = 0;
 public:
-    Frame(wayland::Display& display, int32_t width, int32_t height);
+    static const int32_t CACHE_LINE_SIZE = 64;
+
+    /// Creates a frame with pixels in one of the 32-bit wl_shm formats
+    /// (XRGB8888, or ARGB8888 with premultiplied alpha), or in NV12 (video,
+    /// see write_i420() and write_nv12()) if the compositor supports it.
+    /// Throws std::runtime_error for a format the compositor lacks.
+    Frame(wayland::Display& display, int32_t width, int32_t height,
+        uint32_t format = WL_SHM_FORMAT_XRGB8888);
     ~Frame();
     void attach(wayland::Window& window);
+    void attach(wl::Surface& surface);
     void* get_memory() { return m_memory; }
+
+    /// Returns the plane of a planar frame: for NV12, 0 is the luma (Y)
+    /// plane and 1 the interleaved chroma (UV) one; both have get_stride().
+    uint8_t* get_plane(int index) {
+        return (uint8_t*) m_memory + (index == 0 ? 0 : (size_t) m_stride*m_height);
+    }
     int32_t get_width() const { return m_width; }
     int32_t get_height() const { return m_height; }
+    /// Returns the distance between two rows of the buffer, in bytes.
+    int32_t get_stride() const { return m_stride; }
+    uint32_t get_format() const { return m_format; }
     bool is_busy() const { return m_buffer_busy; }
+
+    /// Returns the serial number of the rendered frame whose image the buffer
+    /// holds, or 0 if its content is undefined (see WaylandApp::render_frame()).
+    uint64_t get_content_serial() const { return m_content_serial; }
+    void set_content_serial(uint64_t serial) { m_content_serial = serial; }
+
+    /// Copies the pixels in the rectangle from another frame of the same size
+    /// (32-bit formats only).
+    void copy_from(Frame const& other, Rect const& rect);
+
+    /// Copies the pixels in the rectangle of another frame of the same size,
+    /// moved by (dx, dy) (e.g. to scroll an older buffer to the latest image).
+    void copy_from(Frame const& other, Rect const& rect, int dx, int dy);
 };
 
 }
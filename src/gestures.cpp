@@ -0,0 +1,276 @@
+#include "gestures.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float PI = 3.14159265f;
+
+void record_latency(GestureType type, uint64_t start_ns) {
+    static stats::Histogram* latencies[] = {
+        &stats::histogram("gesture.tap_latency_us"),
+        &stats::histogram("gesture.long_press_latency_us"),
+        &stats::histogram("gesture.pan_latency_us"),
+        &stats::histogram("gesture.pinch_latency_us"),
+        &stats::histogram("gesture.rotate_latency_us"),
+    };
+    uint64_t now = stats::now_ns();
+    latencies[(int) type]->add(now > start_ns ? (now - start_ns)/1000 : 0);
+}
+
+} // namespace
+
+GestureRecognizer::Point* GestureRecognizer::find_point(int32_t id) {
+    for (auto& point : m_points) {
+        if (point.id == id) { return &point; }
+    }
+    return nullptr;
+}
+
+void GestureRecognizer::reset() {
+    for (auto& point : m_points) {
+        point.id = -1;
+    }
+    m_count = 0;
+    m_fingers_changed = false;
+    clear_sequence();
+}
+
+void GestureRecognizer::clear_sequence() {
+    m_active = false;
+    m_consumed = false;
+    m_moved = false;
+    m_max_count = 0;
+    m_pan = m_pinch = m_rotate = false;
+    m_has_pair = false;
+}
+
+void GestureRecognizer::handle(InputEvent const& event) {
+    switch (event.type) {
+    case InputEventType::TouchDown: {
+        Point* point = find_point(-1);
+        if (!point) { return; }
+        point->id = event.id;
+        point->down = true;
+        point->fresh = true;
+        point->x = point->start_x = event.x;
+        point->y = point->start_y = event.y;
+        m_fingers_changed = true;
+        if (!m_active) {
+            m_active = true;
+            m_start_ns = input_event_time_ns(event);
+            m_surface = event.surface;
+        }
+        break;
+    }
+    case InputEventType::TouchMotion: {
+        Point* point = find_point(event.id);
+        if (!point) { return; }
+        point->x = event.x;
+        point->y = event.y;
+        break;
+    }
+    case InputEventType::TouchUp: {
+        Point* point = find_point(event.id);
+        if (!point) { return; }
+        point->down = false;
+        m_fingers_changed = true;
+        break;
+    }
+    default:
+        return;
+    }
+    if (event.time) {
+        m_time = event.time;
+    }
+}
+
+/// Computes the centroid of the fingers the frame started with (or of all, if none).
+void GestureRecognizer::centroid(float& x, float& y) const {
+    float sum_x = 0.0f, sum_y = 0.0f;
+    int count = 0;
+    for (int pass = 0; pass < 2 && count == 0; pass++) {
+        for (auto& point : m_points) {
+            if (point.id < 0 || (pass == 0 && point.fresh)) { continue; }
+            sum_x += point.x;
+            sum_y += point.y;
+            count++;
+        }
+    }
+    x = count ? sum_x/count : 0.0f;
+    y = count ? sum_y/count : 0.0f;
+}
+
+/// Returns the distance and angle of the two fingers down; false if not exactly two.
+bool GestureRecognizer::pair_geometry(float& span, float& angle) const {
+    Point const* pair[2];
+    int count = 0;
+    for (auto& point : m_points) {
+        if (point.id < 0 || !point.down) { continue; }
+        if (count == 2) { return false; }
+        pair[count++] = &point;
+    }
+    if (count != 2) { return false; }
+    float dx = pair[1]->x - pair[0]->x;
+    float dy = pair[1]->y - pair[0]->y;
+    span = std::sqrt(dx*dx + dy*dy);
+    angle = std::atan2(dy, dx);
+    return true;
+}
+
+InputEvent GestureRecognizer::make_gesture(GestureType type, GesturePhase phase, float value) const {
+    InputEvent event;
+    event.type = InputEventType::Gesture;
+    event.time = m_time;
+    event.received_ns = stats::now_ns();
+    event.surface = m_surface;
+    event.code = (uint32_t) type;
+    event.state = (uint32_t) phase;
+    event.value = value;
+    event.discrete = m_count;
+    centroid(event.x, event.y);
+    return event;
+}
+
+void GestureRecognizer::end_gestures(InputEvent* out, int& count) {
+    if (m_pan) {
+        out[count++] = make_gesture(GestureType::Pan, GesturePhase::End, 0.0f);
+    }
+    if (m_pinch) {
+        out[count++] = make_gesture(GestureType::Pinch, GesturePhase::End, m_scale);
+    }
+    if (m_rotate) {
+        out[count++] = make_gesture(GestureType::Rotate, GesturePhase::End, m_angle);
+    }
+    m_pan = m_pinch = m_rotate = false;
+}
+
+/// Begins a pinch or a rotation of the two fingers, if they went far enough.
+void GestureRecognizer::begin_two_finger_gestures(float span, InputEvent* out, int& count) {
+    if (!m_pinch && m_start_span > 0.0f && std::fabs(span/m_start_span - 1.0f) > m_settings.pinch_threshold) {
+        m_pinch = true;
+        m_scale = span/m_start_span;
+        record_latency(GestureType::Pinch, m_start_ns);
+        out[count++] = make_gesture(GestureType::Pinch, GesturePhase::Begin, m_scale);
+    }
+    if (!m_rotate && std::fabs(m_angle) > m_settings.rotate_threshold) {
+        m_rotate = true;
+        record_latency(GestureType::Rotate, m_start_ns);
+        out[count++] = make_gesture(GestureType::Rotate, GesturePhase::Begin, m_angle);
+    }
+}
+
+int GestureRecognizer::finish_frame(InputEvent* out) {
+    int count = 0;
+    if (!m_active) { return 0; }
+
+    int down = 0;
+    for (auto& point : m_points) {
+        if (point.id >= 0 && point.down) { down++; }
+    }
+    bool fingers_changed = m_fingers_changed;
+    m_fingers_changed = false;
+    m_max_count = std::max(m_max_count, down);
+
+    for (auto& point : m_points) {
+        if (point.id < 0 || !point.down) { continue; }
+        float dx = point.x - point.start_x;
+        float dy = point.y - point.start_y;
+        if (dx*dx + dy*dy > m_settings.slop*m_settings.slop) {
+            m_moved = true;
+        }
+    }
+
+    // the two-finger baseline, and the rotation since it (unwrapped)
+    float span = 0.0f, angle = 0.0f;
+    bool pair = pair_geometry(span, angle);
+    if (pair && (fingers_changed || !m_has_pair)) {
+        m_has_pair = true;
+        m_start_span = span;
+        m_last_angle = angle;
+        m_angle = 0.0f;
+    }
+    else if (pair) {
+        float delta = angle - m_last_angle;
+        if (delta > PI) { delta -= 2*PI; }
+        if (delta < -PI) { delta += 2*PI; }
+        m_angle += delta;
+        m_last_angle = angle;
+    }
+    else {
+        m_has_pair = false;
+    }
+
+    bool recognized = m_pan || m_pinch || m_rotate;
+    if (recognized && (fingers_changed || down == 0)) {
+        // the fingers the gesture was made with are gone
+        m_count = std::max(m_count, down);
+        end_gestures(out, count);
+        m_consumed = true;
+    }
+    else if (recognized) {
+        m_count = down;
+        if (m_pan) {
+            out[count++] = make_gesture(GestureType::Pan, GesturePhase::Update, 0.0f);
+        }
+        if (m_pinch) {
+            m_scale = span/m_start_span;
+            out[count++] = make_gesture(GestureType::Pinch, GesturePhase::Update, m_scale);
+        }
+        if (m_rotate) {
+            out[count++] = make_gesture(GestureType::Rotate, GesturePhase::Update, m_angle);
+        }
+        if (!m_pan && pair) {
+            begin_two_finger_gestures(span, out, count);
+        }
+    }
+    else if (!m_consumed && down > 0) {
+        m_count = down;
+        if (pair) {
+            begin_two_finger_gestures(span, out, count);
+        }
+        if (!m_pinch && !m_rotate && m_moved) {
+            m_pan = true;
+            record_latency(GestureType::Pan, m_start_ns);
+            out[count++] = make_gesture(GestureType::Pan, GesturePhase::Begin, 0.0f);
+        }
+    }
+    else if (!m_consumed && down == 0) {
+        uint64_t duration = stats::now_ns() - m_start_ns;
+        if (m_max_count == 1 && !m_moved && duration <= uint64_t(m_settings.tap_ms)*1000000) {
+            m_count = 1;
+            record_latency(GestureType::Tap, m_start_ns);
+            out[count++] = make_gesture(GestureType::Tap, GesturePhase::End, 0.0f);
+        }
+    }
+
+    // lifted fingers are forgotten once the frame is done
+    for (auto& point : m_points) {
+        if (point.id >= 0 && !point.down) { point.id = -1; }
+        point.fresh = false;
+    }
+    m_count = down;
+    if (down == 0) {
+        clear_sequence();
+    }
+    return count;
+}
+
+uint64_t GestureRecognizer::long_press_deadline_ns() const {
+    if (!m_active || m_consumed || m_moved || m_max_count != 1 || m_pan) {
+        return 0;
+    }
+    return m_start_ns + uint64_t(m_settings.long_press_ms)*1000000;
+}
+
+int GestureRecognizer::check_long_press(uint64_t now_ns, InputEvent* out) {
+    uint64_t deadline = long_press_deadline_ns();
+    if (!deadline || now_ns < deadline || m_count != 1) {
+        return 0;
+    }
+    m_consumed = true;
+    record_latency(GestureType::LongPress, m_start_ns);
+    out[0] = make_gesture(GestureType::LongPress, GesturePhase::End, 0.0f);
+    return 1;
+}
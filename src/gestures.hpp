@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include "input.hpp"
+
+/// Kinds of gestures (InputEvent::code of InputEventType::Gesture events).
+enum class GestureType : uint32_t {
+    Tap,            ///< a short touch of one finger without moving
+    LongPress,      ///< one finger held without moving
+    Pan,            ///< fingers moving together; x, y is their centroid
+    Pinch,          ///< two fingers moving apart or together; value is the scale since the start
+    Rotate,         ///< two fingers turning; value is the angle since the start (radians, clockwise)
+};
+
+/// Phases of gestures (InputEvent::state of InputEventType::Gesture events).
+enum class GesturePhase : uint32_t {
+    Begin,
+    Update,
+    End,            ///< also the only event of a tap or a long press
+};
+
+/**
+ * Recognizes gestures in the touch events of a seat, a touch frame at
+ * a time (wl_touch.frame): tap, long press, pan, and pinch and rotation
+ * with two fingers (which may be recognized together). A touch sequence
+ * (from the first finger down to the last one up) gives at most one tap or
+ * long press, or one set of continuous gestures (a pinch and a rotation
+ * can begin at different times); once the number of
+ * fingers changes during a recognized gesture, the gesture ends and
+ * nothing more is recognized until all fingers are up.
+ *
+ * Gestures come out as InputEvents of type Gesture: the code is the
+ * GestureType, the state the GesturePhase, x and y the centroid of the
+ * fingers, discrete the number of fingers. All state is in fixed arrays;
+ * nothing is allocated per event. The time from the first touch to the
+ * recognition goes to the gesture.*_latency_us statistics.
+ */
+class GestureRecognizer {
+public:
+    struct Settings {
+        float slop = 16.0f;                 // moving less than this (px) is not moving
+        int tap_ms = 300;                   // longest touch that is a tap
+        int long_press_ms = 500;            // shortest hold that is a long press
+        float pinch_threshold = 0.1f;       // relative change of the finger distance
+        float rotate_threshold = 0.26f;     // radians (15 degrees)
+    };
+
+    static const int MAX_POINTS = 16;
+
+    /// The most gesture events one call can produce.
+    static const int MAX_OUTPUT = 8;
+
+protected:
+    struct Point {
+        int32_t id = -1;                    // -1 if the slot is free
+        bool down = false;                  // false once lifted in this frame
+        bool fresh = false;                 // put down in this frame
+        float x = 0.0f;
+        float y = 0.0f;
+        float start_x = 0.0f;
+        float start_y = 0.0f;
+    };
+
+    Settings m_settings;
+    Point m_points[MAX_POINTS];
+    int m_count = 0;                        // of fingers down, as of the last frame
+    bool m_fingers_changed = false;         // in the current frame
+    bool m_moved = false;
+
+    // the current touch sequence
+    bool m_active = false;
+    bool m_consumed = false;
+    int m_max_count = 0;
+    uint64_t m_start_ns = 0;
+    uint32_t m_time = 0;                    // of the last touch event
+    wl_surface* m_surface = nullptr;
+
+    // recognized continuous gestures
+    bool m_pan = false;
+    bool m_pinch = false;
+    bool m_rotate = false;
+
+    // two-finger baseline
+    bool m_has_pair = false;
+    float m_start_span = 0.0f;
+    float m_last_angle = 0.0f;
+    float m_angle = 0.0f;                   // accumulated since the baseline
+    float m_scale = 1.0f;                   // of the last pinch event
+
+    Point* find_point(int32_t id);
+    void centroid(float& x, float& y) const;
+    bool pair_geometry(float& span, float& angle) const;
+    InputEvent make_gesture(GestureType type, GesturePhase phase, float value) const;
+    void begin_two_finger_gestures(float span, InputEvent* out, int& count);
+    void end_gestures(InputEvent* out, int& count);
+    void clear_sequence();
+
+public:
+    GestureRecognizer() {}
+    explicit GestureRecognizer(Settings const& settings) : m_settings(settings) {}
+
+    Settings const& get_settings() const { return m_settings; }
+    void set_settings(Settings const& settings) { m_settings = settings; }
+
+    /// Takes a touch event (down, up or motion) of the current frame.
+    void handle(InputEvent const& event);
+
+    /**
+     * Ends the frame: recognizes what the frame's events make, and writes
+     * the resulting gesture events to out (room for MAX_OUTPUT).
+     * Returns their number.
+     */
+    int finish_frame(InputEvent* out);
+
+    /**
+     * Returns the time (ns of CLOCK_MONOTONIC) when check_long_press()
+     * should be called, or 0 if no long press can happen now.
+     */
+    uint64_t long_press_deadline_ns() const;
+
+    /// Recognizes a long press if it is time; returns the number of events written to out.
+    int check_long_press(uint64_t now_ns, InputEvent* out);
+
+    /// Forgets the touch sequence (e.g. on wl_touch.cancel), without any events.
+    void reset();
+};
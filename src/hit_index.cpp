@@ -0,0 +1,161 @@
+#include "hit_index.hpp"
+#include <algorithm>
+#include <cassert>
+
+HitIndex::HitIndex(int cell_size)
+    : m_cell_size(cell_size)
+{
+    assert(cell_size > 0);
+}
+
+void HitIndex::set_size(int width, int height) {
+    if (width == m_width && height == m_height) { return; }
+    m_width = std::max(width, 0);
+    m_height = std::max(height, 0);
+    m_columns = (m_width + m_cell_size - 1)/m_cell_size;
+    m_rows = (m_height + m_cell_size - 1)/m_cell_size;
+
+    // the rectangles are clipped to the size, so all must be clipped again
+    for (auto& cell : m_cells) {
+        cell.clear();
+    }
+    m_cells.resize(size_t(m_columns)*m_rows);
+    for (uint32_t i = 0; i < m_entries.size(); i++) {
+        if (m_entries[i].used) {
+            insert_into_cells(i);
+        }
+    }
+    m_version++;
+}
+
+void HitIndex::insert_into_cells(uint32_t entry) {
+    Rect rect = m_entries[entry].rect.intersected(Rect(0, 0, m_width, m_height));
+    if (rect.is_empty()) { return; }
+    int column0 = rect.x/m_cell_size;
+    int column1 = (rect.right() - 1)/m_cell_size;
+    int row0 = rect.y/m_cell_size;
+    int row1 = (rect.bottom() - 1)/m_cell_size;
+    for (int row = row0; row <= row1; row++) {
+        for (int column = column0; column <= column1; column++) {
+            m_cells[row*m_columns + column].push_back(entry);
+        }
+    }
+}
+
+void HitIndex::remove_from_cells(uint32_t entry) {
+    Rect rect = m_entries[entry].rect.intersected(Rect(0, 0, m_width, m_height));
+    if (rect.is_empty()) { return; }
+    int column0 = rect.x/m_cell_size;
+    int column1 = (rect.right() - 1)/m_cell_size;
+    int row0 = rect.y/m_cell_size;
+    int row1 = (rect.bottom() - 1)/m_cell_size;
+    for (int row = row0; row <= row1; row++) {
+        for (int column = column0; column <= column1; column++) {
+            auto& cell = m_cells[row*m_columns + column];
+            auto it = std::find(cell.begin(), cell.end(), entry);
+            assert(it != cell.end());
+            *it = cell.back();
+            cell.pop_back();
+        }
+    }
+}
+
+void HitIndex::set(uint32_t id, Rect const& rect, int32_t z) {
+    auto found = m_entry_of_id.find(id);
+    if (found != m_entry_of_id.end()) {
+        Entry& entry = m_entries[found->second];
+        if (entry.rect == rect && entry.z == z) { return; }
+        remove_from_cells(found->second);
+        entry.rect = rect;
+        entry.z = z;
+        insert_into_cells(found->second);
+        m_version++;
+        return;
+    }
+
+    uint32_t index;
+    if (!m_free_entries.empty()) {
+        index = m_free_entries.back();
+        m_free_entries.pop_back();
+    }
+    else {
+        index = m_entries.size();
+        m_entries.emplace_back();
+    }
+    Entry& entry = m_entries[index];
+    entry.id = id;
+    entry.rect = rect;
+    entry.z = z;
+    entry.order = m_next_order++;
+    entry.used = true;
+    m_entry_of_id[id] = index;
+    insert_into_cells(index);
+    m_version++;
+}
+
+void HitIndex::remove(uint32_t id) {
+    auto found = m_entry_of_id.find(id);
+    if (found == m_entry_of_id.end()) { return; }
+    remove_from_cells(found->second);
+    m_entries[found->second].used = false;
+    m_free_entries.push_back(found->second);
+    m_entry_of_id.erase(found);
+    m_version++;
+}
+
+void HitIndex::clear() {
+    for (auto& cell : m_cells) {
+        cell.clear();
+    }
+    m_entries.clear();
+    m_free_entries.clear();
+    m_entry_of_id.clear();
+    m_version++;
+}
+
+bool HitIndex::hit_test(int x, int y, uint32_t& id) const {
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height) { return false; }
+    auto& cell = m_cells[(y/m_cell_size)*m_columns + x/m_cell_size];
+    Entry const* best = nullptr;
+    for (uint32_t index : cell) {
+        Entry const& entry = m_entries[index];
+        if (entry.rect.contains(x, y) && (!best || is_above(entry, *best))) {
+            best = &entry;
+        }
+    }
+    if (!best) { return false; }
+    id = best->id;
+    return true;
+}
+
+std::vector<Rect> HitIndex::input_region() const {
+    std::vector<Rect> result;
+    Rect area(0, 0, m_width, m_height);
+    if (m_entry_of_id.size() <= MAX_REGION_RECTS) {
+        for (auto& entry : m_entries) {
+            Rect rect = entry.rect.intersected(area);
+            if (entry.used && !rect.is_empty()) {
+                result.push_back(rect);
+            }
+        }
+        return result;
+    }
+
+    // runs of occupied cells in each row of cells
+    for (int row = 0; row < m_rows; row++) {
+        int column = 0;
+        while (column < m_columns) {
+            if (m_cells[row*m_columns + column].empty()) {
+                column++;
+                continue;
+            }
+            int start = column;
+            while (column < m_columns && !m_cells[row*m_columns + column].empty()) {
+                column++;
+            }
+            result.push_back(Rect(start*m_cell_size, row*m_cell_size,
+                (column - start)*m_cell_size, m_cell_size).intersected(area));
+        }
+    }
+    return result;
+}
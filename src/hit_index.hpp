@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "rect.hpp"
+
+/**
+ * Finds which of many interactive rectangles (widgets) lies under a point,
+ * for routing pointer and touch events. The surface is divided into a
+ * uniform grid of cells, and each cell lists the rectangles that touch it,
+ * so a query looks only at the few rectangles of one cell, however many
+ * there are in total. Moving a rectangle updates only the cells it leaves
+ * and enters.
+ *
+ * Each rectangle has an app-chosen id and a z-order: where rectangles
+ * overlap, the one with the higher z wins, and of equal z the one added
+ * later. Parts outside the size given by set_size() are not indexed.
+ */
+class HitIndex {
+public:
+    static const int DEFAULT_CELL_SIZE = 64;
+
+    /// An input region with more rectangles than this is made of grid cells instead.
+    static const int MAX_REGION_RECTS = 256;
+
+protected:
+    struct Entry {
+        uint32_t id = 0;
+        Rect rect;                  // as given; only the cells it covers are clipped to the size
+        int32_t z = 0;
+        uint64_t order = 0;         // of adding, breaks ties of z
+        bool used = false;
+    };
+
+    int m_cell_size = DEFAULT_CELL_SIZE;
+    int m_width = 0;
+    int m_height = 0;
+    int m_columns = 0;
+    int m_rows = 0;
+    std::vector<Entry> m_entries;
+    std::vector<uint32_t> m_free_entries;
+    std::unordered_map<uint32_t, uint32_t> m_entry_of_id;
+    std::vector<std::vector<uint32_t>> m_cells;    // entry indices, per cell
+    uint64_t m_next_order = 0;
+    uint64_t m_version = 0;
+
+    void insert_into_cells(uint32_t entry);
+    void remove_from_cells(uint32_t entry);
+    bool is_above(Entry const& a, Entry const& b) const {
+        return a.z > b.z || (a.z == b.z && a.order > b.order);
+    }
+
+public:
+    explicit HitIndex(int cell_size = DEFAULT_CELL_SIZE);
+    HitIndex(HitIndex const&) = delete;
+    HitIndex& operator=(HitIndex const&) = delete;
+
+    /// Sets the size of the indexed area (the surface), keeping the rectangles.
+    void set_size(int width, int height);
+
+    /**
+     * Adds the rectangle with the given id, or moves it (and changes its z)
+     * if the id is already there. A moved rectangle keeps its place among
+     * rectangles of equal z.
+     */
+    void set(uint32_t id, Rect const& rect, int32_t z = 0);
+
+    /// Removes the rectangle with the given id, if any.
+    void remove(uint32_t id);
+
+    void clear();
+
+    size_t size() const { return m_entry_of_id.size(); }
+    int cell_size() const { return m_cell_size; }
+
+    /// Returns true if there is a rectangle with the given id.
+    bool contains(uint32_t id) const { return m_entry_of_id.count(id) != 0; }
+
+    /// Finds the topmost rectangle containing the point; returns false if there is none.
+    bool hit_test(int x, int y, uint32_t& id) const;
+
+    /// Finds the topmost rectangle containing the point (e.g. of a pointer event).
+    bool hit_test(float x, float y, uint32_t& id) const {
+        return hit_test((int) std::floor(x), (int) std::floor(y), id);
+    }
+
+    /// Returns a number that changes whenever the rectangles do.
+    uint64_t version() const { return m_version; }
+
+    /**
+     * Returns rectangles covering the area where something can be hit:
+     * the rectangles themselves, or if there are too many, the cells
+     * that contain any (merged into rows). Suitable for the input region
+     * of the surface; it may be larger than needed, never smaller.
+     */
+    std::vector<Rect> input_region() const;
+};
@@ -0,0 +1,657 @@
+#include "input.hpp"
+#include "app.hpp"
+#include "cursor.hpp"
+#include "debug.hpp"
+#include "event_loop.hpp"
+#include "gestures.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+uint64_t unwrap_input_time(uint32_t time, uint64_t near_ns) {
+    int64_t near_ms = near_ns/1000000;
+    int64_t result = (near_ms & ~int64_t(0xffffffff)) | time;
+    if (result > near_ms + 0x80000000ll) {
+        result -= 0x100000000ll;
+    }
+    else if (result + 0x80000000ll < near_ms) {
+        result += 0x100000000ll;
+    }
+    return result < 0 ? 0 : uint64_t(result)*1000000;
+}
+
+// InputRing ----------------------------------------------------------------
+
+InputRing::InputRing(uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) { size *= 2; }
+    m_events.reset(new InputEvent[size]);
+    m_mask = size - 1;
+}
+
+// wayland::Input -----------------------------------------------------------
+
+namespace {
+
+/// Returns an event of the given type, stamped with the time of receipt.
+InputEvent make_event(InputEventType type, uint32_t time) {
+    InputEvent event;
+    event.type = type;
+    event.time = time;
+    event.received_ns = stats::now_ns();
+    return event;
+}
+
+bool is_motion(InputEvent const& event) {
+    return event.type == InputEventType::PointerMotion || event.type == InputEventType::TouchMotion;
+}
+
+} // namespace
+
+wayland::Input::Input(wl::Seat& seat, InputRing& ring, wayland::EventLoop& event_loop)
+    : m_seat(seat), m_ring(ring), m_event_loop(event_loop)
+{
+    m_repeat_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (m_repeat_fd < 0) {
+        throw std::runtime_error("wayland::Input: timerfd_create() failed: " + errno_to_string());
+    }
+    m_event_loop.watch(m_repeat_fd, POLLIN, [this](short revents) { handle_repeat_timer(); });
+    m_long_press_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (m_long_press_fd < 0) {
+        auto message = errno_to_string();
+        m_event_loop.unwatch(m_repeat_fd);
+        close(m_repeat_fd);
+        throw std::runtime_error("wayland::Input: timerfd_create() failed: " + message);
+    }
+    m_event_loop.watch(m_long_press_fd, POLLIN, [this](short revents) { handle_long_press_timer(); });
+    m_gestures = std::make_unique<GestureRecognizer>();
+    update_devices();
+}
+
+wayland::Input::~Input() {
+    destroy_pointer();
+    destroy_keyboard();
+    destroy_touch();
+    m_event_loop.unwatch(m_repeat_fd);
+    close(m_repeat_fd);
+    m_event_loop.unwatch(m_long_press_fd);
+    close(m_long_press_fd);
+}
+
+void wayland::Input::update_devices() {
+    if (m_seat.is_pointer_supported() && !m_pointer) {
+        create_pointer();
+    }
+    else if (!m_seat.is_pointer_supported() && m_pointer) {
+        destroy_pointer();
+    }
+    if (m_seat.is_keyboard_supported() && !m_keyboard) {
+        create_keyboard();
+    }
+    else if (!m_seat.is_keyboard_supported() && m_keyboard) {
+        destroy_keyboard();
+    }
+    if (m_seat.is_touch_supported() && !m_touch) {
+        create_touch();
+    }
+    else if (!m_seat.is_touch_supported() && m_touch) {
+        destroy_touch();
+    }
+}
+
+void wayland::Input::push(InputEvent const& event) {
+    static stats::Counter& events = stats::counter("input.events");
+    static stats::Counter& dropped = stats::counter("input.dropped");
+    InputEvent stamped = event;
+    stamped.seat = m_seat.get_id();
+    if (m_ring.push(stamped)) {
+        events.add();
+    }
+    else {
+        dropped.add();
+    }
+}
+
+/**
+ * Adds an event to the frame. A motion replaces the last event
+ * of the same pointer or touch point if that was a motion too.
+ */
+void wayland::Input::add_to_frame(PendingFrame& frame, InputEvent const& event) {
+    static stats::Counter& coalesced = stats::counter("input.coalesced");
+    if (is_motion(event)) {
+        // the last event of the same pointer or touch point (the pointer is id 0)
+        for (int i = frame.count - 1; i >= 0; --i) {
+            InputEvent& previous = frame.events[i];
+            if (previous.id != event.id) { continue; }
+            if (previous.type == event.type) {
+                if (!m_motion_history) {
+                    previous = event;
+                    coalesced.add();
+                    return;
+                }
+                previous.flags |= INPUT_HISTORICAL;
+            }
+            break;
+        }
+    }
+    if (frame.count == MAX_FRAME_EVENTS) {
+        flush_frame(frame);
+    }
+    frame.events[frame.count++] = event;
+}
+
+void wayland::Input::flush_frame(PendingFrame& frame) {
+    if (&frame == &m_touch_frame && m_gestures) {
+        for (int i = 0; i < frame.count; ++i) {
+            m_gestures->handle(frame.events[i]);
+        }
+    }
+    for (int i = 0; i < frame.count; ++i) {
+        push(frame.events[i]);
+    }
+    frame.count = 0;
+    if (&frame == &m_pointer_frame) {
+        flush_relative();
+    }
+}
+
+/// Pushes the relative motion summed up in the frame, if any.
+void wayland::Input::flush_relative() {
+    if (m_relative.discrete == 0) { return; }
+    m_relative.surface = m_pointer_surface;
+    m_relative.x = m_pointer_x;
+    m_relative.y = m_pointer_y;
+    push(m_relative);
+    m_relative.discrete = 0;
+}
+
+wayland::Input::TouchPoint* wayland::Input::find_touch_point(int32_t id) {
+    for (auto& point : m_touch_points) {
+        if (point.id == id) { return &point; }
+    }
+    return nullptr;
+}
+
+// pointer
+
+void wayland::Input::create_pointer() {
+    m_pointer = wl_seat_get_pointer(m_seat.get());
+    m_pointer_generation++;
+    m_pointer_frames = wl_pointer_get_version(m_pointer) >= WL_POINTER_FRAME_SINCE_VERSION;
+
+    m_pointer_listener.enter = [](void* self_, wl_pointer* pointer, uint32_t serial,
+        wl_surface* surface, wl_fixed_t x, wl_fixed_t y)
+    {
+        auto self = (wayland::Input*) self_;
+        self->m_pointer_surface = surface;
+        self->m_pointer_serial = serial;
+        if (self->m_cursors) { self->m_cursors->pointer_entered(pointer, serial); }
+        self->m_pointer_x = (float) wl_fixed_to_double(x);
+        self->m_pointer_y = (float) wl_fixed_to_double(y);
+        InputEvent event = make_event(InputEventType::PointerEnter, 0);
+        event.serial = serial;
+        event.surface = surface;
+        event.x = self->m_pointer_x;
+        event.y = self->m_pointer_y;
+        self->add_to_frame(self->m_pointer_frame, event);
+        if (!self->m_pointer_frames) { self->flush_frame(self->m_pointer_frame); }
+    };
+    m_pointer_listener.leave = [](void* self_, wl_pointer* pointer, uint32_t serial, wl_surface* surface) {
+        auto self = (wayland::Input*) self_;
+        InputEvent event = make_event(InputEventType::PointerLeave, 0);
+        event.serial = serial;
+        event.surface = surface;
+        event.x = self->m_pointer_x;
+        event.y = self->m_pointer_y;
+        self->m_pointer_surface = nullptr;
+        if (self->m_cursors) { self->m_cursors->pointer_left(); }
+        self->add_to_frame(self->m_pointer_frame, event);
+        if (!self->m_pointer_frames) { self->flush_frame(self->m_pointer_frame); }
+    };
+    m_pointer_listener.motion = [](void* self_, wl_pointer* pointer, uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+        auto self = (wayland::Input*) self_;
+        self->m_pointer_x = (float) wl_fixed_to_double(x);
+        self->m_pointer_y = (float) wl_fixed_to_double(y);
+        InputEvent event = make_event(InputEventType::PointerMotion, time);
+        event.surface = self->m_pointer_surface;
+        event.x = self->m_pointer_x;
+        event.y = self->m_pointer_y;
+        self->add_to_frame(self->m_pointer_frame, event);
+        if (!self->m_pointer_frames) { self->flush_frame(self->m_pointer_frame); }
+    };
+    m_pointer_listener.button = [](void* self_, wl_pointer* pointer, uint32_t serial, uint32_t time,
+        uint32_t button, uint32_t state)
+    {
+        auto self = (wayland::Input*) self_;
+        InputEvent event = make_event(InputEventType::PointerButton, time);
+        event.serial = serial;
+        event.surface = self->m_pointer_surface;
+        event.x = self->m_pointer_x;
+        event.y = self->m_pointer_y;
+        event.code = button;
+        event.state = (state == WL_POINTER_BUTTON_STATE_PRESSED) ? 1 : 0;
+        self->add_to_frame(self->m_pointer_frame, event);
+        if (!self->m_pointer_frames) { self->flush_frame(self->m_pointer_frame); }
+    };
+    m_pointer_listener.axis = [](void* self_, wl_pointer* pointer, uint32_t time, uint32_t axis, wl_fixed_t value) {
+        auto self = (wayland::Input*) self_;
+
+        // a wheel click sends axis_discrete first (making an event with no time yet),
+        // then this; both go into one event
+        PendingFrame& frame = self->m_pointer_frame;
+        if (frame.count > 0) {
+            InputEvent& last = frame.events[frame.count - 1];
+            if (last.type == InputEventType::PointerAxis && last.code == axis && last.time == 0) {
+                last.time = time;
+                last.value = (float) wl_fixed_to_double(value);
+                return;
+            }
+        }
+        InputEvent event = make_event(InputEventType::PointerAxis, time);
+        event.surface = self->m_pointer_surface;
+        event.x = self->m_pointer_x;
+        event.y = self->m_pointer_y;
+        event.code = axis;
+        event.value = (float) wl_fixed_to_double(value);
+        self->add_to_frame(frame, event);
+        if (!self->m_pointer_frames) { self->flush_frame(frame); }
+    };
+    m_pointer_listener.frame = [](void* self_, wl_pointer* pointer) {
+        auto self = (wayland::Input*) self_;
+        self->flush_frame(self->m_pointer_frame);
+    };
+    m_pointer_listener.axis_source = [](void* self_, wl_pointer* pointer, uint32_t source) {
+    };
+    m_pointer_listener.axis_stop = [](void* self_, wl_pointer* pointer, uint32_t time, uint32_t axis) {
+    };
+    m_pointer_listener.axis_discrete = [](void* self_, wl_pointer* pointer, uint32_t axis, int32_t discrete) {
+        auto self = (wayland::Input*) self_;
+        InputEvent event = make_event(InputEventType::PointerAxis, 0);
+        event.surface = self->m_pointer_surface;
+        event.x = self->m_pointer_x;
+        event.y = self->m_pointer_y;
+        event.code = axis;
+        event.discrete = discrete;
+        self->add_to_frame(self->m_pointer_frame, event);
+    };
+
+    wl_pointer_add_listener(m_pointer, &m_pointer_listener, this);
+    if (m_relative_manager) { create_relative_pointer(); }
+}
+
+void wayland::Input::destroy_pointer() {
+    if (!m_pointer) { return; }
+    destroy_relative_pointer();
+    m_pointer_frame.count = 0;
+    m_pointer_surface = nullptr;
+    if (m_cursors) { m_cursors->pointer_left(); }
+    if (wl_pointer_get_version(m_pointer) >= WL_POINTER_RELEASE_SINCE_VERSION) {
+        wl_pointer_release(m_pointer);
+    }
+    else {
+        wl_pointer_destroy(m_pointer);
+    }
+    m_pointer = nullptr;
+}
+
+// relative pointer
+
+void wayland::Input::create_relative_pointer() {
+    m_relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(
+        m_relative_manager->get(), m_pointer);
+
+    m_relative_listener.relative_motion = [](void* self_, zwp_relative_pointer_v1* relative_pointer,
+        uint32_t utime_hi, uint32_t utime_lo, wl_fixed_t dx, wl_fixed_t dy,
+        wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel)
+    {
+        static stats::Counter& coalesced = stats::counter("input.coalesced");
+        auto self = (wayland::Input*) self_;
+        InputEvent& event = self->m_relative;
+
+        // the first motion of the frame starts the sum, later ones add to it
+        // and only move the time forward (a 64-bit µs timestamp, taken down
+        // to the ms of the other events)
+        uint32_t time = uint32_t(((uint64_t(utime_hi) << 32) | utime_lo)/1000);
+        if (event.discrete == 0) {
+            event = make_event(InputEventType::PointerRelative, time);
+        }
+        else {
+            event.time = time;
+            event.received_ns = stats::now_ns();
+            coalesced.add();
+        }
+        event.dx += (float) wl_fixed_to_double(dx);
+        event.dy += (float) wl_fixed_to_double(dy);
+        event.dx_unaccel += (float) wl_fixed_to_double(dx_unaccel);
+        event.dy_unaccel += (float) wl_fixed_to_double(dy_unaccel);
+        event.discrete++;
+        if (!self->m_pointer_frames) { self->flush_relative(); }
+    };
+
+    zwp_relative_pointer_v1_add_listener(m_relative_pointer, &m_relative_listener, this);
+}
+
+void wayland::Input::destroy_relative_pointer() {
+    if (!m_relative_pointer) { return; }
+    m_relative.discrete = 0;
+    zwp_relative_pointer_v1_destroy(m_relative_pointer);
+    m_relative_pointer = nullptr;
+}
+
+void wayland::Input::set_relative_pointer_manager(wp::RelativePointerManager* manager) {
+    destroy_relative_pointer();
+    m_relative_manager = manager;
+    if (m_relative_manager && m_pointer) {
+        create_relative_pointer();
+    }
+}
+
+void wayland::Input::set_cursor_manager(CursorManager* cursors) {
+    if (m_cursors && m_pointer_surface) {
+        m_cursors->pointer_left();
+    }
+    m_cursors = cursors;
+    if (m_cursors && m_pointer_surface) {
+        m_cursors->pointer_entered(m_pointer, m_pointer_serial);
+    }
+}
+
+// keyboard
+
+void wayland::Input::create_keyboard() {
+    m_keyboard = wl_seat_get_keyboard(m_seat.get());
+
+    m_keyboard_listener.keymap = [](void* self_, wl_keyboard* keyboard, uint32_t format, int32_t fd, uint32_t size) {
+        auto self = (wayland::Input*) self_;
+        if (format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+            try {
+                self->m_keymap = std::make_unique<Keymap>(fd, size);
+            }
+            catch (std::exception& e) {
+                // keep the previous keymap, if any; keys still carry their codes
+                complain(e.what());
+            }
+        }
+        close(fd);
+    };
+    m_keyboard_listener.enter = [](void* self_, wl_keyboard* keyboard, uint32_t serial,
+        wl_surface* surface, wl_array* keys)
+    {
+        auto self = (wayland::Input*) self_;
+        self->m_keyboard_surface = surface;
+        InputEvent event = make_event(InputEventType::KeyboardEnter, 0);
+        event.serial = serial;
+        event.surface = surface;
+        self->push(event);
+    };
+    m_keyboard_listener.leave = [](void* self_, wl_keyboard* keyboard, uint32_t serial, wl_surface* surface) {
+        auto self = (wayland::Input*) self_;
+        self->m_keyboard_surface = nullptr;
+        self->stop_repeat();
+        InputEvent event = make_event(InputEventType::KeyboardLeave, 0);
+        event.serial = serial;
+        event.surface = surface;
+        self->push(event);
+    };
+    m_keyboard_listener.key = [](void* self_, wl_keyboard* keyboard, uint32_t serial, uint32_t time,
+        uint32_t key, uint32_t state)
+    {
+        auto self = (wayland::Input*) self_;
+        InputEvent event = make_event(InputEventType::Key, time);
+        event.serial = serial;
+        event.surface = self->m_keyboard_surface;
+        event.code = key;
+        event.state = (state == WL_KEYBOARD_KEY_STATE_PRESSED) ? 1 : 0;
+        self->translate_key(event);
+        self->push(event);
+
+        if (event.state) {
+            self->start_repeat(key);
+        }
+        else if (key == self->m_repeat_key) {
+            self->stop_repeat();
+        }
+    };
+    m_keyboard_listener.modifiers = [](void* self_, wl_keyboard* keyboard, uint32_t serial,
+        uint32_t depressed, uint32_t latched, uint32_t locked, uint32_t group)
+    {
+        auto self = (wayland::Input*) self_;
+        self->m_modifiers = depressed | latched | locked;
+        self->m_layout = group;
+        InputEvent event = make_event(InputEventType::Modifiers, 0);
+        event.serial = serial;
+        event.surface = self->m_keyboard_surface;
+        event.modifiers[0] = depressed;
+        event.modifiers[1] = latched;
+        event.modifiers[2] = locked;
+        event.modifiers[3] = group;
+        self->push(event);
+    };
+    m_keyboard_listener.repeat_info = [](void* self_, wl_keyboard* keyboard, int32_t rate, int32_t delay) {
+        auto self = (wayland::Input*) self_;
+        self->m_repeat_rate = rate;
+        self->m_repeat_delay = delay;
+        if (rate <= 0) {
+            self->stop_repeat();
+        }
+    };
+
+    wl_keyboard_add_listener(m_keyboard, &m_keyboard_listener, this);
+}
+
+void wayland::Input::destroy_keyboard() {
+    if (!m_keyboard) { return; }
+    stop_repeat();
+    m_keymap.reset();
+    m_keyboard_surface = nullptr;
+    if (wl_keyboard_get_version(m_keyboard) >= WL_KEYBOARD_RELEASE_SINCE_VERSION) {
+        wl_keyboard_release(m_keyboard);
+    }
+    else {
+        wl_keyboard_destroy(m_keyboard);
+    }
+    m_keyboard = nullptr;
+}
+
+/// Fills in the keysym and text of a key event by the keymap (if any yet).
+void wayland::Input::translate_key(InputEvent& event) {
+    if (!m_keymap) { return; }
+    auto& key = m_keymap->lookup(event.code + 8, m_modifiers, m_layout);
+    event.keysym = key.keysym;
+    if (event.state) {
+        memcpy(event.text, key.text, sizeof(event.text));
+    }
+}
+
+/// Starts repeating the key after the delay, if it repeats at all.
+void wayland::Input::start_repeat(uint32_t key) {
+    if (m_repeat_rate <= 0 || (m_keymap && !m_keymap->repeats(key + 8))) {
+        stop_repeat();
+        return;
+    }
+    m_repeat_key = key;
+    itimerspec spec = { };
+    spec.it_value.tv_sec = m_repeat_delay/1000;
+    spec.it_value.tv_nsec = (m_repeat_delay % 1000)*1000000L + 1;    // zero would disarm
+    int64_t period_ns = 1000000000LL/std::min(m_repeat_rate, 1000);     // a whole second at rate 1
+    spec.it_interval.tv_sec = period_ns/1000000000LL;
+    spec.it_interval.tv_nsec = period_ns % 1000000000LL;
+    if (timerfd_settime(m_repeat_fd, 0, &spec, nullptr) < 0) {
+        complain("timerfd_settime() failed, key repeat is off: " + errno_to_string());
+    }
+}
+
+void wayland::Input::stop_repeat() {
+    if (!m_repeat_key) { return; }
+    m_repeat_key = 0;
+    itimerspec spec = { };
+    timerfd_settime(m_repeat_fd, 0, &spec, nullptr);
+}
+
+/**
+ * Pushes a press of the repeating key for each expiration of the timer
+ * since the last call (several if the loop was busy), translated with
+ * the current modifiers.
+ */
+void wayland::Input::handle_repeat_timer() {
+    uint64_t expirations = 0;
+    if (read(m_repeat_fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !m_repeat_key) {
+        return;
+    }
+    static auto& repeats = stats::counter("input.key_repeats");
+    InputEvent event = make_event(InputEventType::Key, 0);
+    event.flags = INPUT_REPEATED;
+    event.surface = m_keyboard_surface;
+    event.code = m_repeat_key;
+    event.state = 1;
+    translate_key(event);
+    for (uint64_t i = 0; i < expirations; i++) {
+        push(event);
+        repeats.add();
+    }
+}
+
+// touch
+
+void wayland::Input::create_touch() {
+    m_touch = wl_seat_get_touch(m_seat.get());
+
+    m_touch_listener.down = [](void* self_, wl_touch* touch, uint32_t serial, uint32_t time,
+        wl_surface* surface, int32_t id, wl_fixed_t x, wl_fixed_t y)
+    {
+        auto self = (wayland::Input*) self_;
+        TouchPoint* point = self->find_touch_point(-1);
+        if (point) {
+            point->id = id;
+            point->surface = surface;
+        }
+        InputEvent event = make_event(InputEventType::TouchDown, time);
+        event.serial = serial;
+        event.surface = surface;
+        event.id = id;
+        event.x = (float) wl_fixed_to_double(x);
+        event.y = (float) wl_fixed_to_double(y);
+        self->add_to_frame(self->m_touch_frame, event);
+    };
+    m_touch_listener.up = [](void* self_, wl_touch* touch, uint32_t serial, uint32_t time, int32_t id) {
+        auto self = (wayland::Input*) self_;
+        InputEvent event = make_event(InputEventType::TouchUp, time);
+        event.serial = serial;
+        event.id = id;
+        TouchPoint* point = self->find_touch_point(id);
+        if (point) {
+            event.surface = point->surface;
+            point->id = -1;
+        }
+        self->add_to_frame(self->m_touch_frame, event);
+    };
+    m_touch_listener.motion = [](void* self_, wl_touch* touch, uint32_t time, int32_t id,
+        wl_fixed_t x, wl_fixed_t y)
+    {
+        auto self = (wayland::Input*) self_;
+        InputEvent event = make_event(InputEventType::TouchMotion, time);
+        event.id = id;
+        event.x = (float) wl_fixed_to_double(x);
+        event.y = (float) wl_fixed_to_double(y);
+        TouchPoint* point = self->find_touch_point(id);
+        if (point) {
+            event.surface = point->surface;
+        }
+        self->add_to_frame(self->m_touch_frame, event);
+    };
+    m_touch_listener.frame = [](void* self_, wl_touch* touch) {
+        auto self = (wayland::Input*) self_;
+        self->flush_frame(self->m_touch_frame);
+        self->finish_gestures();
+    };
+    m_touch_listener.cancel = [](void* self_, wl_touch* touch) {
+        auto self = (wayland::Input*) self_;
+
+        // the compositor took over the touch sequence; nothing of it is valid
+        self->m_touch_frame.count = 0;
+        for (auto& point : self->m_touch_points) {
+            point.id = -1;
+        }
+        if (self->m_gestures) {
+            self->m_gestures->reset();
+            self->update_long_press_timer();
+        }
+        self->push(make_event(InputEventType::TouchCancel, 0));
+    };
+    m_touch_listener.shape = [](void* self_, wl_touch* touch, int32_t id, wl_fixed_t major, wl_fixed_t minor) {
+    };
+    m_touch_listener.orientation = [](void* self_, wl_touch* touch, int32_t id, wl_fixed_t orientation) {
+    };
+
+    wl_touch_add_listener(m_touch, &m_touch_listener, this);
+}
+
+void wayland::Input::destroy_touch() {
+    if (!m_touch) { return; }
+    m_touch_frame.count = 0;
+    if (m_gestures) {
+        m_gestures->reset();
+        update_long_press_timer();
+    }
+    for (auto& point : m_touch_points) {
+        point.id = -1;
+    }
+    if (wl_touch_get_version(m_touch) >= WL_TOUCH_RELEASE_SINCE_VERSION) {
+        wl_touch_release(m_touch);
+    }
+    else {
+        wl_touch_destroy(m_touch);
+    }
+    m_touch = nullptr;
+}
+
+// gestures
+
+void wayland::Input::set_gestures(bool enabled) {
+    if (!enabled) {
+        m_gestures.reset();
+        update_long_press_timer();
+    }
+    else if (!m_gestures) {
+        m_gestures = std::make_unique<GestureRecognizer>();
+    }
+}
+
+/// Pushes the gestures recognized in the touch frame that just ended.
+void wayland::Input::finish_gestures() {
+    if (!m_gestures) { return; }
+    InputEvent gestures[GestureRecognizer::MAX_OUTPUT];
+    int count = m_gestures->finish_frame(gestures);
+    for (int i = 0; i < count; i++) {
+        push(gestures[i]);
+    }
+    update_long_press_timer();
+}
+
+/// Arms the timer for the time a long press would be recognized, or disarms it.
+void wayland::Input::update_long_press_timer() {
+    uint64_t deadline = m_gestures ? m_gestures->long_press_deadline_ns() : 0;
+    itimerspec spec = { };
+    if (deadline) {
+        spec.it_value.tv_sec = deadline/1000000000;
+        spec.it_value.tv_nsec = deadline % 1000000000;
+    }
+    timerfd_settime(m_long_press_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void wayland::Input::handle_long_press_timer() {
+    uint64_t expirations = 0;
+    if (read(m_long_press_fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !m_gestures) {
+        return;
+    }
+    InputEvent gestures[GestureRecognizer::MAX_OUTPUT];
+    int count = m_gestures->check_long_press(stats::now_ns(), gestures);
+    for (int i = 0; i < count; i++) {
+        push(gestures[i]);
+    }
+    update_long_press_timer();
+}
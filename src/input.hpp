@@ -0,0 +1,320 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <wayland-client.h>
+#include "keymap.hpp"
+#include "zwp-relative-pointer-client-protocol.h"
+
+namespace wl {
+class Seat;
+}
+
+namespace wp {
+class RelativePointerManager;
+}
+
+namespace wayland {
+class CursorManager;
+class EventLoop;
+}
+
+class GestureRecognizer;
+
+/// Kinds of input events (see InputEvent).
+enum class InputEventType : uint8_t {
+    PointerEnter,
+    PointerLeave,
+    PointerMotion,
+    PointerButton,
+    PointerAxis,
+    PointerRelative,    // motion of the pointer device, summed over a frame, see Input
+    KeyboardEnter,
+    KeyboardLeave,
+    Key,
+    Modifiers,
+    TouchDown,
+    TouchUp,
+    TouchMotion,
+    TouchCancel,
+    Gesture,
+    DragEnter,          // a drag entered one of our surfaces, see DataDevice
+    DragLeave,
+    DragMotion,
+    Drop,
+    Selection,          // the clipboard content changed, see DataDevice
+};
+
+/// Bits of InputEvent::flags.
+enum InputEventFlags : uint8_t {
+    INPUT_HISTORICAL = 1,   ///< a motion superseded by a later one of the same frame
+    INPUT_REPEATED = 2,     ///< a key press generated by key repeat (with no time)
+};
+
+/**
+ * An input event, as a small plain structure (copied around freely).
+ * Which fields are valid depends on the type; the position and the
+ * surface are filled in for all pointer and touch events (for the
+ * pointer, the last known position), in surface coordinates.
+ */
+struct InputEvent {
+    InputEventType type = InputEventType::PointerMotion;
+    uint8_t flags = 0;              // see InputEventFlags
+    uint16_t seat = 0;              // the id of the seat it came from (see wl::Seat::get_id())
+    uint32_t time = 0;              // from the compositor, in ms (the base is arbitrary)
+    uint64_t received_ns = 0;       // when the client got it (stats::now_ns())
+    wl_surface* surface = nullptr;  // the surface the device is focused on
+    uint32_t serial = 0;            // for enter, leave, button, key, touch down and up, drag enter
+    int32_t id = 0;                 // of the touch point
+    float x = 0.0f;
+    float y = 0.0f;
+    uint32_t code = 0;              // button (BTN_*), key (KEY_*), axis (WL_POINTER_AXIS_*) or GestureType
+    uint32_t state = 0;             // button or key: 1 pressed, 0 released; gesture: GesturePhase
+    float value = 0.0f;             // axis: the scroll distance; gesture: see GestureType
+    int32_t discrete = 0;           // axis: wheel clicks, if from a wheel; gesture: fingers;
+                                    // relative: the number of motions summed up
+    float dx = 0.0f;                // relative: the motion, accelerated as the pointer moves
+    float dy = 0.0f;
+    float dx_unaccel = 0.0f;        // relative: the motion before acceleration
+    float dy_unaccel = 0.0f;
+    uint32_t modifiers[4] = { 0 };  // modifiers: depressed, latched, locked, group
+    uint32_t keysym = 0;            // key: XKB_KEY_* by the keymap, 0 if none yet
+    char text[8] = { 0 };           // key press: what it types (UTF-8), see Keymap::Key
+};
+
+/**
+ * Returns the time of a 32-bit millisecond input timestamp (InputEvent::time)
+ * in ns of CLOCK_MONOTONIC, taking the wrap-around closest to near_ns.
+ * The protocol leaves the base of the timestamps undefined, but all
+ * common compositors use CLOCK_MONOTONIC.
+ */
+uint64_t unwrap_input_time(uint32_t time, uint64_t near_ns);
+
+/// Returns when the event happened, by the compositor's timestamp if it has one.
+inline uint64_t input_event_time_ns(InputEvent const& event) {
+    return event.time ? unwrap_input_time(event.time, event.received_ns) : event.received_ns;
+}
+
+/**
+ * A fixed-size queue of input events between one producer thread and one
+ * consumer thread, without locks (and without any allocation after
+ * construction). The producer push()es, the consumer pop()s or drain()s;
+ * both may be the same thread.
+ */
+class InputRing {
+protected:
+    std::unique_ptr<InputEvent[]> m_events;
+    uint32_t m_mask = 0;
+    alignas(64) std::atomic<uint32_t> m_head { 0 };    // the next slot to write
+    alignas(64) std::atomic<uint32_t> m_tail { 0 };    // the next slot to read
+
+public:
+    /// Creates the ring; the capacity is rounded up to a power of two.
+    explicit InputRing(uint32_t capacity = 1024);
+    InputRing(InputRing const&) = delete;
+    InputRing& operator=(InputRing const&) = delete;
+
+    uint32_t capacity() const { return m_mask + 1; }
+
+    /// Returns the number of queued events (exact only for the consumer or the producer).
+    uint32_t size() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    /// Appends an event (producer only). Returns false if the ring is full.
+    bool push(InputEvent const& event) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) > m_mask) { return false; }
+        m_events[head & m_mask] = event;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Takes the oldest event (consumer only). Returns false if the ring is empty.
+    bool pop(InputEvent& event) {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) { return false; }
+        event = m_events[tail & m_mask];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Calls fn(event) for each queued event (at most max_count of them),
+     * oldest first, and removes them (consumer only). Events pushed
+     * meanwhile wait for the next drain(). Returns the number of events.
+     */
+    template<class F>
+    uint32_t drain(F&& fn, uint32_t max_count = UINT32_MAX) {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        if (head - tail > max_count) { head = tail + max_count; }
+        for (uint32_t i = tail; i != head; ++i) {
+            fn(static_cast<InputEvent const&>(m_events[i & m_mask]));
+        }
+        m_tail.store(head, std::memory_order_release);
+        return head - tail;
+    }
+};
+
+namespace wayland {
+
+/**
+ * Turns the events of the pointer, keyboard and touch screen of a seat
+ * into InputEvents pushed into a ring (one for each seat, so a seat
+ * flooding its ring does not make another lose events). The devices are created and
+ * destroyed with the seat's capabilities (see update_devices()).
+ *
+ * Pointer and touch events come in frames of logically simultaneous
+ * events; they are held until the end of the frame, and a motion replaces
+ * the previous motion of the same pointer or touch point in the frame,
+ * so the app gets one motion per frame (unless set_motion_history() asks
+ * for the replaced ones too). Keyboard events are pushed as they come,
+ * translated by the keymap the compositor sends (see Keymap); held keys
+ * repeat by a timerfd watched by the event loop, at the rate and delay
+ * the compositor asks for. Touch frames also go through a gesture
+ * recognizer (see GestureRecognizer, on by default), whose gestures follow
+ * the touch events of the frame. No heap allocation is done per event.
+ *
+ * With a relative pointer manager (see set_relative_pointer_manager()),
+ * the motions of the pointer device are reported too, unclipped and also
+ * while the pointer is locked. A gaming mouse can send them at 1000 Hz
+ * or more, several per frame; they are summed up and pushed as one
+ * PointerRelative event at the end of the pointer frame.
+ */
+class Input {
+public:
+    /// Maximum number of events held in one frame (more end the frame early).
+    static const int MAX_FRAME_EVENTS = 64;
+
+    /// Maximum number of touch points tracked at once.
+    static const int MAX_TOUCH_POINTS = 16;
+
+protected:
+    /// Events of the current pointer or touch frame.
+    struct PendingFrame {
+        InputEvent events[MAX_FRAME_EVENTS];
+        int count = 0;
+    };
+
+    struct TouchPoint {
+        int32_t id = -1;                // -1 if the slot is free
+        wl_surface* surface = nullptr;
+    };
+
+    wl::Seat& m_seat;
+    InputRing& m_ring;
+    wayland::EventLoop& m_event_loop;
+    bool m_motion_history = false;
+
+    wl_pointer* m_pointer = nullptr;
+    wl_keyboard* m_keyboard = nullptr;
+    wl_touch* m_touch = nullptr;
+    wl_pointer_listener m_pointer_listener = { 0 };
+    wl_keyboard_listener m_keyboard_listener = { 0 };
+    wl_touch_listener m_touch_listener = { 0 };
+
+    // pointer state
+    wl_surface* m_pointer_surface = nullptr;
+    uint32_t m_pointer_serial = 0;      // of the last entry
+    uint32_t m_pointer_generation = 0;  // the number of pointers created
+    CursorManager* m_cursors = nullptr;
+    float m_pointer_x = 0.0f;
+    float m_pointer_y = 0.0f;
+    bool m_pointer_frames = false;      // if the pointer sends frame events (version 5)
+    PendingFrame m_pointer_frame;
+
+    // relative pointer state
+    wp::RelativePointerManager* m_relative_manager = nullptr;
+    zwp_relative_pointer_v1* m_relative_pointer = nullptr;
+    zwp_relative_pointer_v1_listener m_relative_listener = { 0 };
+    InputEvent m_relative;              // summed up in the current frame (discrete is the count)
+
+    // keyboard state
+    wl_surface* m_keyboard_surface = nullptr;
+    int32_t m_repeat_rate = 25;         // per second, 0 if keys do not repeat
+    int32_t m_repeat_delay = 600;       // in ms
+    std::unique_ptr<Keymap> m_keymap;   // null until the compositor sends one
+    uint32_t m_modifiers = 0;           // depressed, latched and locked together
+    uint32_t m_layout = 0;
+    int m_repeat_fd = -1;               // timerfd
+    uint32_t m_repeat_key = 0;          // the repeating key, 0 if none
+
+    // touch state
+    TouchPoint m_touch_points[MAX_TOUCH_POINTS];
+    PendingFrame m_touch_frame;
+    std::unique_ptr<GestureRecognizer> m_gestures;     // null if turned off
+    int m_long_press_fd = -1;           // timerfd
+
+    void create_pointer();
+    void create_keyboard();
+    void create_touch();
+    void destroy_pointer();
+    void destroy_keyboard();
+    void destroy_touch();
+    void create_relative_pointer();
+    void destroy_relative_pointer();
+
+    void push(InputEvent const& event);
+    void translate_key(InputEvent& event);
+    void start_repeat(uint32_t key);
+    void stop_repeat();
+    void handle_repeat_timer();
+    void finish_gestures();
+    void update_long_press_timer();
+    void handle_long_press_timer();
+    void add_to_frame(PendingFrame& frame, InputEvent const& event);
+    void flush_frame(PendingFrame& frame);
+    void flush_relative();
+    TouchPoint* find_touch_point(int32_t id);
+
+public:
+    /// Sets up the devices of the seat; key repeat is driven by the event loop.
+    Input(wl::Seat& seat, InputRing& ring, wayland::EventLoop& event_loop);
+    ~Input();
+    Input(Input const&) = delete;
+    Input& operator=(Input const&) = delete;
+
+    /// Creates or destroys the devices to match the seat's capabilities.
+    /// Call after dispatching events (the capabilities come as events).
+    void update_devices();
+
+    /**
+     * If enabled, motions replaced within a frame are kept in the ring too,
+     * flagged INPUT_HISTORICAL (e.g. for drawing with every sample).
+     */
+    void set_motion_history(bool enabled) { m_motion_history = enabled; }
+
+    /// Turns on or off recognizing touch gestures (on by default).
+    void set_gestures(bool enabled);
+
+    /// Returns the gesture recognizer (e.g. to change its settings), or null if off.
+    GestureRecognizer* get_gestures() { return m_gestures.get(); }
+
+    /// Makes the cursor manager show its cursor whenever the pointer enters (null for none).
+    void set_cursor_manager(CursorManager* cursors);
+
+    /// Reports relative motions of the pointer, made by the manager (null for none).
+    void set_relative_pointer_manager(wp::RelativePointerManager* manager);
+
+    wl_pointer* get_pointer() { return m_pointer; }
+
+    /**
+     * Returns a number that changes whenever the pointer is created anew,
+     * to tell a new pointer from an old one (a new proxy may get the
+     * address of a released one).
+     */
+    uint32_t get_pointer_generation() const { return m_pointer_generation; }
+    wl_keyboard* get_keyboard() { return m_keyboard; }
+    wl_touch* get_touch() { return m_touch; }
+
+    /// Returns the key repeat rate (per second, 0 for no repeat) and delay (ms).
+    int32_t get_repeat_rate() const { return m_repeat_rate; }
+    int32_t get_repeat_delay() const { return m_repeat_delay; }
+
+    /// Returns the keymap of the keyboard, or null if there is none (yet).
+    Keymap const* get_keymap() const { return m_keymap.get(); }
+};
+
+} // namespace wayland
@@ -0,0 +1,77 @@
+#include "keymap.hpp"
+#include "mapped_file.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <xkbcommon/xkbcommon.h>
+
+namespace {
+
+uint32_t mod_mask(xkb_keymap* keymap, char const* name) {
+    xkb_mod_index_t index = xkb_keymap_mod_get_index(keymap, name);
+    return (index == XKB_MOD_INVALID) ? 0 : (1u << index);
+}
+
+} // namespace
+
+Keymap::Keymap(int fd, size_t size) {
+    static auto& compile_time = stats::histogram("keymap.compile_us");
+    stats::ScopedTimer timer(compile_time);
+
+    // parsed in place from the mapping; the text may or may not end with a null
+    MappedFile file(fd, size);
+    auto text = (char const*) file.data();
+    size_t length = strnlen(text, file.size());
+
+    xkb_context* context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!context) {
+        throw std::runtime_error("Keymap: xkb_context_new() failed");
+    }
+    xkb_keymap* keymap = xkb_keymap_new_from_buffer(context, text, length,
+        XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    xkb_context_unref(context);
+    if (!keymap) {
+        throw std::runtime_error("Keymap: xkb_keymap_new_from_buffer() failed");
+    }
+    xkb_state* state = xkb_state_new(keymap);
+    if (!state) {
+        xkb_keymap_unref(keymap);
+        throw std::runtime_error("Keymap: xkb_state_new() failed");
+    }
+
+    m_min_keycode = xkb_keymap_min_keycode(keymap);
+    m_key_count = xkb_keymap_max_keycode(keymap) - m_min_keycode + 1;
+    m_layout_count = std::min(std::max(xkb_keymap_num_layouts(keymap), 1u), MAX_LAYOUTS);
+    m_shift_mask = mod_mask(keymap, XKB_MOD_NAME_SHIFT);
+    m_caps_mask = mod_mask(keymap, XKB_MOD_NAME_CAPS);
+    m_num_mask = mod_mask(keymap, XKB_MOD_NAME_NUM);
+    m_level3_mask = mod_mask(keymap, "Mod5");       // AltGr in the usual keymaps
+
+    m_keys.resize(size_t(m_layout_count)*STATE_COUNT*m_key_count);
+    m_repeats.resize(m_key_count);
+    Key* key = m_keys.data();
+    for (uint32_t layout = 0; layout < m_layout_count; layout++) {
+        for (int bits = 0; bits < STATE_COUNT; bits++) {
+            uint32_t depressed = ((bits & 1) ? m_shift_mask : 0) | ((bits & 8) ? m_level3_mask : 0);
+            uint32_t locked = ((bits & 2) ? m_caps_mask : 0) | ((bits & 4) ? m_num_mask : 0);
+            xkb_state_update_mask(state, depressed, 0, locked, 0, 0, layout);
+            for (uint32_t i = 0; i < m_key_count; i++, key++) {
+                key->keysym = xkb_state_key_get_one_sym(state, m_min_keycode + i);
+                int text_length = xkb_state_key_get_utf8(state, m_min_keycode + i, key->text, sizeof(key->text));
+                if (text_length < 0 || text_length >= (int) sizeof(key->text)
+                    || (unsigned char) key->text[0] < 0x20 || key->text[0] == 0x7f)
+                {
+                    // no text, a control character, or too long to keep
+                    memset(key->text, 0, sizeof(key->text));
+                }
+            }
+        }
+    }
+    for (uint32_t i = 0; i < m_key_count; i++) {
+        m_repeats[i] = xkb_keymap_key_repeats(keymap, m_min_keycode + i) ? 1 : 0;
+    }
+
+    xkb_state_unref(state);
+    xkb_keymap_unref(keymap);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A keyboard layout (XKB keymap) compiled into flat lookup tables,
+ * so translating a key press into a keysym and text is a table lookup.
+ * The keymap text is parsed by libxkbcommon once, right from the mapped
+ * file descriptor the compositor sends (wl_keyboard.keymap), and every key
+ * is then resolved for each combination of the modifiers that select
+ * the symbol (Shift, Caps Lock, Num Lock and AltGr) in each layout;
+ * libxkbcommon is not needed after that.
+ *
+ * Other modifiers (Ctrl, Alt, Logo) do not change the symbol and are left
+ * to the app. Compose sequences and dead keys are not handled: a dead key
+ * gives its dead keysym and no text.
+ */
+class Keymap {
+public:
+    /// The result of a lookup.
+    struct Key {
+        uint32_t keysym = 0;        // XKB_KEY_*, 0 (NoSymbol) for unknown keys
+        char text[8] = { 0 };       // UTF-8, null-terminated, empty if the key types nothing
+    };
+
+    /// Layouts beyond this many are not compiled (they fall back to the first).
+    static const uint32_t MAX_LAYOUTS = 4;
+
+protected:
+    static const int STATE_COUNT = 16;      // of the modifiers below
+
+    uint32_t m_min_keycode = 0;
+    uint32_t m_key_count = 0;
+    uint32_t m_layout_count = 0;
+    uint32_t m_shift_mask = 0;
+    uint32_t m_caps_mask = 0;
+    uint32_t m_num_mask = 0;
+    uint32_t m_level3_mask = 0;
+    std::vector<Key> m_keys;                // [layout][state][keycode - min]
+    std::vector<uint8_t> m_repeats;         // [keycode - min]
+
+public:
+    /**
+     * Compiles the keymap in XKB text format from size bytes of the file
+     * descriptor (which stays open). Throws std::runtime_error if it cannot
+     * be mapped or parsed.
+     */
+    Keymap(int fd, size_t size);
+
+    /**
+     * Returns what the key with the given XKB keycode (evdev code + 8) gives
+     * with the given modifiers (a mask as in wl_keyboard.modifiers: depressed,
+     * latched and locked together) in the given layout (group).
+     */
+    Key const& lookup(uint32_t keycode, uint32_t modifiers, uint32_t layout) const {
+        static const Key none;
+        uint32_t index = keycode - m_min_keycode;
+        if (index >= m_key_count) { return none; }
+        if (layout >= m_layout_count) { layout = 0; }
+        int state = ((modifiers & m_shift_mask) ? 1 : 0)
+            | ((modifiers & m_caps_mask) ? 2 : 0)
+            | ((modifiers & m_num_mask) ? 4 : 0)
+            | ((modifiers & m_level3_mask) ? 8 : 0);
+        return m_keys[(layout*STATE_COUNT + state)*m_key_count + index];
+    }
+
+    /// Returns true if the key should repeat while held.
+    bool repeats(uint32_t keycode) const {
+        uint32_t index = keycode - m_min_keycode;
+        return index < m_key_count && m_repeats[index];
+    }
+
+    uint32_t layout_count() const { return m_layout_count; }
+
+    /// Returns the memory taken by the tables, in bytes.
+    size_t memory_used() const { return m_keys.size()*sizeof(Key) + m_repeats.size(); }
+};
@@ -0,0 +1,145 @@
+#include "latency.hpp"
+#include "stats.hpp"
+#include <ctime>
+
+namespace {
+
+const uint64_t MAX_PLAUSIBLE_LATENCY_NS = 10000000000ull;
+
+/// Converts a time of the given clock to CLOCK_MONOTONIC.
+uint64_t to_monotonic_ns(clockid_t clock_id, uint64_t time_ns) {
+    if (clock_id == CLOCK_MONOTONIC) {
+        return time_ns;
+    }
+    timespec ts;
+    clock_gettime(clock_id, &ts);
+    int64_t offset = int64_t(stats::now_ns()) - (int64_t(ts.tv_sec)*1000000000ll + ts.tv_nsec);
+    return uint64_t(int64_t(time_ns) + offset);
+}
+
+} // namespace
+
+wayland::LatencyTracker::LatencyTracker(wayland::Display& display, wl::Surface& surface)
+    : m_surface(surface)
+{
+    if (display.has_presentation()) {
+        m_presentation = &display.get_presentation();
+    }
+    for (auto& frame : m_frames) {
+        frame.tracker = this;
+    }
+
+    m_feedback_listener.sync_output = [](void* frame_, struct wp_presentation_feedback* feedback,
+        wl_output* output)
+    {
+    };
+    m_feedback_listener.presented = [](void* frame_, struct wp_presentation_feedback* feedback,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+        uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+    {
+        auto frame = (Frame*)frame_;
+        uint64_t seconds = (uint64_t(tv_sec_hi) << 32) | tv_sec_lo;
+        uint64_t presented_ns = to_monotonic_ns(frame->tracker->m_presentation->get_clock_id(),
+            seconds*1000000000ull + tv_nsec);
+        frame->tracker->record(*frame, presented_ns);
+        release(*frame);
+    };
+    m_feedback_listener.discarded = [](void* frame_, struct wp_presentation_feedback* feedback) {
+        static auto& discarded = stats::counter("latency.discarded");
+        discarded.add();
+        release(*(Frame*)frame_);
+    };
+
+    m_callback_listener.done = [](void* frame_, wl_callback* callback, uint32_t time) {
+        auto frame = (Frame*)frame_;
+        frame->tracker->record(*frame, unwrap_input_time(time, stats::now_ns()));
+        release(*frame);
+    };
+}
+
+wayland::LatencyTracker::~LatencyTracker() {
+    for (auto& frame : m_frames) {
+        release(frame);
+    }
+}
+
+void wayland::LatencyTracker::release(Frame& frame) {
+    if (frame.feedback) {
+        wp_presentation_feedback_destroy(frame.feedback);
+        frame.feedback = nullptr;
+    }
+    if (frame.callback) {
+        wl_callback_destroy(frame.callback);
+        frame.callback = nullptr;
+    }
+}
+
+void wayland::LatencyTracker::input_consumed(InputEvent const& event) {
+    // enter, leave and modifier events have no timestamp
+    if (m_input_pending || event.time == 0) {
+        return;
+    }
+    m_input_pending = true;
+    m_input_time = event.time;
+    m_input_received_ns = event.received_ns;
+}
+
+void wayland::LatencyTracker::frame_committed() {
+    if (!m_input_pending) {
+        return;
+    }
+    m_input_pending = false;
+
+    static auto& receive_to_commit = stats::histogram("latency.receive_to_commit_us");
+    receive_to_commit.add((stats::now_ns() - m_input_received_ns)/1000);
+
+    Frame* frame = nullptr;
+    for (auto& candidate : m_frames) {
+        if (!candidate.feedback && !candidate.callback) {
+            frame = &candidate;
+            break;
+        }
+    }
+    if (!frame) {
+        static auto& untracked = stats::counter("latency.untracked");
+        untracked.add();
+        return;
+    }
+    frame->input_time = m_input_time;
+    frame->input_received_ns = m_input_received_ns;
+    frame->commit_ns = stats::now_ns();
+
+    if (m_presentation) {
+        frame->feedback = wp_presentation_feedback(m_presentation->get(), m_surface.get());
+        if (frame->feedback) {
+            wp_presentation_feedback_add_listener(frame->feedback, &m_feedback_listener, frame);
+        }
+    }
+    else {
+        frame->callback = wl_surface_frame(m_surface.get());
+        if (frame->callback) {
+            wl_callback_add_listener(frame->callback, &m_callback_listener, frame);
+        }
+    }
+}
+
+/// Adds the latencies of a frame shown at the given time (of CLOCK_MONOTONIC).
+void wayland::LatencyTracker::record(Frame& frame, uint64_t presented_ns) {
+    static auto& input_to_present = stats::histogram("latency.input_to_present_us");
+    static auto& receive_to_present = stats::histogram("latency.receive_to_present_us");
+    static auto& skipped = stats::counter("latency.skipped");
+
+    if (presented_ns > frame.commit_ns && presented_ns - frame.commit_ns < MAX_PLAUSIBLE_LATENCY_NS) {
+        m_present_delay_ns = (7*m_present_delay_ns + (presented_ns - frame.commit_ns))/8;
+    }
+
+    uint64_t input_ns = unwrap_input_time(frame.input_time, presented_ns);
+    if (presented_ns < frame.input_received_ns || presented_ns < input_ns
+        || presented_ns - input_ns > MAX_PLAUSIBLE_LATENCY_NS)
+    {
+        skipped.add();
+        return;
+    }
+    input_to_present.add((presented_ns - input_ns)/1000);
+    receive_to_present.add((presented_ns - frame.input_received_ns)/1000);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include "app.hpp"
+#include "input.hpp"
+
+namespace wayland {
+
+/**
+ * Measures how long it takes from an input event to the frame that shows
+ * the app's response to it on the screen. For each committed frame,
+ * the oldest input event handed to the app since the previous frame
+ * is remembered, and when the compositor reports the frame as presented
+ * (by wp_presentation feedback, or without it by the frame callback,
+ * which comes when the compositor starts on its next frame), the latency
+ * goes to the statistics:
+ *
+ * - latency.input_to_present_us: from the compositor's event timestamp
+ *   (millisecond resolution) to the presentation, the number to track;
+ * - latency.receive_to_present_us: from when the client got the event;
+ * - latency.receive_to_commit_us: the part spent in the client itself.
+ *
+ * The compositor's input timestamps are taken to be CLOCK_MONOTONIC
+ * milliseconds, as they are in all common compositors (the protocol leaves
+ * the base undefined); implausible results are counted in
+ * latency.skipped instead. Frames that do not show anything new,
+ * and input that does not lead to a frame, are not measured.
+ */
+class LatencyTracker {
+public:
+    /// At most this many frames are measured at once; more are not measured.
+    static const int MAX_FRAMES_IN_FLIGHT = 8;
+
+protected:
+    // a committed frame waiting for the compositor to show it
+    struct Frame {
+        LatencyTracker* tracker = nullptr;
+        struct wp_presentation_feedback* feedback = nullptr;
+        wl_callback* callback = nullptr;
+        uint32_t input_time = 0;        // of the oldest event, see InputEvent
+        uint64_t input_received_ns = 0;
+        uint64_t commit_ns = 0;
+    };
+
+    wl::Surface& m_surface;
+    wp::Presentation* m_presentation = nullptr;     // null for the frame callback fallback
+    Frame m_frames[MAX_FRAMES_IN_FLIGHT];
+
+    // shared by the frames, each passing itself as the user data
+    wp_presentation_feedback_listener m_feedback_listener = { 0 };
+    wl_callback_listener m_callback_listener = { 0 };
+
+    // the oldest input consumed since the last commit, if any
+    bool m_input_pending = false;
+    uint32_t m_input_time = 0;
+    uint64_t m_input_received_ns = 0;
+
+    // average time from a commit to the presentation, one frame at 60 Hz at first
+    uint64_t m_present_delay_ns = 16666667;
+
+    void record(Frame& frame, uint64_t presented_ns);
+    static void release(Frame& frame);
+
+public:
+    /// Measures the frames of the given surface (the window's).
+    LatencyTracker(wayland::Display& display, wl::Surface& surface);
+    ~LatencyTracker();
+    LatencyTracker(LatencyTracker const&) = delete;
+    LatencyTracker& operator=(LatencyTracker const&) = delete;
+
+    /// Notes an event handed to the app; it is consumed by the next frame.
+    void input_consumed(InputEvent const& event);
+
+    /**
+     * Called right before the surface commit of a frame: asks for
+     * the feedback on it, if there was input since the last frame.
+     */
+    void frame_committed();
+
+    /// Called instead of frame_committed() if the frame was not shown
+    /// (it did not change anything), so the input was not measured.
+    void frame_skipped() { m_input_pending = false; }
+
+    /**
+     * Returns when a frame committed now will probably be shown (in ns of
+     * CLOCK_MONOTONIC), by the average delay of the measured frames;
+     * e.g. the time to predict the pointer position for.
+     */
+    uint64_t predict_present_ns(uint64_t now_ns) const { return now_ns + m_present_delay_ns; }
+
+    /// Returns true if using wp_presentation, false with frame callbacks.
+    bool has_presentation_feedback() const { return m_presentation != nullptr; }
+};
+
+} // namespace wayland
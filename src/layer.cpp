@@ -0,0 +1,92 @@
+#include "layer.hpp"
+#include "stats.hpp"
+#include <cassert>
+#include <stdexcept>
+
+wayland::Layer::Layer(wayland::Display& display, wl::Surface& parent, int x, int y,
+    int width, int height, uint32_t format)
+    : m_display(display), m_swapchain(display, format), m_x(x), m_y(y), m_width(width), m_height(height)
+{
+    assert(width > 0 && height > 0);
+    if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) {
+        throw std::logic_error("wayland::Layer: only ARGB8888 and XRGB8888 are supported");
+    }
+    m_surface = std::make_unique<wl::Surface>(display.get_compositor());
+    m_subsurface = std::make_unique<wl::Subsurface>(display.get_subcompositor(), *m_surface, parent);
+    m_subsurface->set_position(x, y);
+    m_parent_commit_needed = true;
+}
+
+void wayland::Layer::set_position(int x, int y) {
+    if (x == m_x && y == m_y) { return; }
+    m_x = x;
+    m_y = y;
+    m_subsurface->set_position(x, y);
+    m_parent_commit_needed = true;
+}
+
+void wayland::Layer::resize(int width, int height) {
+    assert(width > 0 && height > 0);
+    if (width == m_width && height == m_height) { return; }
+    m_width = width;
+    m_height = height;
+    m_invalidated = true;
+}
+
+void wayland::Layer::place_above(wl::Surface& sibling) {
+    m_subsurface->place_above(sibling);
+    m_parent_commit_needed = true;
+}
+
+void wayland::Layer::place_below(wl::Surface& sibling) {
+    m_subsurface->place_below(sibling);
+    m_parent_commit_needed = true;
+}
+
+void wayland::Layer::set_sync(bool sync) {
+    if (sync == m_sync) { return; }
+    m_sync = sync;
+    if (sync) {
+        m_subsurface->set_sync();
+    }
+    else {
+        m_subsurface->set_desync();
+    }
+}
+
+void wayland::Layer::set_painter(Painter painter) {
+    m_painter = std::move(painter);
+    m_invalidated = true;
+}
+
+bool wayland::Layer::update() {
+    static auto& layer_time = stats::histogram("layer.update_us");
+    static auto& layer_pixels = stats::counter("layer.pixels");
+    if (!m_invalidated) { return false; }
+    stats::ScopedTimer timer(layer_time);
+
+    auto frame = m_swapchain.get_new_frame(m_width, m_height);
+    PixelFormat format = (frame->get_format() == WL_SHM_FORMAT_ARGB8888)
+        ? PixelFormat::ARGB8888 : PixelFormat::XRGB8888;
+    AnyDrawingContext ctx(format, frame->get_memory(), m_width, m_height, frame->get_stride()/4);
+    ctx.fill_rect(0, 0, m_width, m_height, 0x00000000);
+    if (m_painter) {
+        m_painter(ctx);
+    }
+
+    frame->attach(*m_surface);
+    m_surface->damage(0, 0, m_width, m_height);
+    m_surface->commit();
+    layer_pixels.add((uint64_t) m_width*m_height);
+    m_invalidated = false;
+    if (m_sync) {
+        m_parent_commit_needed = true;
+    }
+    return true;
+}
+
+bool wayland::Layer::take_parent_commit_needed() {
+    bool needed = m_parent_commit_needed;
+    m_parent_commit_needed = false;
+    return needed;
+}
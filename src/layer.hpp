@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include "app.hpp"
+#include "draw.hpp"
+#include "swapchain.hpp"
+
+namespace wayland {
+
+/**
+ * A part of the window with its own surface and buffers: a subsurface
+ * positioned relative to the window, which the compositor composites
+ * with the rest. Redrawing a layer touches only its own (usually small)
+ * buffer, so e.g. a blinking cursor or a progress overlay does not cost
+ * a redraw and upload of the whole window.
+ *
+ * The content is painted by the painter function, into a buffer that is
+ * ARGB8888 (premultiplied alpha, transparent at first) or XRGB8888 (opaque);
+ * it is repainted whole on update() after invalidate() or a resize.
+ *
+ * In synchronized mode (the default) a committed layer appears with the
+ * window's next commit, atomically with the window content; in
+ * desynchronized mode it appears as soon as it is committed. The position
+ * and stacking order always take effect with the window's next commit.
+ */
+class Layer {
+public:
+    using Painter = std::function<void(AnyDrawingContext& ctx)>;
+
+protected:
+    wayland::Display& m_display;
+    std::unique_ptr<wl::Surface> m_surface;
+    std::unique_ptr<wl::Subsurface> m_subsurface;
+    Swapchain m_swapchain;
+    Painter m_painter;
+    int m_x = 0;
+    int m_y = 0;
+    int m_width = 0;
+    int m_height = 0;
+    bool m_sync = true;
+    bool m_invalidated = true;
+    bool m_parent_commit_needed = false;
+
+public:
+    /**
+     * Creates the layer above the parent surface (the window's surface).
+     * Throws std::logic_error for a format other than WL_SHM_FORMAT_ARGB8888
+     * or WL_SHM_FORMAT_XRGB8888, as the painting is 32-bit only.
+     */
+    Layer(wayland::Display& display, wl::Surface& parent, int x, int y, int width, int height,
+        uint32_t format = WL_SHM_FORMAT_ARGB8888);
+    Layer(Layer const&) = delete;
+    Layer& operator=(Layer const&) = delete;
+
+    wl::Surface& get_surface() { return *m_surface; }
+    int get_x() const { return m_x; }
+    int get_y() const { return m_y; }
+    int get_width() const { return m_width; }
+    int get_height() const { return m_height; }
+    bool is_sync() const { return m_sync; }
+
+    /// Moves the layer relative to the window's top-left corner.
+    void set_position(int x, int y);
+
+    /// Changes the size of the layer (it is repainted on the next update()).
+    void resize(int width, int height);
+
+    /// Places the layer directly above or below another layer (or the window).
+    void place_above(Layer& sibling) { place_above(sibling.get_surface()); }
+    void place_below(Layer& sibling) { place_below(sibling.get_surface()); }
+    void place_above(wl::Surface& sibling);
+    void place_below(wl::Surface& sibling);
+
+    /// Switches between synchronized (true) and desynchronized mode.
+    void set_sync(bool sync);
+
+    /// Sets the function that paints the content and invalidates the layer.
+    void set_painter(Painter painter);
+
+    /// Marks the layer as needing a repaint on the next update().
+    void invalidate() { m_invalidated = true; }
+    bool is_invalidated() const { return m_invalidated; }
+
+    /**
+     * Repaints and commits the layer if it was invalidated.
+     * Returns true if it was committed.
+     */
+    bool update();
+
+    /**
+     * Returns true if the layer has changes that wait for the window's
+     * commit (a synchronized commit, a new position or order), and forgets
+     * them: the caller is expected to commit the window.
+     */
+    bool take_parent_commit_needed();
+};
+
+} // namespace wayland
@@ -0,0 +1,51 @@
+#include "mapped_file.hpp"
+#include "debug.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(std::string const& path) {
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("MappedFile: cannot open " + path + ": " + errno_to_string(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        auto orig_errno = errno;
+        close(fd);
+        throw std::runtime_error("MappedFile: fstat() failed on " + path + ": " + errno_to_string(orig_errno));
+    }
+    try {
+        map(fd, st.st_size, path);
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+MappedFile::MappedFile(int fd, size_t size) {
+    map(fd, size, "file descriptor " + std::to_string(fd));
+}
+
+MappedFile::~MappedFile() {
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+}
+
+void MappedFile::map(int fd, size_t size, std::string const& what) {
+    if (size == 0) {
+        throw std::runtime_error("MappedFile: " + what + " is empty");
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("MappedFile: mmap() failed on " + what + ": " + errno_to_string(errno));
+    }
+    m_data = data;
+    m_size = size;
+}
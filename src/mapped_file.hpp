@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * A read-only memory mapping of a whole file, unmapped on destruction.
+ * The content is accessed in place; nothing is copied.
+ * Throws std::runtime_error if the file cannot be opened or mapped.
+ */
+class MappedFile {
+protected:
+    void* m_data = nullptr;
+    size_t m_size = 0;
+
+    void map(int fd, size_t size, std::string const& what);
+
+public:
+    /// Maps the file at the given path.
+    explicit MappedFile(std::string const& path);
+
+    /// Maps size bytes of an already open file descriptor
+    /// (the descriptor is not closed and can be closed right after).
+    MappedFile(int fd, size_t size);
+
+    ~MappedFile();
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    uint8_t const* data() const { return (uint8_t const*) m_data; }
+    size_t size() const { return m_size; }
+};
@@ -0,0 +1,138 @@
+#include "motion_predictor.hpp"
+#include <algorithm>
+#include <cmath>
+
+void MotionPredictor::reset() {
+    m_sample_count = 0;
+    m_fit_count = 0;
+    m_pending_count = 0;
+}
+
+void MotionPredictor::add_sample(uint64_t time_ns, float x, float y) {
+    if (m_sample_count > 0) {
+        Sample const& last = sample(0);
+        if (time_ns < last.time_ns) {
+            return;
+        }
+        float vx, vy;
+        bool turned = fit_velocity(vx, vy) && (vx*(x - last.x) + vy*(y - last.y) < 0.0f);
+        bool paused = (time_ns - last.time_ns > uint64_t(m_settings.pause_ms)*1000000);
+        if (turned || paused) {
+            // the last sample still counts as the start of the new motion
+            m_fit_count = 1;
+        }
+    }
+    m_newest = (m_newest + 1) % MAX_SAMPLES;
+    m_samples[m_newest] = Sample { time_ns, x, y };
+    m_sample_count = std::min(m_sample_count + 1, MAX_SAMPLES);
+    m_fit_count = std::min(m_fit_count + 1, MAX_SAMPLES);
+    evaluate_pending();
+}
+
+/**
+ * Fits the velocity (px/ns) to the samples of the current motion within
+ * the fit window. Returns false if there are not enough of them.
+ */
+bool MotionPredictor::fit_velocity(float& vx, float& vy) const {
+    uint64_t newest_ns = sample(0).time_ns;
+    uint64_t window_ns = uint64_t(m_settings.fit_window_ms)*1000000;
+    int count = 0;
+    double sum_t = 0.0, sum_x = 0.0, sum_y = 0.0;
+    while (count < m_fit_count && newest_ns - sample(count).time_ns <= window_ns) {
+        Sample const& s = sample(count);
+        sum_t += -double(newest_ns - s.time_ns);
+        sum_x += s.x;
+        sum_y += s.y;
+        count++;
+    }
+    if (count < 2) { return false; }
+
+    double mean_t = sum_t/count, mean_x = sum_x/count, mean_y = sum_y/count;
+    double stt = 0.0, stx = 0.0, sty = 0.0;
+    for (int i = 0; i < count; i++) {
+        Sample const& s = sample(i);
+        double dt = -double(newest_ns - s.time_ns) - mean_t;
+        stt += dt*dt;
+        stx += dt*(s.x - mean_x);
+        sty += dt*(s.y - mean_y);
+    }
+    if (stt <= 0.0) { return false; }
+    vx = float(stx/stt);
+    vy = float(sty/stt);
+    return true;
+}
+
+bool MotionPredictor::predict(uint64_t time_ns, float& x, float& y) {
+    if (m_sample_count == 0) { return false; }
+    Sample const& last = sample(0);
+    x = last.x;
+    y = last.y;
+
+    float vx, vy;
+    if (time_ns > last.time_ns && fit_velocity(vx, vy)) {
+        uint64_t horizon_ns = std::min(time_ns - last.time_ns, uint64_t(m_settings.max_horizon_ms)*1000000);
+        float dx = vx*horizon_ns;
+        float dy = vy*horizon_ns;
+        float distance = std::sqrt(dx*dx + dy*dy);
+        if (distance > m_settings.max_distance) {
+            dx *= m_settings.max_distance/distance;
+            dy *= m_settings.max_distance/distance;
+        }
+        x += dx;
+        y += dy;
+    }
+
+    // checked later against the real position (the oldest is dropped if full)
+    if (m_pending_count == MAX_PENDING) {
+        m_pending_first = (m_pending_first + 1) % MAX_PENDING;
+        m_pending_count--;
+    }
+    m_pending[(m_pending_first + m_pending_count) % MAX_PENDING] = Pending { time_ns, x, y, last.x, last.y };
+    m_pending_count++;
+    return true;
+}
+
+/**
+ * Compares the predictions whose time has come with the real position
+ * at that time (interpolated between the samples around it; after a pause,
+ * the pointer is taken to have stood still).
+ */
+void MotionPredictor::evaluate_pending() {
+    static auto& error = stats::histogram("pointer.prediction_error_px10");
+    static auto& unpredicted_error = stats::histogram("pointer.unpredicted_error_px10");
+
+    uint64_t pause_ns = uint64_t(m_settings.pause_ms)*1000000;
+    while (m_pending_count > 0) {
+        Pending const& pending = m_pending[m_pending_first];
+        if (pending.time_ns > sample(0).time_ns) {
+            break;
+        }
+        m_pending_first = (m_pending_first + 1) % MAX_PENDING;
+        m_pending_count--;
+
+        // find the samples around the time
+        int age = 1;
+        while (age < m_sample_count && sample(age).time_ns > pending.time_ns) {
+            age++;
+        }
+        if (age >= m_sample_count) {
+            continue;       // too old to check
+        }
+        Sample const& before = sample(age);
+        Sample const& after = sample(age - 1);
+        float real_x = before.x, real_y = before.y;
+        uint64_t gap = after.time_ns - before.time_ns;
+        if (gap > 0 && gap <= pause_ns) {
+            float t = float(pending.time_ns - before.time_ns)/gap;
+            real_x += (after.x - before.x)*t;
+            real_y += (after.y - before.y)*t;
+        }
+
+        uint64_t e = uint64_t(10.0f*std::hypot(pending.x - real_x, pending.y - real_y) + 0.5f);
+        uint64_t u = uint64_t(10.0f*std::hypot(pending.last_x - real_x, pending.last_y - real_y) + 0.5f);
+        error.add(e);
+        unpredicted_error.add(u);
+        m_error.add(e);
+        m_unpredicted_error.add(u);
+    }
+}
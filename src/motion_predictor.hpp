@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include "stats.hpp"
+
+/**
+ * Predicts where the pointer will be when the frame being drawn is shown,
+ * so that dragged objects can be drawn under the cursor instead of a frame
+ * or more behind it. The velocity is fitted (least squares) to the recent
+ * motion samples by their timestamps and extrapolated from the last
+ * sample; the extrapolation is limited in time and distance, and the
+ * fit starts anew when the motion turns back or pauses.
+ *
+ * Each prediction is checked against the real position once samples past
+ * its time arrive: the error goes to the pointer.prediction_error_px10
+ * histogram (in tenths of a pixel) and to the predictor's own histogram,
+ * next to the error of not predicting at all (using the last position),
+ * so the settings can be tuned for a device.
+ */
+class MotionPredictor {
+public:
+    struct Settings {
+        int fit_window_ms = 40;         // samples older than this are not fitted
+        int max_horizon_ms = 50;        // extrapolate at most this far past the last sample
+        float max_distance = 64.0f;     // move the position at most this far (px)
+        int pause_ms = 100;             // a longer gap between samples restarts the fit
+    };
+
+    static const int MAX_SAMPLES = 16;
+    static const int MAX_PENDING = 16;
+
+protected:
+    struct Sample {
+        uint64_t time_ns = 0;
+        float x = 0.0f;
+        float y = 0.0f;
+    };
+
+    // a prediction waiting for the real position at its time
+    struct Pending {
+        uint64_t time_ns = 0;
+        float x = 0.0f;
+        float y = 0.0f;
+        float last_x = 0.0f;            // the position known when predicting
+        float last_y = 0.0f;
+    };
+
+    Settings m_settings;
+    Sample m_samples[MAX_SAMPLES];      // a ring, the newest at m_newest
+    int m_sample_count = 0;
+    int m_newest = 0;
+    int m_fit_count = 0;                // of the newest samples, used for fitting
+    Pending m_pending[MAX_PENDING];     // a ring, the oldest at m_pending_first
+    int m_pending_count = 0;
+    int m_pending_first = 0;
+    stats::Histogram m_error;
+    stats::Histogram m_unpredicted_error;
+
+    Sample const& sample(int age) const {
+        return m_samples[(m_newest - age + MAX_SAMPLES) % MAX_SAMPLES];
+    }
+    bool fit_velocity(float& vx, float& vy) const;
+    void evaluate_pending();
+
+public:
+    MotionPredictor() {}
+    explicit MotionPredictor(Settings const& settings) : m_settings(settings) {}
+
+    Settings const& get_settings() const { return m_settings; }
+    void set_settings(Settings const& settings) { m_settings = settings; }
+
+    /// Adds a motion sample (e.g. of a wl_pointer.motion event, see input_event_time_ns()).
+    void add_sample(uint64_t time_ns, float x, float y);
+
+    /// Forgets the samples (e.g. when the pointer leaves the surface).
+    void reset();
+
+    /**
+     * Returns the position predicted for the given time (e.g. by
+     * LatencyTracker::predict_present_ns()) in x and y; returns false,
+     * leaving them unchanged, if there are no samples.
+     */
+    bool predict(uint64_t time_ns, float& x, float& y);
+
+    /// Returns the errors of the predictions of this predictor and of not predicting (px/10).
+    stats::Histogram const& get_error() const { return m_error; }
+    stats::Histogram const& get_unpredicted_error() const { return m_unpredicted_error; }
+};
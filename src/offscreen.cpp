@@ -0,0 +1,134 @@
+#include "offscreen.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+/// Returns the smallest size class (blocks of 1 << (class + min_shift) bytes) holding the bytes.
+int size_class_of(size_t bytes, int min_shift) {
+    int shift = min_shift;
+    while (((size_t) 1 << shift) < bytes) { shift++; }
+    return shift - min_shift;
+}
+
+} // namespace
+
+OffscreenCache::Entry& OffscreenCache::acquire(uint64_t key, uint64_t inputs, int width, int height) {
+    static stats::Counter& hits = stats::counter("offscreen.cache_hits");
+    static stats::Counter& misses = stats::counter("offscreen.cache_misses");
+    static stats::Counter& pool_reuses = stats::counter("offscreen.pool_reuses");
+
+    if (width <= 0 || height <= 0) {
+        throw std::logic_error("OffscreenCache: empty image");
+    }
+
+    auto found = m_lookup.find(key);
+    std::list<Entry>::iterator entry;
+    if (found != m_lookup.end()) {
+        entry = found->second;
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+        entry->frame = m_frame;
+        if (entry->ready && entry->inputs == inputs
+            && entry->image.width == width && entry->image.height == height)
+        {
+            hits.add();
+            return *entry;
+        }
+    }
+    else {
+        m_entries.emplace_front();
+        entry = m_entries.begin();
+        entry->key = key;
+        entry->frame = m_frame;
+        m_lookup[key] = entry;
+    }
+    misses.add();
+
+    size_t bytes = (size_t) width*height*sizeof(uint32_t);
+    int size_class = size_class_of(bytes, MIN_CLASS_SHIFT);
+    if (size_class >= SIZE_CLASSES) {
+        throw std::logic_error("OffscreenCache: image too large");
+    }
+    if (entry->size_class != size_class) {
+        release_block(*entry);
+        auto& pool = m_pool[size_class];
+        if (!pool.empty()) {
+            entry->block = std::move(pool.back());
+            pool.pop_back();
+            m_pooled -= (size_t) 1 << (size_class + MIN_CLASS_SHIFT);
+            pool_reuses.add();
+        }
+        else {
+            entry->block.reset(new uint32_t[((size_t) 1 << (size_class + MIN_CLASS_SHIFT))/sizeof(uint32_t)]);
+        }
+        entry->size_class = size_class;
+        m_size += (size_t) 1 << (size_class + MIN_CLASS_SHIFT);
+    }
+
+    // the painter starts with a transparent image
+    std::fill_n(entry->block.get(), (size_t) width*height, 0u);
+    entry->inputs = inputs;
+    entry->ready = false;
+    entry->image.pixels = entry->block.get();
+    entry->image.width = width;
+    entry->image.height = height;
+    entry->image.stride = width;
+    entry->image.version = ++m_version;
+    evict();
+    return *entry;
+}
+
+/// Moves the block of the entry to the pool.
+void OffscreenCache::release_block(Entry& entry) {
+    if (!entry.block) { return; }
+    size_t bytes = (size_t) 1 << (entry.size_class + MIN_CLASS_SHIFT);
+    m_size -= bytes;
+    m_pooled += bytes;
+    m_pool[entry.size_class].push_back(std::move(entry.block));
+    entry.size_class = -1;
+    entry.image = OffscreenImage();
+}
+
+/**
+ * Drops the least recently used images while over the bound, sparing
+ * recent frames, and then frees pooled blocks, the biggest first.
+ */
+void OffscreenCache::evict() {
+    while (m_size > m_capacity && !m_entries.empty()) {
+        auto& oldest = m_entries.back();
+        if (oldest.frame + 1 >= m_frame) { break; }
+        release_block(oldest);
+        m_lookup.erase(oldest.key);
+        m_entries.pop_back();
+    }
+    for (int i = SIZE_CLASSES - 1; i >= 0 && m_size + m_pooled > m_capacity; --i) {
+        while (!m_pool[i].empty() && m_size + m_pooled > m_capacity) {
+            m_pool[i].pop_back();
+            m_pooled -= (size_t) 1 << (i + MIN_CLASS_SHIFT);
+        }
+    }
+}
+
+void OffscreenCache::remove(uint64_t key) {
+    auto found = m_lookup.find(key);
+    if (found == m_lookup.end()) { return; }
+    auto entry = found->second;
+    if (entry->frame + 1 >= m_frame) {
+        // may still be recorded in a display list; let it age out instead
+        entry->ready = false;
+        return;
+    }
+    release_block(*entry);
+    m_lookup.erase(found);
+    m_entries.erase(entry);
+    evict();
+}
+
+void OffscreenCache::next_frame() {
+    static stats::Histogram& cache_kb = stats::histogram("offscreen.cache_kb");
+    static stats::Histogram& pool_kb = stats::histogram("offscreen.pool_kb");
+    m_frame++;
+    evict();
+    cache_kb.add(m_size/1024);
+    pool_kb.add(m_pooled/1024);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "draw.hpp"
+#include "stats.hpp"
+
+/// A cached offscreen rendering (see OffscreenCache).
+struct OffscreenImage {
+    uint32_t const* pixels = nullptr;   // premultiplied ARGB
+    int width = 0;
+    int height = 0;
+    int stride = 0;                     // in pixels
+    uint64_t version = 0;               // changes whenever the pixels do
+};
+
+/**
+ * Offscreen renderings of content that is expensive to draw but rarely
+ * changes (e.g. a complex vector widget): the content is painted once into
+ * an ARGB buffer, and then only composited into each frame (see
+ * BasicDrawingContext::blit_image()) for as long as its inputs stay
+ * the same. Each entry is identified by a key chosen by the caller
+ * (e.g. the address of the widget) and tagged with a hash of everything
+ * the painting depends on; a different hash or size repaints the entry.
+ *
+ * Pixel buffers come in power-of-two size classes and are recycled
+ * through a pool when entries are evicted or resized, so a steady state
+ * does no heap allocation. The cache is bounded in bytes (pooled buffers
+ * included); images used in the current or the previous frame are never
+ * evicted, so they may be recorded in a display list: call next_frame()
+ * once per frame. Not thread-safe.
+ */
+class OffscreenCache {
+protected:
+    static const int SIZE_CLASSES = 24;         // 4 KiB to 32 GiB
+    static const int MIN_CLASS_SHIFT = 12;
+
+    struct Entry {
+        uint64_t key = 0;
+        uint64_t inputs = 0;
+        uint64_t frame = 0;             // when it was last used
+        bool ready = false;             // painted with the current inputs
+        OffscreenImage image;
+        std::unique_ptr<uint32_t[]> block;
+        int size_class = -1;
+    };
+
+    size_t m_capacity;
+    size_t m_size = 0;                  // bytes of the blocks held by entries
+    size_t m_pooled = 0;                // bytes of the free blocks
+    uint64_t m_frame = 1;
+    uint64_t m_version = 0;
+    std::list<Entry> m_entries;         // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_lookup;
+    std::vector<std::unique_ptr<uint32_t[]>> m_pool[SIZE_CLASSES];
+
+    Entry& acquire(uint64_t key, uint64_t inputs, int width, int height);
+    void release_block(Entry& entry);
+    void evict();
+
+public:
+    explicit OffscreenCache(size_t capacity = 32 << 20) : m_capacity(capacity) {}
+    OffscreenCache(OffscreenCache const&) = delete;
+    OffscreenCache& operator=(OffscreenCache const&) = delete;
+
+    /**
+     * Returns the image for the key, calling paint(context) to paint it
+     * (into a transparent width x height BasicDrawingContext<ARGB8888Traits>)
+     * if it is not cached with the same inputs and size.
+     * The reference is valid until the next call.
+     */
+    template<class Painter>
+    OffscreenImage const& get(uint64_t key, uint64_t inputs, int width, int height, Painter&& paint) {
+        Entry& entry = acquire(key, inputs, width, height);
+        if (!entry.ready) {
+            static stats::Histogram& paint_time = stats::histogram("offscreen.paint_us");
+            stats::ScopedTimer timer(paint_time);
+            BasicDrawingContext<ARGB8888Traits> ctx(entry.block.get(), width, height);
+            paint(ctx);
+            entry.ready = true;
+        }
+        return entry.image;
+    }
+
+    /**
+     * Draws the cached image for the key at (x, y) into the context,
+     * painting it first if needed (see get()). Works with any context
+     * that has blit_image(), including a RecordingContext.
+     */
+    template<class Context, class Painter>
+    void draw(Context& ctx, uint64_t key, uint64_t inputs, int x, int y, int width, int height,
+        Painter&& paint)
+    {
+        if (width <= 0 || height <= 0) { return; }
+        OffscreenImage const& image = get(key, inputs, width, height, paint);
+        ctx.blit_image(x, y, image.pixels, image.stride, image.width, image.height, image.version);
+    }
+
+    /// Drops the entry for the key (e.g. when the widget is destroyed).
+    void remove(uint64_t key);
+
+    /** Marks the start of a new frame, allowing older images to be evicted. */
+    void next_frame();
+
+    /** Returns the number of bytes taken by the cached images. */
+    size_t cache_size() const { return m_size; }
+
+    /** Returns the number of bytes kept in the pool for reuse. */
+    size_t pool_size() const { return m_pooled; }
+
+    /** Returns the number of cached images. */
+    size_t cached_count() const { return m_entries.size(); }
+};
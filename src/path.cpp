@@ -0,0 +1,66 @@
+#include "path.hpp"
+#include <algorithm>
+#include <cmath>
+
+// PathView ------------------------------------------------------------------
+
+Rect PathView::bounds() const {
+    if (point_count == 0) { return Rect(); }
+    float x_min = points[0].x, x_max = x_min, y_min = points[0].y, y_max = y_min;
+    for (size_t i = 1; i < point_count; ++i) {
+        x_min = std::min(x_min, points[i].x);
+        x_max = std::max(x_max, points[i].x);
+        y_min = std::min(y_min, points[i].y);
+        y_max = std::max(y_max, points[i].y);
+    }
+
+    // keep far away coordinates from overflowing the integer rectangle
+    const float limit = 1 << 28;
+    int left = (int) std::floor(std::clamp(x_min, -limit, limit));
+    int top = (int) std::floor(std::clamp(y_min, -limit, limit));
+    int right = (int) std::ceil(std::clamp(x_max, -limit, limit));
+    int bottom = (int) std::ceil(std::clamp(y_max, -limit, limit));
+    return Rect(left, top, right - left, bottom - top);
+}
+
+// Path ----------------------------------------------------------------------
+
+void Path::move_to(float x, float y) {
+    m_verbs.push_back(PathVerb::Move);
+    m_points.push_back(PathPoint { x, y });
+    m_has_current = true;
+}
+
+void Path::line_to(float x, float y) {
+    ensure_contour(x, y);
+    m_verbs.push_back(PathVerb::Line);
+    m_points.push_back(PathPoint { x, y });
+}
+
+void Path::quad_to(float cx, float cy, float x, float y) {
+    ensure_contour(cx, cy);
+    m_verbs.push_back(PathVerb::Quad);
+    m_points.push_back(PathPoint { cx, cy });
+    m_points.push_back(PathPoint { x, y });
+}
+
+void Path::cubic_to(float c1x, float c1y, float c2x, float c2y, float x, float y) {
+    ensure_contour(c1x, c1y);
+    m_verbs.push_back(PathVerb::Cubic);
+    m_points.push_back(PathPoint { c1x, c1y });
+    m_points.push_back(PathPoint { c2x, c2y });
+    m_points.push_back(PathPoint { x, y });
+}
+
+void Path::close() {
+    if (m_has_current) {
+        m_verbs.push_back(PathVerb::Close);
+        m_has_current = false;
+    }
+}
+
+void Path::clear() {
+    m_verbs.clear();
+    m_points.clear();
+    m_has_current = false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "rect.hpp"
+
+/// How overlapping parts of a path (and its holes) are filled.
+enum class FillRule {
+    NonZero,    ///< inside where the contours wind around a point a non-zero number of times
+    EvenOdd,    ///< inside where a ray from the point crosses an odd number of edges
+};
+
+/// The kinds of path elements; each takes 1, 1, 2, 3 or 0 points respectively.
+enum class PathVerb : uint8_t {
+    Move,
+    Line,
+    Quad,
+    Cubic,
+    Close,
+};
+
+struct PathPoint {
+    float x;
+    float y;
+};
+
+/**
+ * A read-only view of path data (verbs and their points), which may live
+ * in a Path or elsewhere (e.g. recorded in a display list).
+ */
+struct PathView {
+    PathVerb const* verbs = nullptr;
+    size_t verb_count = 0;
+    PathPoint const* points = nullptr;
+    size_t point_count = 0;
+
+    /// Returns the smallest integer rectangle containing all points
+    /// (including curve control points, so the whole path is inside).
+    Rect bounds() const;
+};
+
+/**
+ * A shape built from contours of straight lines and quadratic and cubic
+ * Bezier curves, in the coordinates of the view it is drawn into.
+ * Every contour is closed implicitly when the path is filled.
+ * Reusing a path after clear() does not allocate.
+ */
+class Path {
+protected:
+    std::vector<PathVerb> m_verbs;
+    std::vector<PathPoint> m_points;
+    bool m_has_current = false;     // whether a contour was started
+
+    void ensure_contour(float x, float y) {
+        if (!m_has_current) { move_to(x, y); }
+    }
+
+public:
+    /// Starts a new contour at the point.
+    void move_to(float x, float y);
+
+    /// Adds a straight line from the current point
+    /// (a segment without a current point starts a contour at its end point).
+    void line_to(float x, float y);
+
+    /// Adds a quadratic curve with the control point (cx, cy).
+    void quad_to(float cx, float cy, float x, float y);
+
+    /// Adds a cubic curve with the control points (c1x, c1y) and (c2x, c2y).
+    void cubic_to(float c1x, float c1y, float c2x, float c2y, float x, float y);
+
+    /// Closes the current contour with a line back to its start.
+    void close();
+
+    /// Removes everything, keeping the memory.
+    void clear();
+
+    bool is_empty() const { return m_verbs.empty(); }
+    Rect bounds() const { return view().bounds(); }
+
+    PathView view() const {
+        return PathView { m_verbs.data(), m_verbs.size(), m_points.data(), m_points.size() };
+    }
+    operator PathView() const { return view(); }
+};
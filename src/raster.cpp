@@ -0,0 +1,486 @@
+#include "raster.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void AccumulationRasterizer::reset(int width, int height) {
+    if (m_dirty) {
+        // the previous outline was never rendered, so it was not cleared
+        std::fill(m_cells.begin(), m_cells.end(), 0.0f);
+    }
+    m_dirty = true;
+    m_width = std::max(width, 0);
+    m_height = std::max(height, 0);
+
+    // two spare cells per row for the parts of segments that touch the right edge
+    m_stride = (m_width + 2 + 3) & ~3;
+    size_t size = (size_t) m_stride*m_height;
+    if (m_cells.size() < size) {
+        m_cells.resize(size);
+    }
+}
+
+void AccumulationRasterizer::line(float x0, float y0, float x1, float y1) {
+    if (y0 == y1) { return; }
+
+    // always walk downwards, remembering the direction for the winding
+    float dir = 1.0f;
+    if (y0 > y1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        dir = -1.0f;
+    }
+    float dxdy = (x1 - x0)/(y1 - y0);
+    float x = x0;
+    if (y0 < 0.0f) {
+        x -= y0*dxdy;
+    }
+    int y_start = std::max(0, (int) y0);
+    int y_end = std::min(m_height, (int) std::ceil(y1));
+    float x_max = (float) m_width;
+
+    for (int y = y_start; y < y_end; ++y) {
+        float* row = m_cells.data() + (size_t) y*m_stride;
+        float dy = std::min((float)(y + 1), y1) - std::max((float) y, y0);
+        float x_next = x + dxdy*dy;
+        float d = dy*dir;
+
+        float xa = std::clamp(std::min(x, x_next), 0.0f, x_max);
+        float xb = std::clamp(std::max(x, x_next), 0.0f, x_max);
+        float xa_floor = std::floor(xa);
+        int xa_i = (int) xa_floor;
+        float xb_ceil = std::ceil(xb);
+        int xb_i = (int) xb_ceil;
+
+        if (xb_i <= xa_i + 1) {
+            // the segment stays within one pixel of this row
+            float xm = 0.5f*(xa + xb) - xa_floor;
+            row[xa_i] += d - d*xm;
+            row[xa_i + 1] += d*xm;
+        }
+        else {
+            // spread the area over the crossed pixels (a trapezoid per pixel)
+            float s = 1.0f/(xb - xa);
+            float xa_f = xa - xa_floor;
+            float a0 = 0.5f*s*(1.0f - xa_f)*(1.0f - xa_f);
+            float xb_f = xb - xb_ceil + 1.0f;
+            float am = 0.5f*s*xb_f*xb_f;
+            row[xa_i] += d*a0;
+            if (xb_i == xa_i + 2) {
+                row[xa_i + 1] += d*(1.0f - a0 - am);
+            }
+            else {
+                float a1 = s*(1.5f - xa_f);
+                row[xa_i + 1] += d*(a1 - a0);
+                for (int xi = xa_i + 2; xi < xb_i - 1; ++xi) {
+                    row[xi] += d*s;
+                }
+                float a2 = a1 + (xb_i - xa_i - 3)*s;
+                row[xb_i - 1] += d*(1.0f - a2 - am);
+            }
+            row[xb_i] += d*am;
+        }
+        x = x_next;
+    }
+}
+
+void AccumulationRasterizer::quad(float x0, float y0, float x1, float y1, float x2, float y2) {
+    // the number of lines grows with the square root of the curve's deviation
+    float dx = x0 - 2.0f*x1 + x2;
+    float dy = y0 - 2.0f*y1 + y2;
+    float deviation = dx*dx + dy*dy;
+    int n = 1 + (int) std::sqrt(std::sqrt(3.0f*deviation));
+    n = std::min(n, 32);
+
+    float step = 1.0f/n;
+    float px = x0, py = y0;
+    for (int i = 1; i <= n; ++i) {
+        float t = i*step;
+        float u = 1.0f - t;
+        float qx = u*u*x0 + 2.0f*u*t*x1 + t*t*x2;
+        float qy = u*u*y0 + 2.0f*u*t*y1 + t*t*y2;
+        line(px, py, qx, qy);
+        px = qx;
+        py = qy;
+    }
+}
+
+void AccumulationRasterizer::render(uint8_t* out, int stride) {
+    m_dirty = false;
+    for (int y = 0; y < m_height; ++y) {
+        float* row = m_cells.data() + (size_t) y*m_stride;
+        uint8_t* out_row = out + (size_t) y*stride;
+        int x = 0;
+
+#if defined(__SSE2__)
+        // prefix sum of four cells in a register, plus the sum of everything before
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        __m128 carry = _mm_setzero_ps();
+        for (; x + 4 <= m_width; x += 4) {
+            __m128 v = _mm_loadu_ps(row + x);
+            v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+            v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+            v = _mm_add_ps(v, carry);
+            carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+            _mm_storeu_ps(row + x, _mm_setzero_ps());
+
+            __m128 coverage = _mm_min_ps(_mm_andnot_ps(sign, v), one);
+            __m128i bytes = _mm_cvtps_epi32(_mm_mul_ps(coverage, scale));
+            bytes = _mm_packs_epi32(bytes, bytes);
+            bytes = _mm_packus_epi16(bytes, bytes);
+            int32_t packed = _mm_cvtsi128_si32(bytes);
+            memcpy(out_row + x, &packed, 4);
+        }
+        float sum = _mm_cvtss_f32(carry);
+#else
+        float sum = 0.0f;
+#endif
+        for (; x < m_width; ++x) {
+            sum += row[x];
+            row[x] = 0.0f;
+            float coverage = std::min(std::fabs(sum), 1.0f);
+            out_row[x] = (uint8_t) std::lround(coverage*255.0f);
+        }
+
+        // the spare cells must be cleared too
+        for (; x < m_stride; ++x) {
+            row[x] = 0.0f;
+        }
+    }
+}
+
+// ScanlineRasterizer --------------------------------------------------------
+
+// positions are kept in fixed point with this many fractional bits
+static const int SUBPIXEL_SHIFT = 8;
+static const int SUBPIXEL_SCALE = 1 << SUBPIXEL_SHIFT;
+static const int SUBPIXEL_MASK = SUBPIXEL_SCALE - 1;
+
+// edges reaching further than this outside the clip are cut (in pixels)
+static const float CLIP_MARGIN = 2048.0f;
+
+// curves are flattened into lines deviating at most this much, in pixels
+static const float FLATNESS = 0.1f;
+
+ScanlineRasterizer& ScanlineRasterizer::scratch() {
+    static thread_local ScanlineRasterizer rasterizer;
+    return rasterizer;
+}
+
+void ScanlineRasterizer::reset(Rect const& clip) {
+    m_cells.clear();
+    m_clip = clip;
+    m_current = Cell { INT32_MIN, INT32_MIN, 0, 0 };
+}
+
+void ScanlineRasterizer::add_cell() {
+    Cell const& c = m_current;
+    if ((c.cover | c.area) == 0 || c.y < m_clip.y || c.y >= m_clip.bottom() || c.x >= m_clip.right()) {
+        return;
+    }
+    // everything left of the clip only matters for its cover, so it can share one cell
+    m_cells.push_back(c);
+    if (c.x < m_clip.x) { m_cells.back().x = m_clip.x - 1; }
+}
+
+/**
+ * Adds the part of an edge within one row (y1, y2 are within the row,
+ * 0 to SUBPIXEL_SCALE), distributing it over the cells it crosses.
+ */
+void ScanlineRasterizer::render_hline(int ey, int x1, int y1, int x2, int y2) {
+    int ex1 = x1 >> SUBPIXEL_SHIFT;
+    int ex2 = x2 >> SUBPIXEL_SHIFT;
+    int fx1 = x1 & SUBPIXEL_MASK;
+    int fx2 = x2 & SUBPIXEL_MASK;
+
+    if (y1 == y2) {
+        set_cell(ex2, ey);
+        return;
+    }
+    if (ex1 == ex2) {
+        int delta = y2 - y1;
+        m_current.cover += delta;
+        m_current.area += (fx1 + fx2)*delta;
+        return;
+    }
+
+    // a run of adjacent cells
+    int64_t p = (int64_t)(SUBPIXEL_SCALE - fx1)*(y2 - y1);
+    int first = SUBPIXEL_SCALE;
+    int incr = 1;
+    int64_t dx = x2 - x1;
+    if (dx < 0) {
+        p = (int64_t) fx1*(y2 - y1);
+        first = 0;
+        incr = -1;
+        dx = -dx;
+    }
+    int delta = (int)(p/dx);
+    int64_t mod = p % dx;
+    if (mod < 0) { delta--; mod += dx; }
+
+    m_current.cover += delta;
+    m_current.area += (fx1 + first)*delta;
+    ex1 += incr;
+    set_cell(ex1, ey);
+    y1 += delta;
+
+    if (ex1 != ex2) {
+        p = (int64_t) SUBPIXEL_SCALE*(y2 - y1 + delta);
+        int lift = (int)(p/dx);
+        int64_t rem = p % dx;
+        if (rem < 0) { lift--; rem += dx; }
+        mod -= dx;
+        while (ex1 != ex2) {
+            delta = lift;
+            mod += rem;
+            if (mod >= 0) { mod -= dx; delta++; }
+            m_current.cover += delta;
+            m_current.area += SUBPIXEL_SCALE*delta;
+            y1 += delta;
+            ex1 += incr;
+            set_cell(ex1, ey);
+        }
+    }
+    delta = y2 - y1;
+    m_current.cover += delta;
+    m_current.area += (fx2 + SUBPIXEL_SCALE - first)*delta;
+}
+
+/// Adds an edge given in fixed point, row by row.
+void ScanlineRasterizer::line_fixed(int x1, int y1, int x2, int y2) {
+    int64_t dx = x2 - x1;
+    int64_t dy = y2 - y1;
+    int ey1 = y1 >> SUBPIXEL_SHIFT;
+    int ey2 = y2 >> SUBPIXEL_SHIFT;
+    int fy1 = y1 & SUBPIXEL_MASK;
+    int fy2 = y2 & SUBPIXEL_MASK;
+
+    set_cell(x1 >> SUBPIXEL_SHIFT, ey1);
+    if (ey1 == ey2) {
+        render_hline(ey1, x1, fy1, x2, fy2);
+        return;
+    }
+
+    int incr = 1;
+    if (dx == 0) {
+        // a vertical edge stays in one column, with the same area in every row
+        int ex = x1 >> SUBPIXEL_SHIFT;
+        int two_fx = (x1 - (ex << SUBPIXEL_SHIFT)) << 1;
+        int first = SUBPIXEL_SCALE;
+        if (dy < 0) { first = 0; incr = -1; }
+        int delta = first - fy1;
+        m_current.cover += delta;
+        m_current.area += two_fx*delta;
+        ey1 += incr;
+        set_cell(ex, ey1);
+        delta = first + first - SUBPIXEL_SCALE;
+        int area = two_fx*delta;
+        while (ey1 != ey2) {
+            m_current.cover = delta;
+            m_current.area = area;
+            ey1 += incr;
+            set_cell(ex, ey1);
+        }
+        delta = fy2 - SUBPIXEL_SCALE + first;
+        m_current.cover += delta;
+        m_current.area += two_fx*delta;
+        return;
+    }
+
+    // several rows: find where the edge crosses each row boundary
+    int64_t p = (int64_t)(SUBPIXEL_SCALE - fy1)*dx;
+    int first = SUBPIXEL_SCALE;
+    if (dy < 0) {
+        p = (int64_t) fy1*dx;
+        first = 0;
+        incr = -1;
+        dy = -dy;
+    }
+    int delta = (int)(p/dy);
+    int64_t mod = p % dy;
+    if (mod < 0) { delta--; mod += dy; }
+    int x_from = x1 + delta;
+    render_hline(ey1, x1, fy1, x_from, first);
+    ey1 += incr;
+    set_cell(x_from >> SUBPIXEL_SHIFT, ey1);
+
+    if (ey1 != ey2) {
+        p = (int64_t) SUBPIXEL_SCALE*dx;
+        int lift = (int)(p/dy);
+        int64_t rem = p % dy;
+        if (rem < 0) { lift--; rem += dy; }
+        mod -= dy;
+        while (ey1 != ey2) {
+            delta = lift;
+            mod += rem;
+            if (mod >= 0) { mod -= dy; delta++; }
+            int x_to = x_from + delta;
+            render_hline(ey1, x_from, SUBPIXEL_SCALE - first, x_to, first);
+            x_from = x_to;
+            ey1 += incr;
+            set_cell(x_from >> SUBPIXEL_SHIFT, ey1);
+        }
+    }
+    render_hline(ey1, x_from, SUBPIXEL_SCALE - first, x2, fy2);
+}
+
+/// Adds an edge lying near the clip, converting it to fixed point.
+void ScanlineRasterizer::line_clipped(float x0, float y0, float x1, float y1) {
+    line_fixed((int) std::lround(x0*SUBPIXEL_SCALE), (int) std::lround(y0*SUBPIXEL_SCALE),
+        (int) std::lround(x1*SUBPIXEL_SCALE), (int) std::lround(y1*SUBPIXEL_SCALE));
+}
+
+/**
+ * Clips the edge against the clip rectangle before adding it: parts above
+ * or below and parts to the right contribute nothing visible and are
+ * dropped; parts to the left still affect the winding of everything
+ * to their right, so they are replaced by a vertical edge just left of the clip.
+ * Edges near the clip are passed unchanged, because add_cell() clips
+ * them exactly, while cutting an edge moves it by a rounding error
+ * (visible as seams between separately clipped parts, like tiles).
+ */
+void ScanlineRasterizer::line(float x0, float y0, float x1, float y1) {
+    float top = (float) m_clip.y, bottom = (float) m_clip.bottom();
+    float left = (float) m_clip.x, right = (float) m_clip.right();
+    if (m_clip.is_empty() || (y0 <= top && y1 <= top) || (y0 >= bottom && y1 >= bottom)
+        || (x0 >= right && x1 >= right) || y0 == y1 || !(std::isfinite(x0 + y0 + x1 + y1))) {
+        return;
+    }
+    if (std::min(x0, x1) >= left - CLIP_MARGIN && std::max(x0, x1) <= right + CLIP_MARGIN
+        && std::min(y0, y1) >= top - CLIP_MARGIN && std::max(y0, y1) <= bottom + CLIP_MARGIN) {
+        line_clipped(x0, y0, x1, y1);
+        return;
+    }
+
+    // cut off the parts above and below
+    auto cut_y = [&](float limit) {
+        float t = (limit - y0)/(y1 - y0);
+        return x0 + t*(x1 - x0);
+    };
+    if (y0 < top) { x0 = cut_y(top); y0 = top; }
+    else if (y0 > bottom) { x0 = cut_y(bottom); y0 = bottom; }
+    if (y1 < top) { x1 = x0 + (top - y0)/(y1 - y0)*(x1 - x0); y1 = top; }
+    else if (y1 > bottom) { x1 = x0 + (bottom - y0)/(y1 - y0)*(x1 - x0); y1 = bottom; }
+
+    // split at the left and right edges of the clip
+    float xs[4] = { x0, 0, 0, x1 };
+    float ys[4] = { y0, 0, 0, y1 };
+    int count = 1;
+    float limits[2] = { left, right };
+    if (x0 > x1) { std::swap(limits[0], limits[1]); }
+    for (float limit : limits) {
+        if ((x0 < limit && x1 > limit) || (x0 > limit && x1 < limit)) {
+            float t = (limit - x0)/(x1 - x0);
+            xs[count] = limit;
+            ys[count] = y0 + t*(y1 - y0);
+            count++;
+        }
+    }
+    xs[count] = x1;
+    ys[count] = y1;
+
+    const float outside_left = left - 0.5f;
+    for (int i = 0; i < count; ++i) {
+        float mid = (xs[i] + xs[i + 1])/2;
+        if (mid >= right) { continue; }
+        if (mid <= left) {
+            line_clipped(outside_left, ys[i], outside_left, ys[i + 1]);
+        }
+        else {
+            line_clipped(std::max(xs[i], left), ys[i], std::min(xs[i + 1], right), ys[i + 1]);
+        }
+    }
+}
+
+void ScanlineRasterizer::add_path(PathView const& path, float dx, float dy) {
+    PathPoint const* points = path.points;
+    PathPoint const* points_end = path.points + path.point_count;
+    float start_x = 0, start_y = 0;     // of the current contour
+    float x = 0, y = 0;                 // the current point
+    bool open = false;
+
+    auto close = [&]() {
+        if (open && (x != start_x || y != start_y)) {
+            line(x, y, start_x, start_y);
+        }
+        x = start_x;
+        y = start_y;
+        open = false;
+    };
+
+    for (size_t i = 0; i < path.verb_count; ++i) {
+        PathVerb verb = path.verbs[i];
+        int needed = verb == PathVerb::Close ? 0 : verb == PathVerb::Quad ? 2 : verb == PathVerb::Cubic ? 3 : 1;
+        if (points_end - points < needed) { break; }
+
+        switch (verb) {
+        case PathVerb::Move:
+            close();
+            x = start_x = points[0].x + dx;
+            y = start_y = points[0].y + dy;
+            open = true;
+            break;
+        case PathVerb::Line: {
+            float nx = points[0].x + dx, ny = points[0].y + dy;
+            line(x, y, nx, ny);
+            x = nx;
+            y = ny;
+            break;
+        }
+        case PathVerb::Quad: {
+            float cx = points[0].x + dx, cy = points[0].y + dy;
+            float nx = points[1].x + dx, ny = points[1].y + dy;
+            // the chord deviates from the curve by |p0 - 2 p1 + p2|/(8 n^2)
+            float ddx = x - 2*cx + nx, ddy = y - 2*cy + ny;
+            float dd = std::sqrt(ddx*ddx + ddy*ddy);
+            int n = std::clamp((int) std::ceil(std::sqrt(dd/(8*FLATNESS))), 1, 100);
+            float px = x, py = y;
+            for (int k = 1; k <= n; ++k) {
+                float t = (float) k/n, u = 1 - t;
+                float qx = u*u*x + 2*u*t*cx + t*t*nx;
+                float qy = u*u*y + 2*u*t*cy + t*t*ny;
+                line(px, py, qx, qy);
+                px = qx;
+                py = qy;
+            }
+            x = nx;
+            y = ny;
+            break;
+        }
+        case PathVerb::Cubic: {
+            float c1x = points[0].x + dx, c1y = points[0].y + dy;
+            float c2x = points[1].x + dx, c2y = points[1].y + dy;
+            float nx = points[2].x + dx, ny = points[2].y + dy;
+            // similarly bounded by 3/4 of the largest second difference over n^2
+            float d1x = x - 2*c1x + c2x, d1y = y - 2*c1y + c2y;
+            float d2x = c1x - 2*c2x + nx, d2y = c1y - 2*c2y + ny;
+            float dd = std::sqrt(std::max(d1x*d1x + d1y*d1y, d2x*d2x + d2y*d2y));
+            int n = std::clamp((int) std::ceil(std::sqrt(3*dd/(4*FLATNESS))), 1, 100);
+            float px = x, py = y;
+            for (int k = 1; k <= n; ++k) {
+                float t = (float) k/n, u = 1 - t;
+                float qx = u*u*u*x + 3*u*u*t*c1x + 3*u*t*t*c2x + t*t*t*nx;
+                float qy = u*u*u*y + 3*u*u*t*c1y + 3*u*t*t*c2y + t*t*t*ny;
+                line(px, py, qx, qy);
+                px = qx;
+                py = qy;
+            }
+            x = nx;
+            y = ny;
+            break;
+        }
+        case PathVerb::Close:
+            close();
+            break;
+        }
+        points += needed;
+    }
+    close();
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "path.hpp"
+#include "rect.hpp"
+
+/**
+ * An anti-aliasing rasterizer for small closed outlines (glyphs), using
+ * signed area accumulation: every line segment adds the area it covers
+ * and the change of winding it causes to the cells it crosses, and
+ * a running sum along each row then gives the exact coverage of each pixel
+ * under the non-zero rule (for non-overlapping contours).
+ * The running sum is done four pixels at a time with SSE where available.
+ * Coordinates are in pixels, y growing downwards; the buffer is reused
+ * between outlines, so rasterizing does not allocate once it has grown.
+ */
+class AccumulationRasterizer {
+protected:
+    std::vector<float> m_cells;     // (area, cover) accumulated per pixel
+    int m_width = 0;
+    int m_height = 0;
+    int m_stride = 0;               // of m_cells, in floats (a multiple of 4)
+    bool m_dirty = false;           // m_cells holds an outline not rendered yet
+
+public:
+    /// Starts a new outline covering an area of the given size.
+    void reset(int width, int height);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    /// Adds a line segment of the outline.
+    void line(float x0, float y0, float x1, float y1);
+
+    /// Adds a quadratic Bezier curve, flattened into enough lines.
+    void quad(float x0, float y0, float x1, float y1, float x2, float y2);
+
+    /**
+     * Converts the accumulated outline to A8 coverage, writing width x height
+     * bytes with rows stride bytes apart, and clears the accumulation buffer.
+     */
+    void render(uint8_t* out, int stride);
+};
+
+/**
+ * An anti-aliasing rasterizer for paths of any size, working on sparse
+ * scanlines: each edge records the area and cover it contributes to only
+ * the cells (pixels) it crosses, at 1/256 pixel precision. The cells are
+ * then sorted by row and swept left to right, so the interior of a shape
+ * costs one span per row rather than any per-pixel work, and rows or
+ * columns without edges are never visited. Everything outside the clip
+ * rectangle given to reset() is skipped early.
+ * The cell storage is reused, so rasterizing does not allocate once grown;
+ * use scratch() for a per-thread instance.
+ */
+class ScanlineRasterizer {
+protected:
+    struct Cell {
+        int x;
+        int y;
+        int cover;      // sum of the vertical extents of the edges in the cell
+        int area;       // twice the area of the cell to the left of the edges
+    };
+
+    std::vector<Cell> m_cells;
+    Cell m_current;
+    Rect m_clip;
+    std::vector<uint8_t> m_coverage;    // one row of output
+
+    void set_cell(int x, int y) {
+        if (m_current.x != x || m_current.y != y) {
+            add_cell();
+            m_current = Cell { x, y, 0, 0 };
+        }
+    }
+    void add_cell();
+    void render_hline(int ey, int x1, int y1, int x2, int y2);
+    void line_fixed(int x1, int y1, int x2, int y2);
+    void line_clipped(float x0, float y0, float x1, float y1);
+
+    static uint8_t coverage(int area, FillRule rule) {
+        int cover = area >> 9;
+        if (cover < 0) { cover = -cover; }
+        if (rule == FillRule::EvenOdd) {
+            cover &= 511;
+            if (cover > 256) { cover = 512 - cover; }
+        }
+        return (uint8_t)(cover > 255 ? 255 : cover);
+    }
+
+public:
+    /// Returns a rasterizer owned by the calling thread.
+    static ScanlineRasterizer& scratch();
+
+    /// Starts a new shape; nothing outside the clip (in pixels) will be produced.
+    void reset(Rect const& clip);
+
+    /// Adds a line; contours must be closed by the caller.
+    void line(float x0, float y0, float x1, float y1);
+
+    /// Adds all contours of the path (closing them), moved by (dx, dy).
+    void add_path(PathView const& path, float dx, float dy);
+
+    /**
+     * Sweeps the shape, calling span(x, y, coverage, count) for every run
+     * of pixels with non-zero coverage, in increasing y and x.
+     */
+    template<class SpanFunction>
+    void render(FillRule rule, SpanFunction&& span) {
+        add_cell();
+        m_current = Cell { INT32_MIN, INT32_MIN, 0, 0 };
+        std::sort(m_cells.begin(), m_cells.end(), [](Cell const& a, Cell const& b) {
+            return a.y < b.y || (a.y == b.y && a.x < b.x);
+        });
+        m_coverage.resize(std::max(m_clip.width, 0));
+
+        uint8_t* row = m_coverage.data() - m_clip.x;    // indexed by x
+        size_t i = 0, n = m_cells.size();
+        while (i < n) {
+            int y = m_cells[i].y;
+            int cover = 0;
+            int span_start = -1, span_end = 0;
+            auto flush = [&]() {
+                if (span_start >= 0) {
+                    span(span_start, y, row + span_start, span_end - span_start);
+                    span_start = -1;
+                }
+            };
+            auto put = [&](int x, int count, uint8_t alpha) {
+                if (alpha == 0) { flush(); return; }
+                if (span_start < 0) { span_start = x; }
+                memset(row + x, alpha, count);
+                span_end = x + count;
+            };
+
+            while (i < n && m_cells[i].y == y) {
+                int x = m_cells[i].x;
+                int area = 0;
+                for (; i < n && m_cells[i].y == y && m_cells[i].x == x; ++i) {
+                    area += m_cells[i].area;
+                    cover += m_cells[i].cover;
+                }
+                if (area) {
+                    if (x >= m_clip.x) { put(x, 1, coverage(cover*512 - area, rule)); }
+                    x++;
+                }
+                int next_x = (i < n && m_cells[i].y == y) ? m_cells[i].x : m_clip.right();
+                x = std::max(x, m_clip.x);
+                if (next_x > x) { put(x, next_x - x, coverage(cover*512, rule)); }
+            }
+            flush();
+        }
+        m_cells.clear();
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+
+/**
+ * An axis-aligned rectangle in pixel coordinates.
+ * The rectangle covers columns x..x+width-1 and rows y..y+height-1;
+ * it is empty if either the width or the height is not positive.
+ */
+struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    Rect() {}
+    Rect(int x, int y, int width, int height)
+        : x(x), y(y), width(width), height(height) {}
+
+    int left() const { return x; }
+    int top() const { return y; }
+    int right() const { return x + width; }      ///< one past the last column
+    int bottom() const { return y + height; }    ///< one past the last row
+
+    bool is_empty() const { return width <= 0 || height <= 0; }
+
+    bool contains(int px, int py) const {
+        return px >= x && px < right() && py >= y && py < bottom();
+    }
+
+    /// Returns true if the other rectangle lies entirely inside this one.
+    /// An empty rectangle is contained in everything.
+    bool contains(Rect const& other) const {
+        if (other.is_empty()) { return true; }
+        return other.x >= x && other.y >= y
+            && other.right() <= right() && other.bottom() <= bottom();
+    }
+
+    bool intersects(Rect const& other) const {
+        return !intersected(other).is_empty();
+    }
+
+    /// Returns the common part of both rectangles (possibly empty).
+    Rect intersected(Rect const& other) const {
+        int x0 = std::max(x, other.x);
+        int y0 = std::max(y, other.y);
+        int x1 = std::min(right(), other.right());
+        int y1 = std::min(bottom(), other.bottom());
+        if (x1 <= x0 || y1 <= y0) { return Rect(); }
+        return Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    /// Returns the smallest rectangle containing both rectangles;
+    /// empty rectangles are ignored.
+    Rect united(Rect const& other) const {
+        if (is_empty()) { return other; }
+        if (other.is_empty()) { return *this; }
+        int x0 = std::min(x, other.x);
+        int y0 = std::min(y, other.y);
+        int x1 = std::max(right(), other.right());
+        int y1 = std::max(bottom(), other.bottom());
+        return Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    Rect translated(int dx, int dy) const {
+        return Rect(x + dx, y + dy, width, height);
+    }
+
+    bool operator==(Rect const& other) const {
+        return x == other.x && y == other.y
+            && width == other.width && height == other.height;
+    }
+    bool operator!=(Rect const& other) const { return !(*this == other); }
+};
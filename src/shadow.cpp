@@ -0,0 +1,76 @@
+#include "shadow.hpp"
+#include "blur.hpp"
+#include "draw.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+Shadow const& ShadowCache::get(int width, int height, int corner_radius, float blur_radius) {
+    static stats::Counter& hits = stats::counter("shadow.cache_hits");
+    static stats::Counter& misses = stats::counter("shadow.cache_misses");
+
+    if (width > 0xFFFF || height > 0xFFFF) {
+        throw std::logic_error("ShadowCache: shadow too large");
+    }
+    width = std::max(width, 0);
+    height = std::max(height, 0);
+    corner_radius = std::clamp(corner_radius, 0, std::min(width, height)/2);
+
+    // the blur radius in 1/4 pixels, which is finer than any difference one could see
+    uint64_t blur4 = std::min((uint64_t) std::lround(std::max(blur_radius, 0.0f)*4.0f), (uint64_t) 0xFFFF);
+    uint64_t key = (uint64_t) width << 48 | (uint64_t) height << 32 | (uint64_t) corner_radius << 16 | blur4;
+
+    auto found = m_lookup.find(key);
+    if (found != m_lookup.end()) {
+        auto entry = found->second;
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+        entry->frame = m_frame;
+        hits.add();
+        return entry->shadow;
+    }
+    misses.add();
+
+    m_entries.emplace_front();
+    auto entry = m_entries.begin();
+    entry->key = key;
+    entry->frame = m_frame;
+    render(width, height, corner_radius, blur4/4.0f, *entry);
+    m_lookup[key] = entry;
+    m_size += entry->size;
+    evict();
+    return entry->shadow;
+}
+
+void ShadowCache::render(int width, int height, int corner_radius, float blur_radius, Entry& entry) {
+    int margin = blur_extent(blur_radius);
+    Shadow& shadow = entry.shadow;
+    shadow.width = width + 2*margin;
+    shadow.height = height + 2*margin;
+    shadow.margin = margin;
+
+    entry.size = (size_t) shadow.width*shadow.height;
+    entry.mask.reset(new uint8_t[entry.size]());
+    shadow.mask = entry.mask.get();
+
+    BasicDrawingContext<A8Traits> ctx(entry.mask.get(), shadow.width, shadow.height);
+    ctx.fill_rounded_rect(margin, margin, width, height, corner_radius, 0xFF000000);
+    blur_a8(entry.mask.get(), shadow.width, shadow.height, shadow.width, blur_radius,
+        BlurEdges::Transparent, m_pool);
+}
+
+/// Drops the least recently used shadows while over the bound, sparing recent frames.
+void ShadowCache::evict() {
+    while (m_size > m_capacity && !m_entries.empty()) {
+        auto& oldest = m_entries.back();
+        if (oldest.frame + 1 >= m_frame) { break; }
+        m_size -= oldest.size;
+        m_lookup.erase(oldest.key);
+        m_entries.pop_back();
+    }
+}
+
+void ShadowCache::next_frame() {
+    m_frame++;
+    evict();
+}
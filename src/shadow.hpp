@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+class ThreadPool;
+
+/// A blurred shadow of a box, as an A8 mask.
+struct Shadow {
+    uint8_t const* mask = nullptr;
+    int width = 0;              // of the mask (the box plus the margin on both sides)
+    int height = 0;
+    int margin = 0;             // how far the shadow reaches beyond the box
+};
+
+/**
+ * Drop shadows of (rounded) boxes: the box drawn into an A8 mask and then
+ * blurred (see blur_a8()), kept in an LRU cache bounded in bytes so that
+ * a shadow of the same size and shape is rendered only once. The colour is
+ * applied when the mask is blitted, so one entry serves every colour.
+ *
+ * Masks used in the current or the previous frame are never evicted,
+ * so they may be recorded in a display list: call next_frame() once
+ * per frame. Not thread-safe (but the blur itself can use a thread pool).
+ */
+class ShadowCache {
+protected:
+    struct Entry {
+        uint64_t key = 0;
+        uint64_t frame = 0;             // when it was last used
+        Shadow shadow;
+        std::unique_ptr<uint8_t[]> mask;
+        size_t size = 0;
+    };
+
+    size_t m_capacity;
+    ThreadPool* m_pool;
+    size_t m_size = 0;
+    uint64_t m_frame = 1;
+    std::list<Entry> m_entries;         // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_lookup;
+
+    void render(int width, int height, int corner_radius, float blur_radius, Entry& entry);
+    void evict();
+
+public:
+    explicit ShadowCache(size_t capacity = 16 << 20, ThreadPool* pool = nullptr)
+        : m_capacity(capacity), m_pool(pool) {}
+    ShadowCache(ShadowCache const&) = delete;
+    ShadowCache& operator=(ShadowCache const&) = delete;
+
+    /**
+     * Returns the shadow of a width x height box with corners rounded
+     * by corner_radius, blurred by blur_radius (as in CSS), rendering it
+     * if it is not cached. The reference is valid until the next call.
+     * Throws std::logic_error if a size exceeds 65535 pixels.
+     */
+    Shadow const& get(int width, int height, int corner_radius, float blur_radius);
+
+    /** Marks the start of a new frame, allowing older shadows to be evicted. */
+    void next_frame();
+
+    /** Returns the number of bytes taken by the cached masks. */
+    size_t cache_size() const { return m_size; }
+
+    /** Returns the number of cached shadows. */
+    size_t cached_count() const { return m_entries.size(); }
+};
+
+/**
+ * Draws the shadow of a box placed at (x, y) with the given size,
+ * i.e. the shadow extends beyond the box by its margin (offset the box
+ * to move the shadow). Works with any context that has blit_mask().
+ */
+template<class Context>
+void draw_shadow(Context& ctx, ShadowCache& cache, int x, int y, int width, int height,
+    int corner_radius, float blur_radius, uint32_t color)
+{
+    if (width <= 0 || height <= 0) { return; }
+    Shadow const& shadow = cache.get(width, height, corner_radius, blur_radius);
+    ctx.blit_mask(x - shadow.margin, y - shadow.margin, shadow.mask, shadow.width,
+        shadow.width, shadow.height, color);
+}
@@ -0,0 +1,84 @@
+#include "stats.hpp"
+#include "debug.hpp"
+#include <cstdio>
+#include <map>
+#include <time.h>
+
+namespace {
+
+// std::map never moves its elements, so references to them stay valid
+std::map<std::string, stats::Counter>& counters() {
+    static std::map<std::string, stats::Counter> the_counters;
+    return the_counters;
+}
+
+std::map<std::string, stats::Histogram>& histograms() {
+    static std::map<std::string, stats::Histogram> the_histograms;
+    return the_histograms;
+}
+
+// index of the bucket for the value: 0 for 0, 1 for 1, 2 for 2-3, 3 for 4-7...
+int bucket_of(uint64_t value) {
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    return bucket < stats::Histogram::BUCKETS ? bucket : stats::Histogram::BUCKETS - 1;
+}
+
+}
+
+void stats::Histogram::add(uint64_t value) {
+    m_count++;
+    m_sum += value;
+    if (value < m_min) { m_min = value; }
+    if (value > m_max) { m_max = value; }
+    m_buckets[bucket_of(value)]++;
+}
+
+void stats::Histogram::reset() {
+    *this = Histogram();
+}
+
+uint64_t stats::Histogram::percentile(double p) const {
+    if (!m_count) { return 0; }
+    uint64_t wanted = (uint64_t)(p/100.0*m_count + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += m_buckets[i];
+        if (seen >= wanted && seen > 0) {
+            uint64_t upper = i ? ((uint64_t)1 << i) - 1 : 0;
+            return upper < m_max ? upper : m_max;
+        }
+    }
+    return m_max;
+}
+
+stats::Counter& stats::counter(std::string const& name) {
+    return counters()[name];
+}
+
+stats::Histogram& stats::histogram(std::string const& name) {
+    return histograms()[name];
+}
+
+void stats::report() {
+    char line[256];
+    for (auto& entry : counters()) {
+        snprintf(line, sizeof(line), "%s: %llu", entry.first.c_str(),
+            (unsigned long long) entry.second.get());
+        info(line);
+    }
+    for (auto& entry : histograms()) {
+        auto& h = entry.second;
+        if (!h.count()) { continue; }
+        snprintf(line, sizeof(line), "%s: n=%llu mean=%.1f min=%llu p50=%llu p99=%llu max=%llu",
+            entry.first.c_str(), (unsigned long long) h.count(), h.mean(),
+            (unsigned long long) h.min(), (unsigned long long) h.percentile(50),
+            (unsigned long long) h.percentile(99), (unsigned long long) h.max());
+        info(line);
+    }
+}
+
+uint64_t stats::now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Run-time statistics: named counters and histograms that the framework
+ * (and the app) update as they work, and that can be dumped with report().
+ * Entries are created on first use and live until the program exits,
+ * so a reference obtained once can be kept and updated cheaply.
+ * Not thread-safe; update them from the main thread only.
+ */
+namespace stats {
+
+/// A monotonically growing count of something.
+class Counter {
+protected:
+    uint64_t m_value = 0;
+public:
+    void add(uint64_t amount = 1) { m_value += amount; }
+    uint64_t get() const { return m_value; }
+    void reset() { m_value = 0; }
+};
+
+/**
+ * A distribution of measured values (usually durations in microseconds).
+ * Count, sum, minimum and maximum are exact; percentiles are estimated
+ * from power-of-two buckets.
+ */
+class Histogram {
+public:
+    static const int BUCKETS = 48;
+protected:
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+    uint64_t m_buckets[BUCKETS] = { 0 };
+public:
+    void add(uint64_t value);
+    void reset();
+    uint64_t count() const { return m_count; }
+    uint64_t sum() const { return m_sum; }
+    uint64_t min() const { return m_count ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count ? (double)m_sum/m_count : 0.0; }
+
+    /// Returns an upper estimate of the given percentile (0 to 100).
+    uint64_t percentile(double p) const;
+};
+
+/// Returns the counter of the given name, creating it if needed.
+Counter& counter(std::string const& name);
+
+/// Returns the histogram of the given name, creating it if needed.
+Histogram& histogram(std::string const& name);
+
+/// Writes all statistics to the log, one line per entry.
+void report();
+
+/// Returns the time of the monotonic clock, in nanoseconds.
+uint64_t now_ns();
+
+/// Measures the time until the end of the scope, in microseconds.
+class ScopedTimer {
+protected:
+    Histogram& m_histogram;
+    uint64_t m_start;
+public:
+    explicit ScopedTimer(Histogram& histogram) : m_histogram(histogram), m_start(now_ns()) {}
+    ~ScopedTimer() { m_histogram.add((now_ns() - m_start)/1000); }
+};
+
+} // namespace stats
@@ -0,0 +1,62 @@
+#include "swapchain.hpp"
+#include "debug.hpp"
+#include <string>
+
+wayland::Swapchain::Swapchain(wayland::Display& display, uint32_t format)
+    : m_display(display), m_format(format)
+{
+}
+
+wayland::Swapchain::~Swapchain() {
+
+    // discard all allocated frames (here we are allowed to delete even those
+    // that may be still in use).
+    while (!m_frames.empty()) {
+        auto frame = m_frames.front();
+        m_frames.pop_front();
+        delete frame;
+    }
+}
+
+void wayland::Swapchain::purge_badly_sized_frames(int32_t width, int32_t height) {
+
+    // discard all cached frames that have unsuitable dimensions
+    // (they will exist every time the window is resized)
+    bool restart_search;
+    do {
+        restart_search = false;
+        for (auto frame : m_frames) {
+            if (!frame->is_busy()) {
+                if (frame->get_width() != width || frame->get_height() != height) {
+                    if (frame == m_last_frame) {
+                        m_last_frame = nullptr;
+                    }
+                    m_frames.remove(frame);
+                    delete frame;
+                    restart_search = true;
+                    info("purged an improperly sized frame");
+                    break;
+                }
+            }
+        }
+    } while(restart_search);
+}
+
+wayland::Frame* wayland::Swapchain::get_new_frame(int32_t width, int32_t height) {
+    purge_badly_sized_frames(width, height);
+
+    // try to find an already allocated frame of appropriate size and reuse it
+    for (auto frame : m_frames) {
+        if (!frame->is_busy()) {
+            if (frame->get_width() == width && frame->get_height() == height) {
+                return frame;
+            }
+        }
+    }
+
+    // no suitable frame was found in the list, so create a new one
+    auto frame = new wayland::Frame(m_display, width, height, m_format);
+    m_frames.push_back(frame);
+    info("created a new frame, now " + std::to_string(m_frames.size()) + " frames in the list");
+    return frame;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <wayland-client.h>
+#include "frame.hpp"
+
+namespace wayland {
+
+class Display;
+
+/**
+ * The frames (buffers) of one surface. A frame is reused as soon as the
+ * compositor releases it; frames of another size are destroyed once they
+ * are free, and a new frame is created only when all frames of the right
+ * size are busy (the count usually settles at two or three).
+ * Also remembers which frame was rendered last, for copying forward
+ * the parts of the image that did not change.
+ */
+class Swapchain {
+protected:
+    wayland::Display& m_display;
+    uint32_t m_format;
+    std::list<Frame*> m_frames;
+    Frame* m_last_frame = nullptr;
+
+    void purge_badly_sized_frames(int32_t width, int32_t height);
+
+public:
+    Swapchain(wayland::Display& display, uint32_t format = WL_SHM_FORMAT_XRGB8888);
+    ~Swapchain();
+    Swapchain(Swapchain const&) = delete;
+    Swapchain& operator=(Swapchain const&) = delete;
+
+    /// Returns a frame of the given size that is not in use by the compositor.
+    Frame* get_new_frame(int32_t width, int32_t height);
+
+    /// Returns the frame rendered last (null if none, or if it was destroyed).
+    Frame* get_last_frame() const { return m_last_frame; }
+    void set_last_frame(Frame* frame) { m_last_frame = frame; }
+
+    uint32_t get_format() const { return m_format; }
+
+    /// Returns the number of frames allocated.
+    size_t size() const { return m_frames.size(); }
+};
+
+} // namespace wayland
@@ -0,0 +1,77 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(int worker_count) {
+    if (worker_count < 0) {
+        worker_count = (int) std::thread::hardware_concurrency() - 1;
+    }
+    for (int i = 0; i < worker_count; ++i) {
+        m_threads.emplace_back([this]() { worker_main(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::worker_main() {
+    uint64_t seen_generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_quit || m_generation != seen_generation; });
+            if (m_quit) { return; }
+            seen_generation = m_generation;
+        }
+        work();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_busy_workers == 0) {
+                m_done.notify_one();
+            }
+        }
+    }
+}
+
+/// Takes indices of the current job until there are none left.
+void ThreadPool::work() {
+    for (;;) {
+        int index = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= m_count) { break; }
+        m_function(m_context, index);
+    }
+}
+
+void ThreadPool::run(int count, void (*function)(void*, int), void* context) {
+    if (count <= 0) { return; }
+
+    // not worth waking anybody up
+    if (count == 1 || m_threads.empty()) {
+        for (int i = 0; i < count; ++i) {
+            function(context, i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_function = function;
+        m_context = context;
+        m_count = count;
+        m_next.store(0, std::memory_order_relaxed);
+        m_busy_workers = (int) m_threads.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&]() { return m_busy_workers == 0; });
+}
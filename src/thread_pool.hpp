@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A fixed set of worker threads for data-parallel work, such as rendering
+ * tiles or bands of rows. The calling thread takes part in the work too.
+ * Jobs must not throw. Running a job does no heap allocation.
+ */
+class ThreadPool {
+protected:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;         // workers wait here for a job
+    std::condition_variable m_done;         // the caller waits here for workers
+    uint64_t m_generation = 0;              // incremented with each job
+    bool m_quit = false;
+    int m_busy_workers = 0;
+
+    // the current job
+    void (*m_function)(void*, int) = nullptr;
+    void* m_context = nullptr;
+    int m_count = 0;
+    std::atomic<int> m_next { 0 };
+
+    void worker_main();
+    void work();
+    void run(int count, void (*function)(void*, int), void* context);
+
+public:
+    /// Creates the pool with the given number of worker threads; if negative,
+    /// one less than there are CPUs (the caller is the remaining one).
+    explicit ThreadPool(int worker_count = -1);
+    ~ThreadPool();
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    /// Returns the number of threads working on a job, including the caller.
+    int thread_count() const { return (int) m_threads.size() + 1; }
+
+    /**
+     * Calls fn(i) for every i from 0 to count-1, spread over all threads,
+     * and returns when all calls are finished. The order is not defined.
+     */
+    template<class F>
+    void parallel_for(int count, F&& fn) {
+        using Fn = typename std::remove_reference<F>::type;
+        run(count, [](void* context, int index) { (*(Fn*) context)(index); }, (void*) &fn);
+    }
+};
@@ -0,0 +1,128 @@
+#include "tile_hasher.hpp"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+/*
+ * Two interleaved CRC32C streams with different seeds give a 64-bit hash,
+ * and as they do not depend on each other, the CPU can run them in parallel.
+ */
+
+uint64_t hash_rows_portable(uint32_t const* pixels, int stride, int width, int height) {
+    uint64_t a = 0x9E3779B97F4A7C15ull, b = 0xC2B2AE3D27D4EB4Full;
+    for (int y = 0; y < height; ++y, pixels += stride) {
+        for (int x = 0; x < width; ++x) {
+            a = (a ^ pixels[x])*0x100000001B3ull;
+            b = (b + pixels[x])*0xFF51AFD7ED558CCDull;
+            b ^= b >> 29;
+        }
+    }
+    return a ^ (b << 1);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint64_t hash_rows_crc32c(uint32_t const* pixels, int stride, int width, int height) {
+    uint64_t a = 0xFFFFFFFFu, b = 0x12345678u;
+    for (int y = 0; y < height; ++y, pixels += stride) {
+        auto bytes = (uint8_t const*) pixels;
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            uint64_t w0, w1;
+            memcpy(&w0, bytes + x*4, 8);
+            memcpy(&w1, bytes + x*4 + 8, 8);
+            a = _mm_crc32_u64(a, w0);
+            b = _mm_crc32_u64(b, w1);
+        }
+        for (; x < width; ++x) {
+            a = _mm_crc32_u32((uint32_t) a, pixels[x]);
+        }
+    }
+    return (a << 32) | (uint32_t) b;
+}
+#endif
+
+using HashFunction = uint64_t (*)(uint32_t const*, int, int, int);
+
+HashFunction choose_hash_function() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return hash_rows_crc32c;
+    }
+#endif
+    return hash_rows_portable;
+}
+
+}
+
+TileHasher::TileHasher(int tile_size) : m_tile_size(tile_size > 0 ? tile_size : DEFAULT_TILE_SIZE) {
+}
+
+uint64_t TileHasher::hash_block(uint32_t const* pixels, int stride, int width, int height) {
+    static const HashFunction hash = choose_hash_function();
+    return hash(pixels, stride, width, height);
+}
+
+DamageRegion TileHasher::filter(uint32_t const* pixels, int width, int height, int stride,
+    DamageRegion const& damage)
+{
+    if (width != m_width || height != m_height) {
+        m_width = width;
+        m_height = height;
+        m_columns = (width + m_tile_size - 1)/m_tile_size;
+        m_rows = (height + m_tile_size - 1)/m_tile_size;
+        m_hashes.assign(m_columns*m_rows, 0);
+        m_valid = false;
+    }
+    m_changed.assign(m_columns*m_rows, 0);
+
+    // without the hashes of the previous frame, everything counts as changed
+    // and the whole frame is hashed for the next time
+    Rect surface(0, 0, width, height);
+    DamageRegion everything(surface);
+    DamageRegion const& to_hash = m_valid ? damage : everything;
+
+    for (int row = 0; row < m_rows; ++row) {
+        for (int column = 0; column < m_columns; ++column) {
+            Rect tile = Rect(column*m_tile_size, row*m_tile_size, m_tile_size, m_tile_size)
+                .intersected(surface);
+            if (!to_hash.intersects(tile)) { continue; }
+            uint64_t hash = hash_block(pixels + (intptr_t)tile.y*stride + tile.x,
+                stride, tile.width, tile.height);
+            int index = row*m_columns + column;
+            if (hash != m_hashes[index] || !m_valid) {
+                m_hashes[index] = hash;
+                m_changed[index] = 1;
+            }
+        }
+    }
+    if (!m_valid) {
+        m_valid = true;
+        return damage;
+    }
+
+    // keep the damage only in changed tiles, merged into horizontal runs
+    DamageRegion result;
+    for (int row = 0; row < m_rows; ++row) {
+        for (int column = 0; column < m_columns; ) {
+            if (!m_changed[row*m_columns + column]) {
+                column++;
+                continue;
+            }
+            int first = column;
+            while (column < m_columns && m_changed[row*m_columns + column]) {
+                column++;
+            }
+            Rect run(first*m_tile_size, row*m_tile_size,
+                (column - first)*m_tile_size, m_tile_size);
+            for (auto& rect : damage) {
+                result.add(rect.intersected(run));
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "damage.hpp"
+
+/**
+ * Derives damage from the rendered pixels themselves, for apps that do not
+ * report what they changed. After a frame is rendered, every tile inside
+ * the claimed damage is hashed (CRC32C, hardware-accelerated where the CPU
+ * supports it) and compared with the hash of the same tile in the previous
+ * frame; only the tiles that really changed remain damaged.
+ * A changed tile with an equal 64-bit hash would be missed, which is
+ * improbable enough to be ignored.
+ */
+class TileHasher {
+public:
+    static const int DEFAULT_TILE_SIZE = 64;
+
+protected:
+    int m_tile_size = DEFAULT_TILE_SIZE;
+    int m_width = 0;
+    int m_height = 0;
+    int m_columns = 0;
+    int m_rows = 0;
+    std::vector<uint64_t> m_hashes;         // of the last frame, per tile
+    std::vector<uint8_t> m_changed;         // scratch, per tile
+    bool m_valid = false;                   // m_hashes describe the last frame
+
+public:
+    explicit TileHasher(int tile_size = DEFAULT_TILE_SIZE);
+
+    int tile_size() const { return m_tile_size; }
+
+    /// Forgets the hashes, so the next frame is taken as completely changed.
+    void reset() { m_valid = false; }
+
+    /**
+     * Hashes the tiles of a freshly rendered frame that intersect the damage,
+     * remembers the hashes, and returns the part of the damage that lies
+     * in tiles whose content changed since the previous frame.
+     * The stride is in pixels.
+     */
+    DamageRegion filter(uint32_t const* pixels, int width, int height, int stride,
+        DamageRegion const& damage);
+
+    /// Returns the hash of a block of pixels (exposed for testing and benchmarks).
+    static uint64_t hash_block(uint32_t const* pixels, int stride, int width, int height);
+};
@@ -0,0 +1,77 @@
+#include "tile_renderer.hpp"
+#include <algorithm>
+
+TileRenderer::TileRenderer(int thread_count, int tile_size)
+    : m_pool(thread_count > 0 ? thread_count - 1 : -1)
+{
+    if (tile_size < 16) {
+        tile_size = 16;
+    }
+    m_tile_size = (tile_size + 15) & ~15;
+}
+
+Rect TileRenderer::tile_rect(int tile) const {
+    return Rect((tile % m_columns)*m_tile_size, (tile / m_columns)*m_tile_size,
+        m_tile_size, m_tile_size);
+}
+
+void TileRenderer::render(DisplayList& list, DrawingContext& ctx, DamageRegion const& damage) {
+    Rect surface(0, 0, list.width(), list.height());
+    m_columns = (surface.width + m_tile_size - 1)/m_tile_size;
+    m_rows = (surface.height + m_tile_size - 1)/m_tile_size;
+    int tile_count = m_columns*m_rows;
+
+    // the bins keep their capacity from frame to frame
+    if ((int) m_bins.size() < tile_count) {
+        m_bins.resize(tile_count);
+    }
+    for (int i = 0; i < tile_count; ++i) {
+        m_bins[i].clear();
+    }
+
+    // only the tiles touched by the damage are scheduled
+    m_dirty_tiles.clear();
+    for (int tile = 0; tile < tile_count; ++tile) {
+        if (damage.intersects(tile_rect(tile).intersected(surface))) {
+            m_dirty_tiles.push_back(tile);
+        }
+    }
+    if (m_dirty_tiles.empty()) {
+        return;
+    }
+
+    // sort the visible commands into the bins of the tiles they touch;
+    // since commands are visited in order, each bin stays in drawing order
+    list.prepare_replay(damage);
+    for (size_t i = 0; i < list.command_count(); ++i) {
+        if (list.is_occluded(i)) { continue; }
+        Rect b = list.command(i)->bounds.intersected(surface);
+        if (b.is_empty() || !damage.intersects(b)) { continue; }
+        int column0 = b.x/m_tile_size, column1 = (b.right() - 1)/m_tile_size;
+        int row0 = b.y/m_tile_size, row1 = (b.bottom() - 1)/m_tile_size;
+        for (int row = row0; row <= row1; ++row) {
+            for (int column = column0; column <= column1; ++column) {
+                m_bins[row*m_columns + column].push_back((int) i);
+            }
+        }
+    }
+
+    m_tile_stats.assign(m_dirty_tiles.size(), DisplayList::ReplayStats());
+    m_pool.parallel_for((int) m_dirty_tiles.size(), [&](int job) {
+        int tile = m_dirty_tiles[job];
+        Rect area = tile_rect(tile).intersected(surface);
+        auto& bin = m_bins[tile];
+        if (bin.empty()) { return; }
+        DrawingContext tile_ctx = ctx;
+        for (auto& rect : damage) {
+            Rect part = area.intersected(rect);
+            if (!part.is_empty()) {
+                list.replay_area(tile_ctx, part, bin.data(), bin.size(), m_tile_stats[job]);
+            }
+        }
+    });
+
+    for (auto& stats : m_tile_stats) {
+        list.add_replay_stats(stats);
+    }
+}
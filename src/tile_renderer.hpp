@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include "damage.hpp"
+#include "display_list.hpp"
+#include "draw.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Replays display lists in parallel. The surface is divided into square
+ * tiles; the commands are sorted into bins of the tiles they touch, and
+ * the tiles that intersect the damage are rasterized on a thread pool,
+ * each thread writing only the pixels of its own tile.
+ *
+ * With the tile size a multiple of 16 pixels and a frame stride that is a
+ * multiple of 64 bytes (see wayland::Frame), each row of a tile starts on
+ * a cache line boundary, so two threads never write the same cache line.
+ */
+class TileRenderer {
+public:
+    static const int DEFAULT_TILE_SIZE = 64;
+
+protected:
+    ThreadPool m_pool;
+    int m_tile_size = DEFAULT_TILE_SIZE;
+    int m_columns = 0;
+    int m_rows = 0;
+    std::vector<std::vector<int>> m_bins;   // command indices, per tile
+    std::vector<int> m_dirty_tiles;         // indices of tiles to render
+    std::vector<DisplayList::ReplayStats> m_tile_stats;
+
+    Rect tile_rect(int tile) const;
+
+public:
+    /// Creates the renderer; tile_size is rounded up to a multiple of 16,
+    /// thread_count of 0 means one thread per CPU.
+    TileRenderer(int thread_count = 0, int tile_size = DEFAULT_TILE_SIZE);
+
+    int tile_size() const { return m_tile_size; }
+    int thread_count() const { return m_pool.thread_count(); }
+
+    /// Returns the number of tiles rendered by the last render() call.
+    int last_dirty_tile_count() const { return (int) m_dirty_tiles.size(); }
+
+    /// Replays the list into the context (covering the whole surface),
+    /// restricted to the damaged region; see DisplayList::replay().
+    void render(DisplayList& list, DrawingContext& ctx, DamageRegion const& damage);
+};
@@ -0,0 +1,544 @@
+#include "truetype.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// TrueType data is big-endian
+
+static uint32_t read_u16(uint8_t const* p) {
+    return (uint32_t) p[0] << 8 | p[1];
+}
+
+static int read_i16(uint8_t const* p) {
+    return (int16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t read_u32(uint8_t const* p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+// composite glyphs may not nest deeper than this
+static const int MAX_COMPOSITE_DEPTH = 8;
+
+// TrueTypeFont --------------------------------------------------------------
+
+TrueTypeFont::TrueTypeFont(std::string const& path, size_t cache_capacity)
+    : m_file(path), m_cache_capacity(cache_capacity)
+{
+    uint8_t const* data = m_file.data();
+    size_t size = m_file.size();
+    if (size < 12 || (read_u32(data) != 0x00010000 && memcmp(data, "true", 4) != 0)) {
+        throw std::runtime_error("TrueTypeFont: " + path + " is not a TrueType font");
+    }
+
+    uint32_t length;
+    uint32_t head = find_table("head", length, true);
+    if (length < 54) {
+        throw std::runtime_error("TrueTypeFont: " + path + " has a bad head table");
+    }
+    m_units_per_em = read_u16(data + head + 18);
+    m_long_loca = read_i16(data + head + 50) != 0;
+
+    uint32_t maxp = find_table("maxp", length, true);
+    if (length < 6) {
+        throw std::runtime_error("TrueTypeFont: " + path + " has a bad maxp table");
+    }
+    m_glyph_count = read_u16(data + maxp + 4);
+
+    uint32_t hhea = find_table("hhea", length, true);
+    if (length < 36) {
+        throw std::runtime_error("TrueTypeFont: " + path + " has a bad hhea table");
+    }
+    m_ascender = read_i16(data + hhea + 4);
+    m_descender = read_i16(data + hhea + 6);
+    m_line_gap = read_i16(data + hhea + 8);
+    m_metric_count = read_u16(data + hhea + 34);
+
+    m_hmtx = find_table("hmtx", m_hmtx_length, true);
+    m_loca = find_table("loca", m_loca_length, true);
+    m_glyf = find_table("glyf", m_glyf_length, true);
+
+    if (m_units_per_em == 0 || m_glyph_count == 0 || m_metric_count == 0
+        || (size_t) m_metric_count*4 > m_hmtx_length
+        || (size_t)(m_glyph_count + 1)*(m_long_loca ? 4 : 2) > m_loca_length) {
+        throw std::runtime_error("TrueTypeFont: " + path + " is corrupt");
+    }
+
+    load_cmap();
+    if (!m_cmap_format) {
+        throw std::runtime_error("TrueTypeFont: " + path + " has no Unicode character map");
+    }
+}
+
+/**
+ * Returns the file offset of the table with the given tag and its length,
+ * or 0 if there is no such table (or throws if it is required).
+ */
+uint32_t TrueTypeFont::find_table(char const* tag, uint32_t& length, bool required) const {
+    uint8_t const* data = m_file.data();
+    size_t size = m_file.size();
+    uint32_t count = read_u16(data + 4);
+    for (uint32_t i = 0; i < count && 12 + (i + 1)*16 <= size; ++i) {
+        uint8_t const* record = data + 12 + i*16;
+        if (memcmp(record, tag, 4) != 0) { continue; }
+        uint32_t offset = read_u32(record + 8);
+        length = read_u32(record + 12);
+        if (offset > size || length > size - offset) { break; }
+        return offset;
+    }
+    if (required) {
+        throw std::runtime_error(std::string("TrueTypeFont: missing or bad table ") + tag);
+    }
+    length = 0;
+    return 0;
+}
+
+/// Picks the best Unicode subtable of the cmap: format 12 (full range) or 4 (BMP).
+void TrueTypeFont::load_cmap() {
+    uint8_t const* data = m_file.data();
+    uint32_t length;
+    uint32_t cmap = find_table("cmap", length, true);
+    if (length < 4) { return; }
+
+    uint32_t count = read_u16(data + cmap + 2);
+    for (uint32_t i = 0; i < count && 4 + (i + 1)*8 <= length; ++i) {
+        uint8_t const* record = data + cmap + 4 + i*8;
+        uint32_t platform = read_u16(record);
+        uint32_t encoding = read_u16(record + 2);
+        uint32_t offset = read_u32(record + 4);
+        bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+        if (!unicode || offset + 8 > length) { continue; }
+
+        uint32_t subtable = cmap + offset;
+        int format = read_u16(data + subtable);
+        if (format == 12) {
+            uint32_t groups = read_u32(data + subtable + 12);
+            if (groups <= (length - offset - 16)/12) {
+                m_cmap_subtable = subtable;
+                m_cmap_format = 12;
+                return;
+            }
+        }
+        else if (format == 4 && m_cmap_format == 0) {
+            uint32_t seg_count = read_u16(data + subtable + 6)/2;
+            if (16 + seg_count*8 <= length - offset) {
+                m_cmap_subtable = subtable;
+                m_cmap_format = 4;
+            }
+        }
+    }
+}
+
+int TrueTypeFont::glyph_index(uint32_t code_point) const {
+    uint8_t const* data = m_file.data();
+    uint8_t const* table = data + m_cmap_subtable;
+
+    if (m_cmap_format == 12) {
+        // groups of consecutive code points mapped to consecutive glyphs
+        uint32_t lo = 0, hi = read_u32(table + 12);
+        while (lo < hi) {
+            uint32_t mid = (lo + hi)/2;
+            uint8_t const* group = table + 16 + mid*12;
+            if (code_point < read_u32(group)) { hi = mid; }
+            else if (code_point > read_u32(group + 4)) { lo = mid + 1; }
+            else {
+                uint32_t glyph = read_u32(group + 8) + (code_point - read_u32(group));
+                return glyph < (uint32_t) m_glyph_count ? glyph : 0;
+            }
+        }
+        return 0;
+    }
+
+    // format 4: segments with a delta or an offset into a glyph array
+    if (code_point > 0xFFFF) { return 0; }
+    uint32_t seg_count = read_u16(table + 6)/2;
+    uint8_t const* end_codes = table + 14;
+    uint8_t const* start_codes = end_codes + seg_count*2 + 2;
+    uint8_t const* deltas = start_codes + seg_count*2;
+    uint8_t const* range_offsets = deltas + seg_count*2;
+
+    uint32_t lo = 0, hi = seg_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi)/2;
+        if (read_u16(end_codes + mid*2) < code_point) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    if (lo >= seg_count || read_u16(start_codes + lo*2) > code_point) { return 0; }
+
+    uint32_t delta = read_u16(deltas + lo*2);
+    uint32_t range_offset = read_u16(range_offsets + lo*2);
+    uint32_t glyph;
+    if (range_offset == 0) {
+        glyph = (code_point + delta) & 0xFFFF;
+    }
+    else {
+        uint8_t const* address = range_offsets + lo*2 + range_offset
+            + (code_point - read_u16(start_codes + lo*2))*2;
+        if (address + 2 > data + m_file.size()) { return 0; }
+        glyph = read_u16(address);
+        if (glyph != 0) { glyph = (glyph + delta) & 0xFFFF; }
+    }
+    return glyph < (uint32_t) m_glyph_count ? glyph : 0;
+}
+
+float TrueTypeFont::advance(int glyph_index, float size) const {
+    int metric = std::min(glyph_index, m_metric_count - 1);
+    uint32_t units = read_u16(m_file.data() + m_hmtx + metric*4);
+    return units*size/m_units_per_em;
+}
+
+/// Finds the outline data of the glyph in the glyf table (false if it has none).
+bool TrueTypeFont::glyph_data(int glyph_index, uint32_t& offset, uint32_t& length) const {
+    if (glyph_index < 0 || glyph_index >= m_glyph_count) { return false; }
+    uint8_t const* loca = m_file.data() + m_loca;
+    uint32_t start, end;
+    if (m_long_loca) {
+        start = read_u32(loca + glyph_index*4);
+        end = read_u32(loca + glyph_index*4 + 4);
+    }
+    else {
+        start = read_u16(loca + glyph_index*2)*2;
+        end = read_u16(loca + glyph_index*2 + 2)*2;
+    }
+    if (end <= start || end > m_glyf_length || end - start < 10) { return false; }
+    offset = m_glyf + start;
+    length = end - start;
+    return true;
+}
+
+/**
+ * Appends the contours of the glyph to m_points and m_contour_ends,
+ * transformed by the 2x3 matrix (xx, yx, xy, yy, dx, dy).
+ * Returns false if the glyph data is corrupt.
+ */
+bool TrueTypeFont::load_outline(int glyph_index, float const* transform, int depth) {
+    uint32_t offset, length;
+    if (!glyph_data(glyph_index, offset, length)) { return true; }  // no outline (e.g. space)
+
+    uint8_t const* p = m_file.data() + offset;
+    uint8_t const* end = p + length;
+    int contour_count = read_i16(p);
+    p += 10;
+
+    if (contour_count >= 0) {
+        if (p + contour_count*2 + 2 > end) { return false; }
+        size_t first_point = m_points.size();
+        int point_count = contour_count > 0 ? read_u16(p + (contour_count - 1)*2) + 1 : 0;
+        for (int i = 0; i < contour_count; ++i) {
+            int contour_end = read_u16(p + i*2);
+            if (contour_end >= point_count) { return false; }
+            m_contour_ends.push_back((int) first_point + contour_end);
+        }
+        p += contour_count*2;
+        uint32_t instruction_length = read_u16(p);
+        p += 2 + instruction_length;
+
+        // the flags (with run-length repeats), then the x and the y deltas
+        m_points.resize(first_point + point_count);
+        OutlinePoint* points = m_points.data() + first_point;
+        m_flags.resize(point_count);
+        uint8_t* flags = m_flags.data();
+        for (int i = 0; i < point_count; ) {
+            if (p >= end) { return false; }
+            uint8_t flag = *p++;
+            int repeat = 0;
+            if (flag & 0x08) {
+                if (p >= end) { return false; }
+                repeat = *p++;
+            }
+            for (int r = 0; r <= repeat && i < point_count; ++r) {
+                flags[i++] = flag;
+            }
+        }
+        int value = 0;
+        for (int i = 0; i < point_count; ++i) {
+            uint8_t flag = flags[i];
+            if (flag & 0x02) {
+                if (p >= end) { return false; }
+                value += (flag & 0x10) ? *p : -*p;
+                p++;
+            }
+            else if (!(flag & 0x10)) {
+                if (p + 2 > end) { return false; }
+                value += read_i16(p);
+                p += 2;
+            }
+            points[i].x = (float) value;
+            points[i].on_curve = flag & 0x01;
+        }
+        value = 0;
+        for (int i = 0; i < point_count; ++i) {
+            uint8_t flag = flags[i];
+            if (flag & 0x04) {
+                if (p >= end) { return false; }
+                value += (flag & 0x20) ? *p : -*p;
+                p++;
+            }
+            else if (!(flag & 0x20)) {
+                if (p + 2 > end) { return false; }
+                value += read_i16(p);
+                p += 2;
+            }
+            points[i].y = (float) value;
+        }
+        for (int i = 0; i < point_count; ++i) {
+            float x = points[i].x, y = points[i].y;
+            points[i].x = transform[0]*x + transform[2]*y + transform[4];
+            points[i].y = transform[1]*x + transform[3]*y + transform[5];
+        }
+        return true;
+    }
+
+    // a composite glyph: other glyphs, each with its own transformation
+    if (depth >= MAX_COMPOSITE_DEPTH) { return false; }
+    for (;;) {
+        if (p + 4 > end) { return false; }
+        uint32_t flags = read_u16(p);
+        int component = read_u16(p + 2);
+        p += 4;
+
+        float dx = 0.0f, dy = 0.0f;
+        if (flags & 0x0001) {
+            if (p + 4 > end) { return false; }
+            dx = read_i16(p);
+            dy = read_i16(p + 2);
+            p += 4;
+        }
+        else {
+            if (p + 2 > end) { return false; }
+            dx = (int8_t) p[0];
+            dy = (int8_t) p[1];
+            p += 2;
+        }
+        if (!(flags & 0x0002)) {
+            // the arguments are point numbers to align; not supported
+            dx = dy = 0.0f;
+        }
+
+        float m[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+        if (flags & 0x0008) {
+            if (p + 2 > end) { return false; }
+            m[0] = m[3] = read_i16(p)/16384.0f;
+            p += 2;
+        }
+        else if (flags & 0x0040) {
+            if (p + 4 > end) { return false; }
+            m[0] = read_i16(p)/16384.0f;
+            m[3] = read_i16(p + 2)/16384.0f;
+            p += 4;
+        }
+        else if (flags & 0x0080) {
+            if (p + 8 > end) { return false; }
+            for (int i = 0; i < 4; ++i) { m[i] = read_i16(p + i*2)/16384.0f; }
+            p += 8;
+        }
+
+        // the component transformation followed by the one of this glyph
+        float const* t = transform;
+        float combined[6] = {
+            t[0]*m[0] + t[2]*m[1], t[1]*m[0] + t[3]*m[1],
+            t[0]*m[2] + t[2]*m[3], t[1]*m[2] + t[3]*m[3],
+            t[0]*dx + t[2]*dy + t[4], t[1]*dx + t[3]*dy + t[5],
+        };
+        if (!load_outline(component, combined, depth + 1)) { return false; }
+
+        if (!(flags & 0x0020)) { break; }
+    }
+    return true;
+}
+
+void TrueTypeFont::render_glyph(int glyph_index, float size, int subpixel, CacheEntry& entry) {
+    static stats::Histogram& cold = stats::histogram("text.glyph_cold_ns");
+    uint64_t start = stats::now_ns();
+
+    // font units to pixels, flipping y so that it grows downwards
+    float scale = size/m_units_per_em;
+    float shift = (float) subpixel/SUBPIXEL_STEPS;
+    float transform[6] = { scale, 0.0f, 0.0f, -scale, shift, 0.0f };
+
+    m_points.clear();
+    m_contour_ends.clear();
+    Glyph glyph;
+    if (load_outline(glyph_index, transform, 0) && !m_points.empty()) {
+        float x_min = m_points[0].x, x_max = x_min, y_min = m_points[0].y, y_max = y_min;
+        for (auto& point : m_points) {
+            x_min = std::min(x_min, point.x);
+            x_max = std::max(x_max, point.x);
+            y_min = std::min(y_min, point.y);
+            y_max = std::max(y_max, point.y);
+        }
+        int left = (int) std::floor(x_min), top = (int) std::floor(y_min);
+        int width = (int) std::ceil(x_max) - left;
+        int height = (int) std::ceil(y_max) - top;
+
+        if (width > 0 && height > 0 && width <= INT16_MAX && height <= INT16_MAX) {
+            m_rasterizer.reset(width, height);
+
+            // each contour is closed; off-curve points are quadratic control
+            // points, with an implied on-curve point between two of them
+            auto midpoint = [](OutlinePoint const& a, OutlinePoint const& b) {
+                return OutlinePoint { (a.x + b.x)/2, (a.y + b.y)/2, true };
+            };
+            size_t first = 0;
+            for (int contour_end : m_contour_ends) {
+                size_t last = contour_end;
+                if (last < first) { continue; }
+                size_t count = last - first + 1;
+                auto at = [&](size_t i) {
+                    OutlinePoint p = m_points[first + i];
+                    p.x -= left;
+                    p.y -= top;
+                    return p;
+                };
+
+                // start at an on-curve point, possibly an implied one
+                OutlinePoint start_point = at(0);
+                size_t begin = 0, end = count;
+                if (start_point.on_curve) {
+                    begin = 1;
+                }
+                else if (at(count - 1).on_curve) {
+                    start_point = at(count - 1);
+                    end = count - 1;
+                }
+                else {
+                    start_point = midpoint(at(count - 1), at(0));
+                }
+
+                OutlinePoint current = start_point;
+                OutlinePoint control = start_point;
+                bool has_control = false;
+                for (size_t i = begin; i < end; ++i) {
+                    OutlinePoint p = at(i);
+                    if (p.on_curve) {
+                        if (has_control) {
+                            m_rasterizer.quad(current.x, current.y, control.x, control.y, p.x, p.y);
+                        }
+                        else {
+                            m_rasterizer.line(current.x, current.y, p.x, p.y);
+                        }
+                        current = p;
+                        has_control = false;
+                    }
+                    else if (has_control) {
+                        OutlinePoint mid = midpoint(control, p);
+                        m_rasterizer.quad(current.x, current.y, control.x, control.y, mid.x, mid.y);
+                        current = mid;
+                        control = p;
+                    }
+                    else {
+                        control = p;
+                        has_control = true;
+                    }
+                }
+                if (has_control) {
+                    m_rasterizer.quad(current.x, current.y, control.x, control.y, start_point.x, start_point.y);
+                }
+                else {
+                    m_rasterizer.line(current.x, current.y, start_point.x, start_point.y);
+                }
+                first = last + 1;
+            }
+
+            entry.mask.reset(new uint8_t[(size_t) width*height]);
+            m_rasterizer.render(entry.mask.get(), width);
+            glyph.mask = entry.mask.get();
+            glyph.stride = width;
+            glyph.width = width;
+            glyph.height = height;
+            glyph.x_offset = left;
+            glyph.y_offset = top;
+            entry.size = (size_t) width*height;
+        }
+    }
+    entry.glyph = glyph;
+    entry.size += sizeof(CacheEntry);
+    cold.add(stats::now_ns() - start);
+}
+
+Glyph const& TrueTypeFont::glyph(int glyph_index, float size, int subpixel) {
+    static stats::Counter& hits = stats::counter("text.glyph_cache_hits");
+    static stats::Counter& misses = stats::counter("text.glyph_cache_misses");
+
+    // size in 1/64 pixels, which is finer than any difference one could see
+    uint64_t size64 = std::min((uint64_t) std::lround(std::max(size, 0.0f)*64.0f), (uint64_t) 0x3FFFFFFF);
+    uint64_t key = (uint64_t) glyph_index << 40 | size64 << 8 | (uint64_t) subpixel;
+
+    auto found = m_lookup.find(key);
+    if (found != m_lookup.end()) {
+        auto entry = found->second;
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+        entry->frame = m_frame;
+        hits.add();
+        return entry->glyph;
+    }
+    misses.add();
+
+    m_entries.emplace_front();
+    auto entry = m_entries.begin();
+    entry->key = key;
+    entry->frame = m_frame;
+    render_glyph(glyph_index, size64/64.0f, subpixel, *entry);
+    m_lookup[key] = entry;
+    m_cache_size += entry->size;
+    evict();
+    return entry->glyph;
+}
+
+/// Drops the least recently used glyphs while over the bound, sparing recent frames.
+void TrueTypeFont::evict() {
+    while (m_cache_size > m_cache_capacity && !m_entries.empty()) {
+        auto& oldest = m_entries.back();
+        if (oldest.frame + 1 >= m_frame) { break; }
+        m_cache_size -= oldest.size;
+        m_lookup.erase(oldest.key);
+        m_entries.pop_back();
+    }
+}
+
+void TrueTypeFont::next_frame() {
+    m_frame++;
+    evict();
+}
+
+TextRun const& TrueTypeFont::layout(float size, std::string_view text) {
+    static stats::Histogram& warm = stats::histogram("text.glyph_warm_ns");
+    static stats::Counter& misses = stats::counter("text.glyph_cache_misses");
+    uint64_t start = stats::now_ns();
+    uint64_t misses_before = misses.get();
+
+    m_run.glyphs.clear();
+    float pen = 0.0f;
+    int baseline = (int) std::lround(ascent(size));
+    size_t count = 0;
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        int index = glyph_index(decode_utf8(text, pos));
+        float pen_floor = std::floor(pen);
+        int subpixel = (int)((pen - pen_floor)*SUBPIXEL_STEPS);
+        Glyph const& glyph = this->glyph(index, size, subpixel);
+        if (glyph.mask) {
+            PlacedGlyph placed;
+            placed.mask = glyph.mask;
+            placed.stride = glyph.stride;
+            placed.x = (int) pen_floor + glyph.x_offset;
+            placed.y = baseline + glyph.y_offset;
+            placed.width = glyph.width;
+            placed.height = glyph.height;
+            m_run.glyphs.push_back(placed);
+        }
+        pen += advance(index, size);
+        count++;
+    }
+    m_run.width = (int) std::ceil(pen);
+    m_run.height = (int) std::ceil(line_height(size));
+
+    // the time per glyph when everything came from the cache
+    if (count > 0 && misses.get() == misses_before) {
+        warm.add((stats::now_ns() - start)/count);
+    }
+    return m_run;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "font.hpp"
+#include "mapped_file.hpp"
+#include "raster.hpp"
+
+/**
+ * A scalable font loaded from a TrueType (glyf outline) file, rendered
+ * at any pixel size with AccumulationRasterizer. The file is mapped into
+ * memory and parsed in place; there is no hinting and no kerning.
+ *
+ * Rendered glyphs are kept in an LRU cache keyed by (glyph, size,
+ * subpixel offset) and bounded in bytes. Masks of glyphs used in the
+ * current or the previous frame are never evicted, so they may be recorded
+ * in a display list: call next_frame() once per frame (until it is called,
+ * nothing is evicted and the cache may outgrow its bound).
+ * Throws std::runtime_error if the file cannot be loaded. Not thread-safe.
+ */
+class TrueTypeFont {
+public:
+    /// Horizontal glyph positions are rounded to this fraction of a pixel.
+    static const int SUBPIXEL_STEPS = 4;
+
+protected:
+    /// A point of a glyph outline, in pixels (after the transformation).
+    struct OutlinePoint {
+        float x;
+        float y;
+        bool on_curve;
+    };
+
+    struct CacheEntry {
+        uint64_t key = 0;
+        uint64_t frame = 0;             // when it was last used
+        Glyph glyph;
+        std::unique_ptr<uint8_t[]> mask;
+        size_t size = 0;                // bytes charged against the cache bound
+    };
+
+    MappedFile m_file;
+    uint32_t m_glyf = 0, m_glyf_length = 0;     // table positions in the file
+    uint32_t m_loca = 0, m_loca_length = 0;
+    uint32_t m_hmtx = 0, m_hmtx_length = 0;
+    uint32_t m_cmap_subtable = 0;
+    int m_cmap_format = 0;
+    int m_units_per_em = 0;
+    int m_glyph_count = 0;
+    int m_metric_count = 0;                     // glyphs with their own advance in hmtx
+    bool m_long_loca = false;
+    int m_ascender = 0, m_descender = 0, m_line_gap = 0;
+
+    // the glyph cache
+    size_t m_cache_capacity;
+    size_t m_cache_size = 0;
+    uint64_t m_frame = 1;
+    std::list<CacheEntry> m_entries;            // most recently used first
+    std::unordered_map<uint64_t, std::list<CacheEntry>::iterator> m_lookup;
+
+    // scratch space reused for every glyph
+    std::vector<OutlinePoint> m_points;
+    std::vector<int> m_contour_ends;
+    std::vector<uint8_t> m_flags;
+    AccumulationRasterizer m_rasterizer;
+    TextRun m_run;
+
+    uint32_t find_table(char const* tag, uint32_t& length, bool required) const;
+    void load_cmap();
+    bool glyph_data(int glyph_index, uint32_t& offset, uint32_t& length) const;
+    bool load_outline(int glyph_index, float const* transform, int depth);
+    void render_glyph(int glyph_index, float size, int subpixel, CacheEntry& entry);
+    void evict();
+
+public:
+    explicit TrueTypeFont(std::string const& path, size_t cache_capacity = 4 << 20);
+    TrueTypeFont(TrueTypeFont const&) = delete;
+    TrueTypeFont& operator=(TrueTypeFont const&) = delete;
+
+    /** Returns the number of glyphs in the font. */
+    int glyph_count() const { return m_glyph_count; }
+
+    /** Returns the glyph index for the Unicode code point (0 if missing). */
+    int glyph_index(uint32_t code_point) const;
+
+    /** Returns the distance from the top of a line to the baseline at the size. */
+    float ascent(float size) const { return m_ascender*size/m_units_per_em; }
+
+    /** Returns the distance from the baseline to the bottom of a line at the size. */
+    float descent(float size) const { return -m_descender*size/m_units_per_em; }
+
+    /** Returns the distance between baselines of two lines at the size. */
+    float line_height(float size) const {
+        return (m_ascender - m_descender + m_line_gap)*size/m_units_per_em;
+    }
+
+    /** Returns how far the pen moves after the glyph at the size, in pixels. */
+    float advance(int glyph_index, float size) const;
+
+    /**
+     * Returns the glyph rendered at the size (the em size in pixels), with
+     * the pen at the given fraction of a pixel (0 to SUBPIXEL_STEPS-1),
+     * from the cache or rendered now. The glyph's advance is not filled in
+     * (it is fractional, see advance()). The reference is valid until
+     * the next call.
+     */
+    Glyph const& glyph(int glyph_index, float size, int subpixel);
+
+    /**
+     * Lays out a line of UTF-8 text at the size, positioning the glyphs
+     * with subpixel precision. The run is relative to the top-left corner
+     * of the line; the reference is valid until the next call.
+     */
+    TextRun const& layout(float size, std::string_view text);
+
+    /** Marks the start of a new frame, allowing older glyphs to be evicted. */
+    void next_frame();
+
+    /** Returns the number of bytes taken by the cached glyphs. */
+    size_t cache_size() const { return m_cache_size; }
+
+    /** Returns the number of cached glyphs. */
+    size_t cached_glyph_count() const { return m_entries.size(); }
+};
+
+/**
+ * Draws a line of UTF-8 text at the size with the top-left corner of the line
+ * at (x, y) and returns its width. Works with any context that has blit_mask().
+ */
+template<class Context>
+int draw_text(Context& ctx, TrueTypeFont& font, float size,
+    int x, int y, std::string_view text, uint32_t color)
+{
+    TextRun const& run = font.layout(size, text);
+    for (auto& glyph : run.glyphs) {
+        ctx.blit_mask(x + glyph.x, y + glyph.y, glyph.mask, glyph.stride,
+            glyph.width, glyph.height, color);
+    }
+    return run.width;
+}
@@ -0,0 +1,276 @@
+#include "yuv.hpp"
+#include "frame.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/**
+ * The conversion in fixed point: Y, U and V (less their offsets) are
+ * shifted left by 6 and multiplied by the coefficients times 2^13, keeping
+ * the high 16 bits of the product (as _mm_mulhi_epi16() does), which
+ * leaves the colour components with 3 fractional bits.
+ */
+struct YuvCoefficients {
+    int16_t y_offset;
+    int16_t y;          // luma scale
+    int16_t rv;         // V to red
+    int16_t gu;         // U to green (subtracted)
+    int16_t gv;         // V to green (subtracted)
+    int16_t bu;         // U to blue
+};
+
+YuvCoefficients coefficients(YuvMatrix matrix, YuvRange range) {
+    double kr = (matrix == YuvMatrix::BT709) ? 0.2126 : 0.299;
+    double kb = (matrix == YuvMatrix::BT709) ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    bool limited = (range == YuvRange::Limited);
+    double y_scale = limited ? 255.0/219.0 : 1.0;
+    double c_scale = limited ? 255.0/224.0 : 1.0;
+
+    auto fixed = [](double value) { return (int16_t) std::lround(value*8192.0); };
+    YuvCoefficients c;
+    c.y_offset = limited ? 16 : 0;
+    c.y = fixed(y_scale);
+    c.rv = fixed(2.0*(1.0 - kr)*c_scale);
+    c.gu = fixed(2.0*kb*(1.0 - kb)/kg*c_scale);
+    c.gv = fixed(2.0*kr*(1.0 - kr)/kg*c_scale);
+    c.bu = fixed(2.0*(1.0 - kb)*c_scale);
+    return c;
+}
+
+inline int mulhi(int a, int b) {
+    return (a*b) >> 16;
+}
+
+inline uint32_t clamp_component(int value) {
+    value = (value + 4) >> 3;
+    return value < 0 ? 0 : (value > 255 ? 255 : (uint32_t) value);
+}
+
+/// Converts one pixel, with the same arithmetic as the SIMD code.
+inline uint32_t yuv_pixel(int y, int u, int v, YuvCoefficients const& c) {
+    int yy = mulhi((y - c.y_offset) << 6, c.y);
+    u = (u - 128) << 6;
+    v = (v - 128) << 6;
+    uint32_t r = clamp_component(yy + mulhi(v, c.rv));
+    uint32_t g = clamp_component(yy - mulhi(u, c.gu) - mulhi(v, c.gv));
+    uint32_t b = clamp_component(yy + mulhi(u, c.bu));
+    return 0xFF000000 | r << 16 | g << 8 | b;
+}
+
+#if defined(__SSE2__)
+
+/// Converts eight pixels, given Y and the (already repeated) U and V as 16-bit lanes.
+inline void yuv_pixels8(uint32_t* dst, __m128i y, __m128i u, __m128i v, YuvCoefficients const& c) {
+    const __m128i round = _mm_set1_epi16(4);
+    const __m128i c128 = _mm_set1_epi16(128);
+    __m128i yy = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(c.y_offset)), 6),
+        _mm_set1_epi16(c.y));
+    u = _mm_slli_epi16(_mm_sub_epi16(u, c128), 6);
+    v = _mm_slli_epi16(_mm_sub_epi16(v, c128), 6);
+
+    __m128i r = _mm_add_epi16(yy, _mm_mulhi_epi16(v, _mm_set1_epi16(c.rv)));
+    __m128i g = _mm_sub_epi16(yy, _mm_add_epi16(
+        _mm_mulhi_epi16(u, _mm_set1_epi16(c.gu)), _mm_mulhi_epi16(v, _mm_set1_epi16(c.gv))));
+    __m128i b = _mm_add_epi16(yy, _mm_mulhi_epi16(u, _mm_set1_epi16(c.bu)));
+    r = _mm_srai_epi16(_mm_add_epi16(r, round), 3);
+    g = _mm_srai_epi16(_mm_add_epi16(g, round), 3);
+    b = _mm_srai_epi16(_mm_add_epi16(b, round), 3);
+
+    // to bytes, then interleaved as B, G, R, A in memory
+    __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+    __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_set1_epi8((char) 0xFF));
+    _mm_storeu_si128((__m128i*) dst, _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+#endif
+
+void i420_row(uint8_t const* y, uint8_t const* u, uint8_t const* v, uint32_t* dst, int width,
+    YuvCoefficients const& c)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= width; x += 8) {
+        int32_t u4, v4;
+        memcpy(&u4, u + x/2, 4);
+        memcpy(&v4, v + x/2, 4);
+        __m128i yv = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(y + x)), zero);
+        __m128i uv = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), zero);
+        __m128i vv = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero);
+        yuv_pixels8(dst + x, yv, _mm_unpacklo_epi16(uv, uv), _mm_unpacklo_epi16(vv, vv), c);
+    }
+#endif
+    for (; x < width; ++x) {
+        dst[x] = yuv_pixel(y[x], u[x/2], v[x/2], c);
+    }
+}
+
+void nv12_row(uint8_t const* y, uint8_t const* uv, uint32_t* dst, int width, YuvCoefficients const& c) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_halves = _mm_set1_epi32(0x0000FFFF);
+    for (; x + 8 <= width; x += 8) {
+        __m128i yv = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(y + x)), zero);
+        __m128i pairs = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(uv + x)), zero);
+
+        // each 32-bit lane of pairs holds a U and a V; spread both over the two pixels
+        __m128i uu = _mm_and_si128(pairs, low_halves);
+        __m128i vv = _mm_srli_epi32(pairs, 16);
+        uu = _mm_or_si128(uu, _mm_slli_epi32(uu, 16));
+        vv = _mm_or_si128(vv, _mm_slli_epi32(vv, 16));
+        yuv_pixels8(dst + x, yv, uu, vv, c);
+    }
+#endif
+    for (; x < width; ++x) {
+        dst[x] = yuv_pixel(y[x], uv[x & ~1], uv[x | 1], c);
+    }
+}
+
+/// Interleaves a row of U and V samples into an NV12 chroma row.
+void interleave_row(uint8_t const* u, uint8_t const* v, uint8_t* uv, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16) {
+        __m128i uu = _mm_loadu_si128((__m128i const*)(u + i));
+        __m128i vv = _mm_loadu_si128((__m128i const*)(v + i));
+        _mm_storeu_si128((__m128i*)(uv + 2*i), _mm_unpacklo_epi8(uu, vv));
+        _mm_storeu_si128((__m128i*)(uv + 2*i + 16), _mm_unpackhi_epi8(uu, vv));
+    }
+#endif
+    for (; i < count; ++i) {
+        uv[2*i] = u[i];
+        uv[2*i + 1] = v[i];
+    }
+}
+
+// bands of rows converted by one thread; even, so that bands do not share chroma rows
+const int BAND_ROWS = 64;
+
+/// Runs fn(first_row, end_row) for bands of rows, on the pool if there is one.
+template<class F>
+void for_each_band(ThreadPool* pool, int height, F&& fn) {
+    int count = (height + BAND_ROWS - 1)/BAND_ROWS;
+    auto band = [&](int index) {
+        fn(index*BAND_ROWS, std::min((index + 1)*BAND_ROWS, height));
+    };
+    if (pool && count > 1) {
+        pool->parallel_for(count, band);
+    }
+    else {
+        for (int i = 0; i < count; ++i) { band(i); }
+    }
+}
+
+/// Records the throughput of a conversion, in megapixels per second.
+void record_throughput(stats::Histogram& histogram, int width, int height, uint64_t start) {
+    uint64_t elapsed = stats::now_ns() - start;
+    histogram.add((uint64_t) width*height*1000/(elapsed ? elapsed : 1));
+}
+
+} // namespace
+
+void i420_to_xrgb(uint8_t const* y, int y_stride, uint8_t const* u, int u_stride,
+    uint8_t const* v, int v_stride, uint32_t* dst, int dst_stride, int width, int height,
+    YuvMatrix matrix, YuvRange range, ThreadPool* pool)
+{
+    static stats::Histogram& throughput = stats::histogram("yuv.i420_to_xrgb_mpix_s");
+    if (width <= 0 || height <= 0) { return; }
+    uint64_t start = stats::now_ns();
+
+    YuvCoefficients c = coefficients(matrix, range);
+    for_each_band(pool, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row) {
+            i420_row(y + (intptr_t) row*y_stride, u + (intptr_t)(row/2)*u_stride,
+                v + (intptr_t)(row/2)*v_stride, dst + (intptr_t) row*dst_stride, width, c);
+        }
+    });
+    record_throughput(throughput, width, height, start);
+}
+
+void nv12_to_xrgb(uint8_t const* y, int y_stride, uint8_t const* uv, int uv_stride,
+    uint32_t* dst, int dst_stride, int width, int height,
+    YuvMatrix matrix, YuvRange range, ThreadPool* pool)
+{
+    static stats::Histogram& throughput = stats::histogram("yuv.nv12_to_xrgb_mpix_s");
+    if (width <= 0 || height <= 0) { return; }
+    uint64_t start = stats::now_ns();
+
+    YuvCoefficients c = coefficients(matrix, range);
+    for_each_band(pool, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row) {
+            nv12_row(y + (intptr_t) row*y_stride, uv + (intptr_t)(row/2)*uv_stride,
+                dst + (intptr_t) row*dst_stride, width, c);
+        }
+    });
+    record_throughput(throughput, width, height, start);
+}
+
+void write_i420(wayland::Frame& frame, uint8_t const* y, int y_stride,
+    uint8_t const* u, int u_stride, uint8_t const* v, int v_stride,
+    YuvMatrix matrix, YuvRange range, ThreadPool* pool)
+{
+    static stats::Histogram& throughput = stats::histogram("yuv.i420_to_nv12_mpix_s");
+    int width = frame.get_width();
+    int height = frame.get_height();
+    if (frame.get_format() != WL_SHM_FORMAT_NV12) {
+        i420_to_xrgb(y, y_stride, u, u_stride, v, v_stride, (uint32_t*) frame.get_memory(),
+            frame.get_stride()/4, width, height, matrix, range, pool);
+        return;
+    }
+    if (width <= 0 || height <= 0) { return; }
+    uint64_t start = stats::now_ns();
+
+    int stride = frame.get_stride();
+    uint8_t* luma = frame.get_plane(0);
+    uint8_t* chroma = frame.get_plane(1);
+    for_each_band(pool, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row) {
+            memcpy(luma + (intptr_t) row*stride, y + (intptr_t) row*y_stride, width);
+            if (row % 2 == 0) {
+                interleave_row(u + (intptr_t)(row/2)*u_stride, v + (intptr_t)(row/2)*v_stride,
+                    chroma + (intptr_t)(row/2)*stride, (width + 1)/2);
+            }
+        }
+    });
+    record_throughput(throughput, width, height, start);
+}
+
+void write_nv12(wayland::Frame& frame, uint8_t const* y, int y_stride,
+    uint8_t const* uv, int uv_stride, YuvMatrix matrix, YuvRange range, ThreadPool* pool)
+{
+    static stats::Histogram& throughput = stats::histogram("yuv.nv12_copy_mpix_s");
+    int width = frame.get_width();
+    int height = frame.get_height();
+    if (frame.get_format() != WL_SHM_FORMAT_NV12) {
+        nv12_to_xrgb(y, y_stride, uv, uv_stride, (uint32_t*) frame.get_memory(),
+            frame.get_stride()/4, width, height, matrix, range, pool);
+        return;
+    }
+    if (width <= 0 || height <= 0) { return; }
+    uint64_t start = stats::now_ns();
+
+    int stride = frame.get_stride();
+    uint8_t* luma = frame.get_plane(0);
+    uint8_t* chroma = frame.get_plane(1);
+    int chroma_bytes = (width + 1)/2*2;
+    for_each_band(pool, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row) {
+            memcpy(luma + (intptr_t) row*stride, y + (intptr_t) row*y_stride, width);
+            if (row % 2 == 0) {
+                memcpy(chroma + (intptr_t)(row/2)*stride, uv + (intptr_t)(row/2)*uv_stride, chroma_bytes);
+            }
+        }
+    });
+    record_throughput(throughput, width, height, start);
+}
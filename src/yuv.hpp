@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+class ThreadPool;
+
+namespace wayland {
+class Frame;
+}
+
+/*
+ * Conversion of 8-bit 4:2:0 video frames to 32-bit RGB. The images are
+ * I420 (three planes: Y, then U and V with half the width and height)
+ * or NV12 (two planes: Y, then U and V interleaved). Chroma is upsampled
+ * by repeating each sample over its 2x2 pixels. Odd sizes are fine;
+ * the chroma planes then have (width + 1)/2 columns and (height + 1)/2 rows.
+ */
+
+/// The YCbCr matrix a video was encoded with.
+enum class YuvMatrix {
+    BT601,      ///< standard definition video, JPEG
+    BT709,      ///< high definition video
+};
+
+/// The range of the Y, U and V values.
+enum class YuvRange {
+    Limited,    ///< Y 16 to 235, U and V 16 to 240 ("TV range", usual for video)
+    Full,       ///< all of 0 to 255 (JPEG, some cameras)
+};
+
+/**
+ * Converts an I420 image to XRGB8888 (with an opaque alpha byte, so the
+ * result is valid ARGB8888 too). The strides of the planes are in bytes,
+ * the stride of the destination in pixels. Works on eight pixels at a time
+ * with SSE2 where available, in 16-bit fixed point (within one step of
+ * the exact result); with a thread pool, bands of rows are converted
+ * in parallel.
+ */
+void i420_to_xrgb(uint8_t const* y, int y_stride, uint8_t const* u, int u_stride,
+    uint8_t const* v, int v_stride, uint32_t* dst, int dst_stride, int width, int height,
+    YuvMatrix matrix = YuvMatrix::BT601, YuvRange range = YuvRange::Limited,
+    ThreadPool* pool = nullptr);
+
+/// The same for an NV12 image (uv is the interleaved chroma plane).
+void nv12_to_xrgb(uint8_t const* y, int y_stride, uint8_t const* uv, int uv_stride,
+    uint32_t* dst, int dst_stride, int width, int height,
+    YuvMatrix matrix = YuvMatrix::BT601, YuvRange range = YuvRange::Limited,
+    ThreadPool* pool = nullptr);
+
+/**
+ * Writes an I420 image of the frame's size into the frame: converted
+ * to RGB for the 32-bit formats, or only repacked for an NV12 frame,
+ * leaving the conversion to the compositor (which then assumes its own
+ * matrix and range; wl_shm cannot say which, BT.601 limited is usual).
+ */
+void write_i420(wayland::Frame& frame, uint8_t const* y, int y_stride,
+    uint8_t const* u, int u_stride, uint8_t const* v, int v_stride,
+    YuvMatrix matrix = YuvMatrix::BT601, YuvRange range = YuvRange::Limited,
+    ThreadPool* pool = nullptr);
+
+/// The same for an NV12 image (plainly copied into an NV12 frame).
+void write_nv12(wayland::Frame& frame, uint8_t const* y, int y_stride,
+    uint8_t const* uv, int uv_stride,
+    YuvMatrix matrix = YuvMatrix::BT601, YuvRange range = YuvRange::Limited,
+    ThreadPool* pool = nullptr);